@@ -83,31 +83,51 @@ INCLUDEPATH += \
 
 HEADERS += \
     src/FoilAuth.h \
+    src/FoilAuthClockWatch.h \
     src/FoilAuthDefs.h \
     src/FoilAuthFavoritesModel.h \
     src/FoilAuthGroupModel.h \
+    src/FoilAuthHmac.h \
     src/FoilAuthImportModel.h \
+    src/FoilAuthLookAheadModel.h \
     src/FoilAuthModel.h \
     src/FoilAuthSettings.h \
     src/FoilAuthToken.h \
     src/FoilAuthTypes.h \
+    src/FoilAuthVault.h \
     src/QrCodeDecoder.h \
     src/QrCodeScanner.h \
     src/SailOTP.h
 
 SOURCES += \
     src/FoilAuth.cpp \
+    src/FoilAuthClockWatch.cpp \
     src/FoilAuthFavoritesModel.cpp \
     src/FoilAuthGroupModel.cpp \
     src/FoilAuthImportModel.cpp \
+    src/FoilAuthLookAheadModel.cpp \
     src/FoilAuthModel.cpp \
     src/FoilAuthSettings.cpp \
     src/FoilAuthToken.cpp \
+    src/FoilAuthVault.cpp \
     src/main.cpp \
     src/QrCodeDecoder.cpp \
     src/QrCodeScanner.cpp \
     src/SailOTP.cpp
 
+# The HMAC lanes rely on the auto-vectorizer which older gcc doesn't
+# enable at -O2. qmake has no per-file flags, hence the extra compiler.
+HMAC_SOURCES = src/FoilAuthHmac.cpp
+HMAC_CXXFLAGS = -ftree-vectorize
+
+hmac.name = hmac
+hmac.input = HMAC_SOURCES
+hmac.dependency_type = TYPE_C
+hmac.variable_out = OBJECTS
+hmac.output = ${QMAKE_VAR_OBJECTS_DIR}${QMAKE_FILE_IN_BASE}$${first(QMAKE_EXT_OBJ)}
+hmac.commands = $${QMAKE_CXX} $(CXXFLAGS) $${HMAC_CXXFLAGS} $(INCPATH) -c ${QMAKE_FILE_IN} -o ${QMAKE_FILE_OUT}
+QMAKE_EXTRA_COMPILERS += hmac
+
 SOURCES += \
     $${LIBFOIL_SRC}/*.c \
     $${LIBFOIL_SRC}/openssl/*.c \
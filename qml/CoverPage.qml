@@ -11,7 +11,7 @@ CoverBackground {
     readonly property int coverActionHeight: Theme.itemSizeSmall
     readonly property bool darkOnLight: ('colorScheme' in Theme) && Theme.colorScheme === 1
     readonly property string lockIconSource: Qt.resolvedUrl("images/" + (darkOnLight ? "cover-lock-dark.svg" :  "cover-lock.svg"))
-    readonly property string displayOn: HarbourSystemState.displayStatus !== HarbourSystemState.MCE_DISPLAY_OFF
+    readonly property bool displayOn: HarbourSystemState.displayStatus !== HarbourSystemState.MCE_DISPLAY_OFF
 
     Rectangle {
         width: parent.width
@@ -22,17 +22,39 @@ CoverBackground {
     }
 
     Rectangle {
+        id: countdown
+
         height: appTitle.height
         width: Math.round(parent.width * (active ? value : 1))
         color: Theme.primaryColor
         opacity: 0.1
 
+        property real value: 1
         readonly property bool active: foilModel.timerActive && displayOn
-        readonly property real value: (foilModel.timeLeft - 1)/(foilModel.period - 1)
 
-        Behavior on width {
-            enabled: displayOn
-            NumberAnimation { duration: 500 }
+        function restart() {
+            countdownAnimation.stop()
+            if (active) {
+                var ms = Math.max(foilModel.periodEnd - Date.now(), 0)
+                value = ms/(foilModel.period * 1000)
+                countdownAnimation.duration = ms
+                countdownAnimation.start()
+            }
+        }
+
+        onActiveChanged: restart()
+
+        NumberAnimation {
+            id: countdownAnimation
+
+            target: countdown
+            property: "value"
+            to: 0
+        }
+
+        Connections {
+            target: foilModel
+            onPeriodEndChanged: countdown.restart()
         }
     }
 
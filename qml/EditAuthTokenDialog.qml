@@ -23,6 +23,7 @@ Dialog {
     property alias digits: digitsField.text
     property alias counter: counterField.text
     property alias timeshift: timeshiftField.text
+    property alias period: periodField.text
 
     signal tokenAccepted(var dialog)
 
@@ -32,7 +33,7 @@ Dialog {
         id: generator
 
         ecLevel: FoilAuthSettings.qrCodeEcLevel
-        text: FoilAuth.toUri(type, secret, label, issuer, digits, counter, timeshift, algorithm)
+        text: FoilAuth.toUri(type, secret, label, issuer, digits, counter, timeshift, algorithm, period)
     }
 
     Item {
@@ -203,6 +204,29 @@ Dialog {
                     }
                 }
 
+                TextField {
+                    id: periodField
+
+                    width: parent.columnWidth
+                    //: Text field label (TOTP period)
+                    //% "Period (seconds)"
+                    label: qsTrId("foilauth-token-period-text")
+                    //: Text field placeholder (TOTP period)
+                    //% "How often the password changes, in seconds"
+                    placeholderText: qsTrId("foilauth-token-period-placeholder")
+                    text: FoilAuthDefaultPeriod
+                    validator: IntValidator {
+                        bottom: FoilAuthMinPeriod
+                        top: FoilAuthMaxPeriod
+                    }
+                    inputMethodHints: Qt.ImhDigitsOnly
+                    enabled: !qrCodeOnly
+                    visible: type === FoilAuth.TypeTOTP
+
+                    EnterKey.iconSource: "image://theme/icon-m-enter-accept"
+                    EnterKey.onClicked: thisDialog.accept()
+                }
+
                 ComboBox {
                     id: algorithmComboBox
 
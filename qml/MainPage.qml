@@ -201,6 +201,24 @@ Page {
 
         anchors.fill: parent
         contentHeight: height
+
+        // CheckingFoilKeyView
+        Loader {
+            anchors.fill: parent
+            active: opacity > 0
+            opacity: (foilModel.foilState === FoilAuthModel.FoilCheckingKey) ? 1 : 0
+            sourceComponent: Component {
+                Item {
+                    BusyIndicator {
+                        anchors.centerIn: parent
+                        size: BusyIndicatorSize.Large
+                        running: true
+                    }
+                }
+            }
+            Behavior on opacity { FadeAnimation { } }
+        }
+
         // GenerateFoilKeyView
         Loader {
             anchors.fill: parent
@@ -241,7 +259,8 @@ Page {
             anchors.fill: parent
             active: opacity > 0
             opacity: (foilModel.foilState === FoilAuthModel.FoilLocked ||
-                        foilModel.foilState === FoilAuthModel.FoilLockedTimedOut) ? 1 : 0
+                        foilModel.foilState === FoilAuthModel.FoilLockedTimedOut ||
+                        foilModel.foilState === FoilAuthModel.FoilUnlocking) ? 1 : 0
             sourceComponent: Component {
                 FoilUiEnterPasswordView {
                     foilUi: getFoilUi()
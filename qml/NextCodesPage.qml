@@ -0,0 +1,57 @@
+import QtQuick 2.0
+import Sailfish.Silica 1.0
+import harbour.foilauth 1.0
+
+Page {
+    property alias token: codesModel.token
+    property alias label: header.title
+    property alias issuer: header.description
+
+    readonly property bool _hotp: token.type === FoilAuth.TypeHOTP
+
+    SilicaListView {
+        id: list
+
+        anchors.fill: parent
+        model: FoilAuthLookAheadModel {
+            id: codesModel
+        }
+
+        header: PageHeader { id: header }
+
+        delegate: ListItem {
+            contentHeight: Theme.itemSizeSmall
+
+            Label {
+                anchors {
+                    left: parent.left
+                    leftMargin: Theme.horizontalPageMargin
+                    right: passwordLabel.left
+                    rightMargin: Theme.paddingLarge
+                    verticalCenter: parent.verticalCenter
+                }
+                truncationMode: TruncationMode.Fade
+                color: Theme.highlightColor
+                text: _hotp ? model.counter : Format.formatDate(new Date(model.time), Formatter.TimeValue)
+            }
+
+            Label {
+                id: passwordLabel
+
+                anchors {
+                    right: parent.right
+                    rightMargin: Theme.horizontalPageMargin
+                    verticalCenter: parent.verticalCenter
+                }
+                font {
+                    pixelSize: Theme.fontSizeLarge
+                    family: Theme.fontFamilyHeading
+                    bold: true
+                }
+                text: model.password
+            }
+        }
+
+        VerticalScrollDecorator { }
+    }
+}
@@ -118,7 +118,8 @@ Dialog {
                                 "digits": token.digits,
                                 "counter": token.counter,
                                 "timeshift": token.timeshift,
-                                "algorithm": token.algorithm
+                                "algorithm": token.algorithm,
+                                "period": token.period
                             }).tokenAccepted.connect(delegate.applyChanges)
                         }
                     }
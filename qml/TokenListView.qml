@@ -36,6 +36,8 @@ Item {
     SilicaListView {
         id: tokenList
 
+        property bool _sailOtpChecked
+
         anchors.fill: parent
 
         model: HarbourOrganizeListModel {
@@ -59,6 +61,35 @@ Item {
         }
 
         Component.onCompleted: {
+            _checkSailOTP()
+            _updateVisibleRows()
+        }
+
+        onContentYChanged: _updateVisibleRows()
+        onHeightChanged: _updateVisibleRows()
+
+        Connections {
+            target: foilModel
+            onBusyChanged: tokenList._checkSailOTP()
+        }
+
+        // Tokens are decrypted in the background, visible ones first
+        function _updateVisibleRows() {
+            if (foilModel.busy) {
+                var first = indexAt(contentX, contentY)
+                if (first >= 0) {
+                    var last = indexAt(contentX, contentY + height - 1)
+                    foilModel.setVisibleRows(first, (last < 0) ? (count - 1) : last)
+                }
+            }
+        }
+
+        // Duplicates can only be detected once everything is decrypted
+        function _checkSailOTP() {
+            if (_sailOtpChecked || foilModel.busy) {
+                return
+            }
+            _sailOtpChecked = true
             SailOTP.importedTokens = FoilAuthSettings.sailotpImportedTokens
             var n = SailOTP.fetchNewTokens(FoilAuthModel)
             if (n > 0) {
@@ -209,7 +240,8 @@ Item {
                             "dialogTitle": qsTrId("foilauth-add_token-title")
                         }).tokenAccepted.connect(function(dialog) {
                             FoilAuthModel.addToken(dialog.type, dialog.secret, dialog.label, dialog.issuer,
-                                dialog.digits, dialog.counter, dialog.timeshift, dialog.algorithm)
+                                dialog.digits, dialog.counter, dialog.timeshift, dialog.algorithm,
+                                dialog.period)
                         })
                     })
                     page.tokenDetected.connect(function(token) {
@@ -224,10 +256,12 @@ Item {
                             "digits": token.digits,
                             "counter": token.counter,
                             "timeshift": token.timeshift,
-                            "algorithm": token.algorithm
+                            "algorithm": token.algorithm,
+                            "period": token.period
                         }).tokenAccepted.connect(function(dialog) {
                             FoilAuthModel.addToken(dialog.type, dialog.secret, dialog.label, dialog.issuer,
-                                dialog.digits, dialog.counter, dialog.timeshift, dialog.algorithm)
+                                dialog.digits, dialog.counter, dialog.timeshift, dialog.algorithm,
+                                dialog.period)
                         })
                     })
                     page.tokensDetected.connect(function(model) {
@@ -256,16 +290,40 @@ Item {
                 anchors.verticalCenter: '_titleItem' in header ? header._titleItem.verticalCenter : header.extraContent.verticalCenter
                 leftMargin: Theme.horizontalPageMargin + Theme.paddingMedium
                 rightMargin: header.rightMargin
-                minimumValue: 1
+                minimumValue: 0
                 maximumValue: foilModel.period
-                value: foilModel.timeLeft
                 visible: opacity > 0
                 opacity: foilModel.timerActive ? 1 : 0
 
+                readonly property bool running: foilModel.timerActive && Qt.application.active
+
+                // The model doesn't tick, the countdown is animated
+                // from the end of the current period
+                function restart() {
+                    countdownAnimation.stop()
+                    if (running) {
+                        var ms = Math.max(foilModel.periodEnd - Date.now(), 0)
+                        value = ms/1000
+                        countdownAnimation.duration = ms
+                        countdownAnimation.start()
+                    }
+                }
+
+                onRunningChanged: restart()
+
                 Behavior on opacity { FadeAnimation { } }
-                Behavior on value {
-                    enabled: foilModel.timerActive && Qt.application.active
-                    NumberAnimation { duration: 500 }
+
+                NumberAnimation {
+                    id: countdownAnimation
+
+                    target: countdown
+                    property: "value"
+                    to: 0
+                }
+
+                Connections {
+                    target: foilModel
+                    onPeriodEndChanged: countdown.restart()
                 }
             }
         }
@@ -277,8 +335,8 @@ Item {
             readonly property string tokenId: model.modelId
             readonly property bool _hidden: !model.groupHeader && model.hidden
 
-            showMenuOnPressAndHold: !model.groupHeader
-            enabled: !disabledItems || !disabledItems.length || disabledItems.indexOf(tokenId) < 0
+            showMenuOnPressAndHold: !model.groupHeader && !model.pending
+            enabled: !model.pending && (!disabledItems || !disabledItems.length || disabledItems.indexOf(tokenId) < 0)
             contentHeight: _hidden ? 0 : Theme.itemSizeSmall
             clip: contentHeight < implicitHeight
             visible: height > 0
@@ -306,7 +364,23 @@ Item {
                                 label: model.label,
                                 issuer: model.issuer,
                                 uri: FoilAuth.toUri(model.type, model.secret, model.label, model.issuer,
-                                    model.digits, model.counter, model.timeshift, model.algorithm)
+                                    model.digits, model.counter, model.timeshift, model.algorithm,
+                                    model.period)
+                            })
+                        }
+                    }
+                    MenuItem {
+                        //: Context menu item (show the upcoming passwords)
+                        //% "Next codes"
+                        text: qsTrId("foilauth-menu-next_codes")
+                        onClicked: {
+                            pageStack.push(Qt.resolvedUrl("NextCodesPage.qml"), {
+                                allowedOrientations: mainPage.allowedOrientations,
+                                label: model.label,
+                                issuer: model.issuer,
+                                token: FoilAuth.toToken(model.type, model.secret, model.label, model.issuer,
+                                    model.digits, model.counter, model.timeshift, model.algorithm,
+                                    model.period)
                             })
                         }
                     }
@@ -327,7 +401,8 @@ Item {
                                 algorithm: model.algorithm,
                                 digits: model.digits,
                                 counter: model.counter,
-                                timeshift: model.timeshift
+                                timeshift: model.timeshift,
+                                period: model.period
                             }).tokenAccepted.connect(function(dialog) {
                                 item.updateToken(dialog)
                             })
@@ -425,6 +500,7 @@ Item {
                 model.digits = token.digits
                 model.counter = token.counter
                 model.timeshift = token.timeshift
+                model.period = token.period
             }
 
             onClicked: {
@@ -9,6 +9,9 @@ ApplicationWindow {
     initialPage: HarbourProcessState.jailedApp ? jailPageComponent : mainPageComponent
     cover: Component {  CoverPage { } }
 
+    // Countdowns are animated by QML
+    Component.onCompleted: FoilAuthModel.tickless = true
+
     function resetAutoLock() {
         lockTimer.stop()
         if (FoilAuthModel.keyAvailable && FoilAuthSettings.autoLock && HarbourSystemState.locked) {
@@ -39,6 +42,18 @@ ApplicationWindow {
         onTriggered: FoilAuthModel.lock(false);
     }
 
+    Binding {
+        target: FoilAuthModel
+        property: "vault"
+        value: FoilAuthSettings.vault
+    }
+
+    Binding {
+        target: FoilAuthModel
+        property: "snapshot"
+        value: FoilAuthSettings.snapshot
+    }
+
     Connections {
         target: HarbourSystemState
         onLockedChanged: resetAutoLock()
@@ -118,6 +118,45 @@ Page {
                     defaultValue: 15000
                 }
             }
+
+            TextSwitch {
+                //: Text switch label
+                //% "Keep tokens in a single file"
+                text: qsTrId("foilauth-settings_page-vault-text")
+                //: Text switch description
+                //% "Makes unlocking and editing faster. Turning it off moves the tokens back into separate files. Takes effect next time Foil Auth is unlocked."
+                description: qsTrId("foilauth-settings_page-vault-description")
+                automaticCheck: false
+                checked: vaultConfig.value
+                onClicked: vaultConfig.value = !vaultConfig.value
+
+                ConfigurationValue {
+                    id: vaultConfig
+
+                    key: _rootPath + "vault"
+                    defaultValue: false
+                }
+            }
+
+            TextSwitch {
+                visible: !vaultConfig.value
+                //: Text switch label
+                //% "Remember unchanged tokens"
+                text: qsTrId("foilauth-settings_page-snapshot-text")
+                //: Text switch description
+                //% "Keeps an encrypted copy of the tokens which allows to skip decrypting the files which haven't changed since the last time."
+                description: qsTrId("foilauth-settings_page-snapshot-description")
+                automaticCheck: false
+                checked: snapshotConfig.value
+                onClicked: snapshotConfig.value = !snapshotConfig.value
+
+                ConfigurationValue {
+                    id: snapshotConfig
+
+                    key: _rootPath + "snapshot"
+                    defaultValue: true
+                }
+            }
         }
     }
 }
@@ -38,13 +38,12 @@
  */
 
 #include "FoilAuth.h"
+#include "FoilAuthHmac.h"
 #include "FoilAuthToken.h"
 
 #include "HarbourBase32.h"
 #include "HarbourDebug.h"
 
-#include "foil_hmac.h"
-#include "foil_digest.h"
 #include "foil_random.h"
 #include "foil_output.h"
 #include "foil_input.h"
@@ -327,33 +326,7 @@ FoilAuth::hash(
     quint64 aValue,
     DigestAlgorithm aAlgorithm)
 {
-    const guint64 msg = htobe64(aValue);
-    GType (*digest_type)(void) = foil_impl_digest_sha1_get_type;
-
-    switch (aAlgorithm) {
-    case DigestAlgorithmSHA1:
-        digest_type = foil_impl_digest_sha1_get_type;
-        break;
-    case DigestAlgorithmSHA256:
-        digest_type = foil_impl_digest_sha256_get_type;
-        break;
-    case DigestAlgorithmSHA512:
-        digest_type = foil_impl_digest_sha512_get_type;
-        break;
-    }
-
-    FoilHmac* hmac = foil_hmac_new(digest_type(), aSecret.constData(), aSecret.size());
-
-    foil_hmac_update(hmac, &msg, sizeof(msg));
-
-    gsize hash_len;
-    GBytes* hash_bytes = foil_hmac_free_to_bytes(hmac);
-    const uchar* hash = (uchar*)g_bytes_get_data(hash_bytes, &hash_len);
-    const uint offset = hash[hash_len - 1] & 0x0f;
-    const uint mini_hash = be32toh(*(guint32*)(hash + offset)) & 0x7fffffff;
-
-    g_bytes_unref(hash_bytes);
-    return mini_hash;
+    return FoilAuthHmac::hash(FoilAuthHmac::Key(aSecret, aAlgorithm), aValue);
 }
 
 /* static */
@@ -363,21 +336,40 @@ FoilAuth::toUri(
     const QString aSecretBase32,
     const QString aLabel,
     QString aIssuer, int aDigits, quint64 aCounter, int aTimeShift,
-    Algorithm aAlgorithm)
+    Algorithm aAlgorithm,
+    int aPeriod)
 {
     const QByteArray secret(HarbourBase32::fromBase32(aSecretBase32));
 
     if (!secret.isEmpty()) {
         QString uri(FoilAuthToken((AuthType)aType, secret, aLabel, aIssuer, aDigits,
-            aCounter, aTimeShift, (DigestAlgorithm) aAlgorithm).toUri());
+            aCounter, aTimeShift, (DigestAlgorithm) aAlgorithm,
+            aPeriod).toUri());
 
         HDEBUG(aType << aSecretBase32 << aLabel << aIssuer << aDigits <<
-            aCounter << aTimeShift << aAlgorithm << "=>" << uri);
+            aCounter << aTimeShift << aAlgorithm << aPeriod << "=>" << uri);
         return uri;
     }
     return QString();
 }
 
+/* static */
+FoilAuthToken
+FoilAuth::toToken(
+    Type aType,
+    const QString aSecretBase32,
+    const QString aLabel,
+    QString aIssuer, int aDigits, quint64 aCounter, int aTimeShift,
+    Algorithm aAlgorithm,
+    int aPeriod)
+{
+    const QByteArray secret(HarbourBase32::fromBase32(aSecretBase32));
+
+    return secret.isEmpty() ? FoilAuthToken() :
+        FoilAuthToken((AuthType)aType, secret, aLabel, aIssuer, aDigits,
+            aCounter, aTimeShift, (DigestAlgorithm) aAlgorithm, aPeriod);
+}
+
 /* static */
 FoilAuthToken
 FoilAuth::parseUri(
@@ -64,7 +64,7 @@ class FoilAuth :
     Q_ENUMS(Type)
 
 public:
-    static const int PERIOD = 30;
+    static const int PERIOD = DEFAULT_PERIOD;
 
     // Export these to QML
     enum Algorithm {
@@ -106,7 +106,11 @@ public:
 
     // Invokable from QML
     Q_INVOKABLE static QString toUri(Type, const QString, const QString,
-        const QString, int, quint64, int, Algorithm);
+        const QString, int, quint64, int, Algorithm,
+        int aPeriod = DEFAULT_PERIOD);
+    Q_INVOKABLE static FoilAuthToken toToken(Type, const QString,
+        const QString, const QString, int, quint64, int, Algorithm,
+        int aPeriod = DEFAULT_PERIOD);
     Q_INVOKABLE static FoilAuthToken parseUri(const QString);
     Q_INVOKABLE static QList<FoilAuthToken> parseMigrationUri(const QString);
     Q_INVOKABLE static bool isValidBase32(const QString);
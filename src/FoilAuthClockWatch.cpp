@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the names of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation
+ * are those of the authors and should not be interpreted as representing
+ * any official policies, either expressed or implied.
+ */
+
+#include "FoilAuthClockWatch.h"
+
+#include "HarbourDebug.h"
+
+#include <QtCore/QSocketNotifier>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+// ==========================================================================
+// FoilAuthClockWatch::Private
+//
+// The timer is armed to expire at the end of times and never does. What
+// it does is getting canceled (with read() failing with ECANCELED) when
+// CLOCK_REALTIME is set discontinuously. No polling is involved.
+// ==========================================================================
+
+class FoilAuthClockWatch::Private :
+    public QObject
+{
+    Q_OBJECT
+
+public:
+    Private(FoilAuthClockWatch*);
+    ~Private();
+
+    FoilAuthClockWatch* parentObject() const;
+    bool arm();
+
+public Q_SLOTS:
+    void onActivated();
+
+public:
+    int iFd;
+    QSocketNotifier* iNotifier;
+};
+
+FoilAuthClockWatch::Private::Private(
+    FoilAuthClockWatch* aParent) :
+    QObject(aParent),
+    iFd(timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC)),
+    iNotifier(Q_NULLPTR)
+{
+    if (iFd >= 0) {
+        if (arm()) {
+            iNotifier = new QSocketNotifier(iFd, QSocketNotifier::Read, this);
+            connect(iNotifier, SIGNAL(activated(int)), SLOT(onActivated()));
+        } else {
+            close(iFd);
+            iFd = -1;
+        }
+    } else {
+        HWARN("timerfd_create failed:" << strerror(errno));
+    }
+}
+
+FoilAuthClockWatch::Private::~Private()
+{
+    if (iFd >= 0) {
+        delete iNotifier;
+        close(iFd);
+    }
+}
+
+inline
+FoilAuthClockWatch*
+FoilAuthClockWatch::Private::parentObject() const
+{
+    return qobject_cast<FoilAuthClockWatch*>(parent());
+}
+
+bool
+FoilAuthClockWatch::Private::arm()
+{
+    struct itimerspec spec;
+
+    // The largest positive time_t
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = (time_t)((Q_UINT64_C(1) <<
+        (sizeof(time_t) * 8 - 1)) - 1);
+    if (timerfd_settime(iFd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+        &spec, Q_NULLPTR) == 0) {
+        return true;
+    } else {
+        HWARN("timerfd_settime failed:" << strerror(errno));
+        return false;
+    }
+}
+
+void
+FoilAuthClockWatch::Private::onActivated()
+{
+    quint64 expirations;
+
+    if (read(iFd, &expirations, sizeof(expirations)) < 0 &&
+        errno == ECANCELED) {
+        HDEBUG("Clock has changed");
+        // Cancellation disarms the timer
+        arm();
+        Q_EMIT parentObject()->clockChanged();
+    }
+}
+
+// ==========================================================================
+// FoilAuthClockWatch
+// ==========================================================================
+
+FoilAuthClockWatch::FoilAuthClockWatch(
+    QObject* aParent) :
+    QObject(aParent),
+    iPrivate(new Private(this))
+{
+}
+
+FoilAuthClockWatch::~FoilAuthClockWatch()
+{
+    delete iPrivate;
+}
+
+bool
+FoilAuthClockWatch::isValid() const
+{
+    return iPrivate->iFd >= 0;
+}
+
+#include "FoilAuthClockWatch.moc"
@@ -0,0 +1,823 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the names of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation
+ * are those of the authors and should not be interpreted as representing
+ * any official policies, either expressed or implied.
+ */
+
+#include "FoilAuthHmac.h"
+
+#include <string.h>
+
+// ==========================================================================
+// FoilAuthHmac::Private
+// ==========================================================================
+
+class FoilAuthHmac::Private
+{
+public:
+    static inline quint32 rol32(quint32 x, int n)
+        { return (x << n) | (x >> (32 - n)); }
+    static inline quint32 ror32(quint32 x, int n)
+        { return (x >> n) | (x << (32 - n)); }
+    static inline quint64 ror64(quint64 x, int n)
+        { return (x >> n) | (x << (64 - n)); }
+
+    struct Sha1 {
+        typedef quint32 Word;
+        static const int BLOCK_SIZE = 64;
+        static const int DIGEST_WORDS = 5;
+        static const int ROUNDS = 80;
+        static const int LANES = LANES_32;
+        static const Word IV[8];
+
+        template <int N>
+        static void compress(Word aState[][N], Word aW[][N]);
+        static Word* state(Key* aKey, int aWhich)
+            { return aKey->iState32[aWhich]; }
+        static const Word* state(const Key* aKey, int aWhich)
+            { return aKey->iState32[aWhich]; }
+    };
+
+    struct Sha256 {
+        typedef quint32 Word;
+        static const int BLOCK_SIZE = 64;
+        static const int DIGEST_WORDS = 8;
+        static const int ROUNDS = 64;
+        static const int LANES = LANES_32;
+        static const Word IV[8];
+        static const Word K[64];
+
+        template <int N>
+        static void compress(Word aState[][N], Word aW[][N]);
+        static Word* state(Key* aKey, int aWhich)
+            { return aKey->iState32[aWhich]; }
+        static const Word* state(const Key* aKey, int aWhich)
+            { return aKey->iState32[aWhich]; }
+    };
+
+    struct Sha512 {
+        typedef quint64 Word;
+        static const int BLOCK_SIZE = 128;
+        static const int DIGEST_WORDS = 8;
+        static const int ROUNDS = 80;
+        static const int LANES = LANES_64;
+        static const Word IV[8];
+        static const Word K[80];
+
+        template <int N>
+        static void compress(Word aState[][N], Word aW[][N]);
+        static Word* state(Key* aKey, int aWhich)
+            { return aKey->iState64[aWhich]; }
+        static const Word* state(const Key* aKey, int aWhich)
+            { return aKey->iState64[aWhich]; }
+    };
+
+    template <class H>
+    static void loadBlock(typename H::Word aW[][1], const uchar*);
+    template <class H>
+    static int digest(const uchar*, int, uchar*);
+    template <class H>
+    static void prepareKey(Key*, const uchar*, int);
+    template <class H, int N>
+    static void hashLanes(const Key* const*, const quint64*, uint*, int);
+    template <class H>
+    static void hashGroup(const Key* const*, const quint64*, uint*, int);
+    template <class H>
+    static void hashRange(const Key&, quint64, quint64, uint*, int);
+    template <class H>
+    static void hashSelected(Lane*, int, DigestAlgorithm);
+};
+
+// --------------------------------------------------------------------------
+// SHA-1
+// --------------------------------------------------------------------------
+
+const FoilAuthHmac::Private::Sha1::Word
+FoilAuthHmac::Private::Sha1::IV[8] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+template <int N>
+void
+FoilAuthHmac::Private::Sha1::compress(
+    Word aState[][N],
+    Word aW[][N])
+{
+    Word a[N], b[N], c[N], d[N], e[N];
+    int t, l;
+
+    for (t = 16; t < ROUNDS; t++) {
+        for (l = 0; l < N; l++) {
+            aW[t][l] = rol32(aW[t-3][l] ^ aW[t-8][l] ^ aW[t-14][l] ^
+                aW[t-16][l], 1);
+        }
+    }
+
+    for (l = 0; l < N; l++) {
+        a[l] = aState[0][l];
+        b[l] = aState[1][l];
+        c[l] = aState[2][l];
+        d[l] = aState[3][l];
+        e[l] = aState[4][l];
+    }
+
+    for (t = 0; t < ROUNDS; t++) {
+        for (l = 0; l < N; l++) {
+            Word f, k;
+
+            if (t < 20) {
+                f = (b[l] & c[l]) | (~b[l] & d[l]);
+                k = 0x5a827999;
+            } else if (t < 40) {
+                f = b[l] ^ c[l] ^ d[l];
+                k = 0x6ed9eba1;
+            } else if (t < 60) {
+                f = (b[l] & c[l]) | (b[l] & d[l]) | (c[l] & d[l]);
+                k = 0x8f1bbcdc;
+            } else {
+                f = b[l] ^ c[l] ^ d[l];
+                k = 0xca62c1d6;
+            }
+
+            const Word tmp = rol32(a[l], 5) + f + e[l] + k + aW[t][l];
+
+            e[l] = d[l];
+            d[l] = c[l];
+            c[l] = rol32(b[l], 30);
+            b[l] = a[l];
+            a[l] = tmp;
+        }
+    }
+
+    for (l = 0; l < N; l++) {
+        aState[0][l] += a[l];
+        aState[1][l] += b[l];
+        aState[2][l] += c[l];
+        aState[3][l] += d[l];
+        aState[4][l] += e[l];
+    }
+}
+
+// --------------------------------------------------------------------------
+// SHA-256
+// --------------------------------------------------------------------------
+
+const FoilAuthHmac::Private::Sha256::Word
+FoilAuthHmac::Private::Sha256::IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+const FoilAuthHmac::Private::Sha256::Word
+FoilAuthHmac::Private::Sha256::K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+template <int N>
+void
+FoilAuthHmac::Private::Sha256::compress(
+    Word aState[][N],
+    Word aW[][N])
+{
+    Word s[8][N];
+    int t, l, i;
+
+    for (t = 16; t < ROUNDS; t++) {
+        for (l = 0; l < N; l++) {
+            const Word w15 = aW[t-15][l];
+            const Word w2 = aW[t-2][l];
+            const Word s0 = ror32(w15, 7) ^ ror32(w15, 18) ^ (w15 >> 3);
+            const Word s1 = ror32(w2, 17) ^ ror32(w2, 19) ^ (w2 >> 10);
+
+            aW[t][l] = aW[t-16][l] + s0 + aW[t-7][l] + s1;
+        }
+    }
+
+    for (i = 0; i < 8; i++) {
+        for (l = 0; l < N; l++) {
+            s[i][l] = aState[i][l];
+        }
+    }
+
+    for (t = 0; t < ROUNDS; t++) {
+        for (l = 0; l < N; l++) {
+            const Word a = s[0][l], b = s[1][l], c = s[2][l], d = s[3][l];
+            const Word e = s[4][l], f = s[5][l], g = s[6][l], h = s[7][l];
+            const Word S1 = ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25);
+            const Word ch = (e & f) ^ (~e & g);
+            const Word t1 = h + S1 + ch + K[t] + aW[t][l];
+            const Word S0 = ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22);
+            const Word maj = (a & b) ^ (a & c) ^ (b & c);
+            const Word t2 = S0 + maj;
+
+            s[7][l] = g;
+            s[6][l] = f;
+            s[5][l] = e;
+            s[4][l] = d + t1;
+            s[3][l] = c;
+            s[2][l] = b;
+            s[1][l] = a;
+            s[0][l] = t1 + t2;
+        }
+    }
+
+    for (i = 0; i < 8; i++) {
+        for (l = 0; l < N; l++) {
+            aState[i][l] += s[i][l];
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+// SHA-512
+// --------------------------------------------------------------------------
+
+const FoilAuthHmac::Private::Sha512::Word
+FoilAuthHmac::Private::Sha512::IV[8] = {
+    Q_UINT64_C(0x6a09e667f3bcc908), Q_UINT64_C(0xbb67ae8584caa73b),
+    Q_UINT64_C(0x3c6ef372fe94f82b), Q_UINT64_C(0xa54ff53a5f1d36f1),
+    Q_UINT64_C(0x510e527fade682d1), Q_UINT64_C(0x9b05688c2b3e6c1f),
+    Q_UINT64_C(0x1f83d9abfb41bd6b), Q_UINT64_C(0x5be0cd19137e2179)
+};
+
+const FoilAuthHmac::Private::Sha512::Word
+FoilAuthHmac::Private::Sha512::K[80] = {
+    Q_UINT64_C(0x428a2f98d728ae22), Q_UINT64_C(0x7137449123ef65cd),
+    Q_UINT64_C(0xb5c0fbcfec4d3b2f), Q_UINT64_C(0xe9b5dba58189dbbc),
+    Q_UINT64_C(0x3956c25bf348b538), Q_UINT64_C(0x59f111f1b605d019),
+    Q_UINT64_C(0x923f82a4af194f9b), Q_UINT64_C(0xab1c5ed5da6d8118),
+    Q_UINT64_C(0xd807aa98a3030242), Q_UINT64_C(0x12835b0145706fbe),
+    Q_UINT64_C(0x243185be4ee4b28c), Q_UINT64_C(0x550c7dc3d5ffb4e2),
+    Q_UINT64_C(0x72be5d74f27b896f), Q_UINT64_C(0x80deb1fe3b1696b1),
+    Q_UINT64_C(0x9bdc06a725c71235), Q_UINT64_C(0xc19bf174cf692694),
+    Q_UINT64_C(0xe49b69c19ef14ad2), Q_UINT64_C(0xefbe4786384f25e3),
+    Q_UINT64_C(0x0fc19dc68b8cd5b5), Q_UINT64_C(0x240ca1cc77ac9c65),
+    Q_UINT64_C(0x2de92c6f592b0275), Q_UINT64_C(0x4a7484aa6ea6e483),
+    Q_UINT64_C(0x5cb0a9dcbd41fbd4), Q_UINT64_C(0x76f988da831153b5),
+    Q_UINT64_C(0x983e5152ee66dfab), Q_UINT64_C(0xa831c66d2db43210),
+    Q_UINT64_C(0xb00327c898fb213f), Q_UINT64_C(0xbf597fc7beef0ee4),
+    Q_UINT64_C(0xc6e00bf33da88fc2), Q_UINT64_C(0xd5a79147930aa725),
+    Q_UINT64_C(0x06ca6351e003826f), Q_UINT64_C(0x142929670a0e6e70),
+    Q_UINT64_C(0x27b70a8546d22ffc), Q_UINT64_C(0x2e1b21385c26c926),
+    Q_UINT64_C(0x4d2c6dfc5ac42aed), Q_UINT64_C(0x53380d139d95b3df),
+    Q_UINT64_C(0x650a73548baf63de), Q_UINT64_C(0x766a0abb3c77b2a8),
+    Q_UINT64_C(0x81c2c92e47edaee6), Q_UINT64_C(0x92722c851482353b),
+    Q_UINT64_C(0xa2bfe8a14cf10364), Q_UINT64_C(0xa81a664bbc423001),
+    Q_UINT64_C(0xc24b8b70d0f89791), Q_UINT64_C(0xc76c51a30654be30),
+    Q_UINT64_C(0xd192e819d6ef5218), Q_UINT64_C(0xd69906245565a910),
+    Q_UINT64_C(0xf40e35855771202a), Q_UINT64_C(0x106aa07032bbd1b8),
+    Q_UINT64_C(0x19a4c116b8d2d0c8), Q_UINT64_C(0x1e376c085141ab53),
+    Q_UINT64_C(0x2748774cdf8eeb99), Q_UINT64_C(0x34b0bcb5e19b48a8),
+    Q_UINT64_C(0x391c0cb3c5c95a63), Q_UINT64_C(0x4ed8aa4ae3418acb),
+    Q_UINT64_C(0x5b9cca4f7763e373), Q_UINT64_C(0x682e6ff3d6b2b8a3),
+    Q_UINT64_C(0x748f82ee5defb2fc), Q_UINT64_C(0x78a5636f43172f60),
+    Q_UINT64_C(0x84c87814a1f0ab72), Q_UINT64_C(0x8cc702081a6439ec),
+    Q_UINT64_C(0x90befffa23631e28), Q_UINT64_C(0xa4506cebde82bde9),
+    Q_UINT64_C(0xbef9a3f7b2c67915), Q_UINT64_C(0xc67178f2e372532b),
+    Q_UINT64_C(0xca273eceea26619c), Q_UINT64_C(0xd186b8c721c0c207),
+    Q_UINT64_C(0xeada7dd6cde0eb1e), Q_UINT64_C(0xf57d4f7fee6ed178),
+    Q_UINT64_C(0x06f067aa72176fba), Q_UINT64_C(0x0a637dc5a2c898a6),
+    Q_UINT64_C(0x113f9804bef90dae), Q_UINT64_C(0x1b710b35131c471b),
+    Q_UINT64_C(0x28db77f523047d84), Q_UINT64_C(0x32caab7b40c72493),
+    Q_UINT64_C(0x3c9ebe0a15c9bebc), Q_UINT64_C(0x431d67c49c100d4c),
+    Q_UINT64_C(0x4cc5d4becb3e42b6), Q_UINT64_C(0x597f299cfc657e2a),
+    Q_UINT64_C(0x5fcb6fab3ad6faec), Q_UINT64_C(0x6c44198c4a475817)
+};
+
+template <int N>
+void
+FoilAuthHmac::Private::Sha512::compress(
+    Word aState[][N],
+    Word aW[][N])
+{
+    Word s[8][N];
+    int t, l, i;
+
+    for (t = 16; t < ROUNDS; t++) {
+        for (l = 0; l < N; l++) {
+            const Word w15 = aW[t-15][l];
+            const Word w2 = aW[t-2][l];
+            const Word s0 = ror64(w15, 1) ^ ror64(w15, 8) ^ (w15 >> 7);
+            const Word s1 = ror64(w2, 19) ^ ror64(w2, 61) ^ (w2 >> 6);
+
+            aW[t][l] = aW[t-16][l] + s0 + aW[t-7][l] + s1;
+        }
+    }
+
+    for (i = 0; i < 8; i++) {
+        for (l = 0; l < N; l++) {
+            s[i][l] = aState[i][l];
+        }
+    }
+
+    for (t = 0; t < ROUNDS; t++) {
+        for (l = 0; l < N; l++) {
+            const Word a = s[0][l], b = s[1][l], c = s[2][l], d = s[3][l];
+            const Word e = s[4][l], f = s[5][l], g = s[6][l], h = s[7][l];
+            const Word S1 = ror64(e, 14) ^ ror64(e, 18) ^ ror64(e, 41);
+            const Word ch = (e & f) ^ (~e & g);
+            const Word t1 = h + S1 + ch + K[t] + aW[t][l];
+            const Word S0 = ror64(a, 28) ^ ror64(a, 34) ^ ror64(a, 39);
+            const Word maj = (a & b) ^ (a & c) ^ (b & c);
+            const Word t2 = S0 + maj;
+
+            s[7][l] = g;
+            s[6][l] = f;
+            s[5][l] = e;
+            s[4][l] = d + t1;
+            s[3][l] = c;
+            s[2][l] = b;
+            s[1][l] = a;
+            s[0][l] = t1 + t2;
+        }
+    }
+
+    for (i = 0; i < 8; i++) {
+        for (l = 0; l < N; l++) {
+            aState[i][l] += s[i][l];
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+// Generic part
+// --------------------------------------------------------------------------
+
+template <class H>
+void
+FoilAuthHmac::Private::loadBlock(
+    typename H::Word aW[][1],
+    const uchar* aBlock)
+{
+    const int wordSize = sizeof(typename H::Word);
+
+    for (int i = 0; i < 16; i++) {
+        typename H::Word w = 0;
+
+        for (int k = 0; k < wordSize; k++) {
+            w = (w << 8) | *aBlock++;
+        }
+        aW[i][0] = w;
+    }
+}
+
+// Plain (one lane) hash, only used for hashing long keys
+template <class H>
+int
+FoilAuthHmac::Private::digest(
+    const uchar* aData,
+    int aSize,
+    uchar* aDigest)
+{
+    const int wordSize = sizeof(typename H::Word);
+    const int lengthSize = 2 * wordSize;
+    typename H::Word state[8][1];
+    typename H::Word w[H::ROUNDS][1];
+    uchar block[H::BLOCK_SIZE];
+    const quint64 bits = ((quint64)aSize) << 3;
+    int i, left = aSize;
+
+    for (i = 0; i < 8; i++) {
+        state[i][0] = H::IV[i];
+    }
+
+    // Full blocks
+    for (; left >= H::BLOCK_SIZE; left -= H::BLOCK_SIZE) {
+        loadBlock<H>(w, aData);
+        H::template compress<1>(state, w);
+        aData += H::BLOCK_SIZE;
+    }
+
+    // The last one or two blocks
+    memset(block, 0, sizeof(block));
+    memcpy(block, aData, left);
+    block[left] = 0x80;
+    if (left + 1 > H::BLOCK_SIZE - lengthSize) {
+        loadBlock<H>(w, block);
+        H::template compress<1>(state, w);
+        memset(block, 0, sizeof(block));
+    }
+    for (i = 0; i < 8; i++) {
+        block[H::BLOCK_SIZE - 1 - i] = (uchar)(bits >> (8 * i));
+    }
+    loadBlock<H>(w, block);
+    H::template compress<1>(state, w);
+
+    // Serialize the digest
+    for (i = 0; i < H::DIGEST_WORDS * wordSize; i++) {
+        const int shift = 8 * (wordSize - 1 - (i % wordSize));
+
+        aDigest[i] = (uchar)(state[i / wordSize][0] >> shift);
+    }
+    memset(block, 0, sizeof(block));
+    memset(w, 0, sizeof(w));
+    return H::DIGEST_WORDS * wordSize;
+}
+
+template <class H>
+void
+FoilAuthHmac::Private::prepareKey(
+    Key* aKey,
+    const uchar* aSecret,
+    int aSize)
+{
+    uchar key[H::BLOCK_SIZE];
+    uchar pad[H::BLOCK_SIZE];
+    typename H::Word state[8][1];
+    typename H::Word w[H::ROUNDS][1];
+    int i, k;
+
+    // Keys longer than the block size are hashed first
+    memset(key, 0, sizeof(key));
+    if (aSize > H::BLOCK_SIZE) {
+        digest<H>(aSecret, aSize, key);
+    } else {
+        memcpy(key, aSecret, aSize);
+    }
+
+    // Inner (ipad) and outer (opad) states
+    for (k = 0; k < 2; k++) {
+        const uchar x = k ? 0x5c : 0x36;
+        typename H::Word* keyState = H::state(aKey, k);
+
+        for (i = 0; i < H::BLOCK_SIZE; i++) {
+            pad[i] = key[i] ^ x;
+        }
+        for (i = 0; i < 8; i++) {
+            state[i][0] = H::IV[i];
+        }
+        loadBlock<H>(w, pad);
+        H::template compress<1>(state, w);
+        for (i = 0; i < 8; i++) {
+            keyState[i] = state[i][0];
+        }
+    }
+
+    memset(key, 0, sizeof(key));
+    memset(pad, 0, sizeof(pad));
+    memset(w, 0, sizeof(w));
+    memset(state, 0, sizeof(state));
+}
+
+//
+// Processes up to N lanes. The message is always the 8-byte value which
+// together with padding fits into a single block. The inner digest plus
+// padding fits into a single block too, so that each lane takes exactly
+// two compression passes.
+//
+template <class H, int N>
+void
+FoilAuthHmac::Private::hashLanes(
+    const Key* const* aKeys,
+    const quint64* aValues,
+    uint* aHashes,
+    int aCount)
+{
+    typedef typename H::Word Word;
+    const int wordSize = sizeof(Word);
+    const int wordBits = 8 * wordSize;
+    const int digestSize = H::DIGEST_WORDS * wordSize;
+    const Word padBit = ((Word)1) << (wordBits - 1);
+    Word state[8][N];
+    Word w[H::ROUNDS][N];
+    int i, l;
+
+    // Unused lanes (if any) repeat the first one
+    for (l = 0; l < N; l++) {
+        const int src = (l < aCount) ? l : 0;
+        const Word* inner = H::state(aKeys[src], 0);
+        const quint64 value = aValues[src];
+
+        for (i = 0; i < 8; i++) {
+            state[i][l] = inner[i];
+        }
+
+        // Big-endian value followed by padding
+        i = 0;
+        if (wordSize == 8) {
+            w[i++][l] = (Word)value;
+        } else {
+            w[i++][l] = (Word)(value >> 32);
+            w[i++][l] = (Word)value;
+        }
+        w[i++][l] = padBit;
+        while (i < 15) {
+            w[i++][l] = 0;
+        }
+        w[15][l] = (H::BLOCK_SIZE + 8) * 8;
+    }
+
+    H::template compress<N>(state, w);
+
+    // Inner digest becomes the message for the outer hash
+    for (i = 0; i < H::DIGEST_WORDS; i++) {
+        for (l = 0; l < N; l++) {
+            w[i][l] = state[i][l];
+        }
+    }
+    for (l = 0; l < N; l++) {
+        const Word* outer = H::state(aKeys[(l < aCount) ? l : 0], 1);
+
+        for (i = 0; i < 8; i++) {
+            state[i][l] = outer[i];
+        }
+        w[H::DIGEST_WORDS][l] = padBit;
+        for (i = H::DIGEST_WORDS + 1; i < 15; i++) {
+            w[i][l] = 0;
+        }
+        w[15][l] = (H::BLOCK_SIZE + digestSize) * 8;
+    }
+
+    H::template compress<N>(state, w);
+
+    // Dynamic truncation (RFC 4226 section 5.3)
+    for (l = 0; l < aCount; l++) {
+        const int last = digestSize - 1;
+        const uint offset = (uint)(state[last / wordSize][l] & 0x0f);
+        uint bin = 0;
+
+        for (i = 0; i < 4; i++) {
+            const int pos = offset + i;
+            const int shift = 8 * (wordSize - 1 - (pos % wordSize));
+
+            bin = (bin << 8) | (uchar)(state[pos / wordSize][l] >> shift);
+        }
+        aHashes[l] = bin & 0x7fffffff;
+    }
+}
+
+template <class H>
+void
+FoilAuthHmac::Private::hashGroup(
+    const Key* const* aKeys,
+    const quint64* aValues,
+    uint* aHashes,
+    int aCount)
+{
+    int done = 0;
+
+    while (aCount - done >= H::LANES) {
+        hashLanes<H,H::LANES>(aKeys + done, aValues + done, aHashes + done,
+            H::LANES);
+        done += H::LANES;
+    }
+    // Scalar tail
+    for (; done < aCount; done++) {
+        hashLanes<H,1>(aKeys + done, aValues + done, aHashes + done, 1);
+    }
+}
+
+template <class H>
+void
+FoilAuthHmac::Private::hashRange(
+    const Key& aKey,
+    quint64 aFirst,
+    quint64 aStep,
+    uint* aHashes,
+    int aCount)
+{
+    const Key* keys[H::LANES];
+    quint64 values[H::LANES];
+    int i, done = 0;
+
+    for (i = 0; i < H::LANES; i++) {
+        keys[i] = &aKey;
+    }
+    while (done < aCount) {
+        const int n = qMin(aCount - done, (int)H::LANES);
+
+        for (i = 0; i < n; i++) {
+            values[i] = aFirst + (done + i) * aStep;
+        }
+        hashGroup<H>(keys, values, aHashes + done, n);
+        done += n;
+    }
+}
+
+// Only hashes the lanes using the specified algorithm
+template <class H>
+void
+FoilAuthHmac::Private::hashSelected(
+    Lane* aLanes,
+    int aCount,
+    DigestAlgorithm aAlgorithm)
+{
+    const Key* keys[H::LANES];
+    quint64 values[H::LANES];
+    uint hashes[H::LANES];
+    int index[H::LANES];
+    int k = 0;
+
+    for (int i = 0; i <= aCount; i++) {
+        if (k == H::LANES || (i == aCount && k > 0)) {
+            // Flush the full (or the last) group
+            hashGroup<H>(keys, values, hashes, k);
+            for (int j = 0; j < k; j++) {
+                aLanes[index[j]].iHash = hashes[j];
+            }
+            k = 0;
+        }
+        if (i < aCount && aLanes[i].iKey->iAlgorithm == aAlgorithm) {
+            keys[k] = aLanes[i].iKey;
+            values[k] = aLanes[i].iValue;
+            index[k++] = i;
+        }
+    }
+}
+
+// ==========================================================================
+// FoilAuthHmac::Key
+// ==========================================================================
+
+FoilAuthHmac::Key::Key() :
+    iAlgorithm(DEFAULT_ALGORITHM),
+    iValid(false)
+{
+    memset(iState64, 0, sizeof(iState64));
+}
+
+FoilAuthHmac::Key::Key(
+    const void* aSecret,
+    int aSize,
+    DigestAlgorithm aAlgorithm) :
+    iAlgorithm(aAlgorithm),
+    iValid(true)
+{
+    init(aSecret, aSize);
+}
+
+FoilAuthHmac::Key::Key(
+    const QByteArray& aSecret,
+    DigestAlgorithm aAlgorithm) :
+    iAlgorithm(aAlgorithm),
+    iValid(true)
+{
+    init(aSecret.constData(), aSecret.size());
+}
+
+FoilAuthHmac::Key::Key(
+    const Key& aKey) :
+    iAlgorithm(aKey.iAlgorithm),
+    iValid(aKey.iValid)
+{
+    memcpy(iState64, aKey.iState64, sizeof(iState64));
+}
+
+FoilAuthHmac::Key::~Key()
+{
+    clear();
+}
+
+FoilAuthHmac::Key&
+FoilAuthHmac::Key::operator=(
+    const Key& aKey)
+{
+    iAlgorithm = aKey.iAlgorithm;
+    iValid = aKey.iValid;
+    memcpy(iState64, aKey.iState64, sizeof(iState64));
+    return *this;
+}
+
+void
+FoilAuthHmac::Key::init(
+    const void* aSecret,
+    int aSize)
+{
+    const uchar* secret = (const uchar*)aSecret;
+
+    memset(iState64, 0, sizeof(iState64));
+    switch (iAlgorithm) {
+    case DigestAlgorithmSHA256:
+        Private::prepareKey<Private::Sha256>(this, secret, aSize);
+        return;
+    case DigestAlgorithmSHA512:
+        Private::prepareKey<Private::Sha512>(this, secret, aSize);
+        return;
+    case DigestAlgorithmSHA1:
+        break;
+    }
+    iAlgorithm = DigestAlgorithmSHA1;
+    Private::prepareKey<Private::Sha1>(this, secret, aSize);
+}
+
+void
+FoilAuthHmac::Key::clear()
+{
+    // Don't leave the key material lying around
+    volatile quint64* ptr = &iState64[0][0];
+
+    for (uint i = 0; i < sizeof(iState64)/sizeof(iState64[0][0]); i++) {
+        ptr[i] = 0;
+    }
+    iValid = false;
+}
+
+// ==========================================================================
+// FoilAuthHmac
+// ==========================================================================
+
+/* static */
+uint
+FoilAuthHmac::hash(
+    const Key& aKey,
+    quint64 aValue)
+{
+    uint result = 0;
+
+    hash(aKey, aValue, &result, 1);
+    return result;
+}
+
+// Hashes aCount consecutive values starting with aFirst
+/* static */
+void
+FoilAuthHmac::hash(
+    const Key& aKey,
+    quint64 aFirst,
+    uint* aHashes,
+    int aCount)
+{
+    hash(aKey, aFirst, 1, aHashes, aCount);
+}
+
+// Hashes aCount values starting with aFirst, aStep apart
+/* static */
+void
+FoilAuthHmac::hash(
+    const Key& aKey,
+    quint64 aFirst,
+    quint64 aStep,
+    uint* aHashes,
+    int aCount)
+{
+    switch (aKey.iAlgorithm) {
+    case DigestAlgorithmSHA1:
+        Private::hashRange<Private::Sha1>(aKey, aFirst, aStep, aHashes, aCount);
+        break;
+    case DigestAlgorithmSHA256:
+        Private::hashRange<Private::Sha256>(aKey, aFirst, aStep, aHashes, aCount);
+        break;
+    case DigestAlgorithmSHA512:
+        Private::hashRange<Private::Sha512>(aKey, aFirst, aStep, aHashes, aCount);
+        break;
+    }
+}
+
+// Lanes are grouped by the digest algorithm, one pass per algorithm
+/* static */
+void
+FoilAuthHmac::hash(
+    Lane* aLanes,
+    int aCount)
+{
+    Private::hashSelected<Private::Sha1>(aLanes, aCount, DigestAlgorithmSHA1);
+    Private::hashSelected<Private::Sha256>(aLanes, aCount, DigestAlgorithmSHA256);
+    Private::hashSelected<Private::Sha512>(aLanes, aCount, DigestAlgorithmSHA512);
+}
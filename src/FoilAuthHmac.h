@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the names of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation
+ * are those of the authors and should not be interpreted as representing
+ * any official policies, either expressed or implied.
+ */
+
+#ifndef FOILAUTH_HMAC_H
+#define FOILAUTH_HMAC_H
+
+#include "FoilAuthTypes.h"
+
+#include <QtCore/QByteArray>
+
+// Multi-lane HMAC for bulk OTP generation. Computes HMAC of 64-bit
+// (big-endian) values, i.e. exactly what HOTP and TOTP need, for many
+// independent (key, value) pairs at once. Key schedule (ipad and opad
+// blocks run through the compression function) is done once per key,
+// after that each value costs exactly two compression passes.
+//
+// Lanes are processed in groups, with the state of each group laid out
+// as [word][lane] arrays, so that the compiler can turn each step of
+// the compression function into a vector operation (SSE/AVX on x86,
+// NEON on ARM). Without vectorization it's still a plain scalar loop,
+// which is why the build enables it for FoilAuthHmac.cpp.
+class FoilAuthHmac :
+    public FoilAuthTypes
+{
+public:
+    // Number of lanes processed in parallel
+    static const int LANES_32 = 8;  // SHA1 and SHA256
+    static const int LANES_64 = 4;  // SHA512
+
+    class Key {
+    public:
+        Key();
+        Key(const void*, int, DigestAlgorithm aAlgorithm = DEFAULT_ALGORITHM);
+        Key(const QByteArray&, DigestAlgorithm aAlgorithm = DEFAULT_ALGORITHM);
+        Key(const Key&);
+        ~Key();
+
+        Key& operator=(const Key&);
+        bool isValid() const { return iValid; }
+        DigestAlgorithm algorithm() const { return iAlgorithm; }
+        void clear();
+
+    private:
+        void init(const void*, int);
+
+    public:
+        DigestAlgorithm iAlgorithm;
+        bool iValid;
+        union {
+            quint32 iState32[2][8];  // Inner and outer, SHA1 and SHA256
+            quint64 iState64[2][8];  // Inner and outer, SHA512
+        };
+    };
+
+    class Lane {
+    public:
+        Lane() : iKey(Q_NULLPTR), iValue(0), iHash(0) {}
+        Lane(const Key* aKey, quint64 aValue) :
+            iKey(aKey), iValue(aValue), iHash(0) {}
+
+    public:
+        const Key* iKey;
+        quint64 iValue;
+        uint iHash;   // Output, same as FoilAuth::hash()
+    };
+
+    static uint hash(const Key&, quint64);
+    static void hash(const Key&, quint64 aFirst, uint* aHashes, int aCount);
+    static void hash(const Key&, quint64 aFirst, quint64 aStep,
+        uint* aHashes, int aCount);
+    static void hash(Lane*, int aCount);
+
+private:
+    FoilAuthHmac();
+    class Private;
+};
+
+#endif // FOILAUTH_HMAC_H
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the names of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation
+ * are those of the authors and should not be interpreted as representing
+ * any official policies, either expressed or implied.
+ */
+
+#include "FoilAuthLookAheadModel.h"
+
+#include "HarbourDebug.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QVector>
+
+// Model roles
+#define MODEL_ROLES_(first,role,last) \
+    first(Password,password) \
+    role(Time,time) \
+    last(Counter,counter)
+
+#define MODEL_ROLES(role) \
+    MODEL_ROLES_(role,role,role)
+
+// One day worth of 30 second periods
+#define DEFAULT_MAX_COUNT (24 * 60 * 2)
+#define FETCH_SIZE 120
+
+// ==========================================================================
+// FoilAuthLookAheadModel::Private
+// ==========================================================================
+
+class FoilAuthLookAheadModel::Private
+{
+public:
+    enum Role {
+        #define FIRST(X,x) FirstRole = Qt::UserRole, X##Role = FirstRole,
+        #define ROLE(X,x) X##Role,
+        #define LAST(X,x) X##Role, LastRole = X##Role
+        MODEL_ROLES_(FIRST,ROLE,LAST)
+        #undef FIRST
+        #undef ROLE
+        #undef LAST
+    };
+
+    // QtCreator syntax highlighter gets confused by the above macro magic.
+    // Somehow this stupid enum unconfuses it :/
+    enum { _ };
+
+    Private(FoilAuthLookAheadModel*);
+
+    bool isHOTP() const;
+    quint64 firstPeriod() const;
+    QVariant get(int, Role) const;
+    void fetchMore();
+    void reset();
+
+public:
+    FoilAuthLookAheadModel* iModel;
+    FoilAuthToken iToken;
+    qint64 iStartTime; // Milliseconds, zero means now
+    quint64 iFirstPeriod; // Seconds
+    int iMaxCount;
+    QVector<uint> iValues;
+};
+
+FoilAuthLookAheadModel::Private::Private(
+    FoilAuthLookAheadModel* aModel) :
+    iModel(aModel),
+    iStartTime(0),
+    iFirstPeriod(0),
+    iMaxCount(DEFAULT_MAX_COUNT)
+{}
+
+inline
+bool
+FoilAuthLookAheadModel::Private::isHOTP() const
+{
+    return iToken.type() == FoilAuthTypes::AuthTypeHOTP;
+}
+
+quint64
+FoilAuthLookAheadModel::Private::firstPeriod() const
+{
+    const qint64 ms = iStartTime ? iStartTime :
+        QDateTime::currentMSecsSinceEpoch();
+
+    return iToken.periodStart(ms / 1000);
+}
+
+QVariant
+FoilAuthLookAheadModel::Private::get(
+    int aRow,
+    Role aRole) const
+{
+    switch (aRole) {
+    case PasswordRole:
+        return iToken.formatPassword(iValues.at(aRow));
+    case TimeRole:
+        return isHOTP() ? Q_INT64_C(0) :
+            (qint64)(iFirstPeriod + (quint64) aRow * iToken.period()) * 1000;
+    case CounterRole:
+        return isHOTP() ? (iToken.counter() + aRow) : Q_UINT64_C(0);
+    }
+    return QVariant();
+}
+
+// Generates the next chunk of codes with a single key schedule
+void
+FoilAuthLookAheadModel::Private::fetchMore()
+{
+    const int pos = iValues.count();
+    const int n = qMin(iMaxCount - pos, (int) FETCH_SIZE);
+
+    if (n > 0 && iToken.isValid()) {
+        iModel->beginInsertRows(QModelIndex(), pos, pos + n - 1);
+        iValues.resize(pos + n);
+        if (isHOTP()) {
+            iToken.withCounter(iToken.counter() + pos).
+                passwordValues(0, iValues.data() + pos, n);
+        } else {
+            iToken.passwordValues(iFirstPeriod + (quint64) pos *
+                iToken.period(), iValues.data() + pos, n);
+        }
+        HDEBUG(pos << "+" << n);
+        iModel->endInsertRows();
+    }
+}
+
+void
+FoilAuthLookAheadModel::Private::reset()
+{
+    iModel->beginResetModel();
+    iValues.clear();
+    iFirstPeriod = firstPeriod();
+    iModel->endResetModel();
+}
+
+// ==========================================================================
+// FoilAuthLookAheadModel
+// ==========================================================================
+
+FoilAuthLookAheadModel::FoilAuthLookAheadModel(
+    QObject* aParent) :
+    QAbstractListModel(aParent),
+    iPrivate(new Private(this))
+{
+    connect(this, SIGNAL(modelReset()), SIGNAL(countChanged()));
+    connect(this, SIGNAL(rowsInserted(QModelIndex,int,int)), SIGNAL(countChanged()));
+}
+
+FoilAuthLookAheadModel::~FoilAuthLookAheadModel()
+{
+    delete iPrivate;
+}
+
+FoilAuthToken
+FoilAuthLookAheadModel::token() const
+{
+    return iPrivate->iToken;
+}
+
+void
+FoilAuthLookAheadModel::setToken(
+    FoilAuthToken aToken)
+{
+    if (iPrivate->iToken != aToken) {
+        HDEBUG(aToken);
+        iPrivate->iToken = aToken;
+        iPrivate->reset();
+        Q_EMIT tokenChanged();
+    }
+}
+
+qint64
+FoilAuthLookAheadModel::startTime() const
+{
+    return iPrivate->iStartTime;
+}
+
+void
+FoilAuthLookAheadModel::setStartTime(
+    qint64 aTime)
+{
+    if (iPrivate->iStartTime != aTime) {
+        HDEBUG(aTime);
+        iPrivate->iStartTime = aTime;
+        iPrivate->reset();
+        Q_EMIT startTimeChanged();
+    }
+}
+
+int
+FoilAuthLookAheadModel::maxCount() const
+{
+    return iPrivate->iMaxCount;
+}
+
+void
+FoilAuthLookAheadModel::setMaxCount(
+    int aCount)
+{
+    const int count = qMax(aCount, 0);
+
+    if (iPrivate->iMaxCount != count) {
+        HDEBUG(count);
+        iPrivate->iMaxCount = count;
+        if (iPrivate->iValues.count() > count) {
+            iPrivate->reset();
+        }
+        Q_EMIT maxCountChanged();
+    }
+}
+
+QHash<int,QByteArray>
+FoilAuthLookAheadModel::roleNames() const
+{
+    QHash<int,QByteArray> roles;
+
+    #define ROLE(X,x) roles.insert(Private::X##Role, #x);
+    MODEL_ROLES(ROLE)
+    #undef ROLE
+    return roles;
+}
+
+int
+FoilAuthLookAheadModel::rowCount(
+    const QModelIndex& aParent) const
+{
+    return aParent.isValid() ? 0 : iPrivate->iValues.count();
+}
+
+QVariant
+FoilAuthLookAheadModel::data(
+    const QModelIndex& aIndex,
+    int aRole) const
+{
+    const int row = aIndex.row();
+
+    return (row >= 0 && row < iPrivate->iValues.count()) ?
+        iPrivate->get(row, (Private::Role) aRole) : QVariant();
+}
+
+bool
+FoilAuthLookAheadModel::canFetchMore(
+    const QModelIndex& aParent) const
+{
+    return !aParent.isValid() && iPrivate->iToken.isValid() &&
+        iPrivate->iValues.count() < iPrivate->iMaxCount;
+}
+
+void
+FoilAuthLookAheadModel::fetchMore(
+    const QModelIndex& aParent)
+{
+    if (!aParent.isValid()) {
+        iPrivate->fetchMore();
+    }
+}
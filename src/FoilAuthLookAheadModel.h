@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the names of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation
+ * are those of the authors and should not be interpreted as representing
+ * any official policies, either expressed or implied.
+ */
+
+#ifndef FOILAUTH_LOOKAHEAD_MODEL_H
+#define FOILAUTH_LOOKAHEAD_MODEL_H
+
+#include "FoilAuthToken.h"
+
+#include <QtCore/QAbstractListModel>
+
+// Codes of a single token for the upcoming periods (or counter values),
+// generated in chunks as the view scrolls down
+class FoilAuthLookAheadModel :
+    public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(FoilAuthToken token READ token WRITE setToken NOTIFY tokenChanged)
+    Q_PROPERTY(qint64 startTime READ startTime WRITE setStartTime NOTIFY startTimeChanged)
+    Q_PROPERTY(int maxCount READ maxCount WRITE setMaxCount NOTIFY maxCountChanged)
+    Q_PROPERTY(int count READ rowCount NOTIFY countChanged)
+
+public:
+    FoilAuthLookAheadModel(QObject* aParent = Q_NULLPTR);
+    ~FoilAuthLookAheadModel();
+
+    FoilAuthToken token() const;
+    void setToken(FoilAuthToken);
+    qint64 startTime() const;
+    void setStartTime(qint64);
+    int maxCount() const;
+    void setMaxCount(int);
+
+    // QAbstractItemModel
+    QHash<int,QByteArray> roleNames() const Q_DECL_OVERRIDE;
+    int rowCount(const QModelIndex& aParent = QModelIndex()) const Q_DECL_OVERRIDE;
+    QVariant data(const QModelIndex&, int) const Q_DECL_OVERRIDE;
+    bool canFetchMore(const QModelIndex&) const Q_DECL_OVERRIDE;
+    void fetchMore(const QModelIndex&) Q_DECL_OVERRIDE;
+
+Q_SIGNALS:
+    void tokenChanged();
+    void startTimeChanged();
+    void maxCountChanged();
+    void countChanged();
+
+private:
+    class Private;
+    Private* iPrivate;
+};
+
+#endif // FOILAUTH_LOOKAHEAD_MODEL_H
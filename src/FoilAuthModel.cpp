@@ -38,11 +38,15 @@
  */
 
 #include "FoilAuthModel.h"
+#include "FoilAuthClockWatch.h"
+#include "FoilAuthHmac.h"
+#include "FoilAuthVault.h"
 #include "FoilAuth.h"
 
 #include "HarbourBase32.h"
 #include "HarbourDebug.h"
 #include "HarbourParentSignalQueueObject.h"
+#include "HarbourProtoBuf.h"
 #include "HarbourTask.h"
 
 #include "foil_output.h"
@@ -57,16 +61,27 @@
 
 #include <QtCore/QDateTime>
 #include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QFile>
 #include <QtCore/QFileInfo>
+#include <QtCore/QMutex>
+#include <QtCore/QRunnable>
 #include <QtCore/QScopedPointer>
+#include <QtCore/QThread>
 #include <QtCore/QThreadPool>
 #include <QtCore/QTimer>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QtAlgorithms>
+
+#include <algorithm>
 
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #define ENCRYPT_FILE_MODE       0600
 
@@ -82,14 +97,25 @@
 #define HEADER_TIMESHIFT        "OTP-TimeShift"  // TOTP and Steam specific
 #define HEADER_FAVORITE         "OTP-Favorite"
 #define HEADER_STEAM            "OTP-Steam"
-#define MAX_HEADERS             9
+#define HEADER_PERIOD           "OTP-Period"     // TOTP and Steam specific
+#define MAX_HEADERS             10
 
 // Directories relative to home
 #define FOIL_AUTH_DIR           "Documents/FoilAuth"
 #define FOIL_KEY_DIR            ".local/share/foil"
 #define FOIL_KEY_FILE           "foil.key"
 
+// The key file is shared with the other Foil apps, which must be able to
+// decrypt it with the same password. The passphrase KDF cost is defined
+// by the export format, libfoil doesn't let us tune it.
+#define FOIL_KEY_FORMAT         FOIL_KEY_EXPORT_FORMAT_DEFAULT
+
 #define INFO_FILE               ".info"
+#define TEMP_SUFFIX             ".tmp"
+#define VAULT_FILE              ".vault"
+#define SNAPSHOT_FILE           ".snapshot"
+#define SNAPSHOT_VERSION_HEADER "Snapshot-Version"
+#define SNAPSHOT_VERSION        "1"
 #define INFO_CONTENTS           "FoilAuth"
 #define INFO_ORDER_HEADER       "Order"
 #define INFO_ORDER_DELIMITER    ','
@@ -99,11 +125,47 @@
 #define INFO_GROUPS_DELIMITER_S INFO_ORDER_DELIMITER_S
 #define INFO_GROUP_DELIMITER    ':'
 #define INFO_GROUP_DELIMITER_S  ":"
+#define INFO_FAVORITES_HEADER   "Favorites"
+
+// Passwords are stored as numbers, this one is never a valid password
+#define NO_PASSWORD             ((uint)-1)
+
+// Number of periods before and after the current one which are
+// searched by findPassword()
+#define DEFAULT_LOOKUP_WINDOW   1
+#define MAX_LOOKUP_WINDOW       10
+
+// With the vault, RSA is only used for wrapping the vault key. Token
+// edits are encrypted and authenticated with the symmetric vault key.
+// It's opt-in, turning it off exports the vault back into the files.
+#define DEFAULT_VAULT_ENABLED   false
+
+// Without the vault, the snapshot allows to skip decrypting the files
+// which haven't changed since the last time the info was saved. It's
+// just a cache, deleting it only makes the next unlock slower.
+#define DEFAULT_SNAPSHOT_ENABLED true
+
+// Bursts of changes are collapsed into a single write of the info,
+// which happens after a period of inactivity but no later than the
+// maximum delay after the first change (milliseconds)
+#define DEFAULT_SAVE_DELAY      1000
+#define DEFAULT_MAX_SAVE_DELAY  5000
+
+// Decrypted tokens are passed to the GUI thread in chunks limited
+// by both the size and the time (in milliseconds)
+#define MAX_PROGRESS_CHUNK      64
+#define MAX_PROGRESS_DELAY      100
+
+// Nice value of the background thread. It still gets its share of the
+// CPU time under load, which matters because the key is generated there
+// while the user is waiting.
+#define BACKGROUND_NICE         10
 
 // Model roles
 #define FOILAUTH_ROLES_(first,role,last) \
     first(ModelId,modelId) \
     role(GroupHeader,groupHeader) \
+    role(Pending,pending) \
     role(Hidden,hidden) \
     role(Favorite,favorite) \
     role(Type,type) \
@@ -113,6 +175,7 @@
     role(Algorithm,algorithm) \
     role(Counter,counter) \
     role(Timeshift,timeshift) \
+    role(Period,period) \
     role(Label,label) \
     role(PrevPassword,prevPassword) \
     role(CurrentPassword,currentPassword) \
@@ -130,6 +193,10 @@ private:
     Util();
 public:
     static const FoilMsgEncryptOptions* encryptionOptions(FoilMsgEncryptOptions*);
+    static const char* headerValue(const FoilMsgHeaders*, const char*);
+    static bool writeFile(const QString&, const FoilBytes*,
+        const FoilMsgHeaders*, FoilPrivateKey*, FoilKey*);
+    static void syncDir(const QString&);
 };
 
 const FoilMsgEncryptOptions*
@@ -142,6 +209,175 @@ FoilAuthModel::Util::encryptionOptions(
     return aOpt;
 }
 
+// Same as foilmsg_get_value() but doesn't need the whole FoilMsg
+const char*
+FoilAuthModel::Util::headerValue(
+    const FoilMsgHeaders* aHeaders,
+    const char* aName)
+{
+    for (guint i = 0; i < aHeaders->count; i++) {
+        const FoilMsgHeader* header = aHeaders->header + i;
+
+        if (!strcmp(header->name, aName)) {
+            return header->value;
+        }
+    }
+    return Q_NULLPTR;
+}
+
+// Writes the temporary file and then atomically replaces the old one,
+// so that there's always a complete file
+bool
+FoilAuthModel::Util::writeFile(
+    const QString& aPath,
+    const FoilBytes* aData,
+    const FoilMsgHeaders* aHeaders,
+    FoilPrivateKey* aPrivate,
+    FoilKey* aPublic)
+{
+    const QByteArray path(aPath.toUtf8());
+    const QByteArray tmpPath(path + TEMP_SUFFIX);
+    const char* fname = path.constData();
+    const char* tmpName = tmpPath.constData();
+    FoilOutput* out = foil_output_file_new_open(tmpName);
+    bool ok = false;
+
+    if (out) {
+        FoilMsgEncryptOptions opt;
+
+        HDEBUG("Saving" << fname);
+        const bool encrypted = foilmsg_encrypt(out, aData, Q_NULLPTR,
+            aHeaders, aPrivate, aPublic, encryptionOptions(&opt), Q_NULLPTR);
+        foil_output_unref(out);
+        if (encrypted) {
+            const int fd = open(tmpName, O_RDONLY);
+
+            if (chmod(tmpName, ENCRYPT_FILE_MODE) < 0) {
+                HWARN("Failed to chmod" << tmpName << strerror(errno));
+            }
+            if (fd >= 0) {
+                if (fsync(fd) < 0) {
+                    HWARN("Failed to sync" << tmpName << strerror(errno));
+                }
+                close(fd);
+            }
+            if (rename(tmpName, fname) < 0) {
+                HWARN("Failed to rename" << tmpName << strerror(errno));
+                unlink(tmpName);
+            } else {
+                syncDir(aPath);
+                ok = true;
+            }
+        } else {
+            HWARN("Failed to encrypt" << fname);
+            unlink(tmpName);
+        }
+    } else {
+        HWARN("Failed to open" << tmpName);
+    }
+    return ok;
+}
+
+// Makes the rename durable
+void
+FoilAuthModel::Util::syncDir(
+    const QString& aPath)
+{
+    const QByteArray dir(QFileInfo(aPath).absolutePath().toUtf8());
+    const int fd = open(dir.constData(), O_RDONLY | O_DIRECTORY);
+
+    if (fd >= 0) {
+        if (fsync(fd) < 0) {
+            HWARN("Failed to sync" << dir.constData() << strerror(errno));
+        }
+        close(fd);
+    } else {
+        HWARN("Failed to open" << dir.constData() << strerror(errno));
+    }
+}
+
+// ==========================================================================
+// FoilAuthModel::VaultRecord
+// ==========================================================================
+
+// Vault records contain the same headers as the individual files, each
+// one stored as a pair of NUL-terminated strings. An empty name marks
+// the end of the headers, the rest is the body.
+class FoilAuthModel::VaultRecord
+{
+public:
+    VaultRecord(const QByteArray&);
+
+    static QByteArray encode(const FoilMsgHeaders*, const QByteArray&);
+
+public:
+    bool iValid;
+    FoilMsgHeaders iHeaders;
+    QByteArray iBody;
+
+private:
+    Q_DISABLE_COPY(VaultRecord)
+    const QByteArray iData;
+    QVector<FoilMsgHeader> iHeader;
+};
+
+FoilAuthModel::VaultRecord::VaultRecord(
+    const QByteArray& aData) :
+    iValid(false),
+    iData(aData)
+{
+    const char* ptr = iData.constData();
+    const char* end = ptr + iData.size();
+
+    while (ptr < end) {
+        const char* name = ptr;
+        const char* nameEnd = (const char*)memchr(name, 0, end - name);
+
+        if (!nameEnd) {
+            break;
+        } else if (nameEnd == name) {
+            iBody = QByteArray(nameEnd + 1, end - nameEnd - 1);
+            iValid = true;
+            break;
+        } else {
+            const char* value = nameEnd + 1;
+            const char* valueEnd = (const char*)memchr(value, 0, end - value);
+
+            if (valueEnd) {
+                FoilMsgHeader header;
+
+                header.name = name;
+                header.value = value;
+                iHeader.append(header);
+                ptr = valueEnd + 1;
+            } else {
+                break;
+            }
+        }
+    }
+    iHeaders.header = iHeader.constData();
+    iHeaders.count = iHeader.count();
+}
+
+/* static */
+QByteArray
+FoilAuthModel::VaultRecord::encode(
+    const FoilMsgHeaders* aHeaders,
+    const QByteArray& aBody)
+{
+    QByteArray data;
+
+    for (guint i = 0; i < aHeaders->count; i++) {
+        const FoilMsgHeader* header = aHeaders->header + i;
+
+        data.append(header->name).append('\0');
+        data.append(header->value).append('\0');
+    }
+    data.append('\0');
+    data.append(aBody);
+    return data;
+}
+
 // ==========================================================================
 // FoilAuthModel::ModelData
 // ==========================================================================
@@ -168,18 +404,34 @@ public:
 
     ModelData(const QString&, const FoilAuthToken&, bool aFavorite = true);
     ModelData(const QString&, const QString&, bool aHidden = false);
+    explicit ModelData(const QString&);
 
     QVariant get(Role) const;
-    bool isGroupHeader() const { return !iToken.isValid(); }
+    QString password(uint) const;
+    void clearPasswords(QVector<int>*);
+    void setPasswords(quint64, uint, uint, uint, QVector<int>*);
+    void setPasswords(quint64, const QVector<uint>&, QVector<int>*);
+    bool setFarthestPassword(quint64, int, uint);
+    void rotatePasswords(quint64);
+    void setLookupWindow(int);
+    bool isWindowComplete() const;
+    bool canRotate() const;
+    QVector<uint> knownPasswords(int) const;
+    QVector<quint64> lookupKeys(int) const;
+    bool checkPassword(const QString&, int) const;
+    bool isTimeBased() const;
+    bool isGroupHeader() const { return !iToken.isValid() && !iPending; }
+    bool isToken() const { return iToken.isValid(); }
     const QString label() const;
     void setTokenPath(const QString&);
 
-    static AuthType headerAuthType(const FoilMsg*);
-    static DigestAlgorithm headerAlgorithm(const FoilMsg*);
-    static QString headerString(const FoilMsg*, const char*);
-    static quint64 headerUint64(const FoilMsg*, const char*, quint64);
-    static int headerInt(const FoilMsg*, const char*, int);
-    static bool headerBool(const FoilMsg*, const char*, bool);
+    static AuthType headerAuthType(const FoilMsgHeaders*);
+    static DigestAlgorithm headerAlgorithm(const FoilMsgHeaders*);
+    static QString headerString(const FoilMsgHeaders*, const char*);
+    static quint64 headerUint64(const FoilMsgHeaders*, const char*, quint64);
+    static int headerInt(const FoilMsgHeaders*, const char*, int);
+    static bool headerBool(const FoilMsgHeaders*, const char*, bool);
+    static FoilAuthToken headerToken(const FoilMsgHeaders*, const QByteArray&);
 
 public:
     QString iPath;
@@ -187,10 +439,16 @@ public:
     QString iGroupLabel;
     bool iHidden;
     bool iFavorite;
+    bool iPending; // Placeholder for the token being decrypted
     FoilAuthToken iToken;
-    QString iPrevPassword;
-    QString iCurrentPassword;
-    QString iNextPassword;
+    uint iPrevPassword;
+    uint iCurrentPassword;
+    uint iNextPassword;
+    quint64 iPasswordTime; // Start of the period passwords belong to
+    QVector<uint> iEarlierPasswords; // Before the previous one (-2, -3...)
+    QVector<uint> iLaterPasswords; // After the next one (+2, +3...)
+    QVector<quint64> iLookupKeys; // Currently in the lookup index
+    uint iSecretKey; // Currently in the secret index
 };
 
 FoilAuthModel::ModelData::ModelData(
@@ -201,7 +459,13 @@ FoilAuthModel::ModelData::ModelData(
     iId(QFileInfo(aPath).fileName()),
     iHidden(false),
     iFavorite(aFavorite),
-    iToken(aToken)
+    iPending(false),
+    iToken(aToken),
+    iPrevPassword(NO_PASSWORD),
+    iCurrentPassword(NO_PASSWORD),
+    iNextPassword(NO_PASSWORD),
+    iPasswordTime(0),
+    iSecretKey(0)
 {
     HDEBUG(iToken.secretBase32() << iToken.label());
 }
@@ -213,11 +477,33 @@ FoilAuthModel::ModelData::ModelData(
     iId(aId),
     iGroupLabel(aLabel),
     iHidden(aHidden),
-    iFavorite(false)
+    iFavorite(false),
+    iPending(false),
+    iPrevPassword(NO_PASSWORD),
+    iCurrentPassword(NO_PASSWORD),
+    iNextPassword(NO_PASSWORD),
+    iPasswordTime(0),
+    iSecretKey(0)
 {
     HDEBUG("Group" << aLabel);
 }
 
+// Holds the place of the token until it gets decrypted
+FoilAuthModel::ModelData::ModelData(
+    const QString& aPath) :
+    iPath(aPath),
+    iId(QFileInfo(aPath).fileName()),
+    iHidden(false),
+    iFavorite(false),
+    iPending(true),
+    iPrevPassword(NO_PASSWORD),
+    iCurrentPassword(NO_PASSWORD),
+    iNextPassword(NO_PASSWORD),
+    iPasswordTime(0),
+    iSecretKey(0)
+{
+}
+
 const QString
 FoilAuthModel::ModelData::label() const
 {
@@ -232,6 +518,216 @@ FoilAuthModel::ModelData::setTokenPath(
     iId = QFileInfo(aPath).fileName();
 }
 
+// Passwords are stored as numbers and only get converted to strings
+// when QML asks for them
+QString
+FoilAuthModel::ModelData::password(
+    uint aValue) const
+{
+    return (aValue == NO_PASSWORD) ? QString() : iToken.formatPassword(aValue);
+}
+
+// Stored numbers are only meaningful for the token which produced them,
+// they must not be formatted according to the new number of digits or
+// the new token type
+void
+FoilAuthModel::ModelData::clearPasswords(
+    QVector<int>* aRoles)
+{
+    iPrevPassword = iCurrentPassword = iNextPassword = NO_PASSWORD;
+    iPasswordTime = 0;
+    iEarlierPasswords.fill(NO_PASSWORD);
+    iLaterPasswords.fill(NO_PASSWORD);
+    aRoles->append(PrevPasswordRole);
+    aRoles->append(CurrentPasswordRole);
+    aRoles->append(NextPasswordRole);
+}
+
+// Results of the asynchronous tasks may arrive after the passwords have
+// already been rotated at the period boundary, those must not take the
+// passwords back in time
+void
+FoilAuthModel::ModelData::setPasswords(
+    quint64 aTime,
+    uint aPrev,
+    uint aCurrent,
+    uint aNext,
+    QVector<int>* aRoles)
+{
+    if (aTime >= iPasswordTime) {
+        if (aTime > iPasswordTime) {
+            // The rest of the window is no longer valid
+            iEarlierPasswords.fill(NO_PASSWORD);
+            iLaterPasswords.fill(NO_PASSWORD);
+            iPasswordTime = aTime;
+        }
+        if (iPrevPassword != aPrev) {
+            iPrevPassword = aPrev;
+            aRoles->append(PrevPasswordRole);
+        }
+        if (iCurrentPassword != aCurrent) {
+            iCurrentPassword = aCurrent;
+            aRoles->append(CurrentPasswordRole);
+        }
+        if (iNextPassword != aNext) {
+            iNextPassword = aNext;
+            aRoles->append(NextPasswordRole);
+        }
+    }
+}
+
+// The window is centered at the current password, i.e. it has
+// (2 * k + 1) passwords in it
+void
+FoilAuthModel::ModelData::setPasswords(
+    quint64 aTime,
+    const QVector<uint>& aWindow,
+    QVector<int>* aRoles)
+{
+    const int k = aWindow.count() / 2;
+    const uint* center = aWindow.constData() + k;
+
+    setPasswords(aTime, center[-1], center[0], center[1], aRoles);
+    if (iPasswordTime == aTime && iLaterPasswords.count() == k - 1) {
+        for (int i = 0; i < k - 1; i++) {
+            iEarlierPasswords[i] = center[-(i + 2)];
+            iLaterPasswords[i] = center[i + 2];
+        }
+    }
+}
+
+// Sets the password for the last period in the window (k > 0 periods
+// ahead), which is the only one unknown after rotation. Returns true
+// if it's the next password (the one being displayed) that got updated.
+bool
+FoilAuthModel::ModelData::setFarthestPassword(
+    quint64 aTime,
+    int aWindow,
+    uint aPassword)
+{
+    if (iPasswordTime == aTime && iLaterPasswords.count() == aWindow - 1) {
+        if (iLaterPasswords.isEmpty()) {
+            if (iNextPassword != aPassword) {
+                iNextPassword = aPassword;
+                return true;
+            }
+        } else {
+            iLaterPasswords.last() = aPassword;
+        }
+    }
+    return false;
+}
+
+// Moves everything one period back
+void
+FoilAuthModel::ModelData::rotatePasswords(
+    quint64 aTime)
+{
+    if (!iEarlierPasswords.isEmpty()) {
+        iEarlierPasswords.prepend(iPrevPassword);
+        iEarlierPasswords.removeLast();
+    }
+    iPrevPassword = iCurrentPassword;
+    iCurrentPassword = iNextPassword;
+    if (iLaterPasswords.isEmpty()) {
+        iNextPassword = NO_PASSWORD;
+    } else {
+        iNextPassword = iLaterPasswords.first();
+        iLaterPasswords.remove(0);
+        iLaterPasswords.append(NO_PASSWORD);
+    }
+    iPasswordTime = aTime;
+}
+
+// Previous, current and next passwords are always there, extra space
+// is only needed for windows wider than that
+void
+FoilAuthModel::ModelData::setLookupWindow(
+    int aWindow)
+{
+    const int extra = qMax(aWindow - 1, 0);
+
+    if (iLaterPasswords.count() != extra) {
+        iEarlierPasswords.fill(NO_PASSWORD, extra);
+        iLaterPasswords.fill(NO_PASSWORD, extra);
+    }
+}
+
+bool
+FoilAuthModel::ModelData::isWindowComplete() const
+{
+    return !iEarlierPasswords.contains(NO_PASSWORD) &&
+        !iLaterPasswords.contains(NO_PASSWORD);
+}
+
+bool
+FoilAuthModel::ModelData::canRotate() const
+{
+    return iNextPassword != NO_PASSWORD && isWindowComplete();
+}
+
+// Passwords within the window, in no particular order
+QVector<uint>
+FoilAuthModel::ModelData::knownPasswords(
+    int aWindow) const
+{
+    QVector<uint> values;
+
+    if (isToken()) {
+        values.append(iCurrentPassword);
+        if (aWindow > 0) {
+            values.append(iPrevPassword);
+            values.append(iNextPassword);
+            values += iEarlierPasswords;
+            values += iLaterPasswords;
+        }
+        values.removeAll(NO_PASSWORD);
+    }
+    return values;
+}
+
+QVector<quint64>
+FoilAuthModel::ModelData::lookupKeys(
+    int aWindow) const
+{
+    const QVector<uint> values(knownPasswords(aWindow));
+    QVector<quint64> keys;
+
+    keys.reserve(values.count());
+    for (int i = 0; i < values.count(); i++) {
+        const quint64 key = iToken.passwordKey(values.at(i));
+
+        if (!keys.contains(key)) {
+            keys.append(key);
+        }
+    }
+    return keys;
+}
+
+// Checks the entire window, without stopping at the first match
+bool
+FoilAuthModel::ModelData::checkPassword(
+    const QString& aCode,
+    int aWindow) const
+{
+    const QVector<uint> values(knownPasswords(aWindow));
+    bool match = false;
+
+    for (int i = 0; i < values.count(); i++) {
+        if (iToken.checkPassword(values.at(i), aCode)) {
+            match = true;
+        }
+    }
+    return match;
+}
+
+inline
+bool
+FoilAuthModel::ModelData::isTimeBased() const
+{
+    return isToken() && iToken.type() != FoilAuthTypes::AuthTypeHOTP;
+}
+
 QVariant
 FoilAuthModel::ModelData::get(
     Role aRole) const
@@ -239,6 +735,7 @@ FoilAuthModel::ModelData::get(
     switch (aRole) {
     case ModelIdRole: return iId;
     case GroupHeaderRole: return isGroupHeader();
+    case PendingRole: return iPending;
     case HiddenRole: return iHidden;
     case FavoriteRole: return iFavorite;
     case SecretRole: return iToken.secretBase32();
@@ -248,10 +745,11 @@ FoilAuthModel::ModelData::get(
     case AlgorithmRole: return (int)iToken.algorithm();
     case CounterRole: return iToken.counter();
     case TimeshiftRole: return iToken.timeshift();
+    case PeriodRole: return iToken.period();
     case LabelRole: return label();
-    case PrevPasswordRole: return iPrevPassword;
-    case CurrentPasswordRole: return iCurrentPassword;
-    case NextPasswordRole: return iNextPassword;
+    case PrevPasswordRole: return password(iPrevPassword);
+    case CurrentPasswordRole: return password(iCurrentPassword);
+    case NextPasswordRole: return password(iNextPassword);
     }
     return QVariant();
 }
@@ -259,13 +757,13 @@ FoilAuthModel::ModelData::get(
 /* static */
 FoilAuthTypes::AuthType
 FoilAuthModel::ModelData::headerAuthType(
-    const FoilMsg* aMsg)
+    const FoilMsgHeaders* aHeaders)
 {
-    const char* value = foilmsg_get_value(aMsg, HEADER_TYPE);
+    const char* value = Util::headerValue(aHeaders, HEADER_TYPE);
 
     if (value) {
         if (!g_ascii_strcasecmp(value, FOILAUTH_TYPE_TOTP)) {
-            return headerBool(aMsg, HEADER_STEAM, false) ?
+            return headerBool(aHeaders, HEADER_STEAM, false) ?
                 AuthTypeSteam : AuthTypeTOTP;
         } else if (!g_ascii_strcasecmp(value, FOILAUTH_TYPE_HOTP)) {
             return AuthTypeHOTP;
@@ -277,9 +775,9 @@ FoilAuthModel::ModelData::headerAuthType(
 /* static */
 FoilAuthTypes::DigestAlgorithm
 FoilAuthModel::ModelData::headerAlgorithm(
-    const FoilMsg* aMsg)
+    const FoilMsgHeaders* aHeaders)
 {
-    const char* value = foilmsg_get_value(aMsg, HEADER_ALGORITHM);
+    const char* value = Util::headerValue(aHeaders, HEADER_ALGORITHM);
 
     if (value) {
         if (!g_ascii_strcasecmp(value, FOILAUTH_ALGORITHM_SHA1)) {
@@ -296,21 +794,21 @@ FoilAuthModel::ModelData::headerAlgorithm(
 /* static */
 QString
 FoilAuthModel::ModelData::headerString(
-    const FoilMsg* aMsg,
+    const FoilMsgHeaders* aHeaders,
     const char* aKey)
 {
-    const char* value = foilmsg_get_value(aMsg, aKey);
+    const char* value = Util::headerValue(aHeaders, aKey);
     return (value && value[0]) ? QString::fromUtf8(value) : QString();
 }
 
 /* static */
 quint64
 FoilAuthModel::ModelData::headerUint64(
-    const FoilMsg* aMsg,
+    const FoilMsgHeaders* aHeaders,
     const char* aKey,
     quint64 aDefault)
 {
-    const char* str = foilmsg_get_value(aMsg, aKey);
+    const char* str = Util::headerValue(aHeaders, aKey);
     guint64 value = aDefault;
 
     gutil_parse_uint64(str, 10, &value);
@@ -320,11 +818,11 @@ FoilAuthModel::ModelData::headerUint64(
 /* static */
 int
 FoilAuthModel::ModelData::headerInt(
-    const FoilMsg* aMsg,
+    const FoilMsgHeaders* aHeaders,
     const char* aKey,
     int aDefault)
 {
-    const char* str = foilmsg_get_value(aMsg, aKey);
+    const char* str = Util::headerValue(aHeaders, aKey);
     int value = aDefault;
 
     gutil_parse_int(str, 10, &value);
@@ -334,16 +832,32 @@ FoilAuthModel::ModelData::headerInt(
 /* static */
 bool
 FoilAuthModel::ModelData::headerBool(
-    const FoilMsg* aMsg,
+    const FoilMsgHeaders* aHeaders,
     const char* aKey,
     bool aDefault)
 {
-    const char* str = foilmsg_get_value(aMsg, aKey);
+    const char* str = Util::headerValue(aHeaders, aKey);
     int value = 0;
 
     return gutil_parse_int(str, 10, &value) ? (value != 0) : aDefault;
 }
 
+/* static */
+FoilAuthToken
+FoilAuthModel::ModelData::headerToken(
+    const FoilMsgHeaders* aHeaders,
+    const QByteArray& aSecret)
+{
+    return FoilAuthToken(headerAuthType(aHeaders), aSecret,
+        headerString(aHeaders, HEADER_LABEL),
+        headerString(aHeaders, HEADER_ISSUER),
+        headerInt(aHeaders, HEADER_DIGITS, DEFAULT_DIGITS),
+        headerUint64(aHeaders, HEADER_COUNTER, DEFAULT_COUNTER),
+        headerInt(aHeaders, HEADER_TIMESHIFT, DEFAULT_TIMESHIFT),
+        headerAlgorithm(aHeaders),
+        headerInt(aHeaders, HEADER_PERIOD, DEFAULT_PERIOD));
+}
+
 // ==========================================================================
 // FoilNotesModel::ModelInfo
 // ==========================================================================
@@ -352,26 +866,39 @@ class FoilAuthModel::ModelInfo
 {
 public:
     ModelInfo() {}
-    ModelInfo(const FoilMsg*);
+    ModelInfo(const FoilMsgHeaders*);
     ModelInfo(const ModelInfo&);
     ModelInfo(const ModelData::List&);
 
     static ModelInfo load(const QString&, FoilPrivateKey*, FoilKey*);
+    static ModelInfo load(const FoilAuthVault*);
+    static ModelInfo fromRecord(const QByteArray&);
 
-    void save(const QString&, FoilPrivateKey*, FoilKey*);
+    QByteArray record() const;
+    bool save(const QString&, FoilPrivateKey*, FoilKey*);
+    bool save(FoilAuthVault*) const;
     ModelInfo& operator = (const ModelInfo&);
 
+private:
+    QByteArray orderHeader() const;
+    QByteArray groupsHeader() const;
+    QByteArray favoritesHeader() const;
+    void headers(FoilMsgHeaders*, FoilMsgHeader*, const QByteArray&,
+        const QByteArray&, const QByteArray&) const;
+
 public:
     QStringList iOrder;
     QHash<QString,QString> iGroups;
     QSet<QString> iHiddenGroups;
+    QSet<QString> iFavorites; // Known before the tokens are decrypted
 };
 
 FoilAuthModel::ModelInfo::ModelInfo(
     const ModelInfo& aInfo) :
     iOrder(aInfo.iOrder),
     iGroups(aInfo.iGroups),
-    iHiddenGroups(aInfo.iHiddenGroups)
+    iHiddenGroups(aInfo.iHiddenGroups),
+    iFavorites(aInfo.iFavorites)
 {}
 
 FoilAuthModel::ModelInfo::ModelInfo(
@@ -390,15 +917,17 @@ FoilAuthModel::ModelInfo::ModelInfo(
                 if (data->iHidden) {
                     iHiddenGroups.insert(data->iId);
                 }
+            } else if (data->iFavorite) {
+                iFavorites.insert(data->iId);
             }
         }
     }
 }
 
 FoilAuthModel::ModelInfo::ModelInfo(
-    const FoilMsg* aMsg)
+    const FoilMsgHeaders* aHeaders)
 {
-    const char* order = foilmsg_get_value(aMsg, INFO_ORDER_HEADER);
+    const char* order = Util::headerValue(aHeaders, INFO_ORDER_HEADER);
 
     if (order) {
         char** strv = g_strsplit(order, INFO_ORDER_DELIMITER_S, -1);
@@ -410,7 +939,7 @@ FoilAuthModel::ModelInfo::ModelInfo(
         g_strfreev(strv);
     }
 
-    const char* groups = foilmsg_get_value(aMsg, INFO_GROUPS_HEADER);
+    const char* groups = Util::headerValue(aHeaders, INFO_GROUPS_HEADER);
 
     if (groups) {
         char** strv = g_strsplit(groups, INFO_GROUPS_DELIMITER_S, -1);
@@ -436,6 +965,18 @@ FoilAuthModel::ModelInfo::ModelInfo(
         }
         g_strfreev(strv);
     }
+
+    const char* favorites = Util::headerValue(aHeaders, INFO_FAVORITES_HEADER);
+
+    if (favorites) {
+        char** strv = g_strsplit(favorites, INFO_ORDER_DELIMITER_S, -1);
+
+        HDEBUG(favorites);
+        for (char** ptr = strv; *ptr; ptr++) {
+            iFavorites.insert(g_strstrip(*ptr));
+        }
+        g_strfreev(strv);
+    }
 }
 
 FoilAuthModel::ModelInfo&
@@ -445,6 +986,7 @@ FoilAuthModel::ModelInfo::operator=(
     iOrder = aInfo.iOrder;
     iGroups = aInfo.iGroups;
     iHiddenGroups = aInfo.iHiddenGroups;
+    iFavorites = aInfo.iFavorites;
     return *this;
 }
 
@@ -465,7 +1007,7 @@ FoilAuthModel::ModelInfo::load(
 
     if (aMsg) {
         if (foilmsg_verify(aMsg, aPublic)) {
-            info = ModelInfo(aMsg);
+            info = ModelInfo(&aMsg->headers);
         } else {
             HWARN("Could not verify" << fname);
         }
@@ -474,105 +1016,543 @@ FoilAuthModel::ModelInfo::load(
     return info;
 }
 
-void
-FoilAuthModel::ModelInfo::save(
-    const QString& aDir,
-    FoilPrivateKey* aPrivate,
-    FoilKey* aPublic)
+/* static */
+FoilAuthModel::ModelInfo
+FoilAuthModel::ModelInfo::load(
+    const FoilAuthVault* aVault)
 {
-    const QString fullPath(aDir + "/" INFO_FILE);
-    const QByteArray path(fullPath.toUtf8());
-    const char* fname = path.constData();
-    FoilOutput* out = foil_output_file_new_open(fname);
+    return fromRecord(aVault->read(INFO_FILE));
+}
 
-    if (out) {
-        QString buf;
-        const int n = iOrder.count();
+/* static */
+FoilAuthModel::ModelInfo
+FoilAuthModel::ModelInfo::fromRecord(
+    const QByteArray& aRecord)
+{
+    const VaultRecord record(aRecord);
 
-        for (int i = 0; i < n; i++) {
-            if (!buf.isEmpty()) buf += QChar(INFO_ORDER_DELIMITER);
-            buf += iOrder.at(i);
-        }
+    return record.iValid ? ModelInfo(&record.iHeaders) : ModelInfo();
+}
 
-        FoilMsgHeaders headers;
-        FoilMsgHeader header[2];
-        const QByteArray order(buf.toUtf8());
-        QByteArray groups;
+QByteArray
+FoilAuthModel::ModelInfo::orderHeader() const
+{
+    QString buf;
+    const int n = iOrder.count();
 
-        HDEBUG("Saving" << fname);
-        headers.header = header;
-        headers.count = 0;
+    for (int i = 0; i < n; i++) {
+        if (!buf.isEmpty()) buf += QChar(INFO_ORDER_DELIMITER);
+        buf += iOrder.at(i);
+    }
+    return buf.toUtf8();
+}
 
-        HDEBUG(INFO_ORDER_HEADER ":" << order.constData());
-        header[headers.count].name = INFO_ORDER_HEADER;
-        header[headers.count].value = order.constData();
-        headers.count++;
+QByteArray
+FoilAuthModel::ModelInfo::groupsHeader() const
+{
+    QString buf, groupBuf;
+    QHashIterator<QString,QString> it(iGroups);
 
-        if (!iGroups.isEmpty()) {
-            QString groupBuf;
+    while (it.hasNext()) {
+        it.next();
 
-            buf.resize(0);
-            QHashIterator<QString,QString> it(iGroups);
-            while (it.hasNext()) {
-                it.next();
+        const QString id(it.key());
 
-                const QString id(it.key());
+        groupBuf.resize(0);
+        groupBuf.append(id).
+            append(QChar(INFO_GROUP_DELIMITER)).
+            append(it.value().toUtf8().toHex()).
+            append(QChar(INFO_GROUP_DELIMITER)).
+            append(iHiddenGroups.contains(id) ?
+            QChar('0') : QChar('1'));
 
-                groupBuf.resize(0);
-                groupBuf.append(id).
-                    append(QChar(INFO_GROUP_DELIMITER)).
-                    append(it.value().toUtf8().toHex()).
-                    append(QChar(INFO_GROUP_DELIMITER)).
-                    append(iHiddenGroups.contains(id) ?
-                    QChar('0') : QChar('1'));
+        if (!buf.isEmpty()) buf += QChar(INFO_GROUPS_DELIMITER);
+        buf += groupBuf;
+    }
+    return buf.toUtf8();
+}
 
-                if (!buf.isEmpty()) buf += QChar(INFO_GROUPS_DELIMITER);
-                buf += groupBuf;
-            }
+QByteArray
+FoilAuthModel::ModelInfo::favoritesHeader() const
+{
+    QString buf;
+    QSetIterator<QString> it(iFavorites);
 
-            groups = buf.toUtf8();
-            HDEBUG(INFO_GROUPS_HEADER ":" << groups.constData());
-            header[headers.count].name = INFO_GROUPS_HEADER;
-            header[headers.count].value = groups.constData();
-            headers.count++;
-        }
+    while (it.hasNext()) {
+        if (!buf.isEmpty()) buf += QChar(INFO_ORDER_DELIMITER);
+        buf += it.next();
+    }
+    return buf.toUtf8();
+}
 
-        FoilBytes data;
-        FoilMsgEncryptOptions opt;
+// The header array must have room for 3 headers
+void
+FoilAuthModel::ModelInfo::headers(
+    FoilMsgHeaders* aHeaders,
+    FoilMsgHeader* aHeader,
+    const QByteArray& aOrder,
+    const QByteArray& aGroups,
+    const QByteArray& aFavorites) const
+{
+    aHeaders->header = aHeader;
+    aHeaders->count = 0;
+
+    HDEBUG(INFO_ORDER_HEADER ":" << aOrder.constData());
+    aHeader[aHeaders->count].name = INFO_ORDER_HEADER;
+    aHeader[aHeaders->count].value = aOrder.constData();
+    aHeaders->count++;
+
+    if (!iGroups.isEmpty()) {
+        HDEBUG(INFO_GROUPS_HEADER ":" << aGroups.constData());
+        aHeader[aHeaders->count].name = INFO_GROUPS_HEADER;
+        aHeader[aHeaders->count].value = aGroups.constData();
+        aHeaders->count++;
+    }
 
-        foil_bytes_from_string(&data, INFO_CONTENTS);
-        foilmsg_encrypt(out, &data, Q_NULLPTR, &headers, aPrivate, aPublic,
-            Util::encryptionOptions(&opt), Q_NULLPTR);
-        foil_output_unref(out);
-        if (chmod(fname, ENCRYPT_FILE_MODE) < 0) {
-            HWARN("Failed to chmod" << fname << strerror(errno));
-        }
-    } else {
-        HWARN("Failed to open" << fname);
+    if (!iFavorites.isEmpty()) {
+        HDEBUG(INFO_FAVORITES_HEADER ":" << aFavorites.constData());
+        aHeader[aHeaders->count].name = INFO_FAVORITES_HEADER;
+        aHeader[aHeaders->count].value = aFavorites.constData();
+        aHeaders->count++;
     }
 }
 
+bool
+FoilAuthModel::ModelInfo::save(
+    const QString& aDir,
+    FoilPrivateKey* aPrivate,
+    FoilKey* aPublic)
+{
+    const QByteArray order(orderHeader());
+    const QByteArray groups(groupsHeader());
+    const QByteArray favorites(favoritesHeader());
+    FoilMsgHeaders msgHeaders;
+    FoilMsgHeader header[3];
+    FoilBytes data;
+
+    headers(&msgHeaders, header, order, groups, favorites);
+    foil_bytes_from_string(&data, INFO_CONTENTS);
+    return Util::writeFile(aDir + "/" INFO_FILE, &data, &msgHeaders,
+        aPrivate, aPublic);
+}
+
+// The info in the vault record format
+QByteArray
+FoilAuthModel::ModelInfo::record() const
+{
+    const QByteArray order(orderHeader());
+    const QByteArray groups(groupsHeader());
+    const QByteArray favorites(favoritesHeader());
+    FoilMsgHeaders msgHeaders;
+    FoilMsgHeader header[3];
+
+    headers(&msgHeaders, header, order, groups, favorites);
+    return VaultRecord::encode(&msgHeaders, QByteArray(INFO_CONTENTS));
+}
+
+bool
+FoilAuthModel::ModelInfo::save(
+    FoilAuthVault* aVault) const
+{
+    HDEBUG("Saving" << INFO_FILE);
+    return aVault->write(INFO_FILE, record());
+}
+
 // ==========================================================================
-// FoilAuthModel::BaseTask
+// FoilAuthModel::Snapshot
 // ==========================================================================
 
-class FoilAuthModel::BaseTask :
-    public HarbourTask,
-    public FoilAuthTypes
+// The snapshot holds the decoded contents of the data directory (the info
+// and the tokens in the vault record format) so that all of it can be
+// loaded with a single decryption. Each entry remembers the size and the
+// modification time of the file it has been taken from, and is only used
+// as long as the file stays the same.
+class FoilAuthModel::Snapshot
 {
-    Q_OBJECT
-
 public:
-    BaseTask(QThreadPool*, FoilPrivateKey*, FoilKey*);
-    virtual ~BaseTask();
+    class Entry {
+    public:
+        Entry() : iSize(-1), iTime(0) {}
+        Entry(const QFileInfo&, const QByteArray&);
 
-    FoilMsg* decryptAndVerify(const QString&) const;
-    FoilMsg* decryptAndVerify(const char*) const;
+        bool matches(const QFileInfo&) const;
 
-    static bool removeFile(const QString&);
+    public:
+        qint64 iSize;
+        qint64 iTime; // Milliseconds since epoch
+        QByteArray iRecord;
+    };
 
-public:
-    FoilPrivateKey* iPrivateKey;
+    Snapshot() {}
+    Snapshot(const QByteArray&);
+
+    static Snapshot load(const QString&, FoilPrivateKey*, FoilKey*);
+
+    bool save(const QString&, FoilPrivateKey*, FoilKey*) const;
+    void add(const QString&, const QByteArray&);
+    QByteArray take(const QFileInfo&);
+
+#define DELIMITED_TAG(x) (((x) << HarbourProtoBuf::TYPE_SHIFT) | HarbourProtoBuf::TYPE_DELIMITED)
+#define VARINT_TAG(x) (((x) << HarbourProtoBuf::TYPE_SHIFT) | HarbourProtoBuf::TYPE_VARINT)
+
+    static const uchar ENTRY_TAG = DELIMITED_TAG(1);
+    static const uchar NAME_TAG = DELIMITED_TAG(1);
+    static const uchar SIZE_TAG = VARINT_TAG(2);
+    static const uchar TIME_TAG = VARINT_TAG(3);
+    static const uchar RECORD_TAG = DELIMITED_TAG(4);
+
+#undef DELIMITED_TAG
+#undef VARINT_TAG
+
+public:
+    QHash<QString,Entry> iEntries; // File name => entry
+};
+
+FoilAuthModel::Snapshot::Entry::Entry(
+    const QFileInfo& aFile,
+    const QByteArray& aRecord) :
+    iSize(aFile.size()),
+    iTime(aFile.lastModified().toMSecsSinceEpoch()),
+    iRecord(aRecord)
+{}
+
+bool
+FoilAuthModel::Snapshot::Entry::matches(
+    const QFileInfo& aFile) const
+{
+    return aFile.isFile() && aFile.size() == iSize &&
+        aFile.lastModified().toMSecsSinceEpoch() == iTime;
+}
+
+FoilAuthModel::Snapshot::Snapshot(
+    const QByteArray& aData)
+{
+    GUtilRange pos;
+    GUtilData payload;
+    quint64 tag;
+
+    pos.ptr = (const guint8*)aData.constData();
+    pos.end = pos.ptr + aData.size();
+    while (HarbourProtoBuf::parseVarInt(&pos, &tag) && tag == ENTRY_TAG &&
+        HarbourProtoBuf::parseDelimitedValue(&pos, &payload)) {
+        GUtilRange entryPos;
+        QString name;
+        Entry entry;
+        quint64 value;
+        bool ok = true;
+
+        entryPos.ptr = payload.bytes;
+        entryPos.end = payload.bytes + payload.size;
+        while (ok && HarbourProtoBuf::parseVarInt(&entryPos, &tag)) {
+            switch (tag) {
+            case NAME_TAG:
+                if ((ok = HarbourProtoBuf::parseDelimitedValue(&entryPos,
+                    &payload))) {
+                    name = QString::fromUtf8((const char*)payload.bytes,
+                        payload.size);
+                }
+                break;
+            case SIZE_TAG:
+                if ((ok = HarbourProtoBuf::parseVarInt(&entryPos, &value))) {
+                    entry.iSize = (qint64)value;
+                }
+                break;
+            case TIME_TAG:
+                if ((ok = HarbourProtoBuf::parseVarInt(&entryPos, &value))) {
+                    entry.iTime = (qint64)value;
+                }
+                break;
+            case RECORD_TAG:
+                if ((ok = HarbourProtoBuf::parseDelimitedValue(&entryPos,
+                    &payload))) {
+                    entry.iRecord = QByteArray((const char*)payload.bytes,
+                        payload.size);
+                }
+                break;
+            default:
+                HWARN("Unexpected snapshot tag" << tag);
+                ok = false;
+                break;
+            }
+        }
+        if (ok && !name.isEmpty() && !entry.iRecord.isEmpty()) {
+            iEntries.insert(name, entry);
+        }
+    }
+}
+
+/* static */
+FoilAuthModel::Snapshot
+FoilAuthModel::Snapshot::load(
+    const QString& aPath,
+    FoilPrivateKey* aPrivate,
+    FoilKey* aPublic)
+{
+    Snapshot snapshot;
+
+    if (QFile::exists(aPath)) {
+        const QByteArray path(aPath.toUtf8());
+        const char* fname = path.constData();
+
+        HDEBUG("Loading" << fname);
+        FoilMsg* msg = foilmsg_decrypt_file(aPrivate, fname, Q_NULLPTR);
+
+        if (msg) {
+            const char* version = foilmsg_get_value(msg,
+                SNAPSHOT_VERSION_HEADER);
+
+            if (!foilmsg_verify(msg, aPublic)) {
+                HWARN("Could not verify" << fname);
+            } else if (g_strcmp0(version, SNAPSHOT_VERSION)) {
+                HWARN("Unsupported snapshot version" << version);
+            } else {
+                QByteArray data(FoilAuth::toByteArray(msg->data));
+
+                snapshot = Snapshot(data);
+                data.fill(0);
+                HDEBUG(snapshot.iEntries.count() << "entries");
+            }
+            foilmsg_free(msg);
+        }
+    }
+    return snapshot;
+}
+
+bool
+FoilAuthModel::Snapshot::save(
+    const QString& aPath,
+    FoilPrivateKey* aPrivate,
+    FoilKey* aPublic) const
+{
+    QByteArray data;
+    QHashIterator<QString,Entry> it(iEntries);
+
+    while (it.hasNext()) {
+        it.next();
+        const Entry& entry = it.value();
+        QByteArray payload;
+
+        HarbourProtoBuf::appendDelimitedKeyValue(&payload, NAME_TAG,
+            it.key().toUtf8());
+        HarbourProtoBuf::appendVarIntKeyValue(&payload, SIZE_TAG,
+            (quint64)entry.iSize);
+        HarbourProtoBuf::appendVarIntKeyValue(&payload, TIME_TAG,
+            (quint64)entry.iTime);
+        HarbourProtoBuf::appendDelimitedKeyValue(&payload, RECORD_TAG,
+            entry.iRecord);
+        HarbourProtoBuf::appendDelimitedKeyValue(&data, ENTRY_TAG, payload);
+        payload.fill(0);
+    }
+
+    FoilMsgHeaders headers;
+    FoilMsgHeader header;
+    FoilBytes bytes;
+
+    header.name = SNAPSHOT_VERSION_HEADER;
+    header.value = SNAPSHOT_VERSION;
+    headers.header = &header;
+    headers.count = 1;
+    bytes.val = (const guint8*)data.constData();
+    bytes.len = data.size();
+
+    const bool ok = Util::writeFile(aPath, &bytes, &headers,
+        aPrivate, aPublic);
+
+    data.fill(0);
+    return ok;
+}
+
+// Files which don't exist don't get into the snapshot
+void
+FoilAuthModel::Snapshot::add(
+    const QString& aPath,
+    const QByteArray& aRecord)
+{
+    const QFileInfo file(aPath);
+
+    if (file.isFile()) {
+        iEntries.insert(file.fileName(), Entry(file, aRecord));
+    }
+}
+
+// Returns an empty array if the file has changed since the snapshot
+// has been taken (or is not in the snapshot at all)
+QByteArray
+FoilAuthModel::Snapshot::take(
+    const QFileInfo& aFile)
+{
+    const Entry entry(iEntries.take(aFile.fileName()));
+
+    return entry.matches(aFile) ? entry.iRecord : QByteArray();
+}
+
+// ==========================================================================
+// FoilAuthModel::Scheduler
+// ==========================================================================
+
+// Tasks run in separate lanes, so that the expensive ones don't hold back
+// the cheap ones. The crypto lane runs one task at a time in the order of
+// submission, which guarantees that the files of the same token are never
+// written, saved or deleted out of order. The CPU lane calculates the
+// passwords in parallel, the results are matched against the current
+// state of the token when they arrive. The background lane generates
+// the keys at a lower thread priority.
+class FoilAuthModel::Scheduler :
+    public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Lane {
+        CpuLane,
+        CryptoLane,
+        BackgroundLane,
+        LaneCount
+    };
+
+    Scheduler(QObject*);
+
+    QThreadPool* pool(Lane) const;
+    int queueDepth(Lane) const;
+    void submit(Lane, HarbourTask*, QObject* aTarget = Q_NULLPTR,
+        const char* aSlot = Q_NULLPTR);
+    void waitForDone();
+
+private Q_SLOTS:
+    void onTaskDestroyed(QObject*);
+
+private:
+    static const char* const gLaneNames[LaneCount];
+
+    // Sets the nice value of the thread it runs on. QThread priorities
+    // have no effect under SCHED_OTHER (except IdlePriority which may
+    // starve the thread) but Linux applies nice values per thread.
+    class ThreadNice : public QRunnable {
+    public:
+        ThreadNice(int aNice) : iNice(aNice) {}
+        void run() Q_DECL_OVERRIDE
+            { setpriority(PRIO_PROCESS, syscall(SYS_gettid), iNice); }
+
+    private:
+        const int iNice;
+    };
+
+private:
+    QThreadPool* iPool[LaneCount];
+    mutable QMutex iMutex;
+    QSet<QObject*> iTasks[LaneCount]; // Submitted and not yet deleted
+};
+
+const char* const FoilAuthModel::Scheduler::gLaneNames[] = {
+    "cpu", "crypto", "background"
+};
+
+FoilAuthModel::Scheduler::Scheduler(
+    QObject* aParent) :
+    QObject(aParent)
+{
+    for (int i = 0; i < LaneCount; i++) {
+        iPool[i] = new QThreadPool(this);
+    }
+
+    // Password calculations don't depend on each other
+    iPool[CpuLane]->setMaxThreadCount(QThread::idealThreadCount());
+
+    // Serialize the file operations
+    iPool[CryptoLane]->setMaxThreadCount(1);
+
+    // The background thread never expires, so it keeps its priority
+    iPool[BackgroundLane]->setMaxThreadCount(1);
+    iPool[BackgroundLane]->setExpiryTimeout(-1);
+    iPool[BackgroundLane]->start(new ThreadNice(BACKGROUND_NICE));
+}
+
+QThreadPool*
+FoilAuthModel::Scheduler::pool(
+    Lane aLane) const
+{
+    return iPool[aLane];
+}
+
+// Number of tasks submitted to the lane which are either waiting for
+// their turn, running or waiting for their results to be picked up
+int
+FoilAuthModel::Scheduler::queueDepth(
+    Lane aLane) const
+{
+    QMutexLocker lock(&iMutex);
+
+    return iTasks[aLane].count();
+}
+
+// The task must have been created for this lane's pool
+void
+FoilAuthModel::Scheduler::submit(
+    Lane aLane,
+    HarbourTask* aTask,
+    QObject* aTarget,
+    const char* aSlot)
+{
+    iMutex.lock();
+    iTasks[aLane].insert(aTask);
+    iMutex.unlock();
+
+    // The task may get deleted on a worker thread
+    connect(aTask, SIGNAL(destroyed(QObject*)),
+        SLOT(onTaskDestroyed(QObject*)), Qt::DirectConnection);
+    if (aTarget) {
+        aTask->submit(aTarget, aSlot);
+    } else {
+        aTask->submit();
+    }
+    HDEBUG(gLaneNames[aLane] << "queue depth" << queueDepth(aLane));
+}
+
+// May be invoked on any thread
+void
+FoilAuthModel::Scheduler::onTaskDestroyed(
+    QObject* aTask)
+{
+    QMutexLocker lock(&iMutex);
+
+    // The pointer is only used as a key, the object is being destroyed
+    for (int i = 0; i < LaneCount; i++) {
+        if (iTasks[i].remove(aTask)) {
+            HDEBUG(gLaneNames[i] << "queue depth" << iTasks[i].count());
+            break;
+        }
+    }
+}
+
+void
+FoilAuthModel::Scheduler::waitForDone()
+{
+    for (int i = 0; i < LaneCount; i++) {
+        iPool[i]->waitForDone();
+    }
+}
+
+// ==========================================================================
+// FoilAuthModel::BaseTask
+// ==========================================================================
+
+class FoilAuthModel::BaseTask :
+    public HarbourTask,
+    public FoilAuthTypes
+{
+    Q_OBJECT
+
+public:
+    BaseTask(QThreadPool*, FoilPrivateKey*, FoilKey*);
+    virtual ~BaseTask();
+
+    FoilMsg* decryptAndVerify(const QString&) const;
+    FoilMsg* decryptAndVerify(const char*) const;
+
+    static bool removeFile(const QString&);
+
+public:
+    FoilPrivateKey* iPrivateKey;
     FoilKey* iPublicKey;
 };
 
@@ -689,7 +1669,7 @@ FoilAuthModel::GenerateKeyTask::performTask()
         FoilOutput* out = foil_output_file_new_open(path.constData());
         FoilPrivateKey* pk = FOIL_PRIVATE_KEY(key);
 
-        if (foil_private_key_encrypt(pk, out, FOIL_KEY_EXPORT_FORMAT_DEFAULT,
+        if (foil_private_key_encrypt(pk, out, FOIL_KEY_FORMAT,
             passphrase.constData(), Q_NULLPTR, &error)) {
             iPrivateKey = pk;
             iPublicKey = foil_public_key_new_from_private(pk);
@@ -704,185 +1684,505 @@ FoilAuthModel::GenerateKeyTask::performTask()
 }
 
 // ==========================================================================
-// FoilAuthModel::EncryptTask
+// FoilAuthModel::KeyTask
 // ==========================================================================
 
-class FoilAuthModel::EncryptTask :
+// Everything that involves the passphrase KDF. The key file is read
+// once, and probed without the password (which is cheap) before it's
+// decrypted with one.
+class FoilAuthModel::KeyTask :
     public BaseTask
 {
     Q_OBJECT
 
 public:
-    EncryptTask(QThreadPool*, const ModelData*, FoilPrivateKey*, FoilKey*,
-        quint64, const QString&);
+    enum Action {
+        ProbeKey,
+        Unlock,
+        CheckPassword,
+        ChangePassword
+    };
+
+    KeyTask(QThreadPool*, Action, const QString&, const QString& aPassword =
+        QString(), const QString& aNewPassword = QString());
+
+    static FoilState decryptKey(const QString&, const QString*,
+        FoilPrivateKey**);
+    static bool encryptKey(const QString&, FoilPrivateKey*, const QString&);
 
     void performTask() Q_DECL_OVERRIDE;
 
 public:
-    const QString iId;
-    const bool iFavorite;
-    const FoilAuthToken iToken;
-    const QString iDestDir;
-    const QString iRemoveFile;
-    const quint64 iTime;
-    QString iNewFile;
-    QString iPrevPassword;
-    QString iCurrentPassword;
-    QString iNextPassword;
+    const Action iAction;
+    const QString iKeyFile;
+    const QString iPassword;
+    const QString iNewPassword;
+    FoilState iKeyState;
+    bool iPasswordOk;
+    bool iPasswordChanged;
 };
 
-FoilAuthModel::EncryptTask::EncryptTask(
+FoilAuthModel::KeyTask::KeyTask(
     QThreadPool* aPool,
-    const ModelData* aData,
-    FoilPrivateKey* aPrivateKey,
-    FoilKey* aPublicKey,
-    quint64 aTime,
-    const QString& aDestDir) :
-    BaseTask(aPool, aPrivateKey, aPublicKey),
-    iId(aData->iId),
-    iFavorite(aData->iFavorite),
-    iToken(aData->iToken),
-    iDestDir(aDestDir),
-    iRemoveFile(aData->iPath),
-    iTime(aTime)
-{
-    HDEBUG("Encrypting" << iToken.label());
-}
+    Action aAction,
+    const QString& aKeyFile,
+    const QString& aPassword,
+    const QString& aNewPassword) :
+    BaseTask(aPool, Q_NULLPTR, Q_NULLPTR),
+    iAction(aAction),
+    iKeyFile(aKeyFile),
+    iPassword(aPassword),
+    iNewPassword(aNewPassword),
+    iKeyState(FoilKeyMissing),
+    iPasswordOk(false),
+    iPasswordChanged(false)
+{}
 
-void
-FoilAuthModel::EncryptTask::performTask()
+// Returns FoilLocked if the key is encrypted, and the decrypted key if
+// the password is given and correct. The caller unrefs the key.
+/* static */
+FoilAuthModel::FoilState
+FoilAuthModel::KeyTask::decryptKey(
+    const QString& aKeyFile,
+    const QString* aPassword,
+    FoilPrivateKey** aKey)
 {
-    GString* dest = g_string_sized_new(iDestDir.size() + 9);
-    FoilOutput* out = FoilAuth::createFoilFile(iDestDir, dest);
-
-    if (out) {
-        FoilMsgHeaders headers;
-        FoilMsgHeader header[MAX_HEADERS];
-
-        headers.header = header;
-        headers.count = 0;
-
-        if (iToken.type() != DEFAULT_AUTH_TYPE) {
-            const guint authTypeHeaderIndex = headers.count++;
-
-            header[authTypeHeaderIndex].name = HEADER_TYPE;
-            header[authTypeHeaderIndex].value = FOILAUTH_TYPE_DEFAULT;
-            switch (iToken.type()) {
-            case AuthTypeSteam:
-                header[headers.count].name = HEADER_STEAM;
-                header[headers.count].value = "1";
-                headers.count++;
-                // fallthrough
-            case AuthTypeTOTP:
-                header[authTypeHeaderIndex].value = FOILAUTH_TYPE_TOTP;
-                break;
-            case AuthTypeHOTP:
-                header[authTypeHeaderIndex].value = FOILAUTH_TYPE_HOTP;
-                break;
-            }
-        }
+    QFile file(aKeyFile);
 
-        const QByteArray label(iToken.label().toUtf8());
-
-        header[headers.count].name = HEADER_LABEL;
-        header[headers.count].value = label.constData();
-        headers.count++;
-
-        QByteArray issuer;
+    *aKey = Q_NULLPTR;
+    if (!file.open(QIODevice::ReadOnly)) {
+        HDEBUG("No key" << qPrintable(aKeyFile));
+        return FoilKeyMissing;
+    }
 
-        if (!iToken.issuer().isEmpty()) {
-            issuer = iToken.issuer().toUtf8();
-            header[headers.count].name = HEADER_ISSUER;
-            header[headers.count].value = issuer.constData();
-            headers.count++;
+    const QByteArray data(file.readAll());
+    GError* error = Q_NULLPTR;
+    FoilPrivateKey* key;
+
+    file.close();
+    if (aPassword) {
+        const QByteArray password(aPassword->toUtf8());
+        QElapsedTimer timer;
+
+        // This is where the time goes
+        timer.start();
+        key = foil_private_key_decrypt_from_data(FOIL_KEY_RSA_PRIVATE,
+            data.constData(), data.size(), password.constData(), Q_NULLPTR);
+        HDEBUG("Decryption took" << timer.elapsed() << "ms");
+        if (key) {
+            HDEBUG("Password OK");
+            *aKey = key;
+            return FoilLocked;
         }
+    }
 
-        if (iFavorite) {
-            header[headers.count].name = HEADER_FAVORITE;
-            header[headers.count].value = "1";
-            headers.count++;
+    // Figure out what's wrong. Without the password, there's no key
+    // derivation and the encrypted key gets rejected right away.
+    key = foil_private_key_decrypt_from_data(FOIL_KEY_RSA_PRIVATE,
+        data.constData(), data.size(), Q_NULLPTR, &error);
+    if (key) {
+        HWARN("Key not encrypted");
+        foil_private_key_unref(key);
+        return FoilKeyNotEncrypted;
+    } else if (error->domain == FOIL_ERROR &&
+        error->code == FOIL_ERROR_KEY_ENCRYPTED) {
+        if (aPassword) {
+            HDEBUG("Wrong password");
+        } else {
+            HDEBUG("Key encrypted");
         }
+        g_error_free(error);
+        return FoilLocked;
+    } else {
+        HWARN("Key invalid:" << error->message);
+        g_error_free(error);
+        return FoilKeyInvalid;
+    }
+}
 
-        char digits[16];
-        snprintf(digits, sizeof(digits), "%d", iToken.digits());
-        header[headers.count].name = HEADER_DIGITS;
-        header[headers.count].value = digits;
-        headers.count++;
-
-        char timeshift[16];
-        if (iToken.timeshift() != DEFAULT_TIMESHIFT) {
-            snprintf(timeshift, sizeof(timeshift), "%d", iToken.timeshift());
-            header[headers.count].name = HEADER_TIMESHIFT;
-            header[headers.count].value = timeshift;
-            headers.count++;
-        }
+// Writes the temporary file and then replaces the old one with it
+/* static */
+bool
+FoilAuthModel::KeyTask::encryptKey(
+    const QString& aKeyFile,
+    FoilPrivateKey* aKey,
+    const QString& aPassword)
+{
+    GError* error = Q_NULLPTR;
+    const QByteArray password(aPassword.toUtf8());
+    const QString tmpKeyFile(aKeyFile + ".new");
+    const QByteArray tmp(tmpKeyFile.toUtf8());
+    FoilOutput* out = foil_output_file_new_open(tmp.constData());
 
-        char counter[16];
-        if (iToken.counter() != DEFAULT_COUNTER) {
-            snprintf(counter, sizeof(counter), "%llu", iToken.counter());
-            header[headers.count].name = HEADER_COUNTER;
-            header[headers.count].value = counter;
-            headers.count++;
-        }
+    if (foil_private_key_encrypt(aKey, out, FOIL_KEY_FORMAT,
+        password.constData(), Q_NULLPTR, &error) && foil_output_flush(out)) {
+        const QString saveKeyFile(aKeyFile + ".save");
 
-        if (iToken.algorithm() != DEFAULT_ALGORITHM) {
-            header[headers.count].name = HEADER_ALGORITHM;
-            header[headers.count].value = FOILAUTH_ALGORITHM_DEFAULT;
-            switch (iToken.algorithm()) {
-            case DigestAlgorithmSHA1:
-                header[headers.count].value = FOILAUTH_ALGORITHM_SHA1;
-                break;
-            case DigestAlgorithmSHA256:
-                header[headers.count].value = FOILAUTH_ALGORITHM_SHA256;
-                break;
-            case DigestAlgorithmSHA512:
-                header[headers.count].value = FOILAUTH_ALGORITHM_SHA512;
-                break;
-            }
-            headers.count++;
+        foil_output_unref(out);
+        QFile::remove(saveKeyFile);
+        if (QFile::rename(aKeyFile, saveKeyFile) &&
+            QFile::rename(tmpKeyFile, aKeyFile)) {
+            BaseTask::removeFile(saveKeyFile);
+            HDEBUG("Password changed");
+            return true;
         }
-
-        HASSERT(headers.count <= G_N_ELEMENTS(header));
-        HDEBUG("Writing" << iToken);
-
-        const QByteArray secret(iToken.secret());
-        FoilBytes body;
-
-        body.val = (guint8*)secret.constData();
-        body.len = secret.length();
-
-        FoilMsgEncryptOptions opt;
-        if (foilmsg_encrypt(out, &body, Q_NULLPTR, &headers,
-            iPrivateKey, iPublicKey, Util::encryptionOptions(&opt),
-            Q_NULLPTR)) {
-            iNewFile = QString::fromLocal8Bit(dest->str, dest->len);
-            removeFile(iRemoveFile);
-            foil_output_unref(out);
-            if (chmod(dest->str, ENCRYPT_FILE_MODE) < 0) {
-                HWARN("Failed to chmod" << dest->str << strerror(errno));
-            }
-        } else {
-            foil_output_unref(out);
-            unlink(dest->str);
+    } else {
+        if (error) {
+            HWARN(error->message);
+            g_error_free(error);
         }
+        foil_output_unref(out);
+    }
+    return false;
+}
 
-        if ((iTime || iToken.type() == FoilAuth::AuthTypeHOTP) && !isCanceled()) {
-            iCurrentPassword = iToken.passwordString(iTime);
-            if (iToken.type() == FoilAuth::AuthTypeHOTP) {
-                iPrevPassword = iNextPassword = iCurrentPassword;
+void
+FoilAuthModel::KeyTask::performTask()
+{
+    if (!isCanceled()) {
+        FoilPrivateKey* key = Q_NULLPTR;
+
+        iKeyState = decryptKey(iKeyFile, (iAction == ProbeKey) ? Q_NULLPTR :
+            &iPassword, &key);
+        if (key) {
+            iPasswordOk = true;
+            if (iAction == Unlock) {
+                // BaseTask unrefs the keys
+                iPrivateKey = key;
+                iPublicKey = foil_public_key_new_from_private(key);
             } else {
-                iPrevPassword = iToken.passwordString(iTime - FoilAuth::PERIOD);
-                iNextPassword = iToken.passwordString(iTime + FoilAuth::PERIOD);
+                // Don't touch the key file if the user has backed out
+                if (iAction == ChangePassword && !isCanceled()) {
+                    iPasswordChanged = encryptKey(iKeyFile, key,
+                        iNewPassword);
+                }
+                foil_private_key_unref(key);
             }
-            HDEBUG(qPrintable(iPrevPassword) << qPrintable(iCurrentPassword) <<
-                qPrintable(iNextPassword));
         }
     }
-    g_string_free(dest, TRUE);
 }
 
 // ==========================================================================
-// FoilAuthModel::PasswordTask
+// FoilAuthModel::TokenHeaders
+// ==========================================================================
+
+// Headers describing the token. They point to the buffers owned by
+// this object, which is why it's not copyable.
+class FoilAuthModel::TokenHeaders :
+    public FoilAuthTypes
+{
+public:
+    TokenHeaders(const FoilAuthToken&, bool);
+
+public:
+    FoilMsgHeaders iHeaders;
+
+private:
+    Q_DISABLE_COPY(TokenHeaders)
+    FoilMsgHeader iHeader[MAX_HEADERS];
+    QByteArray iLabel;
+    QByteArray iIssuer;
+    char iDigits[16];
+    char iTimeshift[16];
+    char iPeriod[16];
+    char iCounter[16];
+};
+
+FoilAuthModel::TokenHeaders::TokenHeaders(
+    const FoilAuthToken& aToken,
+    bool aFavorite) :
+    iLabel(aToken.label().toUtf8())
+{
+    FoilMsgHeader* header = iHeader;
+
+    iHeaders.header = header;
+    iHeaders.count = 0;
+
+    if (aToken.type() != DEFAULT_AUTH_TYPE) {
+        const guint authTypeHeaderIndex = iHeaders.count++;
+
+        header[authTypeHeaderIndex].name = HEADER_TYPE;
+        header[authTypeHeaderIndex].value = FOILAUTH_TYPE_DEFAULT;
+        switch (aToken.type()) {
+        case AuthTypeSteam:
+            header[iHeaders.count].name = HEADER_STEAM;
+            header[iHeaders.count].value = "1";
+            iHeaders.count++;
+            // fallthrough
+        case AuthTypeTOTP:
+            header[authTypeHeaderIndex].value = FOILAUTH_TYPE_TOTP;
+            break;
+        case AuthTypeHOTP:
+            header[authTypeHeaderIndex].value = FOILAUTH_TYPE_HOTP;
+            break;
+        }
+    }
+
+    header[iHeaders.count].name = HEADER_LABEL;
+    header[iHeaders.count].value = iLabel.constData();
+    iHeaders.count++;
+
+    if (!aToken.issuer().isEmpty()) {
+        iIssuer = aToken.issuer().toUtf8();
+        header[iHeaders.count].name = HEADER_ISSUER;
+        header[iHeaders.count].value = iIssuer.constData();
+        iHeaders.count++;
+    }
+
+    if (aFavorite) {
+        header[iHeaders.count].name = HEADER_FAVORITE;
+        header[iHeaders.count].value = "1";
+        iHeaders.count++;
+    }
+
+    snprintf(iDigits, sizeof(iDigits), "%d", aToken.digits());
+    header[iHeaders.count].name = HEADER_DIGITS;
+    header[iHeaders.count].value = iDigits;
+    iHeaders.count++;
+
+    if (aToken.timeshift() != DEFAULT_TIMESHIFT) {
+        snprintf(iTimeshift, sizeof(iTimeshift), "%d", aToken.timeshift());
+        header[iHeaders.count].name = HEADER_TIMESHIFT;
+        header[iHeaders.count].value = iTimeshift;
+        iHeaders.count++;
+    }
+
+    if (aToken.period() != DEFAULT_PERIOD &&
+        aToken.type() != AuthTypeHOTP) {
+        snprintf(iPeriod, sizeof(iPeriod), "%d", aToken.period());
+        header[iHeaders.count].name = HEADER_PERIOD;
+        header[iHeaders.count].value = iPeriod;
+        iHeaders.count++;
+    }
+
+    if (aToken.counter() != DEFAULT_COUNTER) {
+        snprintf(iCounter, sizeof(iCounter), "%llu", aToken.counter());
+        header[iHeaders.count].name = HEADER_COUNTER;
+        header[iHeaders.count].value = iCounter;
+        iHeaders.count++;
+    }
+
+    if (aToken.algorithm() != DEFAULT_ALGORITHM) {
+        header[iHeaders.count].name = HEADER_ALGORITHM;
+        header[iHeaders.count].value = FOILAUTH_ALGORITHM_DEFAULT;
+        switch (aToken.algorithm()) {
+        case DigestAlgorithmSHA1:
+            header[iHeaders.count].value = FOILAUTH_ALGORITHM_SHA1;
+            break;
+        case DigestAlgorithmSHA256:
+            header[iHeaders.count].value = FOILAUTH_ALGORITHM_SHA256;
+            break;
+        case DigestAlgorithmSHA512:
+            header[iHeaders.count].value = FOILAUTH_ALGORITHM_SHA512;
+            break;
+        }
+        iHeaders.count++;
+    }
+
+    HASSERT(iHeaders.count <= G_N_ELEMENTS(iHeader));
+}
+
+// ==========================================================================
+// FoilAuthModel::EncryptTask
+// ==========================================================================
+
+class FoilAuthModel::EncryptTask :
+    public BaseTask
+{
+    Q_OBJECT
+
+public:
+    // The file currently holding the token, shared by the tasks writing
+    // the same token. Each task replaces the file written by the previous
+    // one. Only touched by the tasks, which run one at a time.
+    class Target : public QSharedData {
+    public:
+        typedef QExplicitlySharedDataPointer<Target> Ptr;
+
+        Target(const QString& aPath) : iPath(aPath) {}
+
+    public:
+        QString iPath;
+    };
+
+    EncryptTask(QThreadPool*, const ModelData*, FoilPrivateKey*, FoilKey*,
+        quint64, const QString&, FoilAuthVault*, Target*);
+
+    void performTask() Q_DECL_OVERRIDE;
+    bool encryptToFile(const TokenHeaders&, const QByteArray&);
+    bool encryptToVault(const TokenHeaders&, const QByteArray&);
+    bool supersede(const ModelData*, quint64);
+    bool discard();
+
+public:
+    const QString iId;
+    const QString iDestDir;
+    const FoilAuthVault::Ptr iVault;
+    const Target::Ptr iTarget;
+    QString iModelId; // Follows the token when the previous task renames it
+    QMutex iMutex;
+    bool iStarted;
+    bool iDiscarded;
+    // The state to write may be replaced until the task starts
+    bool iFavorite;
+    FoilAuthToken iToken;
+    quint64 iTime;
+    QString iNewFile;
+    uint iPrevPassword;
+    uint iCurrentPassword;
+    uint iNextPassword;
+};
+
+FoilAuthModel::EncryptTask::EncryptTask(
+    QThreadPool* aPool,
+    const ModelData* aData,
+    FoilPrivateKey* aPrivateKey,
+    FoilKey* aPublicKey,
+    quint64 aTime,
+    const QString& aDestDir,
+    FoilAuthVault* aVault,
+    Target* aTarget) :
+    BaseTask(aPool, aPrivateKey, aPublicKey),
+    iId(aData->iId),
+    iDestDir(aDestDir),
+    iVault(aVault),
+    iTarget(aTarget),
+    iModelId(aData->iId),
+    iStarted(false),
+    iDiscarded(false),
+    iFavorite(aData->iFavorite),
+    iToken(aData->iToken),
+    iTime(aTime),
+    iPrevPassword(NO_PASSWORD),
+    iCurrentPassword(NO_PASSWORD),
+    iNextPassword(NO_PASSWORD)
+{
+    HDEBUG("Encrypting" << iToken.label());
+}
+
+// Called on the main thread. Replaces the state to be written, unless
+// it's too late for that.
+bool
+FoilAuthModel::EncryptTask::supersede(
+    const ModelData* aData,
+    quint64 aTime)
+{
+    QMutexLocker lock(&iMutex);
+
+    if (!iStarted) {
+        iFavorite = aData->iFavorite;
+        iToken = aData->iToken;
+        iTime = aTime;
+        return true;
+    }
+    return false;
+}
+
+// Called on the main thread. The token has been deleted, there's no
+// need to write it unless it's already being written.
+bool
+FoilAuthModel::EncryptTask::discard()
+{
+    QMutexLocker lock(&iMutex);
+
+    if (!iStarted) {
+        iDiscarded = true;
+        return true;
+    }
+    return false;
+}
+
+bool
+FoilAuthModel::EncryptTask::encryptToFile(
+    const TokenHeaders& aHeaders,
+    const QByteArray& aSecret)
+{
+    GString* dest = g_string_sized_new(iDestDir.size() + 9);
+    FoilOutput* out = FoilAuth::createFoilFile(iDestDir, dest);
+    bool ok = false;
+
+    if (out) {
+        FoilBytes body;
+
+        body.val = (guint8*)aSecret.constData();
+        body.len = aSecret.length();
+
+        FoilMsgEncryptOptions opt;
+        if (foilmsg_encrypt(out, &body, Q_NULLPTR, &aHeaders.iHeaders,
+            iPrivateKey, iPublicKey, Util::encryptionOptions(&opt),
+            Q_NULLPTR)) {
+            iNewFile = QString::fromLocal8Bit(dest->str, dest->len);
+            removeFile(iTarget->iPath);
+            iTarget->iPath = iNewFile;
+            foil_output_unref(out);
+            if (chmod(dest->str, ENCRYPT_FILE_MODE) < 0) {
+                HWARN("Failed to chmod" << dest->str << strerror(errno));
+            }
+        } else {
+            foil_output_unref(out);
+            unlink(dest->str);
+        }
+        ok = true;
+    }
+    g_string_free(dest, TRUE);
+    return ok;
+}
+
+// The record keeps its id, there's no need to generate a new one
+bool
+FoilAuthModel::EncryptTask::encryptToVault(
+    const TokenHeaders& aHeaders,
+    const QByteArray& aSecret)
+{
+    if (iVault->write(iId, VaultRecord::encode(&aHeaders.iHeaders,
+        aSecret))) {
+        iNewFile = iDestDir + "/" + iId;
+        // The token may still have a file (e.g. if it has been added
+        // before the vault was opened)
+        if (QFile::exists(iTarget->iPath)) {
+            removeFile(iTarget->iPath);
+        }
+        iTarget->iPath = iNewFile;
+    }
+    return true;
+}
+
+void
+FoilAuthModel::EncryptTask::performTask()
+{
+    // The state can't be replaced once the task has started
+    iMutex.lock();
+    iStarted = true;
+    iMutex.unlock();
+
+    if (iDiscarded) {
+        HDEBUG("Discarded" << iToken);
+        return;
+    }
+
+    const TokenHeaders headers(iToken, iFavorite);
+    const QByteArray secret(iToken.secret());
+
+    HDEBUG("Writing" << iToken);
+    if (iVault ? encryptToVault(headers, secret) :
+        encryptToFile(headers, secret)) {
+        if ((iTime || iToken.type() == FoilAuth::AuthTypeHOTP) && !isCanceled()) {
+            const quint64 t = iToken.periodStart(iTime);
+
+            iCurrentPassword = iToken.passwordValue(t);
+            if (iToken.type() == FoilAuth::AuthTypeHOTP) {
+                iPrevPassword = iNextPassword = iCurrentPassword;
+            } else {
+                iPrevPassword = iToken.passwordValue(t - iToken.period());
+                iNextPassword = iToken.passwordValue(t + iToken.period());
+            }
+            HDEBUG(iPrevPassword << iCurrentPassword << iNextPassword);
+        }
+    }
+}
+
+// ==========================================================================
+// FoilAuthModel::PasswordTask
 // ==========================================================================
 
 class FoilAuthModel::PasswordTask :
@@ -899,9 +2199,9 @@ public:
     const QString iId;
     const FoilAuthToken iToken;
     const quint64 iTime;
-    QString iPrevPassword;
-    QString iCurrentPassword;
-    QString iNextPassword;
+    uint iPrevPassword;
+    uint iCurrentPassword;
+    uint iNextPassword;
 };
 
 FoilAuthModel::PasswordTask::PasswordTask(
@@ -911,7 +2211,10 @@ FoilAuthModel::PasswordTask::PasswordTask(
     HarbourTask(aPool),
     iId(aData->iId),
     iToken(aData->iToken),
-    iTime(aTime)
+    iTime(aTime),
+    iPrevPassword(NO_PASSWORD),
+    iCurrentPassword(NO_PASSWORD),
+    iNextPassword(NO_PASSWORD)
 {
     HDEBUG("Updating" << iToken.label());
 }
@@ -919,963 +2222,2810 @@ FoilAuthModel::PasswordTask::PasswordTask(
 void
 FoilAuthModel::PasswordTask::performTask()
 {
-    iCurrentPassword = iToken.passwordString(iTime);
-    iPrevPassword = iToken.passwordString(iTime - FoilAuth::PERIOD);
-    iNextPassword = iToken.passwordString(iTime + FoilAuth::PERIOD);
-    HDEBUG(iToken.label() << qPrintable(iPrevPassword) <<
-        qPrintable(iCurrentPassword) << qPrintable(iNextPassword));
+    const quint64 t = iToken.periodStart(iTime);
+
+    iCurrentPassword = iToken.passwordValue(t);
+    iPrevPassword = iToken.passwordValue(t - iToken.period());
+    iNextPassword = iToken.passwordValue(t + iToken.period());
+    HDEBUG(iToken.label() << iPrevPassword << iCurrentPassword <<
+        iNextPassword);
 }
 
 // ==========================================================================
-// FoilNotesModel::SaveInfoTask
+// FoilAuthModel::PasswordBatchTask
+//
+// Calculates passwords for many tokens at once. At the period boundary
+// only the farthest password in the window needs to be calculated, the
+// rest is rotated in place. The results are stored in the same order as
+// the input, the row numbers recorded at the time of submission are used
+// as a hint when the results are applied to the model.
 // ==========================================================================
 
-class FoilAuthModel::SaveInfoTask :
-    public BaseTask
+class FoilAuthModel::PasswordBatchTask :
+    public HarbourTask
 {
     Q_OBJECT
 
 public:
-    SaveInfoTask(QThreadPool*, const ModelData::List&, const QString&,
-        FoilPrivateKey*, FoilKey*);
+    class Entry {
+    public:
+        Entry() : iRow(-1), iTime(0), iWindow(1), iFarthestOnly(false) {}
+        Entry(int aRow, const ModelData* aData, quint64 aTime, int aWindow,
+            bool aFarthestOnly) : iRow(aRow), iId(aData->iId),
+            iToken(aData->iToken), iTime(iToken.periodStart(aTime)),
+            iWindow(qMax(aWindow, 1)), iFarthestOnly(aFarthestOnly) {}
+
+    public:
+        int iRow;
+        QString iId;
+        FoilAuthToken iToken;
+        quint64 iTime; // Period start
+        int iWindow; // At least 1 (previous, current and next)
+        bool iFarthestOnly;
+        QVector<uint> iPasswords; // From -iWindow to +iWindow
+    };
+
+    PasswordBatchTask(QThreadPool*, const QVector<Entry>&);
 
     void performTask() Q_DECL_OVERRIDE;
 
 public:
-    ModelInfo iInfo;
-    QString iFoilDir;
+    QVector<Entry> iEntries;
 };
 
-FoilAuthModel::SaveInfoTask::SaveInfoTask(
+FoilAuthModel::PasswordBatchTask::PasswordBatchTask(
     QThreadPool* aPool,
-    const ModelData::List& aData,
-    const QString& aFoilDir,
-    FoilPrivateKey* aPrivateKey,
-    FoilKey* aPublicKey) :
-    BaseTask(aPool, aPrivateKey, aPublicKey),
-    iInfo(aData),
-    iFoilDir(aFoilDir)
-{}
+    const QVector<Entry>& aEntries) :
+    HarbourTask(aPool),
+    iEntries(aEntries)
+{
+    HDEBUG(iEntries.count() << "token(s)");
+}
 
 void
-FoilAuthModel::SaveInfoTask::performTask()
+FoilAuthModel::PasswordBatchTask::performTask()
 {
+    const int n = iEntries.count();
+    Entry* entries = iEntries.data();
+    QVector<FoilAuthHmac::Key> keys;
+    QVector<FoilAuthHmac::Lane> lanes;
+    int i;
+
+    // One lane per token at rollover, the whole window otherwise
+    keys.reserve(n);
+    lanes.reserve(3 * n);
+    for (i = 0; i < n && !isCanceled(); i++) {
+        const Entry* e = entries + i;
+        const FoilAuthToken& token = e->iToken;
+        const int k = e->iWindow;
+        const int first = e->iFarthestOnly ? k : -k;
+        const qint64 p = token.period();
+
+        keys.append(token.hmacKey());
+
+        const FoilAuthHmac::Key* key = keys.constData() + i;
+
+        for (int j = first; j <= k; j++) {
+            lanes.append(FoilAuthHmac::Lane(key,
+                token.hashInput(e->iTime + j * p)));
+        }
+    }
+
     if (!isCanceled()) {
-        if (iInfo.iOrder.isEmpty()) {
-            removeFile(iFoilDir + "/" INFO_FILE);
+        const FoilAuthHmac::Lane* lane = lanes.constData();
+
+        FoilAuthHmac::hash(lanes.data(), lanes.count());
+        for (i = 0; i < n; i++) {
+            Entry* e = entries + i;
+            const int count = e->iFarthestOnly ? 1 : (2 * e->iWindow + 1);
+
+            e->iPasswords.resize(count);
+            for (int j = 0; j < count; j++) {
+                e->iPasswords[j] = e->iToken.passwordValueFromHash((lane++)->iHash);
+            }
+        }
+    }
+}
+
+// ==========================================================================
+// FoilAuthModel::DeleteTask
+// ==========================================================================
+
+class FoilAuthModel::DeleteTask :
+    public HarbourTask
+{
+    Q_OBJECT
+
+public:
+    DeleteTask(QThreadPool*, const ModelData::List&,
+        const QList<EncryptTask::Target::Ptr>&, FoilAuthVault*);
+
+    void performTask() Q_DECL_OVERRIDE;
+
+public:
+    QStringList iIds;
+    QList<EncryptTask::Target::Ptr> iTargets;
+    const FoilAuthVault::Ptr iVault;
+};
+
+FoilAuthModel::DeleteTask::DeleteTask(
+    QThreadPool* aPool,
+    const ModelData::List& aData,
+    const QList<EncryptTask::Target::Ptr>& aTargets,
+    FoilAuthVault* aVault) :
+    HarbourTask(aPool),
+    iTargets(aTargets),
+    iVault(aVault)
+{
+    const int n = aData.count();
+
+    iIds.reserve(n);
+    for (int i = 0; i < n; i++) {
+        iIds.append(aData.at(i)->iId);
+    }
+}
+
+// Runs even if released, otherwise the tokens would come back
+void
+FoilAuthModel::DeleteTask::performTask()
+{
+    const int n = iIds.count();
+
+    HDEBUG("Deleting" << n << "token(s)");
+    for (int i = 0; i < n; i++) {
+        // The file may have been replaced since the task was created
+        const QString path(iTargets.at(i)->iPath);
+
+        if (iVault) {
+            // The token may still have its own file
+            iVault->remove(iIds.at(i));
+            if (QFile::exists(path)) {
+                BaseTask::removeFile(path);
+            }
         } else {
-            iInfo.save(iFoilDir, iPrivateKey, iPublicKey);
+            BaseTask::removeFile(path);
         }
     }
 }
 
 // ==========================================================================
-// FoilAuthModel::DecryptAllTask
+// FoilAuthModel::ImportTask
 // ==========================================================================
 
-class FoilAuthModel::DecryptAllTask :
+// Writes a batch of new tokens under the ids reserved by the model. Each
+// token is written exactly once, progress is reported in chunks.
+class FoilAuthModel::ImportTask :
     public BaseTask
 {
     Q_OBJECT
 
 public:
-    // The purpose of this class is to make sure that ModelData doesn't
-    // get lost in transit when we asynchronously post the results from
-    // DecryptAllTask to FoilAuthModel.
-    //
-    // If the signal successfully reaches the slot, the receiver zeros
-    // iModelData which stops ModelData from being deallocated by the
-    // Progress destructor. If the signal never reaches the slot, then
-    // ModelData is deallocated together with when the last reference
-    // to Progress
-    class Progress : public QSharedData {
+    class Entry {
     public:
-        typedef QExplicitlySharedDataPointer<Progress> Ptr;
-
-        Progress(ModelData* aModelData, DecryptAllTask* aTask, bool aFront = false) :
-            iModelData(aModelData), iTask(aTask), iFront(aFront) {}
-        ~Progress() { delete iModelData; }
+        Entry() : iFavorite(false) {}
+        Entry(const ModelData* aData) : iId(aData->iId),
+            iPath(aData->iPath), iToken(aData->iToken),
+            iFavorite(aData->iFavorite) {}
 
     public:
-        ModelData* iModelData;
-        DecryptAllTask* iTask;
-        const bool iFront;
+        QString iId;
+        QString iPath;
+        FoilAuthToken iToken;
+        bool iFavorite;
     };
 
-    DecryptAllTask(QThreadPool*, const QString, FoilPrivateKey*, FoilKey*);
+    ImportTask(QThreadPool*, const ModelData::List&, FoilPrivateKey*,
+        FoilKey*, FoilAuthVault*);
 
     void performTask() Q_DECL_OVERRIDE;
-
-    bool decryptToken(const QString, bool, bool aFront = false);
+    bool writeFile(const Entry&) const;
+    void flushProgress(QHash<QString,QByteArray>*, QStringList*);
 
 Q_SIGNALS:
-    void progress(DecryptAllTask::Progress::Ptr);
+    void progress(int);
 
 public:
-    const QString iDir;
-    bool iSaveInfo;
-    quint64 iTaskTime;
+    const FoilAuthVault::Ptr iVault;
+    QVector<Entry> iEntries;
+    QStringList iFailedIds;
+    int iReported; // Updated on the main thread
 };
 
-Q_DECLARE_METATYPE(FoilAuthModel::DecryptAllTask::Progress::Ptr)
-
-FoilAuthModel::DecryptAllTask::DecryptAllTask(
+FoilAuthModel::ImportTask::ImportTask(
     QThreadPool* aPool,
-    const QString aDir,
+    const ModelData::List& aData,
     FoilPrivateKey* aPrivateKey,
-    FoilKey* aPublicKey) :
+    FoilKey* aPublicKey,
+    FoilAuthVault* aVault) :
     BaseTask(aPool, aPrivateKey, aPublicKey),
-    iDir(aDir),
-    iSaveInfo(false),
-    iTaskTime(0)
+    iVault(aVault),
+    iReported(0)
 {
+    const int n = aData.count();
+
+    iEntries.reserve(n);
+    for (int i = 0; i < n; i++) {
+        iEntries.append(Entry(aData.at(i)));
+    }
+    HDEBUG(n << "token(s)");
 }
 
+// The name has been reserved by the model, the file doesn't exist yet
 bool
-FoilAuthModel::DecryptAllTask::decryptToken(
-    const QString aPath,
-    bool aHidden,
-    bool aFront)
+FoilAuthModel::ImportTask::writeFile(
+    const Entry& aEntry) const
 {
+    const TokenHeaders headers(aEntry.iToken, aEntry.iFavorite);
+    const QByteArray secret(aEntry.iToken.secret());
+    const QByteArray path(aEntry.iPath.toLocal8Bit());
+    const char* fname = path.constData();
+    FoilOutput* out = foil_output_file_new_open(fname);
     bool ok = false;
-    FoilMsg* aMsg = decryptAndVerify(aPath);
-
-    if (aMsg) {
-        const QByteArray bytes(FoilAuth::toByteArray(aMsg->data));
 
-        if (bytes.length() > 0) {
-            const FoilAuthToken token(ModelData::headerAuthType(aMsg), bytes,
-                ModelData::headerString(aMsg, HEADER_LABEL),
-                ModelData::headerString(aMsg, HEADER_ISSUER),
-                ModelData::headerInt(aMsg, HEADER_DIGITS, DEFAULT_DIGITS),
-                ModelData::headerUint64(aMsg, HEADER_COUNTER, DEFAULT_COUNTER),
-                ModelData::headerInt(aMsg, HEADER_TIMESHIFT, DEFAULT_TIMESHIFT),
-                ModelData::headerAlgorithm(aMsg));
-            ModelData* data = new ModelData(aPath, token,
-                ModelData::headerBool(aMsg, HEADER_FAVORITE, false));
-
-            // Calculate current passwords while we are on it
-            data->iCurrentPassword = data->iToken.passwordString(iTaskTime);
-            data->iPrevPassword = data->iToken.passwordString(iTaskTime - FoilAuth::PERIOD);
-            data->iNextPassword = data->iToken.passwordString(iTaskTime + FoilAuth::PERIOD);
-
-            HDEBUG("Loaded secret from" << qPrintable(aPath));
-            data->iHidden = aHidden;
+    if (out) {
+        FoilBytes body;
+        FoilMsgEncryptOptions opt;
 
-            // The Progress takes ownership of ModelData
-            Q_EMIT progress(Progress::Ptr(new Progress(data, this, aFront)));
-            ok = true;
+        body.val = (guint8*)secret.constData();
+        body.len = secret.length();
+        ok = foilmsg_encrypt(out, &body, Q_NULLPTR, &headers.iHeaders,
+            iPrivateKey, iPublicKey, Util::encryptionOptions(&opt),
+            Q_NULLPTR);
+        foil_output_unref(out);
+        if (!ok) {
+            HWARN("Failed to encrypt" << fname);
+            unlink(fname);
+        } else if (chmod(fname, ENCRYPT_FILE_MODE) < 0) {
+            HWARN("Failed to chmod" << fname << strerror(errno));
         }
-        foilmsg_free(aMsg);
+    } else {
+        HWARN("Failed to open" << fname);
     }
     return ok;
 }
 
 void
-FoilAuthModel::DecryptAllTask::performTask()
+FoilAuthModel::ImportTask::flushProgress(
+    QHash<QString,QByteArray>* aRecords,
+    QStringList* aIds)
 {
-    if (!isCanceled()) {
-        const QString path(iDir);
-        HDEBUG("Checking" << iDir);
-
-        // Record time
-        iTaskTime = QDateTime::currentDateTime().toTime_t();
-
-        QDir dir(path);
-        QFileInfoList list = dir.entryInfoList(QDir::Files |
-            QDir::Dirs | QDir::NoDotAndDotDot, QDir::NoSort);
+    if (!aIds->isEmpty()) {
+        // Vault records of the whole chunk are appended in one go
+        if (iVault && !iVault->writeAll(*aRecords)) {
+            iFailedIds.append(*aIds);
+        }
+        HDEBUG(aIds->count() << "token(s) written");
+        Q_EMIT progress(aIds->count());
+        aRecords->clear();
+        aIds->clear();
+    }
+}
 
-        // Restore the order and create the groups
-        const ModelInfo info(ModelInfo::load(iDir, iPrivateKey, iPublicKey));
-        const QString infoFile(INFO_FILE);
-        QHash<QString,QString> fileMap;
+// Runs even if released, the tokens are already in the info file
+void
+FoilAuthModel::ImportTask::performTask()
+{
+    const int n = iEntries.count();
+    QHash<QString,QByteArray> records;
+    QStringList chunk;
+    QElapsedTimer timer;
 
-        bool hidden = false;
-        int i;
+    timer.start();
+    for (int i = 0; i < n; i++) {
+        const Entry& e = iEntries.at(i);
 
-        for (i = 0; i < list.count(); i++) {
-            const QFileInfo& file = list.at(i);
-            if (file.isFile()) {
-                const QString name(file.fileName());
-                if (name != infoFile) {
-                    fileMap.insert(name, file.filePath());
-                }
-            }
-        }
+        if (iVault) {
+            const TokenHeaders headers(e.iToken, e.iFavorite);
 
-        // First decrypt files in known order
-        for (i = 0; i < info.iOrder.count() && !isCanceled(); i++) {
-            const QString id(info.iOrder.at(i));
-            if (info.iGroups.contains(id)) {
-                // This is a group
-                hidden = info.iHiddenGroups.contains(id);
-                // The Progress takes ownership of ModelData
-                Q_EMIT progress(Progress::Ptr(new Progress(new ModelData(id,
-                    info.iGroups.value(id), hidden), this)));
-            } else if (fileMap.contains(id)) {
-                // This is a file
-                if (!decryptToken(fileMap.take(id), hidden)) {
-                    // Broken or missing file
-                    HDEBUG(qPrintable(id) << "oops!");
-                    iSaveInfo = true;
-                }
-            } else {
-                // Broken order or something
-                HDEBUG(qPrintable(id) << "is missing");
-                iSaveInfo = true;
-            }
+            records.insert(e.iId, VaultRecord::encode(&headers.iHeaders,
+                e.iToken.secret()));
+        } else if (!writeFile(e)) {
+            iFailedIds.append(e.iId);
         }
-
-        // Followed by the remaining files in no particular order
-        if (!fileMap.isEmpty()) {
-            const QStringList remainingFiles = fileMap.values();
-            HDEBUG("Remaining file(s)" << remainingFiles);
-            for (i = 0; i < remainingFiles.count() && !isCanceled(); i++) {
-                if (!decryptToken(remainingFiles.at(i), false, true)) {
-                    HDEBUG(remainingFiles.at(i) << "was not expected");
-                    iSaveInfo = true;
-                }
-            }
+        chunk.append(e.iId);
+        if (chunk.count() >= MAX_PROGRESS_CHUNK ||
+            timer.elapsed() >= MAX_PROGRESS_DELAY) {
+            flushProgress(&records, &chunk);
+            timer.restart();
         }
     }
+    flushProgress(&records, &chunk);
 }
 
 // ==========================================================================
-// FoilAuthModel::Private
+// FoilNotesModel::SaveInfoTask
 // ==========================================================================
 
-// s(SignalName,signalName)
-#define FOIL_QUEUED_SIGNALS(s) \
-    s(Count,count) \
-    s(Busy,busy) \
-    s(KeyAvailable,keyAvailable) \
-    s(TimerActive,timerActive) \
-    s(GroupHeaderRows,groupHeaderRows) \
-    s(FoilState,foilState) \
-    s(TimeLeft,timeLeft)
+class FoilAuthModel::SaveInfoTask :
+    public BaseTask
+{
+    Q_OBJECT
 
-enum FoilAuthModelSignal {
-    #define FOIL_SIGNAL_ENUM_(Name,name) Signal##Name##Changed,
-    FOIL_QUEUED_SIGNALS(FOIL_SIGNAL_ENUM_)
-    #undef FOIL_SIGNAL_ENUM_
-    FoilAuthModelSignalCount
+public:
+    SaveInfoTask(QThreadPool*, const ModelData::List&, const QString&,
+        FoilPrivateKey*, FoilKey*, FoilAuthVault*);
+
+    void performTask() Q_DECL_OVERRIDE;
+    void saveSnapshot(const QString&);
+
+public:
+    ModelInfo iInfo;
+    QString iFoilDir;
+    const FoilAuthVault::Ptr iVault;
+    bool iFlush; // Run even if released
+    bool iSaveSnapshot;
+    QHash<QString,FoilAuthToken> iTokens; // For the snapshot
 };
 
-typedef HarbourParentSignalQueueObject<FoilAuthModel,
-    FoilAuthModelSignal, FoilAuthModelSignalCount>
-    FoilAuthModelPrivateBase;
+FoilAuthModel::SaveInfoTask::SaveInfoTask(
+    QThreadPool* aPool,
+    const ModelData::List& aData,
+    const QString& aFoilDir,
+    FoilPrivateKey* aPrivateKey,
+    FoilKey* aPublicKey,
+    FoilAuthVault* aVault) :
+    BaseTask(aPool, aPrivateKey, aPublicKey),
+    iInfo(aData),
+    iFoilDir(aFoilDir),
+    iVault(aVault),
+    iFlush(false),
+    iSaveSnapshot(false)
+{}
 
-class FoilAuthModel::Private :
-    public FoilAuthModelPrivateBase
+// Only the files which are there at this point get into the snapshot
+void
+FoilAuthModel::SaveInfoTask::saveSnapshot(
+    const QString& aPath)
 {
-    Q_OBJECT
-
-    static const SignalEmitter gSignalEmitters[];
+    Snapshot snapshot;
+    QHashIterator<QString,FoilAuthToken> it(iTokens);
+
+    snapshot.add(iFoilDir + "/" INFO_FILE, iInfo.record());
+    while (it.hasNext()) {
+        it.next();
+        const QString id(it.key());
+        const FoilAuthToken& token = it.value();
+        const TokenHeaders headers(token, iInfo.iFavorites.contains(id));
+
+        snapshot.add(iFoilDir + "/" + id, VaultRecord::encode(
+            &headers.iHeaders, token.secret()));
+    }
 
-    template <typename ForwardIterator>
-    static inline void releaseTasks(ForwardIterator ptr, ForwardIterator end)
-    {
-        while (ptr != end) {
-            (*ptr)->release();
-            ++ptr;
+    if (snapshot.iEntries.isEmpty()) {
+        if (QFile::exists(aPath)) {
+            removeFile(aPath);
         }
+    } else {
+        snapshot.save(aPath, iPrivateKey, iPublicKey);
     }
+}
 
-    template <typename Container>
-    static inline void releaseTasks(Container& c)
-    {
-        releaseTasks(c.begin(), c.end());
-        c.clear();
+void
+FoilAuthModel::SaveInfoTask::performTask()
+{
+    if (iFlush || !isCanceled()) {
+        const QString snapshotPath(iFoilDir + "/" SNAPSHOT_FILE);
+
+        if (iVault) {
+            if (iInfo.iOrder.isEmpty()) {
+                iVault->remove(INFO_FILE);
+            } else {
+                iInfo.save(iVault.data());
+            }
+        } else if (iInfo.iOrder.isEmpty()) {
+            removeFile(iFoilDir + "/" INFO_FILE);
+        } else {
+            iInfo.save(iFoilDir, iPrivateKey, iPublicKey);
+        }
+
+        // The snapshot follows the info
+        if (iSaveSnapshot) {
+            saveSnapshot(snapshotPath);
+        } else if (QFile::exists(snapshotPath)) {
+            removeFile(snapshotPath);
+        }
     }
+}
 
-public:
-    Private(FoilAuthModel* aParent);
-    ~Private();
+// ==========================================================================
+// FoilAuthModel::DecryptAllTask
+// ==========================================================================
 
-public Q_SLOTS:
-    void onDecryptAllProgress(DecryptAllTask::Progress::Ptr aProgress);
-    void onDecryptAllTaskDone();
-    void onEncryptTaskDone();
-    void onPasswordTaskDone();
-    void onSaveInfoDone();
-    void onGenerateKeyTaskDone();
-    void onTimer();
+class FoilAuthModel::DecryptAllTask :
+    public BaseTask
+{
+    Q_OBJECT
 
 public:
-    int rowCount() const;
-    ModelData* dataAt(int aIndex) const;
-    ModelData* findData(const QString aId) const;
-    QList<FoilAuthToken> getTokens(const QList<int> aRows) const;
-    int findDataPos(const QString aId) const;
-    int findGroupPos(int) const;
-    bool needTimer() const;
-    void updateTimer();
-    void checkTimer();
-    bool checkPassword(const QString&);
-    bool changePassword(const QString&, const QString&);
-    void setKeys(FoilPrivateKey*, FoilKey* aPublic = Q_NULLPTR);
-    void setFoilState(FoilState);
-    void addGroup(const QString&);
-    void addToken(const FoilAuthToken&, bool aFavorite = true);
-    void addTokens(const QList<FoilAuthToken>&);
-    void insertModelData(ModelData*, bool);
-    void dataChanged(int , ModelData::Role);
-    void dataChanged(QList<int>, ModelData::Role);
-    void destroyItemAt(int);
-    bool destroyTokenAndRemoveFilesAt(int);
-    void deleteToken(const QString&);
-    void deleteTokens(const QStringList&);
-    void clearModel();
-    bool busy() const;
-    void encrypt(const ModelData*);
-    void updatePasswords(const ModelData*);
-    void updateGroupHeaderRows();
-    void saveInfo();
-    void saveInfoAndQueueBusySignal();
-    void saveInfoAndQueueBusySignal(bool);
-    void generate(int, const QString&);
-    void lock(bool);
-    bool unlock(const QString&);
+    // The purpose of this class is to make sure that ModelData doesn't
+    // get lost in transit when we asynchronously post the results from
+    // DecryptAllTask to FoilAuthModel.
+    //
+    // If the signal successfully reaches the slot, the receiver clears
+    // the lists which stops ModelData from being deallocated by the
+    // Progress destructor. If the signal never reaches the slot, then
+    // ModelData is deallocated together with when the last reference
+    // to Progress
+    class Progress : public QSharedData {
+    public:
+        typedef QExplicitlySharedDataPointer<Progress> Ptr;
 
-public:
-    ModelData::List iData;
-    QList<int> iGroupHeaderRows;
-    FoilState iFoilState;
-    QString iFoilDataDir;
-    QString iFoilKeyDir;
-    QString iFoilKeyFile;
-    FoilPrivateKey* iPrivateKey;
-    FoilKey* iPublicKey;
-    QThreadPool* iThreadPool;
-    HarbourTask::AutoReleasePointer<SaveInfoTask> iSaveInfoTask;
-    HarbourTask::AutoReleasePointer<GenerateKeyTask> iGenerateKeyTask;
-    HarbourTask::AutoReleasePointer<DecryptAllTask> iDecryptAllTask;
-    QList<EncryptTask*> iEncryptTasks;
-    QList<PasswordTask*> iPasswordTasks;
-    QTimer* iTimer;
-    qint64 iLastPeriod;
-    uint iTimeLeft;
-};
+        Progress(DecryptAllTask* aTask) : iTask(aTask), iVault(aTask->iVault) {}
+        ~Progress() { qDeleteAll(iModelData); qDeleteAll(iFrontData);
+            qDeleteAll(iResolvedData); }
 
-/* static */
-const FoilAuthModel::Private::SignalEmitter
-FoilAuthModel::Private::gSignalEmitters [] = {
-    #define FOIL_SIGNAL_EMITTER_(Name,name) &FoilAuthModel::name##Changed,
-    FOIL_QUEUED_SIGNALS(FOIL_SIGNAL_EMITTER_)
-    #undef  SIGNAL_EMITTER_
-};
+        int count() const { return iModelData.count() + iFrontData.count() +
+            iResolvedData.count() + iFailedIds.count(); }
 
-FoilAuthModel::Private::Private(FoilAuthModel* aParent) :
-    FoilAuthModelPrivateBase(aParent, gSignalEmitters),
-    iFoilState(FoilKeyMissing),
-    iFoilDataDir(QDir::homePath() + "/" FOIL_AUTH_DIR),
-    iFoilKeyDir(QDir::homePath() + "/" FOIL_KEY_DIR),
-    iFoilKeyFile(iFoilKeyDir + "/" + FOIL_KEY_FILE),
-    iPrivateKey(Q_NULLPTR),
-    iPublicKey(Q_NULLPTR),
-    iThreadPool(new QThreadPool(this)),
-    iTimer(new QTimer(this)),
-    iLastPeriod(0),
-    iTimeLeft(0)
-{
-    // Serialize the tasks:
-    iThreadPool->setMaxThreadCount(1);
-    qRegisterMetaType<DecryptAllTask::Progress::Ptr>("DecryptAllTask::Progress::Ptr");
+    public:
+        DecryptAllTask* iTask;
+        FoilAuthVault::Ptr iVault; // Must reach the model before the data
+        ModelData::List iModelData; // To be appended
+        ModelData::List iFrontData; // To be prepended
+        ModelData::List iResolvedData; // To replace the placeholders
+        QStringList iFailedIds; // Placeholders to be removed
+    };
 
-    HDEBUG("Key file" << qPrintable(iFoilKeyFile));
-    HDEBUG("Data dir" << qPrintable(iFoilDataDir));
+    // The whole list is delivered right away, with placeholders for the
+    // files which need to be decrypted. Files are then decrypted in
+    // parallel, in the order of priority, and delivered as soon as they
+    // are ready.
+    class Item {
+    public:
+        Item() : iHidden(false), iFront(false), iFavorite(false),
+            iDecrypt(false), iData(Q_NULLPTR) {}
 
-    // Create the directories if necessary
-    if (QDir().mkpath(iFoilKeyDir)) {
-        const QByteArray dir(iFoilKeyDir.toUtf8());
-        chmod(dir.constData(), 0700);
-    }
+    public:
+        QString iPath;
+        QString iGroupId;
+        QString iGroupLabel;
+        bool iHidden;
+        bool iFront;
+        bool iFavorite;
+        bool iDecrypt;
+        ModelData* iData;
+    };
 
-    if (QDir().mkpath(iFoilDataDir)) {
-        const QByteArray dir(iFoilDataDir.toUtf8());
-        chmod(dir.constData(), 0700);
-    }
+    class Worker : public QRunnable {
+    public:
+        Worker(DecryptAllTask* aTask) : iTask(aTask) {}
+        void run() Q_DECL_OVERRIDE { iTask->decryptItems(); }
 
-    // Initialize the key state
-    GError* error = Q_NULLPTR;
-    const QByteArray path(iFoilKeyFile.toUtf8());
-    FoilPrivateKey* key = foil_private_key_decrypt_from_file
-        (FOIL_KEY_RSA_PRIVATE, path.constData(), Q_NULLPTR, &error);
-    if (key) {
-        HDEBUG("Key not encrypted");
-        iFoilState = FoilKeyNotEncrypted;
-        foil_private_key_unref(key);
-    } else {
-        if (error->domain == FOIL_ERROR) {
-            if (error->code == FOIL_ERROR_KEY_ENCRYPTED) {
-                HDEBUG("Key encrypted");
-                iFoilState = FoilLocked;
-            } else {
-                HDEBUG("Key invalid" << error->code);
-                iFoilState = FoilKeyInvalid;
-            }
-        } else {
-            HDEBUG(error->message);
-            iFoilState = FoilKeyMissing;
+    public:
+        DecryptAllTask* iTask;
+    };
+
+    DecryptAllTask(QThreadPool*, QThreadPool*, const QString, FoilPrivateKey*,
+        FoilKey*, bool, bool);
+
+    void performTask() Q_DECL_OVERRIDE;
+    void prioritize(const QStringList&);
+
+    ModelData* newModelData(const QString&, const FoilMsgHeaders*,
+        const QByteArray&) const;
+    ModelData* decryptToken(const QString&, QByteArray*) const;
+    void queueItems();
+    void deliverPlaceholders();
+    void decryptItems();
+    void deliverItems();
+    void waitForWorkers();
+    void flushProgress(Progress::Ptr&);
+    bool exportVault();
+
+Q_SIGNALS:
+    void progress(DecryptAllTask::Progress::Ptr);
+
+public:
+    QThreadPool* iWorkerPool;
+    const QString iDir;
+    const bool iUseVault;
+    const bool iUseSnapshot;
+    FoilAuthVault::Ptr iVault;
+    bool iSaveInfo;
+    quint64 iTaskTime;
+    QMutex iMutex;
+    QWaitCondition iItemDone;
+    QVector<Item> iItems;
+    QVector<int> iQueue; // Items to decrypt, in the order of priority
+    QHash<QString,int> iQueueIndex; // Id => index in iItems
+    QVector<int> iDoneItems; // Decrypted but not yet delivered
+    int iNextItem; // Next index in iQueue
+    int iWorkers; // Workers which haven't finished yet
+};
+
+Q_DECLARE_METATYPE(FoilAuthModel::DecryptAllTask::Progress::Ptr)
+
+FoilAuthModel::DecryptAllTask::DecryptAllTask(
+    QThreadPool* aPool,
+    QThreadPool* aWorkerPool,
+    const QString aDir,
+    FoilPrivateKey* aPrivateKey,
+    FoilKey* aPublicKey,
+    bool aUseVault,
+    bool aUseSnapshot) :
+    BaseTask(aPool, aPrivateKey, aPublicKey),
+    iWorkerPool(aWorkerPool),
+    iDir(aDir),
+    iUseVault(aUseVault),
+    iUseSnapshot(aUseSnapshot),
+    iSaveInfo(false),
+    iTaskTime(0),
+    iNextItem(0),
+    iWorkers(0)
+{
+}
+
+FoilAuthModel::ModelData*
+FoilAuthModel::DecryptAllTask::newModelData(
+    const QString& aPath,
+    const FoilMsgHeaders* aHeaders,
+    const QByteArray& aSecret) const
+{
+    if (aSecret.length() > 0) {
+        const FoilAuthToken token(ModelData::headerToken(aHeaders, aSecret));
+        const quint64 t = token.periodStart(iTaskTime);
+        ModelData* data = new ModelData(aPath, token,
+            ModelData::headerBool(aHeaders, HEADER_FAVORITE, false));
+
+        // Calculate current passwords while we are on it
+        data->iCurrentPassword = token.passwordValue(t);
+        data->iPrevPassword = token.passwordValue(t - token.period());
+        data->iNextPassword = token.passwordValue(t + token.period());
+        data->iPasswordTime = t;
+        return data;
+    }
+    return Q_NULLPTR;
+}
+
+// Called on a worker thread, must not touch the shared state. If the
+// record pointer is provided, it receives the vault record for the token.
+FoilAuthModel::ModelData*
+FoilAuthModel::DecryptAllTask::decryptToken(
+    const QString& aPath,
+    QByteArray* aRecord) const
+{
+    ModelData* data = Q_NULLPTR;
+    FoilMsg* aMsg = decryptAndVerify(aPath);
+
+    if (aMsg) {
+        const QByteArray bytes(FoilAuth::toByteArray(aMsg->data));
+
+        data = newModelData(aPath, &aMsg->headers, bytes);
+        if (data) {
+            if (aRecord) {
+                *aRecord = VaultRecord::encode(&aMsg->headers, bytes);
+            }
+            HDEBUG("Loaded secret from" << qPrintable(aPath));
+        }
+        foilmsg_free(aMsg);
+    }
+    return data;
+}
+
+// Favorites go first (they are shown on the cover), then everything
+// else from top to bottom. Called before the workers are started.
+void
+FoilAuthModel::DecryptAllTask::queueItems()
+{
+    const int n = iItems.count();
+    int i;
+
+    QMutexLocker lock(&iMutex);
+    for (i = 0; i < n; i++) {
+        const Item& item = iItems.at(i);
+
+        if (item.iDecrypt && item.iFavorite) {
+            iQueue.append(i);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        const Item& item = iItems.at(i);
+
+        if (item.iDecrypt) {
+            if (!item.iFavorite) {
+                iQueue.append(i);
+            }
+            iQueueIndex.insert(QFileInfo(item.iPath).fileName(), i);
+        }
+    }
+}
+
+// Called on the main thread. Moves the items which haven't been picked
+// up yet to the head of the queue, preserving their relative order.
+void
+FoilAuthModel::DecryptAllTask::prioritize(
+    const QStringList& aIds)
+{
+    QMutexLocker lock(&iMutex);
+    int pos = iNextItem;
+
+    for (int k = 0; k < aIds.count(); k++) {
+        const int item = iQueueIndex.value(aIds.at(k), -1);
+
+        if (item >= 0) {
+            const int i = iQueue.indexOf(item, pos);
+
+            if (i >= pos) {
+                iQueue.remove(i);
+                iQueue.insert(pos++, item);
+            }
+        }
+    }
+}
+
+// Delivers the whole list in one go, so that the rows don't move when
+// the placeholders get replaced with the actual tokens
+void
+FoilAuthModel::DecryptAllTask::deliverPlaceholders()
+{
+    const int n = iItems.count();
+    Progress::Ptr all(new Progress(this));
+
+    for (int i = 0; i < n && !isCanceled(); i++) {
+        Item& item = iItems[i];
+        ModelData* data = Q_NULLPTR;
+
+        if (!item.iGroupId.isEmpty()) {
+            data = new ModelData(item.iGroupId, item.iGroupLabel,
+                item.iHidden);
+        } else if (item.iDecrypt) {
+            data = new ModelData(item.iPath);
+            data->iHidden = item.iHidden;
+            data->iFavorite = item.iFavorite;
+        } else if (item.iData) {
+            // The Progress takes ownership of ModelData
+            data = item.iData;
+            data->iHidden = item.iHidden;
+            item.iData = Q_NULLPTR;
+        } else {
+            // Broken record
+            HDEBUG(qPrintable(item.iPath) << "oops!");
+            iSaveInfo = true;
+        }
+
+        if (data) {
+            if (item.iFront) {
+                all->iFrontData.append(data);
+            } else {
+                all->iModelData.append(data);
+            }
+        }
+    }
+
+    if (!isCanceled()) {
+        flushProgress(all);
+    }
+}
+
+// Runs on each worker thread until there's nothing left to decrypt
+void
+FoilAuthModel::DecryptAllTask::decryptItems()
+{
+    iMutex.lock();
+    while (iNextItem < iQueue.count() && !isCanceled()) {
+        const int i = iQueue.at(iNextItem++);
+        const QString path(iItems.at(i).iPath);
+        QByteArray record;
+
+        iMutex.unlock();
+        ModelData* data = decryptToken(path, iVault ? &record : Q_NULLPTR);
+
+        // Move the file to the vault before the token reaches the model,
+        // so that the model's changes are applied on top of the record.
+        // Only remove the file if it's safely in the vault.
+        if (!record.isEmpty()) {
+            if (iVault->write(QFileInfo(path).fileName(), record)) {
+                removeFile(path);
+            }
+            record.fill(0);
+        }
+        iMutex.lock();
+
+        iItems[i].iData = data;
+        iDoneItems.append(i);
+        iItemDone.wakeAll();
+    }
+    // Don't leave anyone waiting if we have been canceled
+    iWorkers--;
+    iItemDone.wakeAll();
+    iMutex.unlock();
+}
+
+// The worker pool is shared, waitForDone() would wait for other tasks too
+void
+FoilAuthModel::DecryptAllTask::waitForWorkers()
+{
+    iMutex.lock();
+    while (iWorkers > 0) {
+        iItemDone.wait(&iMutex);
+    }
+    iMutex.unlock();
+}
+
+void
+FoilAuthModel::DecryptAllTask::flushProgress(
+    Progress::Ptr& aProgress)
+{
+    if (aProgress) {
+        HDEBUG(aProgress->count() << "item(s)");
+        Q_EMIT progress(aProgress);
+        aProgress.reset();
+    }
+}
+
+// Writes the vault contents back into the individual files. The vault
+// is removed only if everything has been successfully written.
+bool
+FoilAuthModel::DecryptAllTask::exportVault()
+{
+    const QHash<QString,QByteArray> records(iVault->readAll());
+    QHashIterator<QString,QByteArray> it(records);
+    bool ok = true;
+
+    HDEBUG("Exporting" << records.count() << "record(s)");
+    while (ok && it.hasNext() && !isCanceled()) {
+        it.next();
+        const QString& id = it.key();
+
+        if (id == QLatin1String(INFO_FILE)) {
+            ok = ModelInfo::fromRecord(it.value()).save(iDir,
+                iPrivateKey, iPublicKey);
+        } else {
+            const VaultRecord record(it.value());
+
+            if (record.iValid) {
+                FoilBytes body;
+
+                body.val = (guint8*)record.iBody.constData();
+                body.len = record.iBody.length();
+                ok = Util::writeFile(iDir + "/" + id, &body,
+                    &record.iHeaders, iPrivateKey, iPublicKey);
+            } else {
+                HWARN("Skipping invalid record" << qPrintable(id));
+            }
+        }
+    }
+
+    if (ok && !isCanceled()) {
+        const QString path(iVault->path());
+
+        if (removeFile(path)) {
+            Util::syncDir(path);
+            return true;
+        }
+    }
+    HWARN("Failed to export the vault");
+    return false;
+}
+
+// Emits the results as soon as they are ready, collecting them into
+// chunks so that the model doesn't have to handle them one by one.
+void
+FoilAuthModel::DecryptAllTask::deliverItems()
+{
+    Progress::Ptr chunk;
+    QElapsedTimer timer;
+    int delivered = 0;
+
+    iMutex.lock();
+    while (delivered < iQueue.count() && !isCanceled()) {
+        if (!iDoneItems.isEmpty()) {
+            ModelData::List done;
+            QStringList failed;
+
+            for (int k = 0; k < iDoneItems.count(); k++) {
+                Item& item = iItems[iDoneItems.at(k)];
+
+                if (item.iData) {
+                    done.append(item.iData);
+                    item.iData = Q_NULLPTR;
+                } else {
+                    // Broken file
+                    HDEBUG(qPrintable(item.iPath) << "oops!");
+                    failed.append(QFileInfo(item.iPath).fileName());
+                }
+            }
+            delivered += iDoneItems.count();
+            iDoneItems.resize(0);
+            iMutex.unlock();
+
+            if (!chunk) {
+                chunk = new Progress(this);
+                timer.start();
+            }
+
+            // The Progress takes ownership of ModelData
+            chunk->iResolvedData.append(done);
+            if (!failed.isEmpty()) {
+                chunk->iFailedIds.append(failed);
+                iSaveInfo = true;
+            }
+
+            if (chunk->count() >= MAX_PROGRESS_CHUNK ||
+                timer.elapsed() >= MAX_PROGRESS_DELAY) {
+                flushProgress(chunk);
+            }
+            iMutex.lock();
+        } else if (chunk) {
+            // Don't sit on what's already been decrypted for too long
+            const qint64 left = MAX_PROGRESS_DELAY - timer.elapsed();
+
+            if (left > 0) {
+                iItemDone.wait(&iMutex, (ulong)left);
+            } else {
+                iMutex.unlock();
+                flushProgress(chunk);
+                iMutex.lock();
+            }
+        } else {
+            iItemDone.wait(&iMutex);
+        }
+    }
+    iMutex.unlock();
+
+    if (!isCanceled()) {
+        flushProgress(chunk);
+    }
+}
+
+void
+FoilAuthModel::DecryptAllTask::performTask()
+{
+    if (!isCanceled()) {
+        const QString path(iDir);
+        const QString vaultPath(iDir + "/" VAULT_FILE);
+        HDEBUG("Checking" << iDir);
+
+        // Record time
+        iTaskTime = QDateTime::currentDateTime().toTime_t();
+
+        // If the existing vault can't be opened, don't touch it and stick
+        // to the individual files. If it's no longer wanted, its contents
+        // get exported back into the files. Until that succeeds, the vault
+        // remains in use.
+        if (QFile::exists(vaultPath)) {
+            iVault = FoilAuthVault::open(vaultPath, iPrivateKey, iPublicKey);
+            if (!iVault) {
+                HWARN("Failed to open" << qPrintable(vaultPath));
+            } else if (!iUseVault && exportVault()) {
+                iVault.reset();
+            }
+        } else if (iUseVault) {
+            iVault = FoilAuthVault::create(vaultPath, iPrivateKey,
+                iPublicKey);
+        }
+
+        QDir dir(path);
+        QFileInfoList list = dir.entryInfoList(QDir::Files |
+            QDir::Dirs | QDir::NoDotAndDotDot, QDir::NoSort);
+
+        // Everything in the vault is decrypted in one go
+        QHash<QString,QByteArray> records;
+        bool infoFromFile = true;
+
+        if (iVault) {
+            records = iVault->readAll();
+            infoFromFile = !records.contains(INFO_FILE);
+        }
+
+        // So is everything in the snapshot. The vault has no use for it.
+        const QString snapshotPath(iDir + "/" SNAPSHOT_FILE);
+        const bool useSnapshot = iUseSnapshot && !iVault;
+        Snapshot snapshot;
+
+        if (useSnapshot) {
+            snapshot = Snapshot::load(snapshotPath, iPrivateKey, iPublicKey);
+        } else if (QFile::exists(snapshotPath)) {
+            removeFile(snapshotPath);
+        }
+
+        // Restore the order and create the groups
+        const QFileInfo infoFileInfo(iDir + "/" INFO_FILE);
+        const QByteArray infoRecord(infoFromFile ?
+            snapshot.take(infoFileInfo) : QByteArray());
+        const ModelInfo info(!infoFromFile ?
+            ModelInfo::load(iVault.data()) : !infoRecord.isEmpty() ?
+            ModelInfo::fromRecord(infoRecord) :
+            ModelInfo::load(iDir, iPrivateKey, iPublicKey));
+        const QString infoFile(INFO_FILE);
+        const QString vaultFile(VAULT_FILE);
+        const QString snapshotFile(SNAPSHOT_FILE);
+        const QString infoTempFile(INFO_FILE TEMP_SUFFIX);
+        const QString vaultTempFile(VAULT_FILE ".tmp");
+        const QString snapshotTempFile(SNAPSHOT_FILE TEMP_SUFFIX);
+        QHash<QString,QString> fileMap;
+
+        // The snapshot gets rewritten if anything has changed
+        bool snapshotChanged = infoRecord.isEmpty() && infoFileInfo.exists();
+        bool hidden = false;
+        int i, files = 0;
+
+        records.remove(infoFile);
+        for (i = 0; i < list.count(); i++) {
+            const QFileInfo& file = list.at(i);
+            if (file.isFile()) {
+                const QString name(file.fileName());
+                if (name != infoFile && name != infoTempFile &&
+                    name != vaultFile && name != vaultTempFile &&
+                    name != snapshotFile && name != snapshotTempFile) {
+                    if (records.contains(name)) {
+                        // Already migrated, the vault has the latest copy
+                        removeFile(file.filePath());
+                    } else {
+                        const QByteArray record(snapshot.take(file));
+
+                        if (!record.isEmpty()) {
+                            // Unchanged since the snapshot was taken
+                            records.insert(name, record);
+                        } else {
+                            fileMap.insert(name, file.filePath());
+                        }
+                    }
+                }
+            }
+        }
+
+        // Whatever is left in the snapshot is gone from the disk
+        if (!snapshot.iEntries.isEmpty() || !fileMap.isEmpty()) {
+            snapshotChanged = true;
+        }
+        if (useSnapshot && snapshotChanged) {
+            HDEBUG("Snapshot needs to be updated");
+            iSaveInfo = true;
+        }
+        snapshot.iEntries.clear();
+
+        // First the tokens in known order
+        iItems.reserve(info.iOrder.count() + records.count() +
+            fileMap.count());
+        for (i = 0; i < info.iOrder.count(); i++) {
+            const QString id(info.iOrder.at(i));
+            Item item;
+
+            if (info.iGroups.contains(id)) {
+                // This is a group
+                hidden = info.iHiddenGroups.contains(id);
+                item.iGroupId = id;
+                item.iGroupLabel = info.iGroups.value(id);
+                item.iHidden = hidden;
+                iItems.append(item);
+            } else if (records.contains(id)) {
+                // This is a vault record, no need to decrypt it again
+                const VaultRecord record(records.take(id));
+
+                item.iPath = iDir + "/" + id;
+                item.iHidden = hidden;
+                item.iData = record.iValid ? newModelData(item.iPath,
+                    &record.iHeaders, record.iBody) : Q_NULLPTR;
+                iItems.append(item);
+            } else if (fileMap.contains(id)) {
+                // This is a file
+                item.iPath = fileMap.take(id);
+                item.iHidden = hidden;
+                item.iFavorite = info.iFavorites.contains(id);
+                item.iDecrypt = true;
+                iItems.append(item);
+                files++;
+            } else {
+                // Broken order or something
+                HDEBUG(qPrintable(id) << "is missing");
+                iSaveInfo = true;
+            }
+        }
+
+        // Followed by the remaining records and files in no particular order
+        if (!records.isEmpty()) {
+            QHashIterator<QString,QByteArray> it(records);
+
+            HDEBUG("Remaining record(s)" << records.keys());
+            while (it.hasNext()) {
+                it.next();
+                const VaultRecord record(it.value());
+                Item item;
+
+                item.iPath = iDir + "/" + it.key();
+                item.iFront = true;
+                item.iData = record.iValid ? newModelData(item.iPath,
+                    &record.iHeaders, record.iBody) : Q_NULLPTR;
+                iItems.append(item);
+            }
+            records.clear();
+        }
+
+        if (!fileMap.isEmpty()) {
+            const QStringList remainingFiles = fileMap.values();
+
+            HDEBUG("Remaining file(s)" << remainingFiles);
+            for (i = 0; i < remainingFiles.count(); i++) {
+                Item item;
+
+                item.iPath = remainingFiles.at(i);
+                item.iFront = true;
+                item.iDecrypt = true;
+                iItems.append(item);
+                files++;
+            }
+        }
+
+        queueItems();
+        deliverPlaceholders();
+
+        // Each file costs an RSA decryption and a signature check,
+        // spread those across the CPU lane but leave a thread for the
+        // password calculations
+        const int threads = qMax(qMin(iWorkerPool->maxThreadCount() - 1,
+            files), 1);
+
+        HDEBUG(files << "file(s)," << threads << "thread(s)");
+        iWorkers = threads;
+        for (i = 0; i < threads; i++) {
+            iWorkerPool->start(new Worker(this));
+        }
+        deliverItems();
+        waitForWorkers();
+
+        if (iVault && !isCanceled()) {
+            const QString infoPath(iDir + "/" INFO_FILE);
+
+            // The info file is no longer needed either
+            if (infoFromFile && QFile::exists(infoPath) &&
+                (info.iOrder.isEmpty() || info.save(iVault.data()))) {
+                removeFile(infoPath);
+            }
+        }
+
+        // Anything that hasn't been delivered (if we have been canceled)
+        for (i = 0; i < iItems.count(); i++) {
+            delete iItems.at(i).iData;
+        }
+        iItems.clear();
+    }
+}
+
+// ==========================================================================
+// FoilAuthModel::Private
+// ==========================================================================
+
+// s(SignalName,signalName)
+#define FOIL_QUEUED_SIGNALS(s) \
+    s(Count,count) \
+    s(Busy,busy) \
+    s(KeyAvailable,keyAvailable) \
+    s(TimerActive,timerActive) \
+    s(GroupHeaderRows,groupHeaderRows) \
+    s(FoilState,foilState) \
+    s(Period,period) \
+    s(TimeLeft,timeLeft) \
+    s(PeriodEnd,periodEnd) \
+    s(Tickless,tickless) \
+    s(LookupWindow,lookupWindow) \
+    s(Vault,vault) \
+    s(Snapshot,snapshot) \
+    s(ImportPending,importPending) \
+    s(SaveDelay,saveDelay) \
+    s(MaxSaveDelay,maxSaveDelay)
+
+enum FoilAuthModelSignal {
+    #define FOIL_SIGNAL_ENUM_(Name,name) Signal##Name##Changed,
+    FOIL_QUEUED_SIGNALS(FOIL_SIGNAL_ENUM_)
+    #undef FOIL_SIGNAL_ENUM_
+    FoilAuthModelSignalCount
+};
+
+typedef HarbourParentSignalQueueObject<FoilAuthModel,
+    FoilAuthModelSignal, FoilAuthModelSignalCount>
+    FoilAuthModelPrivateBase;
+
+class FoilAuthModel::Private :
+    public FoilAuthModelPrivateBase
+{
+    Q_OBJECT
+
+    static const SignalEmitter gSignalEmitters[];
+
+    template <typename ForwardIterator>
+    static inline void releaseTasks(ForwardIterator ptr, ForwardIterator end)
+    {
+        while (ptr != end) {
+            (*ptr)->release();
+            ++ptr;
+        }
+    }
+
+    template <typename Container>
+    static inline void releaseTasks(Container& c)
+    {
+        releaseTasks(c.begin(), c.end());
+        c.clear();
+    }
+
+public:
+    // Next period boundary for all tokens sharing the same period
+    class Deadline {
+    public:
+        Deadline() : iTime(0), iPeriod(0) {}
+        Deadline(qint64 aTime, int aPeriod) : iTime(aTime), iPeriod(aPeriod) {}
+
+        // Comparator for std heap functions, keeps the earliest on top
+        static bool later(const Deadline& aA, const Deadline& aB)
+            { return aA.iTime > aB.iTime; }
+
+    public:
+        qint64 iTime; // Seconds since epoch
+        int iPeriod;
+    };
+
+    Private(FoilAuthModel* aParent);
+    ~Private();
+
+public Q_SLOTS:
+    void onDecryptAllProgress(DecryptAllTask::Progress::Ptr aProgress);
+    void onDecryptAllTaskDone();
+    void onEncryptTaskDone();
+    void onImportProgress(int);
+    void onImportTaskDone();
+    void onPasswordTaskDone();
+    void onPasswordBatchTaskDone();
+    void onDeleteTaskDone();
+    void onSaveInfoDone();
+    void onSaveInfoTimer();
+    void onGenerateKeyTaskDone();
+    void onKeyTaskDone();
+    void onTimer();
+    void onRolloverTimer();
+    void onClockChanged();
+
+public:
+    static quint64 currentTime();
+    int rowCount() const;
+    ModelData* dataAt(int aIndex) const;
+    ModelData* findData(const QString aId) const;
+    QList<FoilAuthToken> getTokens(const QList<int> aRows) const;
+    int findDataPos(const QString aId) const;
+    int findGroupPos(int) const;
+    void indexRows(int, int);
+    void indexRows(int);
+    bool needTimer() const;
+    int timeLeft() const;
+    void setTickless(bool);
+    void setVault(bool);
+    void setSnapshot(bool);
+    void updateTimer();
+    void checkTimer();
+    void updateSchedule();
+    Deadline nextDeadline(qint64) const;
+    void startRolloverTimer();
+    bool checkPassword(const QString&);
+    bool changePassword(const QString&, const QString&);
+    bool checkPasswordAsync(const QString&);
+    bool changePasswordAsync(const QString&, const QString&);
+    void setKeys(FoilPrivateKey*, FoilKey* aPublic = Q_NULLPTR);
+    void setFoilState(FoilState);
+    QString generateId() const;
+    QString newTokenPath() const;
+    void addGroup(const QString&);
+    void addToken(const FoilAuthToken&, bool aFavorite = true);
+    void addTokens(const QList<FoilAuthToken>&);
+    QString reserveId(const QSet<QString>&) const;
+    int importPending() const;
+    void insertModelData(ModelData*, bool);
+    void insertModelData(const ModelData::List&, bool);
+    void resolvePlaceholders(const ModelData::List&);
+    void removePlaceholders(const QStringList&);
+    void setVisibleRows(int, int);
+    void dataChanged(int , ModelData::Role);
+    void dataChanged(QList<int>, ModelData::Role);
+    void destroyItemAt(int);
+    ModelData::List takeRows(QVector<int>);
+    void deleteToken(const QString&);
+    void deleteTokens(const QStringList&);
+    void clearModel();
+    bool busy() const;
+    void encrypt(const ModelData*);
+    void renameEncryptTasks(const QString&, const QString&);
+    void updatePasswords(const ModelData*);
+    void updatePasswords(const QVector<int>&);
+    void rotatePasswords(const QVector<int>&);
+    void submitPasswordBatch(const QVector<PasswordBatchTask::Entry>&);
+    void completeWindow(int);
+    void setLookupWindow(int);
+    void updateLookupIndex(ModelData*);
+    void removeFromLookupIndex(ModelData*);
+    uint secretKey(const QByteArray&) const;
+    void updateSecretIndex(ModelData*);
+    void removeFromSecretIndex(ModelData*);
+    int findSecretPos(const QByteArray&) const;
+    int findTokenPos(const FoilAuthToken&) const;
+    QList<int> findPassword(const QString&) const;
+    void emitRowsChanged(const QList<int>&, const QVector<int>&);
+    void updateGroupHeaderRows();
+    SaveInfoTask* newSaveInfoTask() const;
+    void saveInfo();
+    void saveInfoNow();
+    void flushInfo();
+    void setSaveDelay(int);
+    void setMaxSaveDelay(int);
+    void saveInfoAndQueueBusySignal();
+    void saveInfoAndQueueBusySignal(bool);
+    void generate(int, const QString&);
+    void lock(bool);
+    bool unlock(const QString&);
+    bool unlockAsync(const QString&);
+    void decryptAll(FoilPrivateKey*);
+    void startKeyTask(KeyTask::Action, const QString& aPassword = QString(),
+        const QString& aNewPassword = QString());
+    void cancelKeyTask();
+
+public:
+    ModelData::List iData;
+    QHash<QString,int> iRowIndex; // ModelData::iId => row in iData
+    QList<int> iGroupHeaderRows;
+    FoilState iFoilState;
+    QString iFoilDataDir;
+    QString iFoilKeyDir;
+    QString iFoilKeyFile;
+    FoilPrivateKey* iPrivateKey;
+    FoilKey* iPublicKey;
+    Scheduler* iScheduler;
+    HarbourTask::AutoReleasePointer<SaveInfoTask> iSaveInfoTask;
+    HarbourTask::AutoReleasePointer<GenerateKeyTask> iGenerateKeyTask;
+    HarbourTask::AutoReleasePointer<KeyTask> iKeyTask;
+    FoilState iKeyTaskPrevState; // To go back to if the task is canceled
+    HarbourTask::AutoReleasePointer<DecryptAllTask> iDecryptAllTask;
+    QList<EncryptTask*> iEncryptTasks;
+    QHash<QString,EncryptTask*> iLastEncryptTask;
+    QList<PasswordTask*> iPasswordTasks;
+    QList<DeleteTask*> iDeleteTasks;
+    QList<ImportTask*> iImportTasks;
+    QList<PasswordBatchTask*> iPasswordBatchTasks;
+    QTimer* iTimer;
+    qint64 iPeriodEnd; // Seconds since epoch
+    int iPeriod;
+    uint iTimeLeft;
+    bool iTickless;
+    QTimer* iRolloverTimer;
+    QVector<Deadline> iDeadlines; // Min-heap
+    FoilAuthClockWatch* iClockWatch;
+    int iLookupWindow;
+    QMultiHash<quint64,ModelData*> iLookupIndex;
+    quint64 iSecretSalt; // Per-session key for the secret index
+    QMultiHash<uint,ModelData*> iSecretIndex;
+    bool iVaultEnabled;
+    bool iSnapshotEnabled;
+    FoilAuthVault::Ptr iVault;
+    int iSaveDelay;
+    int iMaxSaveDelay;
+    QTimer* iSaveInfoTimer;
+    QElapsedTimer iSaveInfoPending; // Since the first unsaved change
+};
+
+/* static */
+const FoilAuthModel::Private::SignalEmitter
+FoilAuthModel::Private::gSignalEmitters [] = {
+    #define FOIL_SIGNAL_EMITTER_(Name,name) &FoilAuthModel::name##Changed,
+    FOIL_QUEUED_SIGNALS(FOIL_SIGNAL_EMITTER_)
+    #undef  SIGNAL_EMITTER_
+};
+
+FoilAuthModel::Private::Private(FoilAuthModel* aParent) :
+    FoilAuthModelPrivateBase(aParent, gSignalEmitters),
+    iFoilState(FoilCheckingKey),
+    iFoilDataDir(QDir::homePath() + "/" FOIL_AUTH_DIR),
+    iFoilKeyDir(QDir::homePath() + "/" FOIL_KEY_DIR),
+    iFoilKeyFile(iFoilKeyDir + "/" + FOIL_KEY_FILE),
+    iPrivateKey(Q_NULLPTR),
+    iPublicKey(Q_NULLPTR),
+    iScheduler(new Scheduler(this)),
+    iKeyTaskPrevState(FoilCheckingKey),
+    iTimer(new QTimer(this)),
+    iPeriodEnd(0),
+    iPeriod(FoilAuth::PERIOD),
+    iTimeLeft(0),
+    iTickless(false),
+    iRolloverTimer(new QTimer(this)),
+    iClockWatch(new FoilAuthClockWatch(this)),
+    iLookupWindow(DEFAULT_LOOKUP_WINDOW),
+    iVaultEnabled(DEFAULT_VAULT_ENABLED),
+    iSnapshotEnabled(DEFAULT_SNAPSHOT_ENABLED),
+    iSaveDelay(DEFAULT_SAVE_DELAY),
+    iMaxSaveDelay(DEFAULT_MAX_SAVE_DELAY),
+    iSaveInfoTimer(new QTimer(this))
+{
+    foil_random(&iSecretSalt, sizeof(iSecretSalt));
+    qRegisterMetaType<DecryptAllTask::Progress::Ptr>("DecryptAllTask::Progress::Ptr");
+
+    HDEBUG("Key file" << qPrintable(iFoilKeyFile));
+    HDEBUG("Data dir" << qPrintable(iFoilDataDir));
+
+    // Create the directories if necessary
+    if (QDir().mkpath(iFoilKeyDir)) {
+        const QByteArray dir(iFoilKeyDir.toUtf8());
+        chmod(dir.constData(), 0700);
+    }
+
+    if (QDir().mkpath(iFoilDataDir)) {
+        const QByteArray dir(iFoilDataDir.toUtf8());
+        chmod(dir.constData(), 0700);
+    }
+
+    // Initialize the key state in the background
+    startKeyTask(KeyTask::ProbeKey);
+
+    iTimer->setSingleShot(true);
+    connect(iTimer, SIGNAL(timeout()), SLOT(onTimer()));
+    iRolloverTimer->setSingleShot(true);
+    iRolloverTimer->setTimerType(Qt::PreciseTimer);
+    connect(iRolloverTimer, SIGNAL(timeout()), SLOT(onRolloverTimer()));
+    connect(iClockWatch, SIGNAL(clockChanged()), SLOT(onClockChanged()));
+    iSaveInfoTimer->setSingleShot(true);
+    connect(iSaveInfoTimer, SIGNAL(timeout()), SLOT(onSaveInfoTimer()));
+    clearQueuedSignals();
+}
+
+FoilAuthModel::Private::~Private()
+{
+    // Don't lose the pending changes
+    flushInfo();
+    foil_private_key_unref(iPrivateKey);
+    foil_key_unref(iPublicKey);
+
+    iSaveInfoTask.reset();
+    iGenerateKeyTask.reset();
+    iKeyTask.reset();
+    iDecryptAllTask.reset();
+    releaseTasks(iEncryptTasks);
+    iLastEncryptTask.clear();
+    releaseTasks(iPasswordTasks);
+    releaseTasks(iPasswordBatchTasks);
+    releaseTasks(iDeleteTasks);
+    releaseTasks(iImportTasks);
+    iScheduler->waitForDone();
+    qDeleteAll(iData);
+}
+
+/* static */
+quint64
+FoilAuthModel::Private::currentTime()
+{
+    return QDateTime::currentMSecsSinceEpoch() / 1000;
+}
+
+inline
+int
+FoilAuthModel::Private::rowCount() const
+{
+    return iData.count();
+}
+
+inline
+FoilAuthModel::ModelData*
+FoilAuthModel::Private::dataAt(
+    int aIndex) const
+{
+    if (aIndex >= 0 && aIndex < iData.count()) {
+        return iData.at(aIndex);
+    } else {
+        return Q_NULLPTR;
+    }
+}
+
+FoilAuthModel::ModelData*
+FoilAuthModel::Private::findData(
+    const QString aId) const
+{
+    return dataAt(findDataPos(aId));
+}
+
+int
+FoilAuthModel::Private::findDataPos(
+    const QString aId) const
+{
+    return iRowIndex.value(aId, -1);
+}
+
+// Updates the row index for the rows [aFrom, aTo) after they have been
+// inserted, removed or moved. Everything outside of that range stays put.
+void
+FoilAuthModel::Private::indexRows(
+    int aFrom,
+    int aTo)
+{
+    for (int i = aFrom; i < aTo; i++) {
+        iRowIndex.insert(iData.at(i)->iId, i);
+    }
+}
+
+void
+FoilAuthModel::Private::indexRows(
+    int aFrom)
+{
+    indexRows(aFrom, iData.count());
+}
+
+int
+FoilAuthModel::Private::findGroupPos(
+    int aPos) const
+{
+    if (aPos < iData.count()) {
+        while (aPos >= 0) {
+            if (iData.at(aPos)->isGroupHeader()) {
+                return aPos;
+            } else {
+                aPos--;
+            }
+        }
+    }
+    return -1;
+}
+
+QList<FoilAuthToken>
+FoilAuthModel::Private::getTokens(
+    const QList<int> aRows) const
+{
+    QList<FoilAuthToken> tokens;
+    const int n = aRows.count();
+
+    tokens.reserve(n);
+    for (int i = 0; i < n; i++) {
+        ModelData* data = dataAt(aRows.at(i));
+        if (data && data->isToken()) {
+            tokens.append(data->iToken);
+        }
+    }
+    return tokens;
+}
+
+void
+FoilAuthModel::Private::setKeys(
+    FoilPrivateKey* aPrivate,
+    FoilKey* aPublic)
+{
+    if (aPrivate) {
+        if (iPrivateKey) {
+            foil_private_key_unref(iPrivateKey);
+        } else {
+            queueSignal(SignalKeyAvailableChanged);
+        }
+        foil_key_unref(iPublicKey);
+        iPrivateKey = foil_private_key_ref(aPrivate);
+        iPublicKey = aPublic ? foil_key_ref(aPublic) :
+            foil_public_key_new_from_private(aPrivate);
+    } else if (iPrivateKey) {
+        queueSignal(SignalKeyAvailableChanged);
+        foil_private_key_unref(iPrivateKey);
+        foil_key_unref(iPublicKey);
+        iPrivateKey = Q_NULLPTR;
+        iPublicKey = Q_NULLPTR;
+    }
+}
+
+bool
+FoilAuthModel::Private::checkPassword(
+    const QString& aPassword)
+{
+    FoilPrivateKey* key;
+
+    HDEBUG(iFoilKeyFile);
+    KeyTask::decryptKey(iFoilKeyFile, &aPassword, &key);
+    if (key) {
+        foil_private_key_unref(key);
+        return true;
+    }
+    return false;
+}
+
+bool
+FoilAuthModel::Private::changePassword(
+    const QString& aOldPassword,
+    const QString& aNewPassword)
+{
+    HDEBUG(iFoilKeyFile);
+    if (iPrivateKey && checkPassword(aOldPassword) &&
+        KeyTask::encryptKey(iFoilKeyFile, iPrivateKey, aNewPassword)) {
+        Q_EMIT parentObject()->passwordChanged();
+        return true;
+    }
+    return false;
+}
+
+// The result is reported by passwordChecked()
+bool
+FoilAuthModel::Private::checkPasswordAsync(
+    const QString& aPassword)
+{
+    if (iPrivateKey) {
+        HDEBUG(iFoilKeyFile);
+        startKeyTask(KeyTask::CheckPassword, aPassword);
+        return true;
+    }
+    return false;
+}
+
+// The result is reported by passwordChanged() or passwordChangeFailed()
+bool
+FoilAuthModel::Private::changePasswordAsync(
+    const QString& aOldPassword,
+    const QString& aNewPassword)
+{
+    if (iPrivateKey) {
+        HDEBUG(iFoilKeyFile);
+        startKeyTask(KeyTask::ChangePassword, aOldPassword, aNewPassword);
+        return true;
+    }
+    return false;
+}
+
+bool
+FoilAuthModel::Private::needTimer() const
+{
+    if (iFoilState == FoilModelReady) {
+        const int n = iData.count();
+        for (int i = 0; i < n; i++) {
+            if (iData.at(i)->iToken.type() != FoilAuthTypes::AuthTypeHOTP) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// The countdown follows the deadlines, those get updated first
+void
+FoilAuthModel::Private::checkTimer()
+{
+    updateSchedule();
+    if (needTimer()) {
+        updateTimer();
+    } else if (iTimer->isActive()){
+        queueSignal(SignalTimerActiveChanged);
+        queueSignal(SignalPeriodEndChanged);
+        iTimer->stop();
+    }
+}
+
+// Synchronizes the deadlines with the periods of the time based tokens
+void
+FoilAuthModel::Private::updateSchedule()
+{
+    QVector<int> periods;
+
+    if (iFoilState == FoilModelReady) {
+        const int n = iData.count();
+
+        for (int i = 0; i < n; i++) {
+            const ModelData* data = iData.at(i);
+
+            if (data->isTimeBased()) {
+                const int period = data->iToken.period();
+
+                if (!periods.contains(period)) {
+                    periods.append(period);
+                }
+            }
+        }
+    }
+
+    // Keep the existing deadlines (even if they have already passed),
+    // drop the ones which are no longer needed
+    bool changed = false;
+
+    for (int i = iDeadlines.count() - 1; i >= 0; i--) {
+        const int k = periods.indexOf(iDeadlines.at(i).iPeriod);
+
+        if (k >= 0) {
+            periods.remove(k);
+        } else {
+            HDEBUG("Period" << iDeadlines.at(i).iPeriod << "is gone");
+            iDeadlines.remove(i);
+            changed = true;
+        }
+    }
+
+    // Passwords for the new periods may have been calculated for the
+    // previous period, those get recalculated right away
+    if (!periods.isEmpty()) {
+        const qint64 now = currentTime();
+
+        for (int i = 0; i < periods.count(); i++) {
+            const int period = periods.at(i);
+
+            HDEBUG("New period" << period);
+            iDeadlines.append(Deadline((now / period + 1) * period, period));
+        }
+        updatePasswords(periods);
+        changed = true;
+    }
+
+    if (changed) {
+        std::make_heap(iDeadlines.begin(), iDeadlines.end(), Deadline::later);
+        startRolloverTimer();
+    }
+}
+
+// The nearest end of period among the time based tokens, the shortest
+// period wins the tie. It's calculated from the periods rather than the
+// deadlines, which may not have been rolled over yet.
+FoilAuthModel::Private::Deadline
+FoilAuthModel::Private::nextDeadline(
+    qint64 aNow) const
+{
+    Deadline next((aNow / FoilAuth::PERIOD + 1) * FoilAuth::PERIOD,
+        FoilAuth::PERIOD);
+    const int n = iDeadlines.count();
+
+    for (int i = 0; i < n; i++) {
+        const int period = iDeadlines.at(i).iPeriod;
+        const qint64 time = (aNow / period + 1) * period;
+
+        if (!i || time < next.iTime ||
+            (time == next.iTime && period < next.iPeriod)) {
+            next = Deadline(time, period);
+        }
+    }
+    return next;
+}
+
+void
+FoilAuthModel::Private::startRolloverTimer()
+{
+    if (iDeadlines.isEmpty()) {
+        iRolloverTimer->stop();
+    } else {
+        const qint64 ms = iDeadlines.first().iTime * 1000 -
+            QDateTime::currentMSecsSinceEpoch();
+
+        iRolloverTimer->start((int) qMax(ms, Q_INT64_C(0)));
+    }
+}
+
+void
+FoilAuthModel::Private::onRolloverTimer()
+{
+    const qint64 now = currentTime();
+    QVector<int> periods;
+
+    // Pop all expired deadlines and push them back with the next one
+    while (!iDeadlines.isEmpty() && iDeadlines.first().iTime <= now) {
+        std::pop_heap(iDeadlines.begin(), iDeadlines.end(), Deadline::later);
+
+        Deadline& next = iDeadlines.last();
+
+        periods.append(next.iPeriod);
+        next.iTime = (now / next.iPeriod + 1) * next.iPeriod;
+        std::push_heap(iDeadlines.begin(), iDeadlines.end(), Deadline::later);
+    }
+
+    if (!periods.isEmpty()) {
+        HDEBUG("Rollover" << periods);
+        rotatePasswords(periods);
+    }
+    startRolloverTimer();
+    emitQueuedSignals();
+}
+
+void
+FoilAuthModel::Private::onClockChanged()
+{
+    // Make the countdown start over
+    iPeriodEnd = 0;
+    if (iTimer->isActive()) {
+        updateTimer();
+    }
+
+    // None of the deadlines can be trusted anymore
+    if (!iDeadlines.isEmpty()) {
+        const qint64 now = currentTime();
+        QVector<int> periods;
+
+        periods.reserve(iDeadlines.count());
+        for (int i = 0; i < iDeadlines.count(); i++) {
+            Deadline& next = iDeadlines[i];
+
+            periods.append(next.iPeriod);
+            next.iTime = (now / next.iPeriod + 1) * next.iPeriod;
+        }
+        std::make_heap(iDeadlines.begin(), iDeadlines.end(), Deadline::later);
+        HDEBUG("Clock changed, updating" << periods);
+        updatePasswords(periods);
+        startRolloverTimer();
+    }
+    emitQueuedSignals();
+}
+
+void
+FoilAuthModel::Private::setFoilState(
+    FoilState aState)
+{
+    if (iFoilState != aState) {
+        iFoilState = aState;
+        HDEBUG(aState);
+        checkTimer();
+        queueSignal(SignalFoilStateChanged);
+    }
+}
+
+void
+FoilAuthModel::Private::dataChanged(
+    int aIndex,
+    ModelData::Role aRole)
+{
+    if (aIndex >= 0 && aIndex < iData.count()) {
+        FoilAuthModel* model = parentObject();
+        QModelIndex modelIndex(model->index(aIndex));
+        QVector<int> roles;
+
+        roles.append(aRole);
+        Q_EMIT model->dataChanged(modelIndex, modelIndex, roles);
+    }
+}
+
+void
+FoilAuthModel::Private::dataChanged(
+    QList<int> aRows,
+    ModelData::Role aRole)
+{
+    const int n = aRows.count();
+
+    if (n > 0) {
+        FoilAuthModel* model = parentObject();
+        QVector<int> roles;
+
+        roles.append(aRole);
+        for (int i = 0; i < n; i++) {
+            const int row = aRows.at(i);
+            if (row >= 0 && row < iData.count()) {
+                QModelIndex modelIndex(model->index(row));
+
+                Q_EMIT model->dataChanged(modelIndex, modelIndex, roles);
+            }
+        }
+    }
+}
+
+void
+FoilAuthModel::Private::insertModelData(
+    ModelData* aData,
+    bool aFront)
+{
+    insertModelData(ModelData::List() << aData, aFront);
+}
+
+// Inserts the whole list with a single range insert. Prepended items
+// end up in the reverse order, same as if they were inserted one by one.
+void
+FoilAuthModel::Private::insertModelData(
+    const ModelData::List& aList,
+    bool aFront)
+{
+    const int n = aList.count();
+
+    if (n > 0) {
+        const int pos = aFront ? 0 : iData.count();
+        FoilAuthModel* model = parentObject();
+
+        model->beginInsertRows(QModelIndex(), pos, pos + n - 1);
+        for (int i = 0; i < n; i++) {
+            ModelData* data = aList.at(i);
+
+            if (aFront) {
+                iData.prepend(data);
+            } else {
+                iData.append(data);
+            }
+            data->setLookupWindow(iLookupWindow);
+            updateLookupIndex(data);
+            updateSecretIndex(data);
+            HDEBUG(data->iId << data->iToken.secretBase32() << data->label());
+        }
+        indexRows(pos);
+        updateGroupHeaderRows();
+        queueSignal(SignalCountChanged);
+        checkTimer();
+        model->endInsertRows();
+    }
+}
+
+void
+FoilAuthModel::Private::onDecryptAllProgress(
+    DecryptAllTask::Progress::Ptr aProgress)
+{
+    if (aProgress && aProgress->iTask == iDecryptAllTask.data()) {
+        if (!iVault) {
+            iVault = aProgress->iVault;
+        }
+        // Transfer ownership of ModelData to the model
+        insertModelData(aProgress->iModelData, false);
+        insertModelData(aProgress->iFrontData, true);
+        resolvePlaceholders(aProgress->iResolvedData);
+        removePlaceholders(aProgress->iFailedIds);
+        aProgress->iModelData.clear();
+        aProgress->iFrontData.clear();
+        aProgress->iResolvedData.clear();
+        aProgress->iFailedIds.clear();
+
+        // The list is usable as soon as all the rows are there, the rest
+        // of the tokens get decrypted in the background
+        if (iFoilState == FoilDecrypting) {
+            setFoilState(FoilModelReady);
+        }
+    }
+    emitQueuedSignals();
+}
+
+// Takes ownership of ModelData
+void
+FoilAuthModel::Private::resolvePlaceholders(
+    const ModelData::List& aList)
+{
+    const int n = aList.count();
+
+    if (n > 0) {
+        FoilAuthModel* model = parentObject();
+        bool favoritesChanged = false;
+
+        for (int i = 0; i < n; i++) {
+            ModelData* data = aList.at(i);
+            const int pos = findDataPos(data->iId);
+            ModelData* placeholder = dataAt(pos);
+
+            if (placeholder && placeholder->iPending) {
+                // The placeholder may have been moved to another group
+                data->iHidden = placeholder->iHidden;
+                if (data->iFavorite != placeholder->iFavorite) {
+                    favoritesChanged = true;
+                }
+                iData[pos] = data;
+                delete placeholder;
+                data->setLookupWindow(iLookupWindow);
+                updateLookupIndex(data);
+                updateSecretIndex(data);
+                HDEBUG(data->iId << data->iToken.secretBase32() <<
+                    data->label());
+
+                const QModelIndex index(model->index(pos));
+                Q_EMIT model->dataChanged(index, index);
+            } else {
+                delete data;
+            }
+        }
+        if (favoritesChanged) {
+            // We are busy decrypting, no need to queue BusyChanged
+            saveInfo();
+        }
+        checkTimer();
+    }
+}
+
+void
+FoilAuthModel::Private::removePlaceholders(
+    const QStringList& aIds)
+{
+    const int n = aIds.count();
+
+    if (n > 0) {
+        QVector<int> rows;
+
+        rows.reserve(n);
+        for (int i = 0; i < n; i++) {
+            const int pos = findDataPos(aIds.at(i));
+            const ModelData* data = dataAt(pos);
+
+            if (data && data->iPending) {
+                rows.append(pos);
+            }
+        }
+        qDeleteAll(takeRows(rows));
+        updateGroupHeaderRows();
+    }
+}
+
+// The view tells which rows it's showing, those get decrypted first
+void
+FoilAuthModel::Private::setVisibleRows(
+    int aFirst,
+    int aLast)
+{
+    if (iDecryptAllTask) {
+        const int last = qMin(aLast, iData.count() - 1);
+        QStringList ids;
+
+        for (int i = qMax(aFirst, 0); i <= last; i++) {
+            const ModelData* data = iData.at(i);
+
+            if (data->iPending) {
+                ids.append(data->iId);
+            }
+        }
+        if (!ids.isEmpty()) {
+            HDEBUG(aFirst << ".." << aLast << ids);
+            iDecryptAllTask->prioritize(ids);
+        }
+    }
+}
+
+void
+FoilAuthModel::Private::onDecryptAllTaskDone()
+{
+    HDEBUG(iData.count() << "token(s) decrypted");
+    HASSERT(sender() == iDecryptAllTask.data());
+
+    bool infoUpdated = iDecryptAllTask->iSaveInfo;
+
+    iVault = iDecryptAllTask->iVault;
+    iDecryptAllTask.reset();
+    if (iFoilState == FoilDecrypting) {
+        setFoilState(FoilModelReady);
+    }
+    if (infoUpdated) {
+        saveInfo();
+    }
+    if (!busy()) {
+        // We know we were busy when we received this signal
+        queueSignal(SignalBusyChanged);
+    }
+    emitQueuedSignals();
+}
+
+// Generates unique id
+QString
+FoilAuthModel::Private::generateId() const
+{
+    GString* dest = g_string_sized_new(8);
+    FoilAuth::generateId(dest);
+    QString id(QString::fromLocal8Bit(dest->str, dest->len));
+
+    while (findData(id) || (iVault && iVault->contains(id))) {
+        g_string_truncate(dest, 0);
+        FoilAuth::generateId(dest);
+        id = QString::fromLocal8Bit(dest->str, dest->len);
+    }
+    g_string_free(dest, TRUE);
+    return id;
+}
+
+// Vault records don't need the empty file to reserve the name
+QString
+FoilAuthModel::Private::newTokenPath() const
+{
+    return iVault ? (iFoilDataDir + "/" + generateId()) :
+        FoilAuth::createEmptyFoilFile(iFoilDataDir);
+}
+
+void
+FoilAuthModel::Private::addGroup(
+    const QString& aTitle)
+{
+    // Insert the new group to the end of the list
+    ModelData* data = new ModelData(generateId(), aTitle);
+    const int pos = iData.count();
+    FoilAuthModel* model = parentObject();
+
+    model->beginInsertRows(QModelIndex(), pos, pos);
+    iData.append(data);
+    indexRows(pos);
+    HDEBUG(data->iId << data->label());
+    queueSignal(SignalCountChanged);
+    saveInfoAndQueueBusySignal();
+    updateGroupHeaderRows();
+    model->endInsertRows();
+}
+
+void
+FoilAuthModel::Private::addToken(
+    const FoilAuthToken& aToken,
+    bool aFavorite)
+{
+    ModelData* data = new ModelData(newTokenPath(), aToken, aFavorite);
+    insertModelData(data, true);
+    updatePasswords(data);
+    encrypt(data);
+}
+
+void
+FoilAuthModel::Private::addTokens(
+    const QList<FoilAuthToken>& aTokens)
+{
+    const int n = aTokens.size();
+
+    if (n == 1) {
+        addToken(aTokens.at(0), false);
+    } else if (n > 1) {
+        ModelData::List newData;
+        QSet<QString> reserved;
+        int i;
+
+        // The ids are reserved in memory, nothing is written until
+        // the import task gets to it
+        reserved.reserve(n);
+        for (i = 0; i < n; i++) {
+            FoilAuthToken token(aTokens.at(i));
+
+            if (token.isValid()) {
+                const QString id(reserveId(reserved));
+                ModelData* data = new ModelData(iFoilDataDir + "/" + id,
+                    token, false);
+
+                HDEBUG(data->iId << token.secretBase32() << token.label());
+                reserved.insert(id);
+                newData.append(data);
+            }
+        }
+
+        if (!newData.isEmpty()) {
+            FoilAuthModel* model = parentObject();
+            const bool wasBusy = busy();
+            const quint64 now = currentTime();
+            const int pos = iData.count();
+            QVector<PasswordBatchTask::Entry> entries;
+            ImportTask* task = new ImportTask(iScheduler->pool
+                (Scheduler::CryptoLane), newData, iPrivateKey, iPublicKey,
+                iVault.data());
+
+            iImportTasks.append(task);
+            connect(task, SIGNAL(progress(int)), SLOT(onImportProgress(int)),
+                Qt::QueuedConnection);
+            iScheduler->submit(Scheduler::CryptoLane, task, this,
+                SLOT(onImportTaskDone()));
+
+            model->beginInsertRows(QModelIndex(), pos, pos + newData.count() - 1);
+            iData.append(newData);
+            entries.reserve(newData.count());
+            for (i = 0; i < newData.count(); i++) {
+                ModelData* data = newData.at(i);
+
+                data->setLookupWindow(iLookupWindow);
+                updateLookupIndex(data);
+                updateSecretIndex(data);
+                if (data->isTimeBased()) {
+                    entries.append(PasswordBatchTask::Entry(pos + i, data,
+                        now, iLookupWindow, false));
+                } else {
+                    updatePasswords(data);
+                }
+            }
+            indexRows(pos);
+            queueSignal(SignalCountChanged);
+            queueSignal(SignalImportPendingChanged);
+            checkTimer();
+            model->endInsertRows();
+
+            // All time based passwords are calculated in one batch
+            submitPasswordBatch(entries);
+            if (!wasBusy) {
+                // We must be busy now
+                queueSignal(SignalBusyChanged);
+            }
         }
-        g_error_free(error);
     }
-
-    iTimer->setSingleShot(true);
-    connect(iTimer, SIGNAL(timeout()), SLOT(onTimer()));
-    clearQueuedSignals();
 }
 
-FoilAuthModel::Private::~Private()
+// Generates an id which is not used by anything, including the ids
+// reserved for the tokens which haven't been written yet
+QString
+FoilAuthModel::Private::reserveId(
+    const QSet<QString>& aReserved) const
 {
-    foil_private_key_unref(iPrivateKey);
-    foil_key_unref(iPublicKey);
+    QString id(generateId());
 
-    iSaveInfoTask.reset();
-    iGenerateKeyTask.reset();
-    iDecryptAllTask.reset();
-    releaseTasks(iEncryptTasks);
-    releaseTasks(iPasswordTasks);
-    iThreadPool->waitForDone();
-    qDeleteAll(iData);
+    while (aReserved.contains(id) ||
+        (!iVault && QFile::exists(iFoilDataDir + "/" + id))) {
+        id = generateId();
+    }
+    return id;
 }
 
-inline
 int
-FoilAuthModel::Private::rowCount() const
+FoilAuthModel::Private::importPending() const
 {
-    return iData.count();
+    int count = 0;
+
+    for (int i = 0; i < iImportTasks.count(); i++) {
+        const ImportTask* task = iImportTasks.at(i);
+
+        count += task->iEntries.count() - task->iReported;
+    }
+    return count;
 }
 
-inline
-FoilAuthModel::ModelData*
-FoilAuthModel::Private::dataAt(
-    int aIndex) const
+void
+FoilAuthModel::Private::onImportProgress(
+    int aCount)
 {
-    if (aIndex >= 0 && aIndex < iData.count()) {
-        return iData.at(aIndex);
-    } else {
-        return Q_NULLPTR;
+    ImportTask* task = qobject_cast<ImportTask*>(sender());
+
+    // Ignore the tasks released by lock()
+    if (task && iImportTasks.contains(task)) {
+        task->iReported += aCount;
+        queueSignal(SignalImportPendingChanged);
+        emitQueuedSignals();
     }
 }
 
-FoilAuthModel::ModelData*
-FoilAuthModel::Private::findData(
-    const QString aId) const
+void
+FoilAuthModel::Private::onImportTaskDone()
 {
-    const int n = iData.count();
+    ImportTask* task = qobject_cast<ImportTask*>(sender());
 
-    for (int i = 0; i < n; i++) {
-        ModelData* data = iData.at(i);
+    if (task) {
+        const QStringList& failed = task->iFailedIds;
+
+        HDEBUG(task->iEntries.count() << "token(s) imported");
+        HVERIFY(iImportTasks.removeAll(task));
+
+        // Give the tokens which failed to get written another chance
+        for (int i = 0; i < failed.count(); i++) {
+            const ModelData* data = findData(failed.at(i));
+
+            if (data) {
+                HWARN("Retrying" << data->iId);
+                encrypt(data);
+            }
+        }
 
-        if (data->iId == aId) {
-            return data;
+        // The info file is saved once for the whole batch
+        saveInfo();
+        queueSignal(SignalImportPendingChanged);
+        task->release();
+        if (!busy()) {
+            // We know we were busy when we received this signal
+            queueSignal(SignalBusyChanged);
         }
+        emitQueuedSignals();
     }
-    return Q_NULLPTR;
 }
 
-int
-FoilAuthModel::Private::findDataPos(
-    const QString aId) const
+void
+FoilAuthModel::Private::encrypt(
+    const ModelData* aData)
 {
-    const int n = iData.count();
+    const bool wasBusy = busy();
+    const quint64 now = currentTime();
+    EncryptTask* last = iLastEncryptTask.value(aData->iId);
 
-    for (int i = 0; i < n; i++) {
-        if (iData.at(i)->iId == aId) {
-            return i;
+    // If the last write of this token hasn't started yet, let it write
+    // the current state. The intermediate states don't need to be saved.
+    if (last && last->supersede(aData, now)) {
+        HDEBUG("Superseded" << aData->iToken.label());
+    } else {
+        // Each write replaces the file written by the previous one
+        EncryptTask* task = new EncryptTask(iScheduler->pool
+            (Scheduler::CryptoLane), aData, iPrivateKey, iPublicKey, now,
+            iFoilDataDir, iVault.data(), last ? last->iTarget.data() :
+            new EncryptTask::Target(aData->iPath));
+
+        iEncryptTasks.append(task);
+        iLastEncryptTask.insert(aData->iId, task);
+        iScheduler->submit(Scheduler::CryptoLane, task, this,
+            SLOT(onEncryptTaskDone()));
+        if (!wasBusy) {
+            // We must be busy now
+            queueSignal(SignalBusyChanged);
         }
     }
-    return -1;
 }
 
-int
-FoilAuthModel::Private::findGroupPos(
-    int aPos) const
+// The remaining writes of the token follow it to the new id
+void
+FoilAuthModel::Private::renameEncryptTasks(
+    const QString& aOldId,
+    const QString& aNewId)
 {
-    if (aPos < iData.count()) {
-        while (aPos >= 0) {
-            if (iData.at(aPos)->isGroupHeader()) {
-                return aPos;
-            } else {
-                aPos--;
-            }
+    EncryptTask* last = iLastEncryptTask.take(aOldId);
+
+    if (last) {
+        iLastEncryptTask.insert(aNewId, last);
+    }
+    for (int i = 0; i < iEncryptTasks.count(); i++) {
+        EncryptTask* task = iEncryptTasks.at(i);
+
+        if (task->iModelId == aOldId) {
+            task->iModelId = aNewId;
         }
     }
-    return -1;
 }
 
-QList<FoilAuthToken>
-FoilAuthModel::Private::getTokens(
-    const QList<int> aRows) const
+void
+FoilAuthModel::Private::onEncryptTaskDone()
 {
-    QList<FoilAuthToken> tokens;
-    const int n = aRows.count();
+    EncryptTask* task = qobject_cast<EncryptTask*>(sender());
 
-    tokens.reserve(n);
-    for (int i = 0; i < n; i++) {
-        ModelData* data = dataAt(aRows.at(i));
-        if (data) {
-            tokens.append(data->iToken);
+    if (task) {
+        HVERIFY(iEncryptTasks.removeAll(task));
+        if (iLastEncryptTask.value(task->iModelId) == task) {
+            iLastEncryptTask.remove(task->iModelId);
+        }
+        if (!task->iNewFile.isEmpty()) {
+            const int pos = findDataPos(task->iModelId);
+
+            if (pos >= 0) {
+                ModelData* data = iData.at(pos);
+                HDEBUG("Encrypted" << qPrintable(task->iNewFile));
+                iRowIndex.remove(data->iId);
+                data->setTokenPath(task->iNewFile);
+                iRowIndex.insert(data->iId, pos);
+                if (data->iId != task->iModelId) {
+                    renameEncryptTasks(task->iModelId, data->iId);
+                }
+
+                // Id has definitely changed, passwords may have changed too
+                // (unless the token has been modified in the meantime)
+                QVector<int> roles;
+
+                roles.append(ModelData::ModelIdRole);
+                if (data->iToken == task->iToken) {
+                    data->setPasswords(task->iToken.periodStart(task->iTime),
+                        task->iPrevPassword, task->iCurrentPassword,
+                        task->iNextPassword, &roles);
+                    updateLookupIndex(data);
+                    completeWindow(pos);
+                }
+
+                FoilAuthModel* model = parentObject();
+                QModelIndex index(model->index(pos));
+
+                Q_EMIT model->dataChanged(index, index, roles);
+                saveInfo();
+            }
+        }
+        task->release();
+        if (!busy()) {
+            // We know we were busy when we received this signal
+            queueSignal(SignalBusyChanged);
         }
+        emitQueuedSignals();
     }
-    return tokens;
 }
 
 void
-FoilAuthModel::Private::setKeys(
-    FoilPrivateKey* aPrivate,
-    FoilKey* aPublic)
+FoilAuthModel::Private::updatePasswords(
+    const ModelData* aData)
 {
-    if (aPrivate) {
-        if (iPrivateKey) {
-            foil_private_key_unref(iPrivateKey);
-        } else {
-            queueSignal(SignalKeyAvailableChanged);
-        }
-        foil_key_unref(iPublicKey);
-        iPrivateKey = foil_private_key_ref(aPrivate);
-        iPublicKey = aPublic ? foil_key_ref(aPublic) :
-            foil_public_key_new_from_private(aPrivate);
-    } else if (iPrivateKey) {
-        queueSignal(SignalKeyAvailableChanged);
-        foil_private_key_unref(iPrivateKey);
-        foil_key_unref(iPublicKey);
-        iPrivateKey = Q_NULLPTR;
-        iPublicKey = Q_NULLPTR;
+    const bool wasBusy = busy();
+    PasswordTask* task = new PasswordTask(iScheduler->pool
+        (Scheduler::CpuLane), aData, currentTime());
+
+    iPasswordTasks.append(task);
+    iScheduler->submit(Scheduler::CpuLane, task, this,
+        SLOT(onPasswordTaskDone()));
+    if (!wasBusy) {
+        // We must be busy now
+        queueSignal(SignalBusyChanged);
     }
 }
 
-bool
-FoilAuthModel::Private::checkPassword(
-    const QString& aPassword)
+void
+FoilAuthModel::Private::onPasswordTaskDone()
 {
-    GError* error = Q_NULLPTR;
-    HDEBUG(iFoilKeyFile);
-    const QByteArray path(iFoilKeyFile.toUtf8());
+    PasswordTask* task = qobject_cast<PasswordTask*>(sender());
 
-    // First make sure that it's encrypted
-    FoilPrivateKey* key = foil_private_key_decrypt_from_file
-        (FOIL_KEY_RSA_PRIVATE, path.constData(), Q_NULLPTR, &error);
+    if (task) {
+        HVERIFY(iPasswordTasks.removeAll(task));
+        const int pos = findDataPos(task->iId);
+        ModelData* data = dataAt(pos);
 
-    if (key) {
-        HWARN("Key not encrypted");
-        foil_private_key_unref(key);
-    } else if (error->domain == FOIL_ERROR) {
-        if (error->code == FOIL_ERROR_KEY_ENCRYPTED) {
-            // Validate the old password
-            QByteArray password(aPassword.toUtf8());
-
-            g_clear_error(&error);
-            key = foil_private_key_decrypt_from_file
-                (FOIL_KEY_RSA_PRIVATE, path.constData(),
-                    password.constData(), &error);
-            if (key) {
-                HDEBUG("Password OK");
-                foil_private_key_unref(key);
-                return true;
-            } else {
-                HDEBUG("Wrong password");
-                g_error_free(error);
+        // Password tasks run in parallel, skip the results calculated
+        // for the state of the token which is no longer there
+        if (data && data->iToken == task->iToken) {
+            QVector<int> roles;
+
+            data->setPasswords(task->iToken.periodStart(task->iTime),
+                task->iPrevPassword, task->iCurrentPassword,
+                task->iNextPassword, &roles);
+            updateLookupIndex(data);
+            completeWindow(pos);
+            if (roles.size() > 0) {
+                HDEBUG("Updated" << qPrintable(data->label()));
+                FoilAuthModel* model = parentObject();
+                QModelIndex modelIndex(model->index(pos));
+
+                Q_EMIT model->dataChanged(modelIndex, modelIndex, roles);
             }
-        } else {
-            HWARN("Key invalid:" << error->message);
-            g_error_free(error);
         }
-    } else {
-        HWARN(error->message);
-        g_error_free(error);
+        task->release();
+        if (!busy()) {
+            // We know we were busy when we received this signal
+            queueSignal(SignalBusyChanged);
+        }
+        emitQueuedSignals();
     }
-    return false;
 }
 
-bool
-FoilAuthModel::Private::changePassword(
-    const QString& aOldPassword,
-    const QString& aNewPassword)
+// Recalculates the passwords which don't match the current period
+void
+FoilAuthModel::Private::updatePasswords(
+    const QVector<int>& aPeriods)
 {
-    HDEBUG(iFoilKeyFile);
-    if (checkPassword(aOldPassword)) {
-        GError* error = Q_NULLPTR;
-        QByteArray password(aNewPassword.toUtf8());
+    const quint64 now = currentTime();
+    const int n = iData.count();
+    QVector<PasswordBatchTask::Entry> entries;
+
+    for (int i = 0; i < n; i++) {
+        const ModelData* data = iData.at(i);
+        const FoilAuthToken& token = data->iToken;
+
+        if (data->isTimeBased() && aPeriods.contains(token.period()) &&
+            (data->iPasswordTime != token.periodStart(now) ||
+             !data->isWindowComplete())) {
+            entries.append(PasswordBatchTask::Entry(i, data, now,
+                iLookupWindow, false));
+        }
+    }
+    submitPasswordBatch(entries);
+}
 
-        // First write the temporary file
-        QString tmpKeyFile = iFoilKeyFile + ".new";
-        const QByteArray tmp(tmpKeyFile.toUtf8());
-        FoilOutput* out = foil_output_file_new_open(tmp.constData());
+// Rollover. If the passwords were calculated for the period which has
+// just ended, the next password becomes current and the current becomes
+// previous right away. Only the farthest password in the window (which
+// is the next one unless the lookup window is wider than that) has to be
+// calculated. Everything else (e.g. if more than one period has passed)
+// gets fully recalculated in the background.
+void
+FoilAuthModel::Private::rotatePasswords(
+    const QVector<int>& aPeriods)
+{
+    const quint64 now = currentTime();
+    const int n = iData.count();
+    QVector<PasswordBatchTask::Entry> entries;
+    QList<int> rows;
 
-        if (foil_private_key_encrypt(iPrivateKey, out,
-            FOIL_KEY_EXPORT_FORMAT_DEFAULT, password.constData(),
-            Q_NULLPTR, &error) && foil_output_flush(out)) {
-            foil_output_unref(out);
+    for (int i = 0; i < n; i++) {
+        ModelData* data = iData.at(i);
+        const FoilAuthToken& token = data->iToken;
 
-            // Then rename it
-            QString saveKeyFile = iFoilKeyFile + ".save";
-            QFile::remove(saveKeyFile);
+        if (data->isTimeBased() && aPeriods.contains(token.period())) {
+            const quint64 t = token.periodStart(now);
 
-            if (QFile::rename(iFoilKeyFile, saveKeyFile) &&
-                QFile::rename(tmpKeyFile, iFoilKeyFile)) {
-                BaseTask::removeFile(saveKeyFile);
-                HDEBUG("Password changed");
-                Q_EMIT parentObject()->passwordChanged();
-                return true;
-            }
-        } else {
-            if (error) {
-                HWARN(error->message);
-                g_error_free(error);
+            if (data->iPasswordTime + token.period() == t &&
+                data->canRotate()) {
+                data->rotatePasswords(t);
+                updateLookupIndex(data);
+                entries.append(PasswordBatchTask::Entry(i, data, now,
+                    iLookupWindow, true));
+                rows.append(i);
+            } else if (data->iPasswordTime != t ||
+                !data->isWindowComplete()) {
+                entries.append(PasswordBatchTask::Entry(i, data, now,
+                    iLookupWindow, false));
             }
-            foil_output_unref(out);
         }
     }
-    return false;
+
+    HDEBUG(rows.count() << "row(s) rotated");
+    if (!rows.isEmpty()) {
+        QVector<int> roles;
+
+        roles.reserve(3);
+        roles.append(ModelData::PrevPasswordRole);
+        roles.append(ModelData::CurrentPasswordRole);
+        roles.append(ModelData::NextPasswordRole);
+        emitRowsChanged(rows, roles);
+    }
+    submitPasswordBatch(entries);
 }
 
-bool
-FoilAuthModel::Private::needTimer() const
+void
+FoilAuthModel::Private::submitPasswordBatch(
+    const QVector<PasswordBatchTask::Entry>& aEntries)
 {
-    if (iFoilState == FoilModelReady) {
-        const int n = iData.count();
+    if (!aEntries.isEmpty()) {
+        const bool wasBusy = busy();
+        PasswordBatchTask* task = new PasswordBatchTask(iScheduler->pool
+            (Scheduler::CpuLane), aEntries);
+
+        iPasswordBatchTasks.append(task);
+        iScheduler->submit(Scheduler::CpuLane, task, this,
+            SLOT(onPasswordBatchTaskDone()));
+        if (!wasBusy) {
+            // We must be busy now
+            queueSignal(SignalBusyChanged);
+        }
+    }
+}
+
+void
+FoilAuthModel::Private::onPasswordBatchTaskDone()
+{
+    PasswordBatchTask* task = qobject_cast<PasswordBatchTask*>(sender());
+
+    if (task) {
+        const int n = task->iEntries.count();
+        const PasswordBatchTask::Entry* entries = task->iEntries.constData();
+        const int rowCount = iData.count();
+        QList<int> rows, nextRows;
+
+        HVERIFY(iPasswordBatchTasks.removeAll(task));
         for (int i = 0; i < n; i++) {
-            if (iData.at(i)->iToken.type() != FoilAuthTypes::AuthTypeHOTP) {
-                return true;
+            const PasswordBatchTask::Entry* e = entries + i;
+            int pos = e->iRow;
+
+            // The model may have changed since the task has been submitted
+            if (pos >= rowCount || iData.at(pos)->iId != e->iId) {
+                pos = findDataPos(e->iId);
+            }
+
+            if (pos >= 0) {
+                ModelData* data = iData.at(pos);
+
+                // Skip the tokens which have been modified in the meantime
+                if (data->iToken == e->iToken) {
+                    if (!e->iFarthestOnly) {
+                        QVector<int> roles;
+
+                        data->setPasswords(e->iTime, e->iPasswords, &roles);
+                        if (!roles.isEmpty()) {
+                            rows.append(pos);
+                        }
+                    } else if (data->setFarthestPassword(e->iTime,
+                        e->iWindow, e->iPasswords.first())) {
+                        nextRows.append(pos);
+                    }
+                    updateLookupIndex(data);
+                }
             }
         }
+
+        HDEBUG(rows.count() << "row(s) updated," << nextRows.count() <<
+            "next password(s)");
+        if (!rows.isEmpty()) {
+            QVector<int> roles;
+
+            roles.reserve(3);
+            roles.append(ModelData::PrevPasswordRole);
+            roles.append(ModelData::CurrentPasswordRole);
+            roles.append(ModelData::NextPasswordRole);
+            emitRowsChanged(rows, roles);
+        }
+        if (!nextRows.isEmpty()) {
+            QVector<int> roles;
+
+            roles.append(ModelData::NextPasswordRole);
+            emitRowsChanged(nextRows, roles);
+        }
+
+        task->release();
+        if (!busy()) {
+            // We know we were busy when we received this signal
+            queueSignal(SignalBusyChanged);
+        }
+        emitQueuedSignals();
     }
-    return false;
 }
 
+// Passwords calculated by the individual tasks only cover previous,
+// current and next periods
 void
-FoilAuthModel::Private::checkTimer()
+FoilAuthModel::Private::completeWindow(
+    int aRow)
 {
-    if (needTimer()) {
-        updateTimer();
-    } else if (iTimer->isActive()){
-        queueSignal(SignalTimerActiveChanged);
-        iTimer->stop();
-    }
-}
+    const ModelData* data = iData.at(aRow);
 
-void
-FoilAuthModel::Private::setFoilState(
-    FoilState aState)
-{
-    if (iFoilState != aState) {
-        iFoilState = aState;
-        HDEBUG(aState);
-        checkTimer();
-        queueSignal(SignalFoilStateChanged);
+    if (data->isTimeBased() && !data->isWindowComplete()) {
+        QVector<PasswordBatchTask::Entry> entries;
+
+        entries.append(PasswordBatchTask::Entry(aRow, data, currentTime(),
+            iLookupWindow, false));
+        submitPasswordBatch(entries);
     }
 }
 
 void
-FoilAuthModel::Private::dataChanged(
-    int aIndex,
-    ModelData::Role aRole)
+FoilAuthModel::Private::setLookupWindow(
+    int aWindow)
 {
-    if (aIndex >= 0 && aIndex < iData.count()) {
-        FoilAuthModel* model = parentObject();
-        QModelIndex modelIndex(model->index(aIndex));
-        QVector<int> roles;
+    const int window = qBound(0, aWindow, MAX_LOOKUP_WINDOW);
 
-        roles.append(aRole);
-        Q_EMIT model->dataChanged(modelIndex, modelIndex, roles);
+    if (iLookupWindow != window) {
+        const int n = iData.count();
+        QVector<int> periods;
+
+        HDEBUG("Lookup window" << window);
+        iLookupWindow = window;
+        for (int i = 0; i < n; i++) {
+            ModelData* data = iData.at(i);
+
+            data->setLookupWindow(window);
+            updateLookupIndex(data);
+        }
+
+        // Fill the new window
+        for (int i = 0; i < iDeadlines.count(); i++) {
+            periods.append(iDeadlines.at(i).iPeriod);
+        }
+        updatePasswords(periods);
+        queueSignal(SignalLookupWindowChanged);
     }
 }
 
+// Incremental, only touches the keys which have changed
 void
-FoilAuthModel::Private::dataChanged(
-    QList<int> aRows,
-    ModelData::Role aRole)
+FoilAuthModel::Private::updateLookupIndex(
+    ModelData* aData)
 {
-    const int n = aRows.count();
+    const QVector<quint64> keys(aData->lookupKeys(iLookupWindow));
+    const QVector<quint64>& oldKeys = aData->iLookupKeys;
+    int i;
 
-    if (n > 0) {
-        FoilAuthModel* model = parentObject();
-        QVector<int> roles;
+    for (i = 0; i < oldKeys.count(); i++) {
+        const quint64 key = oldKeys.at(i);
 
-        roles.append(aRole);
-        for (int i = 0; i < n; i++) {
-            const int row = aRows.at(i);
-            if (row >= 0 && row < iData.count()) {
-                QModelIndex modelIndex(model->index(row));
+        if (!keys.contains(key)) {
+            iLookupIndex.remove(key, aData);
+        }
+    }
+    for (i = 0; i < keys.count(); i++) {
+        const quint64 key = keys.at(i);
 
-                Q_EMIT model->dataChanged(modelIndex, modelIndex, roles);
-            }
+        if (!oldKeys.contains(key)) {
+            iLookupIndex.insert(key, aData);
         }
     }
+    aData->iLookupKeys = keys;
 }
 
 void
-FoilAuthModel::Private::insertModelData(
-    ModelData* aData,
-    bool aFront)
+FoilAuthModel::Private::removeFromLookupIndex(
+    ModelData* aData)
 {
-    // Insert it into the model
-    const int pos = aFront ? 0 : iData.count();
-    FoilAuthModel* model = parentObject();
+    const QVector<quint64>& keys = aData->iLookupKeys;
 
-    model->beginInsertRows(QModelIndex(), pos, pos);
-    if (aFront) {
-        iData.prepend(aData);
-    } else {
-        iData.append(aData);
+    for (int i = 0; i < keys.count(); i++) {
+        iLookupIndex.remove(keys.at(i), aData);
     }
-    HDEBUG(aData->iId << aData->iToken.secretBase32() << aData->label());
-    updateGroupHeaderRows();
-    queueSignal(SignalCountChanged);
-    checkTimer();
-    model->endInsertRows();
+    aData->iLookupKeys.clear();
+}
+
+// Keyed with the per-session salt, so that the index doesn't reveal
+// anything about the secrets to someone who doesn't know the salt
+uint
+FoilAuthModel::Private::secretKey(
+    const QByteArray& aSecret) const
+{
+    return FoilAuthHmac::hash(FoilAuthHmac::Key(aSecret,
+        FoilAuthTypes::DigestAlgorithmSHA256), iSecretSalt);
 }
 
 void
-FoilAuthModel::Private::onDecryptAllProgress(
-    DecryptAllTask::Progress::Ptr aProgress)
+FoilAuthModel::Private::updateSecretIndex(
+    ModelData* aData)
 {
-    if (aProgress && aProgress->iTask == iDecryptAllTask.data()) {
-        // Transfer ownership of this ModelData to the model
-        insertModelData(aProgress->iModelData, aProgress->iFront);
-        aProgress->iModelData = Q_NULLPTR;
+    removeFromSecretIndex(aData);
+    if (aData->isToken()) {
+        aData->iSecretKey = secretKey(aData->iToken.secret());
+        iSecretIndex.insert(aData->iSecretKey, aData);
     }
-    emitQueuedSignals();
 }
 
 void
-FoilAuthModel::Private::onDecryptAllTaskDone()
+FoilAuthModel::Private::removeFromSecretIndex(
+    ModelData* aData)
 {
-    HDEBUG(iData.count() << "token(s) decrypted");
-    HASSERT(sender() == iDecryptAllTask.data());
+    iSecretIndex.remove(aData->iSecretKey, aData);
+}
 
-    bool infoUpdated = iDecryptAllTask->iSaveInfo;
+// Returns the first row containing the secret, -1 if there's none
+int
+FoilAuthModel::Private::findSecretPos(
+    const QByteArray& aSecret) const
+{
+    const uint key = secretKey(aSecret);
+    QMultiHash<uint,ModelData*>::const_iterator it =
+        iSecretIndex.constFind(key);
+    int pos = -1;
 
-    iDecryptAllTask.reset();
-    if (iFoilState == FoilDecrypting) {
-        setFoilState(FoilModelReady);
-    }
-    if (infoUpdated) {
-        saveInfo();
-    }
-    if (!busy()) {
-        // We know we were busy when we received this signal
-        queueSignal(SignalBusyChanged);
+    while (it != iSecretIndex.constEnd() && it.key() == key) {
+        const ModelData* data = it.value();
+
+        if (data->iToken.secret() == aSecret) {
+            const int row = findDataPos(data->iId);
+
+            if (pos < 0 || row < pos) {
+                pos = row;
+            }
+        }
+        ++it;
     }
-    emitQueuedSignals();
+    return pos;
 }
 
-void
-FoilAuthModel::Private::addGroup(
-    const QString& aTitle)
+// Only the tokens sharing the secret can possibly be equal
+int
+FoilAuthModel::Private::findTokenPos(
+    const FoilAuthToken& aToken) const
 {
-    // Generate unique id
-    GString* dest = g_string_sized_new(8);
-    FoilAuth::generateId(dest);
-    QString id(QString::fromLocal8Bit(dest->str, dest->len));
+    const uint key = secretKey(aToken.secret());
+    QMultiHash<uint,ModelData*>::const_iterator it =
+        iSecretIndex.constFind(key);
+    int pos = -1;
 
-    while (findData(id)) {
-        g_string_truncate(dest, 0);
-        FoilAuth::generateId(dest);
-        id = QString::fromLocal8Bit(dest->str, dest->len);
-    }
-    g_string_free(dest, TRUE);
+    while (it != iSecretIndex.constEnd() && it.key() == key) {
+        const ModelData* data = it.value();
 
-    // Insert the new group to the end of the list
-    ModelData* data = new ModelData(id, aTitle);
-    const int pos = iData.count();
-    FoilAuthModel* model = parentObject();
+        if (data->iToken.equals(aToken)) {
+            const int row = findDataPos(data->iId);
 
-    model->beginInsertRows(QModelIndex(), pos, pos);
-    iData.append(data);
-    HDEBUG(data->iId << data->label());
-    queueSignal(SignalCountChanged);
-    saveInfoAndQueueBusySignal();
-    updateGroupHeaderRows();
-    model->endInsertRows();
+            if (pos < 0 || row < pos) {
+                pos = row;
+            }
+        }
+        ++it;
+    }
+    return pos;
 }
 
-void
-FoilAuthModel::Private::addToken(
-    const FoilAuthToken& aToken,
-    bool aFavorite)
+// Returns the rows which have the given code within the lookup window.
+// The index produces the candidates, each of those is then confirmed by
+// comparing the codes in constant time.
+QList<int>
+FoilAuthModel::Private::findPassword(
+    const QString& aCode) const
 {
-    const QString path(FoilAuth::createEmptyFoilFile(iFoilDataDir));
-    ModelData* data = new ModelData(path, aToken, aFavorite);
-    insertModelData(data, true);
-    updatePasswords(data);
-    encrypt(data);
-}
+    QString code(aCode);
+    QList<int> rows;
 
-void
-FoilAuthModel::Private::addTokens(
-    const QList<FoilAuthToken>& aTokens)
-{
-    const int n = aTokens.size();
+    code.remove(QChar(' '));
+    const QList<quint64> keys(FoilAuthToken::passwordKeys(code));
 
-    if (n == 1) {
-        addToken(aTokens.at(0), false);
-    } else if (n > 1) {
-        ModelData::List newData;
-        int i;
+    for (int i = 0; i < keys.count(); i++) {
+        const quint64 key = keys.at(i);
+        QMultiHash<quint64,ModelData*>::const_iterator it =
+            iLookupIndex.constFind(key);
 
-        for (i = 0; i < n; i++) {
-            FoilAuthToken token(aTokens.at(i));
+        while (it != iLookupIndex.constEnd() && it.key() == key) {
+            const ModelData* data = it.value();
 
-            if (token.isValid()) {
-                const QString path(FoilAuth::createEmptyFoilFile(iFoilDataDir));
-                ModelData* data = new ModelData(path, token, false);
+            if (data->checkPassword(code, iLookupWindow)) {
+                const int row = findDataPos(data->iId);
 
-                // Password calculation and encryption happen asynchronously,
-                // we can start doing it even before the data is inserted into
-                // the model
-                HDEBUG(data->iId << token.secretBase32() << token.label());
-                updatePasswords(data);
-                encrypt(data);
-                newData.append(data);
+                if (row >= 0 && !rows.contains(row)) {
+                    rows.append(row);
+                }
             }
-        }
-
-        if (!newData.isEmpty()) {
-            FoilAuthModel* model = parentObject();
-            const int pos = iData.count();
-
-            model->beginInsertRows(QModelIndex(), pos, pos + newData.count() - 1);
-            iData.append(newData);
-            queueSignal(SignalCountChanged);
-            checkTimer();
-            model->endInsertRows();
+            ++it;
         }
     }
+    qSort(rows);
+    HDEBUG(rows.count() << "match(es)");
+    return rows;
 }
 
 void
-FoilAuthModel::Private::encrypt(
-    const ModelData* aData)
+FoilAuthModel::Private::emitRowsChanged(
+    const QList<int>& aRows,
+    const QVector<int>& aRoles)
 {
-    const bool wasBusy = busy();
+    // Emit one dataChanged per contiguous range of rows
+    QList<int> rows(aRows);
+    const int n = rows.count();
+    FoilAuthModel* model = parentObject();
 
-    EncryptTask* task = new EncryptTask(iThreadPool, aData,
-        iPrivateKey, iPublicKey, iLastPeriod * FoilAuth::PERIOD,
-        iFoilDataDir);
-    iEncryptTasks.append(task);
-    task->submit(this, SLOT(onEncryptTaskDone()));
-    if (!wasBusy) {
-        // We must be busy now
-        queueSignal(SignalBusyChanged);
+    qSort(rows);
+    for (int i = 0; i < n;) {
+        const int first = rows.at(i);
+        int last = first;
+
+        for (i++; i < n && rows.at(i) <= last + 1; i++) {
+            last = rows.at(i);
+        }
+        Q_EMIT model->dataChanged(model->index(first), model->index(last),
+            aRoles);
     }
 }
 
+// Schedules the info to be saved. Since the snapshot is taken when
+// the timer fires, it doesn't matter how many times it's called.
 void
-FoilAuthModel::Private::onEncryptTaskDone()
+FoilAuthModel::Private::saveInfo()
 {
-    EncryptTask* task = qobject_cast<EncryptTask*>(sender());
+    // N.B. This method may change the busy state but doesn't queue
+    // BusyChanged signal, it's done by the caller.
+    if (!iSaveInfoPending.isValid()) {
+        iSaveInfoPending.start();
+    }
 
-    if (task) {
-        HVERIFY(iEncryptTasks.removeAll(task));
-        if (!task->iNewFile.isEmpty()) {
-            const int pos = findDataPos(task->iId);
+    const qint64 left = iMaxSaveDelay - iSaveInfoPending.elapsed();
 
-            if (pos >= 0) {
-                ModelData* data = iData.at(pos);
-                HDEBUG("Encrypted" << qPrintable(task->iNewFile));
-                data->setTokenPath(task->iNewFile);
+    iSaveInfoTimer->start((int)qBound((qint64)0, left, (qint64)iSaveDelay));
+}
 
-                // Id has definitely changed, passwords may have changed too
-                QVector<int> roles;
+FoilAuthModel::SaveInfoTask*
+FoilAuthModel::Private::newSaveInfoTask() const
+{
+    SaveInfoTask* task = new SaveInfoTask(iScheduler->pool
+        (Scheduler::CryptoLane), iData, iFoilDataDir, iPrivateKey,
+        iPublicKey, iVault.data());
 
-                roles.append(ModelData::ModelIdRole);
-                if (data->iCurrentPassword != task->iCurrentPassword) {
-                    data->iCurrentPassword = task->iCurrentPassword;
-                    roles.append(ModelData::CurrentPasswordRole);
-                }
-                if (data->iPrevPassword != task->iPrevPassword) {
-                    data->iPrevPassword = task->iPrevPassword;
-                    roles.append(ModelData::PrevPasswordRole);
-                }
-                if (data->iNextPassword != task->iNextPassword) {
-                    data->iNextPassword = task->iNextPassword;
-                    roles.append(ModelData::NextPasswordRole);
-                }
+    if (iSnapshotEnabled && !iVault) {
+        QSet<QString> encrypting;
+        int i;
 
-                FoilAuthModel* model = parentObject();
-                QModelIndex index(model->index(pos));
+        // Files which are about to be replaced stay out of the snapshot,
+        // the tokens will get there with the next save
+        for (i = 0; i < iEncryptTasks.count(); i++) {
+            encrypting.insert(iEncryptTasks.at(i)->iModelId);
+        }
+        for (i = 0; i < iImportTasks.count(); i++) {
+            const QVector<ImportTask::Entry>& entries =
+                iImportTasks.at(i)->iEntries;
 
-                Q_EMIT model->dataChanged(index, index, roles);
-                saveInfo();
+            for (int k = 0; k < entries.count(); k++) {
+                encrypting.insert(entries.at(k).iId);
             }
         }
-        task->release();
-        if (!busy()) {
-            // We know we were busy when we received this signal
-            queueSignal(SignalBusyChanged);
+        for (i = 0; i < iData.count(); i++) {
+            const ModelData* data = iData.at(i);
+
+            if (data->isToken() && !encrypting.contains(data->iId)) {
+                task->iTokens.insert(data->iId, data->iToken);
+            }
         }
-        emitQueuedSignals();
+        task->iSaveSnapshot = true;
     }
+    return task;
 }
 
 void
-FoilAuthModel::Private::updatePasswords(
-    const ModelData* aData)
+FoilAuthModel::Private::saveInfoNow()
 {
-    const bool wasBusy = busy();
-    PasswordTask* task = new PasswordTask(iThreadPool, aData,
-        iLastPeriod * FoilAuth::PERIOD);
+    iSaveInfoTimer->stop();
+    iSaveInfoPending.invalidate();
+    iSaveInfoTask.reset(newSaveInfoTask());
+    iScheduler->submit(Scheduler::CryptoLane, iSaveInfoTask.data(), this,
+        SLOT(onSaveInfoDone()));
+}
 
-    iPasswordTasks.append(task);
-    task->submit(this, SLOT(onPasswordTaskDone()));
-    if (!wasBusy) {
-        // We must be busy now
-        queueSignal(SignalBusyChanged);
+// Writes the pending changes (if any) even if the model is about
+// to be locked or destroyed
+void
+FoilAuthModel::Private::flushInfo()
+{
+    if (iSaveInfoTimer->isActive()) {
+        SaveInfoTask* task = newSaveInfoTask();
+
+        HDEBUG("Flushing");
+        iSaveInfoTimer->stop();
+        iSaveInfoPending.invalidate();
+        task->iFlush = true;
+        iScheduler->submit(Scheduler::CryptoLane, task);
+        task->release();
     }
 }
 
 void
-FoilAuthModel::Private::onPasswordTaskDone()
+FoilAuthModel::Private::onSaveInfoTimer()
 {
-    PasswordTask* task = qobject_cast<PasswordTask*>(sender());
+    const bool wasBusy = busy();
 
-    if (task) {
-        HVERIFY(iPasswordTasks.removeAll(task));
-        const int pos = findDataPos(task->iId);
+    saveInfoNow();
+    if (busy() != wasBusy) {
+        queueSignal(SignalBusyChanged);
+    }
+    emitQueuedSignals();
+}
 
-        if (pos >= 0) {
-            ModelData* data = iData.at(pos);
-            QVector<int> roles;
-            if (data->iPrevPassword != task->iPrevPassword) {
-                data->iPrevPassword = task->iPrevPassword;
-                roles.append(ModelData::PrevPasswordRole);
-            }
-            if (data->iCurrentPassword != task->iCurrentPassword) {
-                data->iCurrentPassword = task->iCurrentPassword;
-                roles.append(ModelData::CurrentPasswordRole);
-            }
-            if (data->iNextPassword != task->iNextPassword) {
-                data->iNextPassword = task->iNextPassword;
-                roles.append(ModelData::NextPasswordRole);
-            }
-            if (roles.size() > 0) {
-                HDEBUG("Updated" << qPrintable(data->label()));
-                FoilAuthModel* model = parentObject();
-                QModelIndex modelIndex(model->index(pos));
+void
+FoilAuthModel::Private::setSaveDelay(
+    int aDelay)
+{
+    const int delay = qMax(aDelay, 0);
 
-                Q_EMIT model->dataChanged(modelIndex, modelIndex, roles);
-            }
-        }
-        task->release();
-        if (!busy()) {
-            // We know we were busy when we received this signal
-            queueSignal(SignalBusyChanged);
-        }
-        emitQueuedSignals();
+    if (iSaveDelay != delay) {
+        iSaveDelay = delay;
+        HDEBUG("Save delay" << delay);
+        queueSignal(SignalSaveDelayChanged);
     }
 }
 
 void
-FoilAuthModel::Private::saveInfo()
+FoilAuthModel::Private::setMaxSaveDelay(
+    int aDelay)
 {
-    // N.B. This method may change the busy state but doesn't queue
-    // BusyChanged signal, it's done by the caller.
-    iSaveInfoTask.reset(new SaveInfoTask(iThreadPool, iData, iFoilDataDir,
-        iPrivateKey, iPublicKey));
-    iSaveInfoTask->submit(this, SLOT(onSaveInfoDone()));
+    const int delay = qMax(aDelay, 0);
+
+    if (iMaxSaveDelay != delay) {
+        iMaxSaveDelay = delay;
+        HDEBUG("Max save delay" << delay);
+        queueSignal(SignalMaxSaveDelayChanged);
+    }
 }
 
 void
@@ -1914,9 +5064,12 @@ FoilAuthModel::Private::generate(
 {
     const bool wasBusy = busy();
 
-    iGenerateKeyTask.reset(new GenerateKeyTask(iThreadPool, iFoilKeyFile,
-        aBits, aPassword));
-    iGenerateKeyTask->submit(this, SLOT(onGenerateKeyTaskDone()));
+    // Whatever the key task was doing, it's irrelevant now
+    iKeyTask.reset();
+    iGenerateKeyTask.reset(new GenerateKeyTask(iScheduler->pool
+        (Scheduler::BackgroundLane), iFoilKeyFile, aBits, aPassword));
+    iScheduler->submit(Scheduler::BackgroundLane, iGenerateKeyTask.data(),
+        this, SLOT(onGenerateKeyTaskDone()));
     setFoilState(FoilGeneratingKey);
     if (!wasBusy) {
         // We know we are busy now
@@ -1956,61 +5109,134 @@ FoilAuthModel::Private::destroyItemAt(
 
     HDEBUG(iData.at(aIndex)->label());
     model->beginRemoveRows(QModelIndex(), aIndex, aIndex);
+    removeFromLookupIndex(iData.at(aIndex));
+    removeFromSecretIndex(iData.at(aIndex));
+    iRowIndex.remove(iData.at(aIndex)->iId);
     delete iData.takeAt(aIndex);
+    indexRows(aIndex);
     model->endRemoveRows();
     queueSignal(SignalCountChanged);
 }
 
-bool
-FoilAuthModel::Private::destroyTokenAndRemoveFilesAt(
-    int aIndex)
+// Removes the rows in as few contiguous ranges as possible. The caller
+// takes ownership of the removed items.
+FoilAuthModel::ModelData::List
+FoilAuthModel::Private::takeRows(
+    QVector<int> aRows)
 {
-    ModelData* data = dataAt(aIndex);
+    ModelData::List taken;
 
-    if (data && !data->isGroupHeader()) {
-        const QString path(data->iPath);
+    std::sort(aRows.begin(), aRows.end());
+    aRows.erase(std::unique(aRows.begin(), aRows.end()), aRows.end());
+    if (!aRows.isEmpty()) {
+        FoilAuthModel* model = parentObject();
+        int i = aRows.count() - 1;
 
-        destroyItemAt(aIndex);
-        checkTimer();
-        BaseTask::removeFile(path);
-        return true;
+        // Bottom up, so that the rows above stay where they are
+        taken.reserve(aRows.count());
+        while (i >= 0) {
+            const int last = aRows.at(i--);
+            int first = last;
+
+            while (i >= 0 && aRows.at(i) == first - 1) {
+                first = aRows.at(i--);
+            }
+
+            HDEBUG("Removing rows" << first << ".." << last);
+            model->beginRemoveRows(QModelIndex(), first, last);
+            for (int k = first; k <= last; k++) {
+                ModelData* data = iData.at(k);
+
+                removeFromLookupIndex(data);
+                removeFromSecretIndex(data);
+                iRowIndex.remove(data->iId);
+                taken.append(data);
+            }
+            iData.erase(iData.begin() + first, iData.begin() + last + 1);
+            indexRows(first);
+            model->endRemoveRows();
+        }
+        queueSignal(SignalCountChanged);
     }
-    return false;
+    return taken;
 }
 
 void
 FoilAuthModel::Private::deleteToken(
     const QString& aId)
 {
-    const bool wasBusy = busy();
-    if (destroyTokenAndRemoveFilesAt(findDataPos(aId))) {
-        saveInfoAndQueueBusySignal(wasBusy);
-        updateGroupHeaderRows();
-    } else {
-        HDEBUG("Invalid token id" << aId);
-    }
+    deleteTokens(QStringList(aId));
 }
 
+// The rows are removed right away, the files in the background
 void
 FoilAuthModel::Private::deleteTokens(
     const QStringList& aIds)
 {
     const bool wasBusy = busy();
     const int n = aIds.count();
-    int deleted = 0;
+    QVector<int> rows;
 
+    rows.reserve(n);
     for (int i = 0; i < n; i++) {
         const QString id(aIds.at(i));
-        if (destroyTokenAndRemoveFilesAt(findDataPos(id))) {
-            deleted++;
+        const int pos = findDataPos(id);
+        const ModelData* data = dataAt(pos);
+
+        // Placeholders can't be deleted, their files are still being decrypted
+        if (data && data->isToken()) {
+            rows.append(pos);
         } else {
             HDEBUG("Invalid token id" << id);
         }
     }
 
-    if (deleted) {
-        saveInfoAndQueueBusySignal(wasBusy);
+    if (!rows.isEmpty()) {
+        const ModelData::List deleted(takeRows(rows));
+        QList<EncryptTask::Target::Ptr> targets;
+
+        // Pending writes of the deleted tokens are no longer needed.
+        // Those already running leave a file which gets deleted too.
+        targets.reserve(deleted.count());
+        for (int i = 0; i < deleted.count(); i++) {
+            const ModelData* data = deleted.at(i);
+            EncryptTask* last = iLastEncryptTask.take(data->iId);
+
+            if (last) {
+                last->discard();
+                targets.append(last->iTarget);
+            } else {
+                targets.append(EncryptTask::Target::Ptr
+                    (new EncryptTask::Target(data->iPath)));
+            }
+        }
+
+        DeleteTask* task = new DeleteTask(iScheduler->pool
+            (Scheduler::CryptoLane), deleted, targets, iVault.data());
+
+        qDeleteAll(deleted);
+        iDeleteTasks.append(task);
+        iScheduler->submit(Scheduler::CryptoLane, task, this,
+            SLOT(onDeleteTaskDone()));
+        checkTimer();
         updateGroupHeaderRows();
+        saveInfoAndQueueBusySignal(wasBusy);
+    }
+}
+
+void
+FoilAuthModel::Private::onDeleteTaskDone()
+{
+    DeleteTask* task = qobject_cast<DeleteTask*>(sender());
+
+    if (task) {
+        HVERIFY(iDeleteTasks.removeAll(task));
+        task->release();
+        if (!busy()) {
+            // We know we were busy when we received this signal
+            queueSignal(SignalBusyChanged);
+        }
+        emitQueuedSignals();
     }
 }
 
@@ -2022,6 +5248,9 @@ FoilAuthModel::Private::clearModel()
         FoilAuthModel* model = parentObject();
 
         model->beginRemoveRows(QModelIndex(), 0, n - 1);
+        iLookupIndex.clear();
+        iSecretIndex.clear();
+        iRowIndex.clear();
         qDeleteAll(iData);
         iData.clear();
         model->endRemoveRows();
@@ -2038,14 +5267,37 @@ FoilAuthModel::Private::lock(
     FoilAuthModel* model = parentObject();
     const bool wasBusy = busy();
 
+    // Including the unlock in progress
+    cancelKeyTask();
+
+    // Except for the pending changes, those get saved
+    flushInfo();
     iSaveInfoTask.reset();
     iDecryptAllTask.reset();
     iGenerateKeyTask.reset();
     releaseTasks(iEncryptTasks);
+    iLastEncryptTask.clear();
+    releaseTasks(iPasswordBatchTasks);
+    if (!iImportTasks.isEmpty()) {
+        // The tokens still get written, but the model no longer cares
+        releaseTasks(iImportTasks);
+        queueSignal(SignalImportPendingChanged);
+    }
+    iVault.reset();
 
     // Destroy decrypted notes
     if (!iData.isEmpty()) {
-        model->beginRemoveRows(QModelIndex(), 0, iData.count() - 1);
+        const int n = iData.count();
+
+        // Tokens may outlive the model data (e.g. if they are still
+        // referenced by a pending task), wipe the cached key state now
+        for (int i = 0; i < n; i++) {
+            iData.at(i)->iToken.clearCache();
+        }
+        model->beginRemoveRows(QModelIndex(), 0, n - 1);
+        iLookupIndex.clear();
+        iSecretIndex.clear();
+        iRowIndex.clear();
         qDeleteAll(iData);
         iData.clear();
         model->endRemoveRows();
@@ -2054,6 +5306,8 @@ FoilAuthModel::Private::lock(
         checkTimer();
     }
 
+    // The next session gets a new salt
+    foil_random(&iSecretSalt, sizeof(iSecretSalt));
     if (busy() != wasBusy) {
         queueSignal(SignalBusyChanged);
     }
@@ -2072,107 +5326,274 @@ bool
 FoilAuthModel::Private::unlock(
     const QString& aPassword)
 {
-    GError* error = Q_NULLPTR;
-    HDEBUG(iFoilKeyFile);
-    const QByteArray path(iFoilKeyFile.toUtf8());
-    bool ok = false;
+    const bool wasBusy = busy();
+    FoilPrivateKey* key;
+    FoilState state;
 
-    // First make sure that it's encrypted
-    FoilPrivateKey* key = foil_private_key_decrypt_from_file
-        (FOIL_KEY_RSA_PRIVATE, path.constData(), Q_NULLPTR, &error);
+    // A pending probe or unlock is irrelevant now
+    if (iKeyTask && (iKeyTask->iAction == KeyTask::ProbeKey ||
+        iKeyTask->iAction == KeyTask::Unlock)) {
+        iKeyTask.reset();
+    }
 
+    HDEBUG(iFoilKeyFile);
+    state = KeyTask::decryptKey(iFoilKeyFile, &aPassword, &key);
     if (key) {
-        HWARN("Key not encrypted");
-        setFoilState(FoilKeyNotEncrypted);
+        HDEBUG("Password accepted, thank you!");
+        decryptAll(key);
         foil_private_key_unref(key);
-    } else if (error->domain == FOIL_ERROR) {
-        if (error->code == FOIL_ERROR_KEY_ENCRYPTED) {
-            // Then try to decrypt it
-            const QByteArray password(aPassword.toUtf8());
-
-            g_clear_error(&error);
-            key = foil_private_key_decrypt_from_file
-                (FOIL_KEY_RSA_PRIVATE, path.constData(),
-                    password.constData(), &error);
-            if (key) {
-                HDEBUG("Password accepted, thank you!");
-                setKeys(key);
-                // Now that we know the key, decrypt the tokens
-                iDecryptAllTask.reset(new DecryptAllTask(iThreadPool,
-                    iFoilDataDir, iPrivateKey, iPublicKey));
-                clearModel();
-                connect(iDecryptAllTask.data(),
-                    SIGNAL(progress(DecryptAllTask::Progress::Ptr)),
-                    SLOT(onDecryptAllProgress(DecryptAllTask::Progress::Ptr)),
-                    Qt::QueuedConnection);
-                iDecryptAllTask->submit(this, SLOT(onDecryptAllTaskDone()));
-                setFoilState(FoilDecrypting);
-                foil_private_key_unref(key);
-                ok = true;
+    } else {
+        setFoilState(state);
+    }
+    if (busy() != wasBusy) {
+        queueSignal(SignalBusyChanged);
+    }
+    return key != Q_NULLPTR;
+}
+
+// The state goes to FoilUnlocking and then either to FoilDecrypting
+// or to whatever state the key is in, and unlockFailed() is emitted
+bool
+FoilAuthModel::Private::unlockAsync(
+    const QString& aPassword)
+{
+    switch (iFoilState) {
+    case FoilCheckingKey:
+    case FoilLocked:
+    case FoilLockedTimedOut:
+    case FoilUnlocking:
+        HDEBUG(iFoilKeyFile);
+        startKeyTask(KeyTask::Unlock, aPassword);
+        return true;
+    case FoilKeyMissing:
+    case FoilKeyInvalid:
+    case FoilKeyError:
+    case FoilKeyNotEncrypted:
+    case FoilGeneratingKey:
+    case FoilDecrypting:
+    case FoilModelReady:
+        break;
+    }
+    return false;
+}
+
+// Now that we know the key, decrypt the tokens
+void
+FoilAuthModel::Private::decryptAll(
+    FoilPrivateKey* aKey)
+{
+    setKeys(aKey);
+    iDecryptAllTask.reset(new DecryptAllTask(iScheduler->pool
+        (Scheduler::CryptoLane), iScheduler->pool(Scheduler::CpuLane),
+        iFoilDataDir, iPrivateKey, iPublicKey, iVaultEnabled,
+        iSnapshotEnabled));
+    clearModel();
+    connect(iDecryptAllTask.data(),
+        SIGNAL(progress(DecryptAllTask::Progress::Ptr)),
+        SLOT(onDecryptAllProgress(DecryptAllTask::Progress::Ptr)),
+        Qt::QueuedConnection);
+    iScheduler->submit(Scheduler::CryptoLane,
+        iDecryptAllTask.data(), this,
+        SLOT(onDecryptAllTaskDone()));
+    setFoilState(FoilDecrypting);
+}
+
+// Only one key task at a time, a new one replaces the old one
+void
+FoilAuthModel::Private::startKeyTask(
+    KeyTask::Action aAction,
+    const QString& aPassword,
+    const QString& aNewPassword)
+{
+    const bool wasBusy = busy();
+
+    iKeyTask.reset(new KeyTask(iScheduler->pool(Scheduler::CpuLane),
+        aAction, iFoilKeyFile, aPassword, aNewPassword));
+    iScheduler->submit(Scheduler::CpuLane, iKeyTask.data(), this,
+        SLOT(onKeyTaskDone()));
+    if (aAction == KeyTask::Unlock) {
+        // Another attempt doesn't change where we go back to
+        if (iFoilState != FoilUnlocking) {
+            iKeyTaskPrevState = iFoilState;
+        }
+        setFoilState(FoilUnlocking);
+    }
+    if (!wasBusy) {
+        // We know we are busy now
+        queueSignal(SignalBusyChanged);
+    }
+}
+
+// The task keeps running (the KDF can't be interrupted) but its
+// results are dropped and the key file is left alone
+void
+FoilAuthModel::Private::cancelKeyTask()
+{
+    if (iKeyTask && iKeyTask->iAction != KeyTask::ProbeKey) {
+        const bool wasBusy = busy();
+        const KeyTask::Action action = iKeyTask->iAction;
+
+        HDEBUG("Canceling" << action);
+        iKeyTask.reset();
+        if (action == KeyTask::Unlock) {
+            if (iKeyTaskPrevState == FoilCheckingKey) {
+                // The unlock has replaced the probe, restart it
+                startKeyTask(KeyTask::ProbeKey);
             } else {
-                HDEBUG("Wrong password");
-                g_error_free(error);
-                setFoilState(FoilLocked);
+                setFoilState(iKeyTaskPrevState);
             }
+        }
+        if (busy() != wasBusy) {
+            queueSignal(SignalBusyChanged);
+        }
+    }
+}
+
+void
+FoilAuthModel::Private::onKeyTaskDone()
+{
+    HASSERT(sender() == iKeyTask.data());
+    FoilAuthModel* model = parentObject();
+    const KeyTask::Action action = iKeyTask->iAction;
+    const bool passwordOk = iKeyTask->iPasswordOk;
+    const bool passwordChanged = iKeyTask->iPasswordChanged;
+    bool unlockFailed = false;
+
+    if (action == KeyTask::Unlock && iKeyTask->iPrivateKey) {
+        HDEBUG("Password accepted, thank you!");
+        decryptAll(iKeyTask->iPrivateKey);
+    } else if (action == KeyTask::ProbeKey || action == KeyTask::Unlock) {
+        HDEBUG("Key state" << iKeyTask->iKeyState);
+        setFoilState(iKeyTask->iKeyState);
+        unlockFailed = (action == KeyTask::Unlock);
+    }
+    iKeyTask.reset();
+    if (!busy()) {
+        // We know we were busy when we received this signal
+        queueSignal(SignalBusyChanged);
+    }
+
+    // The handlers may start another task
+    if (action == KeyTask::CheckPassword) {
+        Q_EMIT model->passwordChecked(passwordOk);
+    } else if (action == KeyTask::ChangePassword) {
+        if (passwordChanged) {
+            Q_EMIT model->passwordChanged();
         } else {
-            HWARN("Key invalid:" << error->message);
-            g_error_free(error);
-            setFoilState(FoilKeyInvalid);
+            Q_EMIT model->passwordChangeFailed();
         }
-    } else {
-        HWARN(error->message);
-        g_error_free(error);
-        setFoilState(FoilKeyMissing);
+    } else if (unlockFailed) {
+        Q_EMIT model->unlockFailed();
     }
-    return ok;
+    emitQueuedSignals();
 }
 
 bool
 FoilAuthModel::Private::busy() const
 {
     if (!iSaveInfoTask.isNull() ||
+        iSaveInfoTimer->isActive() ||
         !iGenerateKeyTask.isNull() ||
+        !iKeyTask.isNull() ||
         !iDecryptAllTask.isNull() ||
         !iEncryptTasks.isEmpty() ||
-        !iPasswordTasks.isEmpty()) {
+        !iPasswordTasks.isEmpty() ||
+        !iDeleteTasks.isEmpty() ||
+        !iImportTasks.isEmpty() ||
+        !iPasswordBatchTasks.isEmpty()) {
         return true;
     } else {
         return false;
     }
 }
 
+int
+FoilAuthModel::Private::timeLeft() const
+{
+    // Calculated on demand, in tickless mode nothing updates iTimeLeft
+    // between the period boundaries
+    if (iTimer->isActive()) {
+        const qint64 now = currentTime();
+
+        return (int)(nextDeadline(now).iTime - now);
+    } else {
+        return iTimeLeft;
+    }
+}
+
+void
+FoilAuthModel::Private::setTickless(
+    bool aTickless)
+{
+    if (iTickless != aTickless) {
+        iTickless = aTickless;
+        HDEBUG("Tickless" << aTickless);
+        // Coarse timers may fire way too early for 30 sec intervals
+        iTimer->setTimerType(aTickless ? Qt::PreciseTimer : Qt::CoarseTimer);
+        if (iTimer->isActive()) {
+            updateTimer();
+        }
+        queueSignal(SignalTicklessChanged);
+    }
+}
+
+// Takes effect when the model gets unlocked. Enabling it migrates
+// the files into the vault, disabling exports the vault back into
+// the individual files.
+void
+FoilAuthModel::Private::setVault(
+    bool aEnabled)
+{
+    if (iVaultEnabled != aEnabled) {
+        iVaultEnabled = aEnabled;
+        HDEBUG("Vault" << aEnabled);
+        queueSignal(SignalVaultChanged);
+    }
+}
+
+// Takes effect with the next save of the info. The snapshot is only
+// used without the vault, which can be loaded in one go anyway.
+void
+FoilAuthModel::Private::setSnapshot(
+    bool aEnabled)
+{
+    if (iSnapshotEnabled != aEnabled) {
+        iSnapshotEnabled = aEnabled;
+        HDEBUG("Snapshot" << aEnabled);
+        queueSignal(SignalSnapshotChanged);
+    }
+}
+
 void
 FoilAuthModel::Private::updateTimer()
 {
     const qint64 msecsSinceEpoch = QDateTime::currentMSecsSinceEpoch();
     const qint64 secsSinceEpoch = msecsSinceEpoch / 1000;
-    const qint64 thisPeriod = secsSinceEpoch / FoilAuth::PERIOD;
-    const qint64 nextSecond = (secsSinceEpoch + 1) * 1000;
+    const Deadline next(nextDeadline(secsSinceEpoch));
     const uint lastTimeLeft = iTimeLeft;
 
     if (!iTimer->isActive()) {
         queueSignal(SignalTimerActiveChanged);
+        queueSignal(SignalPeriodEndChanged);
     }
-    iTimer->start((int)(nextSecond - msecsSinceEpoch));
-    if (iLastPeriod != thisPeriod) {
-        iLastPeriod = thisPeriod;
-        iTimeLeft = FoilAuth::PERIOD;
-        queueSignal(SignalTimeLeftChanged);
-        const int n = iData.count();
-        for (int i = 0; i < n; i++) {
-            const ModelData* data = iData.at(i);
 
-            if (!data->isGroupHeader()) {
-                updatePasswords(data);
-            }
+    // In tickless mode the timer only fires at the end of the period,
+    // QML animates the countdown on its own
+    iTimer->start((int)((iTickless ? next.iTime :
+        (secsSinceEpoch + 1)) * 1000 - msecsSinceEpoch));
+    iTimeLeft = (uint)(next.iTime - secsSinceEpoch);
+    if (iPeriodEnd != next.iTime) {
+        iPeriodEnd = next.iTime;
+        if (iPeriod != next.iPeriod) {
+            iPeriod = next.iPeriod;
+            queueSignal(SignalPeriodChanged);
         }
+        queueSignal(SignalTimeLeftChanged);
+        queueSignal(SignalPeriodEndChanged);
         Q_EMIT parentObject()->timerRestarted();
-    } else {
-        const qint64 endOfThisPeriod = (thisPeriod + 1) * FoilAuth::PERIOD;
-        iTimeLeft = (int)(endOfThisPeriod - secsSinceEpoch);
     }
 
-    if (lastTimeLeft != iTimeLeft) {
+    if (lastTimeLeft != iTimeLeft && !iTickless) {
         queueSignal(SignalTimeLeftChanged);
     }
 }
@@ -2310,7 +5731,8 @@ FoilAuthModel::setData(
     const int row = aIndex.row();
     ModelData* data = iPrivate->dataAt(row);
 
-    if (data) {
+    // Nothing to edit until the placeholder is replaced with the token
+    if (data && !data->iPending) {
         QVector<int> roles;
 
         switch ((ModelData::Role)aRole) {
@@ -2321,6 +5743,8 @@ FoilAuthModel::setData(
                 HDEBUG(row << "favorite" << favorite);
                 if (data->iFavorite != favorite) {
                     data->iFavorite = favorite;
+                    // The info knows the favorites too
+                    iPrivate->saveInfoAndQueueBusySignal();
                     iPrivate->encrypt(data);
                     iPrivate->emitQueuedSignals();
                     roles.append(aRole);
@@ -2399,6 +5823,7 @@ FoilAuthModel::setData(
                     if (data->iToken.secret() != secret) {
                         // Secret has actually changed
                         data->iToken = data->iToken.withSecret(secret);
+                        iPrivate->updateSecretIndex(data);
                         iPrivate->encrypt(data);
                         iPrivate->emitQueuedSignals();
                         roles.append(aRole);
@@ -2417,6 +5842,8 @@ FoilAuthModel::setData(
                 if (ok) {
                     if (data->iToken.digits() != digits) {
                         data->iToken = data->iToken.withDigits(digits);
+                        data->clearPasswords(&roles);
+                        iPrivate->updateLookupIndex(data);
                         iPrivate->encrypt(data);
                         iPrivate->emitQueuedSignals();
                         roles.append(aRole);
@@ -2436,7 +5863,10 @@ FoilAuthModel::setData(
                     HDEBUG(row << "type" << type);
                     if (data->iToken.type() != type) {
                         data->iToken = data->iToken.withType(type);
+                        data->clearPasswords(&roles);
+                        iPrivate->updateLookupIndex(data);
                         iPrivate->encrypt(data);
+                        iPrivate->checkTimer();
                         iPrivate->emitQueuedSignals();
                         roles.append(aRole);
                         Q_EMIT dataChanged(aIndex, aIndex, roles);
@@ -2500,10 +5930,32 @@ FoilAuthModel::setData(
                 }
             }
             break;
+        case ModelData::PeriodRole:
+            if (!data->isGroupHeader()) {
+                bool ok;
+                const int period = aValue.toInt(&ok);
+
+                HDEBUG(row << "period" << period);
+                if (ok && FoilAuthToken::validPeriod(period) == period) {
+                    if (data->iToken.period() != period) {
+                        data->iToken = data->iToken.withPeriod(period);
+                        data->clearPasswords(&roles);
+                        iPrivate->updateLookupIndex(data);
+                        iPrivate->encrypt(data);
+                        iPrivate->checkTimer();
+                        iPrivate->emitQueuedSignals();
+                        roles.append(aRole);
+                        Q_EMIT dataChanged(aIndex, aIndex, roles);
+                    }
+                    return true;
+                }
+            }
+            break;
         // No default to make sure that we get "warning: enumeration value
         // not handled in switch" if we forget to handle a real role.
         case ModelData::ModelIdRole:
         case ModelData::GroupHeaderRole:
+        case ModelData::PendingRole:
         case ModelData::IssuerRole:
         case ModelData::PrevPasswordRole:
         case ModelData::CurrentPasswordRole:
@@ -2534,6 +5986,8 @@ FoilAuthModel::moveRows(
         beginMoveRows(aSrcParent, aSrcRow, aSrcRow, aDestParent,
            (aDestRow < aSrcRow) ? aDestRow : (aDestRow + 1));
         iPrivate->iData.move(aSrcRow, aDestRow);
+        iPrivate->indexRows(qMin(aSrcRow, aDestRow),
+            qMax(aSrcRow, aDestRow) + 1);
         endMoveRows();
 
         if (aDestRow > 0) {
@@ -2577,13 +6031,110 @@ FoilAuthModel::moveRows(
 int
 FoilAuthModel::period() const
 {
-    return FoilAuth::PERIOD;
+    return iPrivate->iPeriod;
 }
 
 int
 FoilAuthModel::timeLeft() const
 {
-    return iPrivate->iTimeLeft;
+    return iPrivate->timeLeft();
+}
+
+qint64
+FoilAuthModel::periodEnd() const
+{
+    return iPrivate->iTimer->isActive() ?
+        (iPrivate->iPeriodEnd * 1000) : 0;
+}
+
+bool
+FoilAuthModel::tickless() const
+{
+    return iPrivate->iTickless;
+}
+
+void
+FoilAuthModel::setTickless(
+    bool aTickless)
+{
+    iPrivate->setTickless(aTickless);
+    iPrivate->emitQueuedSignals();
+}
+
+bool
+FoilAuthModel::vault() const
+{
+    return iPrivate->iVaultEnabled;
+}
+
+void
+FoilAuthModel::setVault(
+    bool aEnabled)
+{
+    iPrivate->setVault(aEnabled);
+    iPrivate->emitQueuedSignals();
+}
+
+bool
+FoilAuthModel::snapshot() const
+{
+    return iPrivate->iSnapshotEnabled;
+}
+
+void
+FoilAuthModel::setSnapshot(
+    bool aEnabled)
+{
+    iPrivate->setSnapshot(aEnabled);
+    iPrivate->emitQueuedSignals();
+}
+
+int
+FoilAuthModel::lookupWindow() const
+{
+    return iPrivate->iLookupWindow;
+}
+
+void
+FoilAuthModel::setLookupWindow(
+    int aWindow)
+{
+    iPrivate->setLookupWindow(aWindow);
+    iPrivate->emitQueuedSignals();
+}
+
+int
+FoilAuthModel::saveDelay() const
+{
+    return iPrivate->iSaveDelay;
+}
+
+void
+FoilAuthModel::setSaveDelay(
+    int aDelay)
+{
+    iPrivate->setSaveDelay(aDelay);
+    iPrivate->emitQueuedSignals();
+}
+
+int
+FoilAuthModel::maxSaveDelay() const
+{
+    return iPrivate->iMaxSaveDelay;
+}
+
+void
+FoilAuthModel::setMaxSaveDelay(
+    int aDelay)
+{
+    iPrivate->setMaxSaveDelay(aDelay);
+    iPrivate->emitQueuedSignals();
+}
+
+int
+FoilAuthModel::importPending() const
+{
+    return iPrivate->importPending();
 }
 
 bool
@@ -2620,7 +6171,9 @@ bool
 FoilAuthModel::checkPassword(
     QString aPassword)
 {
-    return iPrivate->checkPassword(aPassword);
+    const bool ok = iPrivate->checkPassword(aPassword);
+    iPrivate->emitQueuedSignals();
+    return ok;
 }
 
 bool
@@ -2628,7 +6181,26 @@ FoilAuthModel::changePassword(
     QString aOld,
     QString aNew)
 {
-    bool ok = iPrivate->changePassword(aOld, aNew);
+    const bool ok = iPrivate->changePassword(aOld, aNew);
+    iPrivate->emitQueuedSignals();
+    return ok;
+}
+
+bool
+FoilAuthModel::checkPasswordAsync(
+    QString aPassword)
+{
+    const bool ok = iPrivate->checkPasswordAsync(aPassword);
+    iPrivate->emitQueuedSignals();
+    return ok;
+}
+
+bool
+FoilAuthModel::changePasswordAsync(
+    QString aOld,
+    QString aNew)
+{
+    const bool ok = iPrivate->changePasswordAsync(aOld, aNew);
     iPrivate->emitQueuedSignals();
     return ok;
 }
@@ -2659,6 +6231,22 @@ FoilAuthModel::unlock(
     return ok;
 }
 
+bool
+FoilAuthModel::unlockAsync(
+    const QString aPassword)
+{
+    const bool ok = iPrivate->unlockAsync(aPassword);
+    iPrivate->emitQueuedSignals();
+    return ok;
+}
+
+void
+FoilAuthModel::cancelKeyTask()
+{
+    iPrivate->cancelKeyTask();
+    iPrivate->emitQueuedSignals();
+}
+
 void
 FoilAuthModel::addGroup(
     const QString aTitle)
@@ -2677,15 +6265,17 @@ FoilAuthModel::addToken(
     int aDigits,
     int aCounter,
     int aTimeShift,
-    int aAlgorithm)
+    int aAlgorithm,
+    int aPeriod)
 {
     const QByteArray secretBytes(HarbourBase32::fromBase32(aSecretBase32));
 
-    HDEBUG(aSecretBase32 << aLabel << aIssuer << aDigits << aCounter << aTimeShift << aAlgorithm);
+    HDEBUG(aSecretBase32 << aLabel << aIssuer << aDigits << aCounter <<
+        aTimeShift << aAlgorithm << aPeriod);
     if (secretBytes.size() > 0) {
         iPrivate->addToken(FoilAuthToken((FoilAuthTypes::AuthType) aType,
             secretBytes, aLabel, aIssuer, aDigits, aCounter, aTimeShift,
-            (FoilAuthTypes::DigestAlgorithm) aAlgorithm));
+            (FoilAuthTypes::DigestAlgorithm) aAlgorithm, aPeriod));
         iPrivate->emitQueuedSignals();
         return true;
     }
@@ -2765,6 +6355,22 @@ FoilAuthModel::getIdsAt(
     return ids;
 }
 
+// Decryption hint from the view
+void
+FoilAuthModel::setVisibleRows(
+    int aFirst,
+    int aLast)
+{
+    iPrivate->setVisibleRows(aFirst, aLast);
+}
+
+QList<int>
+FoilAuthModel::findPassword(
+    const QString aCode) const
+{
+    return iPrivate->findPassword(aCode);
+}
+
 QList<int>
 FoilAuthModel::itemRowsForGroupAt(
     int aRow) const
@@ -2788,28 +6394,14 @@ int
 FoilAuthModel::indexOf(
     FoilAuthToken aToken) const
 {
-    if (aToken.isValid()) {
-        const int n = iPrivate->rowCount();
-        for (int i = 0; i < n; i++) {
-            if (iPrivate->dataAt(i)->iToken.equals(aToken)) {
-                return i;
-            }
-        }
-    }
-    return -1;
+    return aToken.isValid() ? iPrivate->findTokenPos(aToken) : -1;
 }
 
 bool
 FoilAuthModel::containsSecret(
     const QByteArray aSecret) const
 {
-    const int n = iPrivate->rowCount();
-    for (int i = 0; i < n; i++) {
-        if (iPrivate->dataAt(i)->iToken.secret() == aSecret) {
-            return true;
-        }
-    }
-    return false;
+    return iPrivate->findSecretPos(aSecret) >= 0;
 }
 
 QStringList
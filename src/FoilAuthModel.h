@@ -54,10 +54,18 @@ class FoilAuthModel :
 {
     Q_OBJECT
     Q_ENUMS(FoilState)
-    Q_PROPERTY(int period READ period CONSTANT)
+    Q_PROPERTY(int period READ period NOTIFY periodChanged)
     Q_PROPERTY(int timeLeft READ timeLeft NOTIFY timeLeftChanged)
+    Q_PROPERTY(qint64 periodEnd READ periodEnd NOTIFY periodEndChanged)
+    Q_PROPERTY(bool tickless READ tickless WRITE setTickless NOTIFY ticklessChanged)
+    Q_PROPERTY(int lookupWindow READ lookupWindow WRITE setLookupWindow NOTIFY lookupWindowChanged)
+    Q_PROPERTY(bool vault READ vault WRITE setVault NOTIFY vaultChanged)
+    Q_PROPERTY(bool snapshot READ snapshot WRITE setSnapshot NOTIFY snapshotChanged)
+    Q_PROPERTY(int saveDelay READ saveDelay WRITE setSaveDelay NOTIFY saveDelayChanged)
+    Q_PROPERTY(int maxSaveDelay READ maxSaveDelay WRITE setMaxSaveDelay NOTIFY maxSaveDelayChanged)
     Q_PROPERTY(int count READ rowCount NOTIFY countChanged)
     Q_PROPERTY(bool busy READ busy NOTIFY busyChanged)
+    Q_PROPERTY(int importPending READ importPending NOTIFY importPendingChanged)
     Q_PROPERTY(bool keyAvailable READ keyAvailable NOTIFY keyAvailableChanged)
     Q_PROPERTY(bool timerActive READ timerActive NOTIFY timerActiveChanged)
     Q_PROPERTY(QList<int> groupHeaderRows READ groupHeaderRows NOTIFY groupHeaderRowsChanged)
@@ -66,12 +74,20 @@ class FoilAuthModel :
     class Util;
     class Private;
     class ModelData;
+    class VaultRecord;
+    class Snapshot;
+    class TokenHeaders;
+    class Scheduler;
     class BaseTask;
     class SaveInfoTask;
     class GenerateKeyTask;
+    class KeyTask;
     class DecryptTask;
     class EncryptTask;
     class PasswordTask;
+    class PasswordBatchTask;
+    class DeleteTask;
+    class ImportTask;
 
 public:
     class ModelInfo;
@@ -86,7 +102,9 @@ public:
         FoilLocked,
         FoilLockedTimedOut,
         FoilDecrypting,
-        FoilModelReady
+        FoilModelReady,
+        FoilCheckingKey,
+        FoilUnlocking
     };
 
     FoilAuthModel(QObject* aParent = Q_NULLPTR);
@@ -97,7 +115,21 @@ public:
 
     int period() const;
     int timeLeft() const;
+    qint64 periodEnd() const;
+    bool tickless() const;
+    void setTickless(bool);
+    int lookupWindow() const;
+    void setLookupWindow(int);
+    bool vault() const;
+    void setVault(bool);
+    bool snapshot() const;
+    void setSnapshot(bool);
+    int saveDelay() const;
+    void setSaveDelay(int);
+    int maxSaveDelay() const;
+    void setMaxSaveDelay(int);
     bool busy() const;
+    int importPending() const;
     bool keyAvailable() const;
     bool timerActive() const;
     QList<int> groupHeaderRows() const;
@@ -114,17 +146,28 @@ public:
     Q_INVOKABLE void lock(bool aTimeout);
     Q_INVOKABLE bool unlock(const QString aPassword);
 
+    // Asynchronous versions of the above. These return false if there's
+    // nothing to check, otherwise the results are reported through
+    // foilState and the signals
+    Q_INVOKABLE bool checkPasswordAsync(const QString);
+    Q_INVOKABLE bool changePasswordAsync(const QString aOld, const QString aNew);
+    Q_INVOKABLE bool unlockAsync(const QString aPassword);
+    Q_INVOKABLE void cancelKeyTask();
+
     Q_INVOKABLE void addGroup(const QString);
     Q_INVOKABLE bool addToken(int aType, const QString aTokenBase32,
         const QString aLabel, const QString aIssuer, int aDigits,
-        int aCounter, int aTimeShift, int aAlgorithm);
+        int aCounter, int aTimeShift, int aAlgorithm,
+        int aPeriod = FoilAuthTypes::DEFAULT_PERIOD);
     Q_INVOKABLE void addTokens(const QList<FoilAuthToken>);
     Q_INVOKABLE void deleteGroupItem(const QString);
     Q_INVOKABLE void deleteToken(const QString);
     Q_INVOKABLE void deleteTokens(const QStringList);
+    Q_INVOKABLE QList<int> findPassword(const QString) const;
     Q_INVOKABLE QList<int> itemRowsForGroupAt(int) const;
     Q_INVOKABLE QStringList getIdsAt(const QList<int>) const;
     Q_INVOKABLE QStringList generateMigrationUris(const QList<int>) const;
+    Q_INVOKABLE void setVisibleRows(int aFirst, int aLast);
 
     // QAbstractItemModel
     Qt::ItemFlags flags(const QModelIndex&) const Q_DECL_OVERRIDE;
@@ -144,9 +187,21 @@ Q_SIGNALS:
     void timerActiveChanged();
     void groupHeaderRowsChanged();
     void foilStateChanged();
+    void periodChanged();
     void timeLeftChanged();
+    void periodEndChanged();
+    void ticklessChanged();
+    void lookupWindowChanged();
+    void vaultChanged();
+    void snapshotChanged();
+    void importPendingChanged();
+    void saveDelayChanged();
+    void maxSaveDelayChanged();
     void keyGenerated();
     void passwordChanged();
+    void passwordChangeFailed();
+    void passwordChecked(bool aOk);
+    void unlockFailed();
     void timerRestarted();
 
 private:
@@ -58,6 +58,8 @@
 #define KEY_SHARED_KEY_WARNING2     DCONF_KEY("sharedKeyWarning2")
 #define KEY_AUTO_LOCK               DCONF_KEY("autoLock")
 #define KEY_AUTO_LOCK_TIME          DCONF_KEY("autoLockTime")
+#define KEY_VAULT                   DCONF_KEY("vault")
+#define KEY_SNAPSHOT                DCONF_KEY("snapshot")
 #define KEY_SAILOTP_IMPORT_DONE     DCONF_KEY("sailotpImportDone")
 #define KEY_SAILOTP_IMPORTED_TOKENS DCONF_KEY("sailotpImportedTokens")
 
@@ -70,6 +72,8 @@
 #define DEFAULT_SHARED_KEY_WARNING  true
 #define DEFAULT_AUTO_LOCK           true
 #define DEFAULT_AUTO_LOCK_TIME      15000
+#define DEFAULT_VAULT               false
+#define DEFAULT_SNAPSHOT            true
 
 // Camera configuration (got removed at some point)
 #define CAMERA_DCONF_PATH_(x)           "/apps/jolla-camera/primary/image/" x
@@ -108,6 +112,8 @@ public:
     MGConfItem* iSharedKeyWarning2;
     MGConfItem* iAutoLock;
     MGConfItem* iAutoLockTime;
+    MGConfItem* iVault;
+    MGConfItem* iSnapshot;
     MGConfItem* iSailotpImportDone;
     MGConfItem* iSailotpImportedTokens;
 };
@@ -128,6 +134,8 @@ FoilAuthSettings::Private::Private(
     iSharedKeyWarning2(new MGConfItem(KEY_SHARED_KEY_WARNING2, aParent)),
     iAutoLock(new MGConfItem(KEY_AUTO_LOCK, aParent)),
     iAutoLockTime(new MGConfItem(KEY_AUTO_LOCK_TIME, aParent)),
+    iVault(new MGConfItem(KEY_VAULT, aParent)),
+    iSnapshot(new MGConfItem(KEY_SNAPSHOT, aParent)),
     iSailotpImportDone(new MGConfItem(KEY_SAILOTP_IMPORT_DONE, aParent)),
     iSailotpImportedTokens(new MGConfItem(KEY_SAILOTP_IMPORTED_TOKENS, aParent))
 {
@@ -143,6 +151,8 @@ FoilAuthSettings::Private::Private(
     connect(iSharedKeyWarning2, SIGNAL(valueChanged()), aParent, SIGNAL(sharedKeyWarning2Changed()));
     connect(iAutoLock, SIGNAL(valueChanged()), aParent, SIGNAL(autoLockChanged()));
     connect(iAutoLockTime, SIGNAL(valueChanged()), aParent, SIGNAL(autoLockTimeChanged()));
+    connect(iVault, SIGNAL(valueChanged()), aParent, SIGNAL(vaultChanged()));
+    connect(iSnapshot, SIGNAL(valueChanged()), aParent, SIGNAL(snapshotChanged()));
     connect(iSailotpImportDone, SIGNAL(valueChanged()), aParent, SIGNAL(sailotpImportDoneChanged()));
     connect(iSailotpImportedTokens, SIGNAL(valueChanged()), aParent, SIGNAL(sailotpImportedTokensChanged()));
     HDEBUG("Default 4:3 resolution" << size_4_3(iDefaultResolution_4_3));
@@ -442,6 +452,38 @@ FoilAuthSettings::setAutoLockTime(
     iPrivate->iAutoLockTime->set(aValue);
 }
 
+// vault
+
+bool
+FoilAuthSettings::vault() const
+{
+    return iPrivate->iVault->value(DEFAULT_VAULT).toBool();
+}
+
+void
+FoilAuthSettings::setVault(
+    bool aValue)
+{
+    HDEBUG(aValue);
+    iPrivate->iVault->set(aValue);
+}
+
+// snapshot
+
+bool
+FoilAuthSettings::snapshot() const
+{
+    return iPrivate->iSnapshot->value(DEFAULT_SNAPSHOT).toBool();
+}
+
+void
+FoilAuthSettings::setSnapshot(
+    bool aValue)
+{
+    HDEBUG(aValue);
+    iPrivate->iSnapshot->set(aValue);
+}
+
 // sailotpImportDone
 
 bool
@@ -69,6 +69,8 @@ class FoilAuthSettings :
     Q_PROPERTY(bool sharedKeyWarning2 READ sharedKeyWarning2 WRITE setSharedKeyWarning2 NOTIFY sharedKeyWarning2Changed)
     Q_PROPERTY(bool autoLock READ autoLock WRITE setAutoLock NOTIFY autoLockChanged)
     Q_PROPERTY(int autoLockTime READ autoLockTime WRITE setAutoLockTime NOTIFY autoLockTimeChanged)
+    Q_PROPERTY(bool vault READ vault WRITE setVault NOTIFY vaultChanged)
+    Q_PROPERTY(bool snapshot READ snapshot WRITE setSnapshot NOTIFY snapshotChanged)
     Q_PROPERTY(bool sailotpImportDone READ sailotpImportDone WRITE setSailotpImportDone NOTIFY sailotpImportDoneChanged)
     Q_PROPERTY(QStringList sailotpImportedTokens READ sailotpImportedTokens WRITE setSailotpImportedTokens NOTIFY sailotpImportedTokensChanged)
 
@@ -116,6 +118,12 @@ public:
     int autoLockTime() const;
     void setAutoLockTime(int);
 
+    bool vault() const;
+    void setVault(bool);
+
+    bool snapshot() const;
+    void setSnapshot(bool);
+
     bool sailotpImportDone() const;
     void setSailotpImportDone(bool);
 
@@ -135,6 +143,8 @@ Q_SIGNALS:
     void sharedKeyWarning2Changed();
     void autoLockChanged();
     void autoLockTimeChanged();
+    void vaultChanged();
+    void snapshotChanged();
     void sailotpImportDoneChanged();
     void sailotpImportedTokensChanged();
 
@@ -51,8 +51,11 @@
 #include <gutil_misc.h>
 
 #include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
 #include <QtCore/QUrl>
 
+#include <string.h>
+
 #define FOILAUTH_KEY_TYPE "type"
 #define FOILAUTH_KEY_LABEL "label"
 #define FOILAUTH_KEY_SECRET "secret"
@@ -61,6 +64,7 @@
 #define FOILAUTH_KEY_COUNTER "counter"
 #define FOILAUTH_KEY_TIMESHIFT "timeshift"
 #define FOILAUTH_KEY_ALGORITHM "algorithm"
+#define FOILAUTH_KEY_PERIOD "period"
 
 const QString FoilAuthToken::KEY_VALID("valid");
 const QString FoilAuthToken::KEY_TYPE(FOILAUTH_KEY_TYPE);
@@ -71,6 +75,7 @@ const QString FoilAuthToken::KEY_DIGITS(FOILAUTH_KEY_DIGITS);
 const QString FoilAuthToken::KEY_COUNTER(FOILAUTH_KEY_COUNTER);
 const QString FoilAuthToken::KEY_TIMESHIFT(FOILAUTH_KEY_TIMESHIFT);
 const QString FoilAuthToken::KEY_ALGORITHM(FOILAUTH_KEY_ALGORITHM);
+const QString FoilAuthToken::KEY_PERIOD(FOILAUTH_KEY_PERIOD);
 
 const QString FoilAuthToken::TYPE_TOTP(FOILAUTH_TYPE_TOTP);
 const QString FoilAuthToken::TYPE_HOTP(FOILAUTH_TYPE_HOTP);
@@ -130,7 +135,7 @@ class FoilAuthToken::Private :
 {
 public:
     Private(AuthType, const QByteArray&, const QString&, const QString&,
-        const QString&, int, quint64, int, DigestAlgorithm);
+        const QString&, int, quint64, int, DigestAlgorithm, int);
 
     enum Algorithm {
         ALGORITHM_UNSPECIFIED,
@@ -171,6 +176,15 @@ public:
 
     static const uchar VERSION = 1;
 
+    static const uint POW10[MAX_DIGITS + 1];
+    static const char STEAM_ALPHABET[];
+    static const uint STEAM_BASE = 26;
+
+    // Lookup key layout: value in the low 48 bits, then the number of
+    // digits and the flag telling Steam codes from the numeric ones
+    static const int KEY_DIGITS_SHIFT = 48;
+    static const quint64 KEY_STEAM = Q_UINT64_C(1) << 56;
+
     struct OtpParameters {
         QByteArray secret;
         QString name;
@@ -247,10 +261,18 @@ public:
     static bool parseOtpParameters(GUtilRange*, OtpParameters*);
     static void encodeTrailer(QByteArray*, uint, uint, quint64);
 
-    QString password(quint64 aTime);
+    FoilAuthHmac::Key key();
+    uint hash(quint64);
+    void clearKey();
+    quint64 hashInput(quint64 aTime) const;
+    uint passwordValue(uint aHash) const;
+    QString password(uint aValue) const;
+    quint64 passwordKey(uint aValue) const;
 
 public:
     QAtomicInt iRef;
+    QMutex iKeyMutex;
+    FoilAuthHmac::Key iKey; // Scheduled on demand
     const AuthType iType;
     const DigestAlgorithm iAlgorithm;
     const QByteArray iSecret;
@@ -260,8 +282,17 @@ public:
     const quint64 iCounter;
     const int iDigits;
     const int iTimeshift; // Seconds
+    const int iPeriod; // Seconds
+};
+
+const uint FoilAuthToken::Private::POW10[MAX_DIGITS + 1] = {
+    1u, 10u, 100u, 1000u, 10000u, 100000u, 1000000u,
+    10000000u, 100000000u, 1000000000u
 };
 
+const char FoilAuthToken::Private::STEAM_ALPHABET[] =
+    "23456789BCDFGHJKMNPQRTVWXY";
+
 FoilAuthToken::Private::Private(
     AuthType aType,
     const QByteArray& aSecret,
@@ -271,7 +302,8 @@ FoilAuthToken::Private::Private(
     int aDigits,
     quint64 aCounter,
     int aTimeShift,
-    DigestAlgorithm aAlgorithm) :
+    DigestAlgorithm aAlgorithm,
+    int aPeriod) :
     iRef(1),
     iType(aType),
     iAlgorithm(aAlgorithm),
@@ -281,35 +313,105 @@ FoilAuthToken::Private::Private(
     iIssuer(aIssuer),
     iCounter(aCounter),
     iDigits(aDigits),
-    iTimeshift(aTimeShift)
+    iTimeshift(aTimeShift),
+    iPeriod(aPeriod)
 {}
 
+// Copying the scheduled key is much cheaper than scheduling it again
+FoilAuthHmac::Key
+FoilAuthToken::Private::key()
+{
+    // The same token may be used by more than one thread at a time
+    QMutexLocker lock(&iKeyMutex);
+
+    if (!iKey.isValid()) {
+        // Key schedule is only calculated once per token
+        iKey = FoilAuthHmac::Key(iSecret, iAlgorithm);
+    }
+    return iKey;
+}
+
+uint
+FoilAuthToken::Private::hash(
+    quint64 aValue)
+{
+    return FoilAuthHmac::hash(key(), aValue);
+}
+
+void
+FoilAuthToken::Private::clearKey()
+{
+    QMutexLocker lock(&iKeyMutex);
+
+    iKey.clear();
+}
+
+quint64
+FoilAuthToken::Private::hashInput(
+    quint64 aTime) const
+{
+    switch (iType) {
+    case AuthTypeHOTP:
+        return iCounter;
+    case AuthTypeSteam:
+        return aTime + iTimeshift;
+    case AuthTypeTOTP:
+        break;
+    }
+    return (aTime + iTimeshift)/iPeriod;
+}
+
+// Steam codes are the base-26 digits of the truncated hash, least
+// significant digit first, so the hash itself is what gets stored.
+// Numeric codes are stored as the number being displayed.
+uint
+FoilAuthToken::Private::passwordValue(
+    uint aHash) const
+{
+    return (iType == AuthTypeSteam) ? aHash : (aHash % POW10[iDigits]);
+}
+
 QString
 FoilAuthToken::Private::password(
-    quint64 aTime)
+    uint aValue) const
 {
-    if (iType == AuthTypeSteam) {
-        static const QString ALPHABET("23456789BCDFGHJKMNPQRTVWXY");
-        uint hash = FoilAuth::hash(iSecret, aTime + iTimeshift, iAlgorithm);
-        QString pass;
+    // No heap allocations other than the QString itself
+    char buf[MAX_DIGITS];
+    const int n = qMin(iDigits, (int) MAX_DIGITS);
 
-        for (int i = 0; i < iDigits; i++) {
-            pass.append(ALPHABET.at(hash % ALPHABET.size()));
-            hash /= ALPHABET.size();
+    if (iType == AuthTypeSteam) {
+        for (int i = 0; i < n; i++) {
+            buf[i] = STEAM_ALPHABET[aValue % STEAM_BASE];
+            aValue /= STEAM_BASE;
         }
-
-        return pass;
     } else {
-        uint maxPass = 10;
-
-        for (int i = 1; i < iDigits; i++) {
-            maxPass *= 10;
+        for (int i = n - 1; i >= 0; i--) {
+            buf[i] = '0' + (aValue % 10);
+            aValue /= 10;
         }
+    }
+    return QString::fromLatin1(buf, n);
+}
+
+// Only the lowest base-26 digits of the Steam value make it into
+// the code, the rest doesn't affect the key
+quint64
+FoilAuthToken::Private::passwordKey(
+    uint aValue) const
+{
+    quint64 value = aValue;
+    quint64 key = ((quint64) iDigits) << KEY_DIGITS_SHIFT;
+
+    if (iType == AuthTypeSteam) {
+        quint64 max = 1;
 
-        return QString().sprintf("%0*u", iDigits, (iType == AuthTypeHOTP) ?
-            FoilAuth::HOTP(iSecret, iCounter, maxPass, iAlgorithm) :
-            FoilAuth::TOTP(iSecret, aTime + iTimeshift, maxPass, iAlgorithm));
+        for (int i = 0; i < iDigits; i++) {
+            max *= STEAM_BASE;
+        }
+        value %= max;
+        key |= KEY_STEAM;
     }
+    return key | value;
 }
 
 /* static */
@@ -441,11 +543,12 @@ FoilAuthToken::FoilAuthToken(
     int aDigits,
     quint64 aCounter,
     int aTimeShift,
-    FoilAuthTypes::DigestAlgorithm aAlgorithm) :
+    FoilAuthTypes::DigestAlgorithm aAlgorithm,
+    int aPeriod) :
     iPrivate(new Private(validType(aType),
         aSecret, FoilAuth::toBase32(aSecret), aLabel, aIssuer,
         validDigits(aDigits), aCounter, aTimeShift,
-        validAlgorithm(aAlgorithm)))
+        validAlgorithm(aAlgorithm), validPeriod(aPeriod)))
 {
 }
 
@@ -493,6 +596,7 @@ FoilAuthToken::equals(
             iPrivate->iDigits == other->iDigits &&
             iPrivate->iCounter == other->iCounter &&
             iPrivate->iTimeshift == other->iTimeshift &&
+            iPrivate->iPeriod == other->iPeriod &&
             iPrivate->iSecret == other->iSecret &&
             iPrivate->iLabel == other->iLabel &&
             iPrivate->iIssuer == other->iIssuer;
@@ -561,11 +665,180 @@ FoilAuthToken::timeshift() const
     return iPrivate ? iPrivate->iTimeshift : 0;
 }
 
+int
+FoilAuthToken::period() const
+{
+    return iPrivate ? iPrivate->iPeriod : 0;
+}
+
+// The value fed to HMAC for the given time
+quint64
+FoilAuthToken::hashInput(
+    quint64 aTime) const
+{
+    return iPrivate ? iPrivate->hashInput(aTime) : 0;
+}
+
+// Beginning of the period which the given time belongs to. Passwords
+// are calculated for the beginning of the period, that keeps them the
+// same throughout the period (which matters for Steam tokens).
+quint64
+FoilAuthToken::periodStart(
+    quint64 aTime) const
+{
+    return iPrivate ? (aTime - aTime % iPrivate->iPeriod) : aTime;
+}
+
+// Converts the output of HMAC (after dynamic truncation) into the value
+// which formatPassword() turns into a string. The value is cheap to store
+// and compare, the string is only needed when the code is displayed.
+uint
+FoilAuthToken::passwordValueFromHash(
+    uint aHash) const
+{
+    return iPrivate ? iPrivate->passwordValue(aHash) : 0;
+}
+
+uint
+FoilAuthToken::passwordValue(
+    quint64 aTime) const
+{
+    return iPrivate ? iPrivate->passwordValue(iPrivate->hash(
+        iPrivate->hashInput(aTime))) : 0;
+}
+
+// Fills the buffer with passwords for aCount consecutive periods, starting
+// with the one which contains aTime (TOTP and Steam), or for consecutive
+// counter values starting with the current one (HOTP). The key schedule
+// is reused from the cache. Returns the number of values stored.
+int
+FoilAuthToken::passwordValues(
+    quint64 aTime,
+    uint* aValues,
+    int aCount) const
+{
+    if (iPrivate && aCount > 0) {
+        const FoilAuthHmac::Key key(iPrivate->key());
+        const quint64 first = iPrivate->hashInput(periodStart(aTime));
+
+        // Steam hashes the time itself rather than the period number
+        FoilAuthHmac::hash(key, first,
+            (iPrivate->iType == FoilAuthTypes::AuthTypeSteam) ?
+            iPrivate->iPeriod : 1, aValues, aCount);
+        for (int i = 0; i < aCount; i++) {
+            aValues[i] = iPrivate->passwordValue(aValues[i]);
+        }
+        return aCount;
+    }
+    return 0;
+}
+
+QString
+FoilAuthToken::formatPassword(
+    uint aValue) const
+{
+    return iPrivate ? iPrivate->password(aValue) : QString();
+}
+
+// The key schedule for the batch calculations, cached by the token
+FoilAuthHmac::Key
+FoilAuthToken::hmacKey() const
+{
+    return iPrivate ? iPrivate->key() : FoilAuthHmac::Key();
+}
+
+void
+FoilAuthToken::clearCache() const
+{
+    if (iPrivate) {
+        iPrivate->clearKey();
+    }
+}
+
 QString
 FoilAuthToken::passwordString(
     quint64 aTime) const
 {
-    return iPrivate ? iPrivate->password(aTime) : QString();
+    return formatPassword(passwordValue(aTime));
+}
+
+// Two codes which look the same have the same key, no matter which
+// token they have been produced by (as long as the type of the code
+// and the number of digits are the same)
+quint64
+FoilAuthToken::passwordKey(
+    uint aValue) const
+{
+    return iPrivate ? iPrivate->passwordKey(aValue) : 0;
+}
+
+// Keys the code would have if it had been produced by a numeric or by
+// a Steam token. Some codes (e.g. "22222") can be either.
+QList<quint64>
+FoilAuthToken::passwordKeys(
+    const QString& aCode)
+{
+    QList<quint64> keys;
+    const int n = aCode.length();
+
+    if (n >= FoilAuthTypes::MIN_DIGITS && n <= FoilAuthTypes::MAX_DIGITS) {
+        const char* alphabet = Private::STEAM_ALPHABET;
+        quint64 dec = 0, steam = 0, pow = 1;
+        bool isDec = true, isSteam = true;
+
+        for (int i = 0; i < n && (isDec || isSteam); i++) {
+            const char c = aCode.at(i).toUpper().toLatin1();
+
+            if (c >= '0' && c <= '9') {
+                dec = dec * 10 + (c - '0');
+            } else {
+                isDec = false;
+            }
+
+            // Steam codes have the least significant digit first
+            const char* ptr = c ? strchr(alphabet, c) : Q_NULLPTR;
+
+            if (ptr) {
+                steam += (ptr - alphabet) * pow;
+                pow *= Private::STEAM_BASE;
+            } else {
+                isSteam = false;
+            }
+        }
+
+        const quint64 digits = ((quint64) n) << Private::KEY_DIGITS_SHIFT;
+
+        if (isDec) {
+            keys.append(digits | dec);
+        }
+        if (isSteam) {
+            keys.append(Private::KEY_STEAM | digits | steam);
+        }
+    }
+    return keys;
+}
+
+// Compares the code in constant time, i.e. without bailing out at
+// the first mismatch. Steam codes are case insensitive.
+bool
+FoilAuthToken::checkPassword(
+    uint aValue,
+    const QString& aCode) const
+{
+    const QString code(formatPassword(aValue));
+    const int n = code.length();
+
+    if (n > 0 && aCode.length() == n) {
+        const QChar* expected = code.constData();
+        const QChar* actual = aCode.constData();
+        uint diff = 0;
+
+        for (int i = 0; i < n; i++) {
+            diff |= expected[i].unicode() ^ actual[i].toUpper().unicode();
+        }
+        return !diff;
+    }
+    return false;
 }
 
 int
@@ -577,6 +850,15 @@ FoilAuthToken::validDigits(
         aDigits : FoilAuthTypes::DEFAULT_DIGITS;
 }
 
+int
+FoilAuthToken::validPeriod(
+    int aPeriod)
+{
+    return (aPeriod >= FoilAuthTypes::MIN_PERIOD &&
+        aPeriod <= FoilAuthTypes::MAX_PERIOD) ?
+        aPeriod : FoilAuthTypes::DEFAULT_PERIOD;
+}
+
 FoilAuthTypes::AuthType
 FoilAuthToken::validType(
     int aType)
@@ -630,8 +912,9 @@ FoilAuthToken::fromUri(
     }
 
     if (prefixOK) {
-        QByteArray label, secret, issuer, algorithm, digits, counter;
+        QByteArray label, secret, issuer, algorithm, digits, counter, period;
         GUtilData secretTag, issuerTag, digitsTag, counterTag, algorithmTag;
+        GUtilData periodTag;
 
         while (pos.ptr < pos.end && pos.ptr[0] != '?') {
             label.append(*pos.ptr++);
@@ -642,6 +925,7 @@ FoilAuthToken::fromUri(
         gutil_data_from_string(&digitsTag, FOILAUTH_KEY_DIGITS "=");
         gutil_data_from_string(&counterTag, FOILAUTH_KEY_COUNTER "=");
         gutil_data_from_string(&algorithmTag, FOILAUTH_KEY_ALGORITHM "=");
+        gutil_data_from_string(&periodTag, FOILAUTH_KEY_PERIOD "=");
 
         while (pos.ptr < pos.end) {
             pos.ptr++;
@@ -652,6 +936,7 @@ FoilAuthToken::fromUri(
                 gutil_range_skip_prefix(&pos, &digitsTag) ? &digits :
                 gutil_range_skip_prefix(&pos, &counterTag) ? &counter :
                 gutil_range_skip_prefix(&pos, &algorithmTag) ? &algorithm :
+                gutil_range_skip_prefix(&pos, &periodTag) ? &period :
                 Q_NULLPTR;
 
             if (value) {
@@ -673,6 +958,7 @@ FoilAuthToken::fromUri(
                 FoilAuthTypes::DigestAlgorithm alg = FoilAuthTypes::DEFAULT_ALGORITHM;
                 int imf = FoilAuthTypes::DEFAULT_COUNTER;
                 int timeshift = FoilAuthTypes::DEFAULT_TIMESHIFT;
+                int sec = FoilAuthTypes::DEFAULT_PERIOD;
 
                 static const QByteArray ISSUER_STEAM("Steam");
                 const QString tokenIssuer(QUrl::fromPercentEncoding(issuer));
@@ -695,6 +981,14 @@ FoilAuthToken::fromUri(
                         imf = n;
                     }
                 }
+                if (!period.isEmpty()) {
+                    bool ok;
+                    const int n = period.toInt(&ok);
+                    if (ok && n >= FoilAuthTypes::MIN_PERIOD &&
+                        n <= FoilAuthTypes::MAX_PERIOD) {
+                        sec = n;
+                    }
+                }
                 if (!algorithm.isEmpty()) {
                     const QString algValue(QString::fromLatin1(algorithm).toUpper());
                     if (algValue == ALGORITHM_SHA1) {
@@ -707,7 +1001,7 @@ FoilAuthToken::fromUri(
                 }
                 return FoilAuthToken(type, bytes,
                     QUrl::fromPercentEncoding(label),
-                    tokenIssuer, dig, imf, timeshift, alg);
+                    tokenIssuer, dig, imf, timeshift, alg, sec);
             }
         }
     }
@@ -749,6 +1043,10 @@ FoilAuthToken::toUri() const
                 buf.append("&" FOILAUTH_KEY_TIMESHIFT "=");
                 buf.append(QString::number(iPrivate->iTimeshift));
             }
+            if (iPrivate->iPeriod != FoilAuthTypes::DEFAULT_PERIOD) {
+                buf.append("&" FOILAUTH_KEY_PERIOD "=");
+                buf.append(QString::number(iPrivate->iPeriod));
+            }
             break;
         case FoilAuthTypes::AuthTypeHOTP:
             buf.append("&" FOILAUTH_KEY_COUNTER "=");
@@ -776,6 +1074,7 @@ FoilAuthToken::toVariantMap() const
         out.insert(KEY_COUNTER, iPrivate->iCounter);
         out.insert(KEY_TIMESHIFT, iPrivate->iTimeshift);
         out.insert(KEY_ALGORITHM, (int) iPrivate->iAlgorithm);
+        out.insert(KEY_PERIOD, iPrivate->iPeriod);
     }
     return out;
 }
@@ -933,7 +1232,7 @@ FoilAuthToken::withType(
             return FoilAuthToken(new Private(type,
                 iPrivate->iSecret, iPrivate->iSecretBase32, iPrivate->iLabel,
                 iPrivate->iIssuer, iPrivate->iDigits, iPrivate->iCounter,
-                iPrivate->iTimeshift, iPrivate->iAlgorithm));
+                iPrivate->iTimeshift, iPrivate->iAlgorithm, iPrivate->iPeriod));
         }
     }
     return *this;
@@ -950,7 +1249,7 @@ FoilAuthToken::withAlgorithm(
             return FoilAuthToken(new Private(iPrivate->iType,
                 iPrivate->iSecret, iPrivate->iSecretBase32, iPrivate->iLabel,
                 iPrivate->iIssuer, iPrivate->iDigits, iPrivate->iCounter,
-                iPrivate->iTimeshift, alg));
+                iPrivate->iTimeshift, alg, iPrivate->iPeriod));
         }
     }
     return *this;
@@ -964,7 +1263,7 @@ FoilAuthToken::withSecret(
         return FoilAuthToken(new Private(iPrivate->iType,
             aSecret, FoilAuth::toBase32(aSecret), iPrivate->iLabel,
             iPrivate->iIssuer, iPrivate->iDigits, iPrivate->iCounter,
-            iPrivate->iTimeshift, iPrivate->iAlgorithm));
+            iPrivate->iTimeshift, iPrivate->iAlgorithm, iPrivate->iPeriod));
     }
     return *this;
 }
@@ -977,7 +1276,7 @@ FoilAuthToken::withLabel(
         return FoilAuthToken(new Private(iPrivate->iType,
             iPrivate->iSecret, iPrivate->iSecretBase32, aLabel,
             iPrivate->iIssuer, iPrivate->iDigits, iPrivate->iCounter,
-            iPrivate->iTimeshift, iPrivate->iAlgorithm));
+            iPrivate->iTimeshift, iPrivate->iAlgorithm, iPrivate->iPeriod));
     }
     return *this;
 }
@@ -990,7 +1289,7 @@ FoilAuthToken::withIssuer(
         return FoilAuthToken(new Private(iPrivate->iType,
             iPrivate->iSecret, iPrivate->iSecretBase32, iPrivate->iLabel,
             aIssuer, iPrivate->iDigits, iPrivate->iCounter,
-            iPrivate->iTimeshift, iPrivate->iAlgorithm));
+            iPrivate->iTimeshift, iPrivate->iAlgorithm, iPrivate->iPeriod));
     }
     return *this;
 }
@@ -1005,7 +1304,7 @@ FoilAuthToken::withDigits(
         return FoilAuthToken(new Private(iPrivate->iType,
             iPrivate->iSecret, iPrivate->iSecretBase32, iPrivate->iLabel,
             iPrivate->iIssuer, aDigits, iPrivate->iCounter,
-            iPrivate->iTimeshift, iPrivate->iAlgorithm));
+            iPrivate->iTimeshift, iPrivate->iAlgorithm, iPrivate->iPeriod));
     }
     return *this;
 }
@@ -1018,7 +1317,7 @@ FoilAuthToken::withCounter(
         return FoilAuthToken(new Private(iPrivate->iType,
             iPrivate->iSecret, iPrivate->iSecretBase32, iPrivate->iLabel,
             iPrivate->iIssuer, iPrivate->iDigits, aCounter,
-            iPrivate->iTimeshift, iPrivate->iAlgorithm));
+            iPrivate->iTimeshift, iPrivate->iAlgorithm, iPrivate->iPeriod));
     }
     return *this;
 }
@@ -1031,7 +1330,22 @@ FoilAuthToken::withTimeshift(
         return FoilAuthToken(new Private(iPrivate->iType,
             iPrivate->iSecret, iPrivate->iSecretBase32, iPrivate->iLabel,
             iPrivate->iIssuer, iPrivate->iDigits, iPrivate->iCounter,
-            aTimeshift, iPrivate->iAlgorithm));
+            aTimeshift, iPrivate->iAlgorithm, iPrivate->iPeriod));
+    }
+    return *this;
+}
+
+FoilAuthToken
+FoilAuthToken::withPeriod(
+    int aPeriod) const
+{
+    if (iPrivate && iPrivate->iPeriod != aPeriod &&
+        aPeriod >= FoilAuthTypes::MIN_PERIOD &&
+        aPeriod <= FoilAuthTypes::MAX_PERIOD) {
+        return FoilAuthToken(new Private(iPrivate->iType,
+            iPrivate->iSecret, iPrivate->iSecretBase32, iPrivate->iLabel,
+            iPrivate->iIssuer, iPrivate->iDigits, iPrivate->iCounter,
+            iPrivate->iTimeshift, iPrivate->iAlgorithm, aPeriod));
     }
     return *this;
 }
@@ -1048,7 +1362,7 @@ operator<<(
             ", " << aToken.issuer() << ", " <<aToken.type() <<
             ", " << aToken.algorithm() << ", " <<  aToken.secretBase32() <<
             ", " << aToken.digits() << ", " << aToken.counter() <<
-            ", " << aToken.timeshift() << ")";
+            ", " << aToken.timeshift() << ", " << aToken.period() << ")";
     } else {
         aDebug << "FoilAuthToken()";
     }
@@ -40,6 +40,7 @@
 #ifndef FOILAUTH_TOKEN_H
 #define FOILAUTH_TOKEN_H
 
+#include "FoilAuthHmac.h"
 #include "FoilAuthTypes.h"
 
 #include <QtCore/QByteArray>
@@ -62,6 +63,7 @@ class FoilAuthToken
     Q_PROPERTY(int digits READ digits CONSTANT)
     Q_PROPERTY(int counter READ counter CONSTANT)
     Q_PROPERTY(int timeshift READ timeshift CONSTANT)
+    Q_PROPERTY(int period READ period CONSTANT)
 
     class Private;
     FoilAuthToken(Private*);
@@ -80,6 +82,7 @@ public:
     static const QString KEY_COUNTER;
     static const QString KEY_TIMESHIFT;
     static const QString KEY_ALGORITHM;
+    static const QString KEY_PERIOD;
 
     static const QString TYPE_TOTP;
     static const QString TYPE_HOTP;
@@ -90,7 +93,8 @@ public:
         int aDigits = FoilAuthTypes::DEFAULT_DIGITS,
         quint64 aCounter = FoilAuthTypes::DEFAULT_COUNTER,
         int aTimeshift = FoilAuthTypes::DEFAULT_TIMESHIFT,
-        FoilAuthTypes::DigestAlgorithm aAlgorithm = FoilAuthTypes::DEFAULT_ALGORITHM);
+        FoilAuthTypes::DigestAlgorithm aAlgorithm = FoilAuthTypes::DEFAULT_ALGORITHM,
+        int aPeriod = FoilAuthTypes::DEFAULT_PERIOD);
     ~FoilAuthToken();
 
     Q_REQUIRED_RESULT static FoilAuthToken fromUri(const QString);
@@ -102,6 +106,7 @@ public:
     Q_REQUIRED_RESULT FoilAuthToken withCounter(quint64) const;
     Q_REQUIRED_RESULT FoilAuthToken withDigits(int) const;
     Q_REQUIRED_RESULT FoilAuthToken withTimeshift(int) const;
+    Q_REQUIRED_RESULT FoilAuthToken withPeriod(int) const;
 
     FoilAuthToken& operator=(const FoilAuthToken&);
     bool operator==(const FoilAuthToken&) const;
@@ -118,8 +123,19 @@ public:
     quint64 counter() const;
     int digits() const;
     int timeshift() const;
+    int period() const;
 
     Q_REQUIRED_RESULT QString passwordString(quint64) const;
+    Q_REQUIRED_RESULT uint passwordValue(quint64) const;
+    Q_REQUIRED_RESULT uint passwordValueFromHash(uint) const;
+    int passwordValues(quint64, uint*, int) const;
+    Q_REQUIRED_RESULT QString formatPassword(uint) const;
+    Q_REQUIRED_RESULT quint64 passwordKey(uint) const;
+    Q_REQUIRED_RESULT bool checkPassword(uint, const QString&) const;
+    Q_REQUIRED_RESULT quint64 hashInput(quint64) const;
+    Q_REQUIRED_RESULT quint64 periodStart(quint64) const;
+    Q_REQUIRED_RESULT FoilAuthHmac::Key hmacKey() const;
+    void clearCache() const;
     Q_REQUIRED_RESULT QString toUri() const;
     Q_REQUIRED_RESULT QVariantMap toVariantMap() const;
     Q_REQUIRED_RESULT QByteArray toProtoBuf() const;
@@ -127,6 +143,8 @@ public:
     Q_REQUIRED_RESULT static FoilAuthTypes::AuthType validType(int);
     Q_REQUIRED_RESULT static FoilAuthTypes::DigestAlgorithm validAlgorithm(int);
     Q_REQUIRED_RESULT static int validDigits(int);
+    Q_REQUIRED_RESULT static int validPeriod(int);
+    Q_REQUIRED_RESULT static QList<quint64> passwordKeys(const QString&);
     Q_REQUIRED_RESULT static QList<FoilAuthToken> fromProtoBuf(const QByteArray&);
     Q_REQUIRED_RESULT static QByteArray toProtoBuf(const QList<FoilAuthToken>&);
     Q_REQUIRED_RESULT static QList<QByteArray> toProtoBufs(const QList<FoilAuthToken>&,
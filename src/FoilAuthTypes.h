@@ -69,6 +69,10 @@ public:
 
     static const int DEFAULT_COUNTER = 0;
     static const int DEFAULT_TIMESHIFT = 0;
+
+    static const int MIN_PERIOD = 1;
+    static const int MAX_PERIOD = 3600;
+    static const int DEFAULT_PERIOD = 30;
 };
 
 #endif // FOILAUTH_TYPES_H
@@ -0,0 +1,838 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the names of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation
+ * are those of the authors and should not be interpreted as representing
+ * any official policies, either expressed or implied.
+ */
+
+#include "FoilAuthVault.h"
+#include "FoilAuth.h"
+
+#include "HarbourDebug.h"
+
+#include "foil_cipher.h"
+#include "foil_digest.h"
+#include "foil_hmac.h"
+#include "foil_key.h"
+#include "foil_output.h"
+#include "foil_random.h"
+#include "foil_util.h"
+
+#include "foilmsg.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QVector>
+#include <QtCore/QtEndian>
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// File layout (all numbers are big-endian):
+//
+//   char    magic[8]      "FOILAV01"
+//   uint32  size          Size of the wrapped key
+//   uint8   key[size]     foilmsg with the AES and MAC keys
+//
+// Followed by the records:
+//
+//   uint32  size          Size of the rest of the record
+//   uint16  idSize        Size of the id
+//   uint8   id[idSize]    UTF-8 encoded id
+//   uint32  dataSize      Size of the decrypted data, zero if removed
+//   uint8   iv[16]        Only present if dataSize is non-zero
+//   uint8   data[]        AES-256-CBC encrypted data, padded
+//   uint8   mac[32]       HMAC-SHA256 of everything from idSize to here
+
+#define VAULT_MAGIC             "FOILAV01"
+#define VAULT_MAGIC_SIZE        8
+#define VAULT_FILE_MODE         0600
+#define VAULT_TEMP_SUFFIX       ".tmp"
+#define VAULT_KEY_SIZE          32  // AES-256
+#define VAULT_MAC_KEY_SIZE      32
+#define VAULT_IV_SIZE           16  // AES block
+#define VAULT_MAC_SIZE          32  // SHA256
+#define VAULT_MIN_RECORD_SIZE   (2 + 4 + VAULT_MAC_SIZE)
+#define VAULT_MAX_RECORD_SIZE   0x100000
+
+#define VAULT_ENCRYPT_KEY_TYPE  FOILMSG_KEY_AES_256
+#define VAULT_SIGNATURE_TYPE    FOILMSG_SIGNATURE_SHA256_RSA
+
+// Don't bother to compact less than that
+#define VAULT_MIN_GARBAGE       0x4000
+
+// ==========================================================================
+// FoilAuthVault::Private
+// ==========================================================================
+
+class FoilAuthVault::Private
+{
+public:
+    class Slot {
+    public:
+        Slot() : iOffset(0), iSize(0) {}
+        Slot(qint64 aOffset, int aSize) : iOffset(aOffset), iSize(aSize) {}
+
+    public:
+        qint64 iOffset; // Where the record starts
+        int iSize;      // Including the size field
+    };
+
+    Private(const QString&);
+    ~Private();
+
+    static bool writeFile(const QString&, const QByteArray&);
+    static void syncDir(const QString&);
+    static QByteArray takeBytes(GBytes*);
+    static bool equal(const char*, const char*, int);
+    static void putUint16(QByteArray*, quint16);
+    static void putUint32(QByteArray*, quint32);
+
+    void setKeys(const guint8*);
+    bool unwrapKeys(const QByteArray&, FoilPrivateKey*, FoilKey*);
+    QByteArray mac(const char*, int) const;
+    QByteArray encryptRecord(const QString&, const QByteArray&) const;
+    bool decryptRecord(const char*, int, QString*, QByteArray*) const;
+    void load(const QByteArray&);
+    bool append(const QString&, const QByteArray&);
+    bool append(const QHash<QString,QByteArray>&);
+    void compactIfNeeded();
+    QByteArray readAll() const;
+
+public:
+    const QString iPath;
+    mutable QMutex iMutex;
+    guint8 iKey[VAULT_KEY_SIZE];
+    guint8 iMacKey[VAULT_MAC_KEY_SIZE];
+    QByteArray iHeader; // Magic and the wrapped key, kept for compaction
+    QHash<QString,Slot> iSlots;
+    qint64 iEnd;
+    qint64 iLiveSize;
+};
+
+FoilAuthVault::Private::Private(
+    const QString& aPath) :
+    iPath(aPath),
+    iEnd(0),
+    iLiveSize(0)
+{
+    memset(iKey, 0, sizeof(iKey));
+    memset(iMacKey, 0, sizeof(iMacKey));
+}
+
+FoilAuthVault::Private::~Private()
+{
+    // Don't leave the keys lying around
+    memset(iKey, 0, sizeof(iKey));
+    memset(iMacKey, 0, sizeof(iMacKey));
+}
+
+/* static */
+bool
+FoilAuthVault::Private::writeFile(
+    const QString& aPath,
+    const QByteArray& aContents)
+{
+    // Write a temporary file and then rename it, so that the old file
+    // remains intact if something goes wrong
+    const QString tmpPath(aPath + VAULT_TEMP_SUFFIX);
+    QFile file(tmpPath);
+
+    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        const QByteArray tmpName(tmpPath.toUtf8());
+
+        if (chmod(tmpName.constData(), VAULT_FILE_MODE) < 0) {
+            HWARN("Failed to chmod" << tmpName.constData() << strerror(errno));
+        }
+        if (file.write(aContents) == aContents.size() && file.flush() &&
+            fsync(file.handle()) == 0) {
+            const QByteArray name(aPath.toUtf8());
+
+            file.close();
+            if (rename(tmpName.constData(), name.constData()) == 0) {
+                syncDir(aPath);
+                return true;
+            }
+            HWARN("Failed to rename" << tmpName.constData() << strerror(errno));
+        } else {
+            HWARN("Failed to write" << qPrintable(tmpPath));
+            file.close();
+        }
+        file.remove();
+    } else {
+        HWARN("Failed to open" << qPrintable(tmpPath));
+    }
+    return false;
+}
+
+// Makes the rename durable
+/* static */
+void
+FoilAuthVault::Private::syncDir(
+    const QString& aPath)
+{
+    const QByteArray dir(QFileInfo(aPath).absolutePath().toUtf8());
+    const int fd = open(dir.constData(), O_RDONLY | O_DIRECTORY);
+
+    if (fd >= 0) {
+        if (fsync(fd) < 0) {
+            HWARN("Failed to sync" << dir.constData() << strerror(errno));
+        }
+        close(fd);
+    } else {
+        HWARN("Failed to open" << dir.constData() << strerror(errno));
+    }
+}
+
+/* static */
+QByteArray
+FoilAuthVault::Private::takeBytes(
+    GBytes* aBytes) // Takes ownership
+{
+    const QByteArray bytes(FoilAuth::toByteArray(aBytes));
+
+    if (aBytes) {
+        g_bytes_unref(aBytes);
+    }
+    return bytes;
+}
+
+// Constant time comparison, doesn't reveal where the difference is
+/* static */
+bool
+FoilAuthVault::Private::equal(
+    const char* aData1,
+    const char* aData2,
+    int aSize)
+{
+    uchar diff = 0;
+
+    for (int i = 0; i < aSize; i++) {
+        diff |= (uchar)(aData1[i] ^ aData2[i]);
+    }
+    return !diff;
+}
+
+/* static */
+inline
+void
+FoilAuthVault::Private::putUint16(
+    QByteArray* aBuf,
+    quint16 aValue)
+{
+    const quint16 value = qToBigEndian(aValue);
+
+    aBuf->append((const char*)&value, sizeof(value));
+}
+
+/* static */
+inline
+void
+FoilAuthVault::Private::putUint32(
+    QByteArray* aBuf,
+    quint32 aValue)
+{
+    const quint32 value = qToBigEndian(aValue);
+
+    aBuf->append((const char*)&value, sizeof(value));
+}
+
+void
+FoilAuthVault::Private::setKeys(
+    const guint8* aKeys)
+{
+    memcpy(iKey, aKeys, VAULT_KEY_SIZE);
+    memcpy(iMacKey, aKeys + VAULT_KEY_SIZE, VAULT_MAC_KEY_SIZE);
+}
+
+bool
+FoilAuthVault::Private::unwrapKeys(
+    const QByteArray& aWrapped,
+    FoilPrivateKey* aPrivate,
+    FoilKey* aPublic)
+{
+    bool ok = false;
+    GBytes* bytes = g_bytes_new_static(aWrapped.constData(), aWrapped.size());
+    FoilMsg* msg = foilmsg_decrypt(aPrivate, bytes, Q_NULLPTR);
+
+    if (msg) {
+        if (foilmsg_verify(msg, aPublic)) {
+            gsize size = 0;
+            const guint8* keys = (const guint8*)g_bytes_get_data(msg->data,
+                &size);
+
+            if (size == VAULT_KEY_SIZE + VAULT_MAC_KEY_SIZE) {
+                setKeys(keys);
+                ok = true;
+            } else {
+                HWARN("Unexpected key size" << size);
+            }
+        } else {
+            HWARN("Could not verify" << qPrintable(iPath));
+        }
+        foilmsg_free(msg);
+    }
+    g_bytes_unref(bytes);
+    return ok;
+}
+
+QByteArray
+FoilAuthVault::Private::mac(
+    const char* aData,
+    int aSize) const
+{
+    FoilHmac* hmac = foil_hmac_new(foil_impl_digest_sha256_get_type(),
+        iMacKey, sizeof(iMacKey));
+
+    foil_hmac_update(hmac, aData, aSize);
+    return takeBytes(foil_hmac_free_to_bytes(hmac));
+}
+
+QByteArray
+FoilAuthVault::Private::encryptRecord(
+    const QString& aId,
+    const QByteArray& aData) const
+{
+    const QByteArray id(aId.toUtf8());
+    QByteArray record;
+
+    putUint32(&record, 0); // Filled in at the end
+    putUint16(&record, id.size());
+    record.append(id);
+    putUint32(&record, aData.size());
+
+    if (!aData.isEmpty()) {
+        // The key is followed by the (random) IV
+        guint8 key[VAULT_KEY_SIZE + VAULT_IV_SIZE];
+
+        memcpy(key, iKey, VAULT_KEY_SIZE);
+        foil_random_generate(FOIL_RANDOM_DEFAULT, key + VAULT_KEY_SIZE,
+            VAULT_IV_SIZE);
+
+        FoilKey* aes = foil_key_new_from_data(FOIL_KEY_AES256, key,
+            sizeof(key));
+        GBytes* enc = foil_cipher_data(FOIL_CIPHER_AES_CBC_ENCRYPT, aes,
+            aData.constData(), aData.size());
+
+        memset(key, 0, VAULT_KEY_SIZE);
+        foil_key_unref(aes);
+        if (!enc) {
+            HWARN("Encryption failed");
+            return QByteArray();
+        }
+        record.append((const char*)key + VAULT_KEY_SIZE, VAULT_IV_SIZE);
+        record.append(takeBytes(enc));
+    }
+
+    record.append(mac(record.constData() + 4, record.size() - 4));
+
+    const quint32 size = qToBigEndian((quint32)(record.size() - 4));
+
+    memcpy(record.data(), &size, sizeof(size));
+    return record;
+}
+
+// The size field has already been parsed and stripped
+bool
+FoilAuthVault::Private::decryptRecord(
+    const char* aRecord,
+    int aSize,
+    QString* aId,
+    QByteArray* aData) const
+{
+    if (aSize < VAULT_MIN_RECORD_SIZE) {
+        return false;
+    }
+
+    // Check the MAC first
+    const int macPos = aSize - VAULT_MAC_SIZE;
+    const QByteArray expected(mac(aRecord, macPos));
+
+    if (expected.size() != VAULT_MAC_SIZE ||
+        !equal(expected.constData(), aRecord + macPos, VAULT_MAC_SIZE)) {
+        return false;
+    }
+
+    const int idSize = qFromBigEndian<quint16>((const uchar*)aRecord);
+    const int dataSizePos = 2 + idSize;
+
+    if (dataSizePos + 4 > macPos) {
+        return false;
+    }
+
+    const quint32 dataSize = qFromBigEndian<quint32>((const uchar*)aRecord +
+        dataSizePos);
+    const int ivPos = dataSizePos + 4;
+
+    if (aId) {
+        *aId = QString::fromUtf8(aRecord + 2, idSize);
+    }
+
+    if (!dataSize) {
+        // Removed record
+        if (ivPos != macPos) {
+            return false;
+        }
+        if (aData) {
+            aData->clear();
+        }
+    } else {
+        const int encPos = ivPos + VAULT_IV_SIZE;
+        const int encSize = macPos - encPos;
+
+        if (encSize < (int)dataSize) {
+            return false;
+        }
+
+        if (aData) {
+            guint8 key[VAULT_KEY_SIZE + VAULT_IV_SIZE];
+
+            memcpy(key, iKey, VAULT_KEY_SIZE);
+            memcpy(key + VAULT_KEY_SIZE, aRecord + ivPos, VAULT_IV_SIZE);
+
+            FoilKey* aes = foil_key_new_from_data(FOIL_KEY_AES256, key,
+                sizeof(key));
+            GBytes* dec = foil_cipher_data(FOIL_CIPHER_AES_CBC_DECRYPT, aes,
+                aRecord + encPos, encSize);
+
+            memset(key, 0, VAULT_KEY_SIZE);
+            foil_key_unref(aes);
+            if (!dec) {
+                return false;
+            }
+
+            // Strip the padding
+            *aData = takeBytes(dec).left(dataSize);
+        }
+    }
+    return true;
+}
+
+// Parses the records, the keys must already be known
+void
+FoilAuthVault::Private::load(
+    const QByteArray& aContents)
+{
+    const char* ptr = aContents.constData();
+    const qint64 total = aContents.size();
+    qint64 pos = iHeader.size();
+    int broken = 0;
+
+    iSlots.clear();
+    iLiveSize = 0;
+    while (pos + 4 <= total) {
+        const quint32 size = qFromBigEndian<quint32>((const uchar*)ptr + pos);
+
+        if (size < VAULT_MIN_RECORD_SIZE || size > VAULT_MAX_RECORD_SIZE ||
+            pos + 4 + size > total) {
+            // Most likely an incomplete write, the next one will
+            // overwrite it
+            HWARN("Garbage at" << pos << "in" << qPrintable(iPath));
+            break;
+        }
+
+        QString id;
+        const int recordSize = 4 + size;
+
+        if (decryptRecord(ptr + pos + 4, size, &id, Q_NULLPTR)) {
+            // The data size is zero for removed records
+            const quint16 idSize = qFromBigEndian<quint16>((const uchar*)
+                ptr + pos + 4);
+            const bool removed = !qFromBigEndian<quint32>((const uchar*)
+                ptr + pos + 4 + 2 + idSize);
+
+            if (iSlots.contains(id)) {
+                iLiveSize -= iSlots.take(id).iSize;
+            }
+            if (!removed) {
+                iSlots.insert(id, Slot(pos, recordSize));
+                iLiveSize += recordSize;
+            }
+        } else {
+            HWARN("Broken record at" << pos << "in" << qPrintable(iPath));
+            broken++;
+        }
+        pos += recordSize;
+    }
+
+    iEnd = pos;
+    HDEBUG(iSlots.count() << "record(s)," << broken << "broken");
+}
+
+QByteArray
+FoilAuthVault::Private::readAll() const
+{
+    QFile file(iPath);
+
+    if (file.open(QIODevice::ReadOnly)) {
+        return file.read(iEnd);
+    } else {
+        HWARN("Failed to open" << qPrintable(iPath));
+        return QByteArray();
+    }
+}
+
+// Empty data means removal
+bool
+FoilAuthVault::Private::append(
+    const QString& aId,
+    const QByteArray& aData)
+{
+    QHash<QString,QByteArray> records;
+
+    records.insert(aId, aData);
+    return append(records);
+}
+
+// All records are appended with a single write
+bool
+FoilAuthVault::Private::append(
+    const QHash<QString,QByteArray>& aRecords)
+{
+    QHashIterator<QString,QByteArray> it(aRecords);
+    QVector<int> sizes;
+    QByteArray buf;
+
+    sizes.reserve(aRecords.count());
+    while (it.hasNext()) {
+        it.next();
+        const QByteArray record(encryptRecord(it.key(), it.value()));
+
+        if (record.isEmpty()) {
+            return false;
+        }
+        sizes.append(record.size());
+        buf.append(record);
+    }
+
+    if (!buf.isEmpty()) {
+        QFile file(iPath);
+
+        if (file.open(QIODevice::ReadWrite)) {
+            // Drop whatever garbage there may be at the end
+            if (file.size() > iEnd) {
+                file.resize(iEnd);
+            }
+            // The caller may delete the original data as soon as this
+            // returns, make sure that the records are on the disk
+            if (file.seek(iEnd) &&
+                file.write(buf) == buf.size() &&
+                file.flush() &&
+                fsync(file.handle()) == 0) {
+                int i = 0;
+
+                it.toFront();
+                while (it.hasNext()) {
+                    it.next();
+                    const QString& id = it.key();
+                    const int size = sizes.at(i++);
+
+                    if (iSlots.contains(id)) {
+                        iLiveSize -= iSlots.take(id).iSize;
+                    }
+                    if (!it.value().isEmpty()) {
+                        iSlots.insert(id, Slot(iEnd, size));
+                        iLiveSize += size;
+                    }
+                    iEnd += size;
+                }
+                file.close();
+                compactIfNeeded();
+                return true;
+            }
+            HWARN("Failed to write" << qPrintable(iPath));
+            file.resize(iEnd);
+        } else {
+            HWARN("Failed to open" << qPrintable(iPath));
+        }
+    }
+    return false;
+}
+
+void
+FoilAuthVault::Private::compactIfNeeded()
+{
+    const qint64 garbage = iEnd - iHeader.size() - iLiveSize;
+
+    if (garbage > iLiveSize && garbage >= VAULT_MIN_GARBAGE) {
+        const QByteArray contents(readAll());
+
+        if (contents.size() == iEnd) {
+            QHash<QString,Slot> slots;
+            QByteArray buf(iHeader);
+
+            buf.reserve(iHeader.size() + iLiveSize);
+            QHashIterator<QString,Slot> it(iSlots);
+            while (it.hasNext()) {
+                it.next();
+                const Slot& slot = it.value();
+
+                slots.insert(it.key(), Slot(buf.size(), slot.iSize));
+                buf.append(contents.constData() + slot.iOffset, slot.iSize);
+            }
+
+            HDEBUG("Compacting" << qPrintable(iPath) << iEnd << "=>" <<
+                buf.size());
+            if (writeFile(iPath, buf)) {
+                iSlots = slots;
+                iEnd = buf.size();
+            }
+        }
+    }
+}
+
+// ==========================================================================
+// FoilAuthVault
+// ==========================================================================
+
+FoilAuthVault::FoilAuthVault(
+    const QString& aPath) :
+    iPrivate(new Private(aPath))
+{
+}
+
+FoilAuthVault::~FoilAuthVault()
+{
+    delete iPrivate;
+}
+
+/* static */
+FoilAuthVault::Ptr
+FoilAuthVault::open(
+    const QString& aPath,
+    FoilPrivateKey* aPrivate,
+    FoilKey* aPublic)
+{
+    QFile file(aPath);
+
+    if (file.open(QIODevice::ReadOnly)) {
+        const QByteArray contents(file.readAll());
+        const char* ptr = contents.constData();
+        const int headerSize = VAULT_MAGIC_SIZE + 4;
+
+        file.close();
+        if (contents.size() >= headerSize &&
+            !memcmp(ptr, VAULT_MAGIC, VAULT_MAGIC_SIZE)) {
+            const quint32 keySize = qFromBigEndian<quint32>((const uchar*)
+                ptr + VAULT_MAGIC_SIZE);
+
+            if (keySize <= (quint32)(contents.size() - headerSize)) {
+                Ptr vault(new FoilAuthVault(aPath));
+                Private* priv = vault->iPrivate;
+
+                HDEBUG("Opening" << qPrintable(aPath));
+                if (priv->unwrapKeys(contents.mid(headerSize, keySize),
+                    aPrivate, aPublic)) {
+                    priv->iHeader = contents.left(headerSize + keySize);
+                    priv->load(contents);
+                    return vault;
+                }
+            }
+        }
+        HWARN("Not a valid vault" << qPrintable(aPath));
+    }
+    return Ptr();
+}
+
+/* static */
+FoilAuthVault::Ptr
+FoilAuthVault::create(
+    const QString& aPath,
+    FoilPrivateKey* aPrivate,
+    FoilKey* aPublic)
+{
+    guint8 keys[VAULT_KEY_SIZE + VAULT_MAC_KEY_SIZE];
+    FoilBytes data;
+    FoilMsgEncryptOptions opt;
+    FoilOutput* out = foil_output_mem_new(Q_NULLPTR);
+
+    foil_random_generate(FOIL_RANDOM_DEFAULT, keys, sizeof(keys));
+    data.val = keys;
+    data.len = sizeof(keys);
+
+    foilmsg_encrypt_defaults(&opt);
+    opt.key_type = VAULT_ENCRYPT_KEY_TYPE;
+    opt.signature = VAULT_SIGNATURE_TYPE;
+
+    Ptr vault;
+
+    if (foilmsg_encrypt(out, &data, Q_NULLPTR, Q_NULLPTR, aPrivate, aPublic,
+        &opt, Q_NULLPTR)) {
+        const QByteArray wrapped(takeBytes(foil_output_free_to_bytes(out)));
+        QByteArray header(VAULT_MAGIC, VAULT_MAGIC_SIZE);
+
+        Private::putUint32(&header, wrapped.size());
+        header.append(wrapped);
+
+        HDEBUG("Creating" << qPrintable(aPath));
+        if (Private::writeFile(aPath, header)) {
+            vault = new FoilAuthVault(aPath);
+            vault->iPrivate->setKeys(keys);
+            vault->iPrivate->iHeader = header;
+            vault->iPrivate->iEnd = header.size();
+        }
+    } else {
+        HWARN("Failed to wrap the vault key");
+        foil_output_unref(out);
+    }
+    memset(keys, 0, sizeof(keys));
+    return vault;
+}
+
+QString
+FoilAuthVault::path() const
+{
+    return iPrivate->iPath;
+}
+
+QStringList
+FoilAuthVault::ids() const
+{
+    QMutexLocker lock(&iPrivate->iMutex);
+
+    return iPrivate->iSlots.keys();
+}
+
+bool
+FoilAuthVault::contains(
+    const QString& aId) const
+{
+    QMutexLocker lock(&iPrivate->iMutex);
+
+    return iPrivate->iSlots.contains(aId);
+}
+
+QByteArray
+FoilAuthVault::read(
+    const QString& aId) const
+{
+    QMutexLocker lock(&iPrivate->iMutex);
+    QByteArray data;
+
+    if (iPrivate->iSlots.contains(aId)) {
+        const Private::Slot slot(iPrivate->iSlots.value(aId));
+        QFile file(iPrivate->iPath);
+
+        if (file.open(QIODevice::ReadOnly) && file.seek(slot.iOffset)) {
+            const QByteArray record(file.read(slot.iSize));
+
+            if (record.size() != slot.iSize ||
+                !iPrivate->decryptRecord(record.constData() + 4,
+                record.size() - 4, Q_NULLPTR, &data)) {
+                HWARN("Failed to read" << aId);
+                data.clear();
+            }
+        }
+    }
+    return data;
+}
+
+// Reads and decrypts all records in one go
+QHash<QString,QByteArray>
+FoilAuthVault::readAll() const
+{
+    QMutexLocker lock(&iPrivate->iMutex);
+    const QByteArray contents(iPrivate->readAll());
+    QHash<QString,QByteArray> records;
+
+    if (contents.size() == iPrivate->iEnd) {
+        QHashIterator<QString,Private::Slot> it(iPrivate->iSlots);
+
+        records.reserve(iPrivate->iSlots.count());
+        while (it.hasNext()) {
+            it.next();
+            const Private::Slot& slot = it.value();
+            QByteArray data;
+
+            if (iPrivate->decryptRecord(contents.constData() +
+                slot.iOffset + 4, slot.iSize - 4, Q_NULLPTR, &data)) {
+                records.insert(it.key(), data);
+            } else {
+                HWARN("Failed to read" << it.key());
+            }
+        }
+    }
+    return records;
+}
+
+bool
+FoilAuthVault::write(
+    const QString& aId,
+    const QByteArray& aData)
+{
+    if (!aData.isEmpty()) {
+        QMutexLocker lock(&iPrivate->iMutex);
+
+        return iPrivate->append(aId, aData);
+    }
+    return false;
+}
+
+// Appends all records in one go, empty data are skipped
+bool
+FoilAuthVault::writeAll(
+    const QHash<QString,QByteArray>& aRecords)
+{
+    QHash<QString,QByteArray> records;
+    QHashIterator<QString,QByteArray> it(aRecords);
+
+    while (it.hasNext()) {
+        it.next();
+        if (!it.value().isEmpty()) {
+            records.insert(it.key(), it.value());
+        }
+    }
+    if (!records.isEmpty()) {
+        QMutexLocker lock(&iPrivate->iMutex);
+
+        return iPrivate->append(records);
+    }
+    return false;
+}
+
+bool
+FoilAuthVault::remove(
+    const QString& aId)
+{
+    QMutexLocker lock(&iPrivate->iMutex);
+
+    // Nothing to do if there's no such record
+    return iPrivate->iSlots.contains(aId) &&
+        iPrivate->append(aId, QByteArray());
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the names of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation
+ * are those of the authors and should not be interpreted as representing
+ * any official policies, either expressed or implied.
+ */
+
+#ifndef FOILAUTH_VAULT_H
+#define FOILAUTH_VAULT_H
+
+#include "foil_types.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QSharedData>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+// Single file container for records identified by string ids. The file
+// starts with a random data key wrapped (encrypted and signed) with the
+// user's RSA key, followed by the records, each one encrypted with
+// AES-256-CBC and authenticated with HMAC-SHA256 independently of the
+// others. Opening the vault costs one RSA decryption and one signature
+// check, regardless of the number of records.
+//
+// Records are never modified in the middle of the file. An updated
+// record is appended to the end of the file and supersedes the earlier
+// one with the same id, a removed record is superseded by an empty one.
+// Once superseded records take more space than the live ones, the file
+// gets compacted by copying the live records into a new file, which
+// involves neither decryption nor RSA operations.
+//
+// All methods are thread-safe.
+class FoilAuthVault :
+    public QSharedData
+{
+public:
+    typedef QExplicitlySharedDataPointer<FoilAuthVault> Ptr;
+
+    ~FoilAuthVault();
+
+    static Ptr open(const QString&, FoilPrivateKey*, FoilKey*);
+    static Ptr create(const QString&, FoilPrivateKey*, FoilKey*);
+
+    QString path() const;
+    QStringList ids() const;
+    bool contains(const QString&) const;
+    QByteArray read(const QString&) const;
+    QHash<QString,QByteArray> readAll() const;
+    bool write(const QString&, const QByteArray&);
+    bool writeAll(const QHash<QString,QByteArray>&);
+    bool remove(const QString&);
+
+private:
+    FoilAuthVault(const QString&);
+    Q_DISABLE_COPY(FoilAuthVault)
+    class Private;
+    Private* iPrivate;
+};
+
+#endif // FOILAUTH_VAULT_H
@@ -49,6 +49,7 @@
 #include <QtCore/QFile>
 #include <QtCore/QStandardPaths>
 #include <QtCore/QCryptographicHash>
+#include <QtCore/QSet>
 
 #include <QtSql/QSqlDatabase>
 #include <QtSql/QSqlQuery>
@@ -97,6 +98,7 @@ private:
 public:
     QList<Token> iTokens;
     QStringList iImportedTokens;
+    QSet<QString> iImportedSet; // Same as iImportedTokens, for lookups
 };
 
 #define TABLE_NAME "OTPStorage"
@@ -118,7 +120,8 @@ const QString SailOTP::Private::COL_DIFF("diff");       // INTEGER
 SailOTP::Private::Private(
     const QStringList& aImportedTokens,
     FoilAuthModel* aDestModel) :
-    iImportedTokens(aImportedTokens)
+    iImportedTokens(aImportedTokens),
+    iImportedSet(aImportedTokens.toSet())
 {
     // SqlDatabase object needs to go out of scope before we can
     // call QSqlDatabase::removeDatabase
@@ -191,7 +194,7 @@ SailOTP::Private::fetchTokens(
                     const QString secretHash(QString(QCryptographicHash::hash(secret,
                         QCryptographicHash::Sha1).toHex()).toLower());
 
-                    if (iImportedTokens.contains(secretHash) ||
+                    if (iImportedSet.contains(secretHash) ||
                         (aDestModel && aDestModel->containsSecret(secret))) {
                         HDEBUG("SailOTP token" << title << "is already imported");
                     } else {
@@ -213,6 +216,7 @@ SailOTP::Private::fetchTokens(
                         HDEBUG(token.iToken << token.iFavorite);
                         iTokens.append(token);
                         iImportedTokens.append(secretHash);
+                        iImportedSet.insert(secretHash);
                     }
                 }
             }
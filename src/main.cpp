@@ -41,6 +41,7 @@
 #include "FoilAuthFavoritesModel.h"
 #include "FoilAuthGroupModel.h"
 #include "FoilAuthImportModel.h"
+#include "FoilAuthLookAheadModel.h"
 #include "FoilAuthModel.h"
 #include "FoilAuthSettings.h"
 #include "FoilAuthToken.h"
@@ -88,6 +89,7 @@ static void register_types(const char* uri, int v1 = 1, int v2 = 0)
     REGISTER_TYPE(uri, v1, v2, FoilAuthFavoritesModel);
     REGISTER_TYPE(uri, v1, v2, FoilAuthGroupModel);
     REGISTER_TYPE(uri, v1, v2, FoilAuthImportModel);
+    REGISTER_TYPE(uri, v1, v2, FoilAuthLookAheadModel);
     REGISTER_TYPE(uri, v1, v2, HarbourOrganizeListModel);
     REGISTER_TYPE(uri, v1, v2, HarbourQrCodeGenerator);
     REGISTER_TYPE(uri, v1, v2, HarbourSelectionListModel);
@@ -179,6 +181,12 @@ int main(int argc, char *argv[])
         QVariant::fromValue((int)FoilAuthTypes::DEFAULT_COUNTER));
     context->setContextProperty("FoilAuthDefaultTimeShift",
         QVariant::fromValue((int)FoilAuthTypes::DEFAULT_TIMESHIFT));
+    context->setContextProperty("FoilAuthMinPeriod",
+        QVariant::fromValue((int)FoilAuthTypes::MIN_PERIOD));
+    context->setContextProperty("FoilAuthMaxPeriod",
+        QVariant::fromValue((int)FoilAuthTypes::MAX_PERIOD));
+    context->setContextProperty("FoilAuthDefaultPeriod",
+        QVariant::fromValue((int)FoilAuthTypes::DEFAULT_PERIOD));
 
     // Initialize the view and show it
     view->setTitle(qtTrId("foilauth-app_name"));
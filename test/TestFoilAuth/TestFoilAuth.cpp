@@ -38,14 +38,20 @@
  */
 
 #include "FoilAuth.h"
+#include "FoilAuthHmac.h"
 #include "FoilAuthToken.h"
 
 #include "HarbourBase32.h"
 #include "HarbourDebug.h"
 
+#include "foil_digest.h"
+#include "foil_hmac.h"
+
 #include <QCoreApplication>
+#include <QElapsedTimer>
 #include <QFileInfo>
 #include <QFile>
+#include <QVector>
 
 /*==========================================================================*
  * basic
@@ -261,6 +267,288 @@ test_hotp(
         FoilAuth::DigestAlgorithmSHA512), == ,          8);
 }
 
+/*==========================================================================*
+ * hmac
+ *==========================================================================*/
+
+// Reference implementation, straight from libfoil
+static
+uint
+test_foil_hmac(
+    const QByteArray aSecret,
+    quint64 aValue,
+    FoilAuth::DigestAlgorithm aAlgorithm)
+{
+    GType (*digest_type)(void) = foil_impl_digest_sha1_get_type;
+
+    switch (aAlgorithm) {
+    case FoilAuth::DigestAlgorithmSHA1:
+        digest_type = foil_impl_digest_sha1_get_type;
+        break;
+    case FoilAuth::DigestAlgorithmSHA256:
+        digest_type = foil_impl_digest_sha256_get_type;
+        break;
+    case FoilAuth::DigestAlgorithmSHA512:
+        digest_type = foil_impl_digest_sha512_get_type;
+        break;
+    }
+
+    FoilHmac* hmac = foil_hmac_new(digest_type(), aSecret.constData(),
+        aSecret.size());
+    const guint64 msg = GUINT64_TO_BE(aValue);
+    gsize len;
+
+    foil_hmac_update(hmac, &msg, sizeof(msg));
+    GBytes* bytes = foil_hmac_free_to_bytes(hmac);
+    const guint8* hash = (const guint8*)g_bytes_get_data(bytes, &len);
+    const uint offset = hash[len - 1] & 0x0f;
+    const uint result = ((hash[offset] & 0x7f) << 24) |
+        (hash[offset + 1] << 16) | (hash[offset + 2] << 8) |
+        hash[offset + 3];
+
+    g_bytes_unref(bytes);
+    return result;
+}
+
+static
+void
+test_hmac(
+    void)
+{
+    const QByteArray secret(HarbourBase32::fromBase32("MHGU3YYJJD6W44KUVED4FODUNN4JHJNQ"));
+    const FoilAuthHmac::Key sha1(secret, FoilAuth::DigestAlgorithmSHA1);
+    const FoilAuthHmac::Key sha256(secret, FoilAuth::DigestAlgorithmSHA256);
+    const FoilAuthHmac::Key sha512(secret, FoilAuth::DigestAlgorithmSHA512);
+
+    // Precomputed state is reusable
+    for (int i = 0; i < 2; i++) {
+        g_assert_cmpuint(FoilAuthHmac::hash(sha1, 0), == , 738207601);
+        g_assert_cmpuint(FoilAuthHmac::hash(sha1, 1), == , 845444239);
+        g_assert_cmpuint(FoilAuthHmac::hash(sha256, 0), == , 1874367047);
+        g_assert_cmpuint(FoilAuthHmac::hash(sha256, 1), == , 943714922);
+        g_assert_cmpuint(FoilAuthHmac::hash(sha512, 0), == , 1432308534);
+        g_assert_cmpuint(FoilAuthHmac::hash(sha512, 1), == , 1775899828);
+    }
+
+    // And matches libfoil
+    for (int i = 0; i < 3; i++) {
+        const FoilAuth::DigestAlgorithm alg = (FoilAuth::DigestAlgorithm)i;
+
+        g_assert_cmpuint(FoilAuth::hash(secret, 1548529350, alg), == ,
+            test_foil_hmac(secret, 1548529350, alg));
+    }
+}
+
+/*==========================================================================*
+ * rfc4226
+ *==========================================================================*/
+
+static
+void
+test_rfc4226(
+    void)
+{
+    // RFC 4226 Appendix D
+    static const uint hotp[] = {
+        755224, 287082, 359152, 969429, 338314,
+        254676, 287922, 162583, 399871, 520489
+    };
+    const QByteArray secret("12345678901234567890");
+    const FoilAuthHmac::Key key(secret, FoilAuth::DigestAlgorithmSHA1);
+    const int n = G_N_ELEMENTS(hotp);
+    uint hashes[G_N_ELEMENTS(hotp)];
+    int i;
+
+    // One by one
+    for (i = 0; i < n; i++) {
+        g_assert_cmpuint(FoilAuthHmac::hash(key, i) % 1000000, == ,hotp[i]);
+        g_assert_cmpuint(FoilAuth::HOTP(secret, i, 1000000), == ,hotp[i]);
+    }
+
+    // All at once
+    FoilAuthHmac::hash(key, 0, hashes, n);
+    for (i = 0; i < n; i++) {
+        g_assert_cmpuint(hashes[i] % 1000000, == ,hotp[i]);
+    }
+
+    // Every other one
+    memset(hashes, 0, sizeof(hashes));
+    FoilAuthHmac::hash(key, 1, 2, hashes, n/2);
+    for (i = 0; i < n/2; i++) {
+        g_assert_cmpuint(hashes[i] % 1000000, == ,hotp[2*i + 1]);
+    }
+}
+
+/*==========================================================================*
+ * rfc6238
+ *==========================================================================*/
+
+static
+void
+test_rfc6238(
+    void)
+{
+    // RFC 6238 Appendix B
+    static const struct {
+        quint64 time;
+        uint totp[3]; // SHA1, SHA256, SHA512
+    } tests[] = {
+        { Q_UINT64_C(59), { 94287082, 46119246, 90693936 } },
+        { Q_UINT64_C(1111111109), { 7081804, 68084774, 25091201 } },
+        { Q_UINT64_C(1111111111), { 14050471, 67062674, 99943326 } },
+        { Q_UINT64_C(1234567890), { 89005924, 91819424, 93441116 } },
+        { Q_UINT64_C(2000000000), { 69279037, 90698825, 38618901 } },
+        { Q_UINT64_C(20000000000), { 65353130, 77737706, 47863826 } }
+    };
+    static const FoilAuth::DigestAlgorithm alg[3] = {
+        FoilAuth::DigestAlgorithmSHA1,
+        FoilAuth::DigestAlgorithmSHA256,
+        FoilAuth::DigestAlgorithmSHA512
+    };
+    const QByteArray seed("1234567890123456789012345678901234567890"
+        "123456789012345678901234");
+    const QByteArray secret[3] = { seed.left(20), seed.left(32), seed };
+    const FoilAuthHmac::Key key[3] = {
+        FoilAuthHmac::Key(secret[0], alg[0]),
+        FoilAuthHmac::Key(secret[1], alg[1]),
+        FoilAuthHmac::Key(secret[2], alg[2])
+    };
+    QVector<FoilAuthHmac::Lane> lanes;
+    uint i, k;
+
+    // Interleave algorithms to make sure that grouping works
+    for (i = 0; i < G_N_ELEMENTS(tests); i++) {
+        for (k = 0; k < 3; k++) {
+            const quint64 t = tests[i].time;
+
+            lanes.append(FoilAuthHmac::Lane(key + k, t / FoilAuth::PERIOD));
+            g_assert_cmpuint(FoilAuth::TOTP(secret[k], t, 100000000, alg[k]),
+                == ,tests[i].totp[k]);
+        }
+    }
+
+    FoilAuthHmac::hash(lanes.data(), lanes.count());
+    for (i = 0; i < G_N_ELEMENTS(tests); i++) {
+        for (k = 0; k < 3; k++) {
+            g_assert_cmpuint(lanes.at(3 * i + k).iHash % 100000000, == ,
+                tests[i].totp[k]);
+        }
+    }
+}
+
+/*==========================================================================*
+ * batch
+ *==========================================================================*/
+
+static
+void
+test_batch(
+    void)
+{
+    // Odd number of lanes and keys of various sizes (including the ones
+    // longer than the block size) against the scalar implementation
+    const int n = 101;
+    QList<QByteArray> secrets;
+    QVector<FoilAuthHmac::Key> keys;
+    QVector<FoilAuthHmac::Lane> lanes;
+    int i;
+
+    keys.reserve(n);
+    for (i = 0; i < n; i++) {
+        QByteArray secret;
+
+        for (int k = 0; k < 3 * i + 1; k++) {
+            secret.append((char)(i + k));
+        }
+        secrets.append(secret);
+        keys.append(FoilAuthHmac::Key(secret, (FoilAuth::DigestAlgorithm)
+            (i % 3)));
+        lanes.append(FoilAuthHmac::Lane(keys.constData() + i,
+            Q_UINT64_C(0x0123456789abcdef) * i));
+    }
+
+    FoilAuthHmac::hash(lanes.data(), n);
+    for (i = 0; i < n; i++) {
+        const FoilAuthHmac::Lane& lane = lanes.at(i);
+
+        g_assert_cmpuint(lane.iHash, == ,test_foil_hmac(secrets.at(i),
+            lane.iValue, (FoilAuth::DigestAlgorithm)(i % 3)));
+    }
+}
+
+/*==========================================================================*
+ * throughput
+ *==========================================================================*/
+
+static
+void
+test_throughput(
+    void)
+{
+    const int n = 100000;
+    const QByteArray secret("12345678901234567890");
+    QVector<uint> hashes(n);
+
+    for (int k = 0; k < 3; k++) {
+        const FoilAuth::DigestAlgorithm alg = (FoilAuth::DigestAlgorithm)k;
+        const FoilAuthHmac::Key key(secret, alg);
+        QElapsedTimer timer;
+        qint64 ns;
+        int i;
+
+        timer.start();
+        FoilAuthHmac::hash(key, 0, hashes.data(), n);
+        ns = timer.nsecsElapsed();
+        g_test_minimized_result(ns / 1e9, "batch, algorithm %d: "
+            "%d codes in %.3f sec", k, n, ns / 1e9);
+
+        // The same thing one lane at a time, i.e. without vectorization
+        timer.start();
+        for (i = 0; i < n; i++) {
+            g_assert_cmpuint(FoilAuthHmac::hash(key, i), == ,hashes.at(i));
+        }
+        ns = timer.nsecsElapsed();
+        g_test_minimized_result(ns / 1e9, "single lane, algorithm %d: "
+            "%d codes in %.3f sec", k, n, ns / 1e9);
+
+        timer.start();
+        for (i = 0; i < n; i++) {
+            g_assert_cmpuint(test_foil_hmac(secret, i, alg), == ,hashes.at(i));
+        }
+        ns = timer.nsecsElapsed();
+        g_test_minimized_result(ns / 1e9, "foil_hmac, algorithm %d: "
+            "%d codes in %.3f sec", k, n, ns / 1e9);
+    }
+}
+
+/*==========================================================================*
+ * toToken
+ *==========================================================================*/
+
+static
+void
+test_toToken(
+    void)
+{
+    g_assert(!FoilAuth::toToken(FoilAuth::TypeTOTP,
+        "", "Label", "Issuer", 5,
+        FoilAuthTypes::DEFAULT_COUNTER,
+        FoilAuthTypes::DEFAULT_TIMESHIFT,
+        FoilAuth::DefaultAlgorithm).isValid());
+
+    const FoilAuthToken token(FoilAuth::toToken(FoilAuth::TypeHOTP,
+        "aebagbaf", "Label", "Issuer", 8, 42, 10,
+        FoilAuth::AlgorithmSHA256, 60));
+
+    g_assert(token.isValid());
+    g_assert_cmpint(token.type(), == ,FoilAuth::TypeHOTP);
+    g_assert_cmpint(token.digits(), == ,8);
+    g_assert_cmpint(token.counter(), == ,42);
+    g_assert_cmpint(token.timeshift(), == ,10);
+    g_assert_cmpint(token.algorithm(), == ,FoilAuth::AlgorithmSHA256);
+    g_assert_cmpint(token.period(), == ,60);
+}
+
 /*==========================================================================*
  * toUri
  *==========================================================================*/
@@ -454,6 +742,14 @@ int main(int argc, char* argv[])
     g_test_add_func(TEST_("file"), test_file);
     g_test_add_func(TEST_("totp"), test_totp);
     g_test_add_func(TEST_("hotp"), test_hotp);
+    g_test_add_func(TEST_("hmac"), test_hmac);
+    g_test_add_func(TEST_("rfc4226"), test_rfc4226);
+    g_test_add_func(TEST_("rfc6238"), test_rfc6238);
+    g_test_add_func(TEST_("batch"), test_batch);
+    if (g_test_perf()) {
+        g_test_add_func(TEST_("throughput"), test_throughput);
+    }
+    g_test_add_func(TEST_("toToken"), test_toToken);
     g_test_add_func(TEST_("toUri"), test_toUri);
     g_test_add_func(TEST_("migrationUri"), test_migrationUri);
     g_test_add_func(TEST_("parseUri"), test_parseUri);
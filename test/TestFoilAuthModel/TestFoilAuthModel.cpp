@@ -0,0 +1,738 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the names of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation
+ * are those of the authors and should not be interpreted as representing
+ * any official policies, either expressed or implied.
+ */
+
+#include "FoilAuthModel.h"
+
+#include "HarbourDebug.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QTimer>
+
+#include <glib.h>
+#include <utime.h>
+
+#define TEST_KEY_BITS 1024
+#define TEST_PASSWORD "test"
+#define TEST_TIMEOUT_MS (60 * 1000)
+
+/*==========================================================================*
+ * Helpers
+ *==========================================================================*/
+
+static
+void
+test_wait(
+    FoilAuthModel* aModel,
+    const char* aSignal,
+    FoilAuthModel::FoilState aState,
+    bool aIdle)
+{
+    QElapsedTimer elapsed;
+    QEventLoop loop;
+
+    QObject::connect(aModel, aSignal, &loop, SLOT(quit()));
+    elapsed.start();
+    while (aModel->foilState() != aState || (aIdle && aModel->busy())) {
+        QTimer::singleShot(1000, &loop, SLOT(quit()));
+        loop.exec();
+        g_assert_cmpint(elapsed.elapsed(), < ,TEST_TIMEOUT_MS);
+    }
+}
+
+static
+void
+test_wait_ready(
+    FoilAuthModel* aModel)
+{
+    test_wait(aModel, SIGNAL(foilStateChanged()),
+        FoilAuthModel::FoilModelReady, true);
+}
+
+static
+void
+test_wait_idle(
+    FoilAuthModel* aModel)
+{
+    test_wait(aModel, SIGNAL(busyChanged()), aModel->foilState(), true);
+}
+
+static
+QStringList
+test_ids(
+    FoilAuthModel* aModel)
+{
+    QList<int> rows;
+    const int n = aModel->rowCount();
+
+    for (int i = 0; i < n; i++) {
+        rows.append(i);
+    }
+    return aModel->getIdsAt(rows);
+}
+
+static
+QString
+test_id_at(
+    FoilAuthModel* aModel,
+    int aRow)
+{
+    return aModel->getIdsAt(QList<int>() << aRow).first();
+}
+
+static
+FoilAuthToken
+test_token(
+    int aIndex)
+{
+    QByteArray secret(20, 0);
+
+    for (int i = 0; i < secret.size(); i++) {
+        secret[i] = (char)g_test_rand_int();
+    }
+    return FoilAuthToken(FoilAuthTypes::AuthTypeTOTP, secret,
+        QString("Token %1").arg(aIndex), QString("Issuer"));
+}
+
+static
+void
+test_check(
+    FoilAuthModel* aModel,
+    const QStringList& aIds)
+{
+    g_assert_cmpint(aModel->rowCount(), == ,aIds.count());
+    g_assert(test_ids(aModel) == aIds);
+}
+
+/*==========================================================================*
+ * rowIndex
+ *==========================================================================*/
+
+static
+void
+test_rowIndex(
+    void)
+{
+    const int groups = 1000;
+    const int tokens = 1000;
+    const int iterations = 5000;
+    FoilAuthModel* model = new FoilAuthModel;
+    QList<FoilAuthToken> list;
+    QStringList ids;
+    int i;
+
+    model->setSaveDelay(0);
+    model->generateKey(TEST_KEY_BITS, TEST_PASSWORD);
+    test_wait_ready(model);
+
+    // Groups are appended one by one, multiple tokens are appended in bulk
+    for (i = 0; i < groups; i++) {
+        model->addGroup(QString("Group %1").arg(i));
+    }
+    for (i = 0; i < tokens; i++) {
+        list.append(test_token(i));
+    }
+    model->addTokens(list);
+    test_wait_idle(model);
+    ids = test_ids(model);
+    g_assert_cmpint(ids.count(), == ,groups + tokens);
+
+    // Deleting by id goes through the index. If the index points to
+    // a wrong row, the wrong item gets deleted and the scan notices it.
+    for (i = 0; i < iterations; i++) {
+        const int n = ids.count();
+        int row, dest;
+
+        switch (n ? g_test_rand_int_range(0, 4) : 1) {
+        case 0:
+            row = g_test_rand_int_range(0, n);
+            dest = g_test_rand_int_range(0, n);
+            if (dest != row) {
+                g_assert(model->moveRows(QModelIndex(), row, 1,
+                    QModelIndex(), dest));
+                ids.move(row, dest);
+            }
+            break;
+        case 1:
+            model->addGroup(QString("Group %1").arg(groups + i));
+            ids.append(test_id_at(model, n));
+            break;
+        case 2:
+            // A single token is prepended, it gets a new id once
+            // it's encrypted
+            model->addTokens(QList<FoilAuthToken>() << test_token(i));
+            test_wait_idle(model);
+            ids.prepend(test_id_at(model, 0));
+            break;
+        default:
+            // Only one of these succeeds
+            row = g_test_rand_int_range(0, n);
+            model->deleteGroupItem(ids.at(row));
+            model->deleteToken(ids.at(row));
+            ids.removeAt(row);
+            break;
+        }
+        if (!(i % 100)) {
+            test_check(model, ids);
+        }
+    }
+    test_wait_idle(model);
+    test_check(model, ids);
+
+    // Bulk deletion of every other row
+    QStringList deleted;
+
+    for (i = ids.count() - 1; i >= 0; i -= 2) {
+        deleted.append(ids.takeAt(i));
+    }
+    model->deleteTokens(deleted);
+    for (i = 0; i < deleted.count(); i++) {
+        model->deleteGroupItem(deleted.at(i));
+    }
+    test_check(model, ids);
+    delete model;
+}
+
+/*==========================================================================*
+ * secretIndex
+ *==========================================================================*/
+
+static
+void
+test_secretIndex(
+    void)
+{
+    const int count = 200;
+    FoilAuthModel* model = new FoilAuthModel;
+    QList<FoilAuthToken> list;
+    QStringList ids;
+    int i;
+
+    model->setSaveDelay(0);
+    model->generateKey(TEST_KEY_BITS, TEST_PASSWORD);
+    test_wait_ready(model);
+
+    for (i = 0; i < count; i++) {
+        list.append(test_token(i));
+    }
+    model->addTokens(list);
+    test_wait_idle(model);
+    ids = test_ids(model);
+
+    // Bulk insert preserves the order
+    for (i = 0; i < count; i++) {
+        const FoilAuthToken& token = list.at(i);
+
+        g_assert(model->containsSecret(token.secret()));
+        g_assert_cmpint(model->indexOf(token), == ,i);
+        g_assert(!model->contains(token.withDigits(token.digits() + 1)));
+    }
+    g_assert(!model->containsSecret(test_token(count).secret()));
+
+    // Delete every other token
+    QStringList deleted;
+
+    for (i = 0; i < count; i += 2) {
+        deleted.append(ids.at(i));
+    }
+    model->deleteTokens(deleted);
+    for (i = 0; i < count; i++) {
+        const FoilAuthToken& token = list.at(i);
+
+        if (i % 2) {
+            g_assert_cmpint(model->indexOf(token), == ,i/2);
+        } else {
+            g_assert(!model->containsSecret(token.secret()));
+            g_assert_cmpint(model->indexOf(token), == ,-1);
+        }
+    }
+    delete model;
+}
+
+/*==========================================================================*
+ * deleteTokens
+ *==========================================================================*/
+
+static
+void
+test_deleteTokens(
+    void)
+{
+    const int count = 10;
+    const QString dir(QDir::homePath() + "/Documents/FoilAuth");
+    FoilAuthModel* model = new FoilAuthModel;
+    QList<FoilAuthToken> list;
+    QStringList ids, deleted;
+    int i;
+
+    model->setSaveDelay(0);
+    model->setVault(false);
+    model->generateKey(TEST_KEY_BITS, TEST_PASSWORD);
+    test_wait_ready(model);
+
+    for (i = 0; i < count; i++) {
+        list.append(test_token(i));
+    }
+    model->addTokens(list);
+    test_wait_idle(model);
+    ids = test_ids(model);
+
+    // Two ranges, a duplicate and an unknown id
+    deleted << ids.at(7) << ids.at(2) << ids.at(3) << ids.at(4) <<
+        ids.at(3) << "unknown";
+    model->deleteTokens(deleted);
+    g_assert(model->busy());
+    ids.removeAt(7);
+    ids.removeAt(4);
+    ids.removeAt(3);
+    ids.removeAt(2);
+    test_check(model, ids);
+
+    // The files are gone once the model is idle
+    test_wait_idle(model);
+    for (i = 0; i < deleted.count(); i++) {
+        g_assert(!QFile::exists(dir + "/" + deleted.at(i)));
+    }
+    for (i = 0; i < ids.count(); i++) {
+        g_assert(QFile::exists(dir + "/" + ids.at(i)));
+    }
+    delete model;
+}
+
+/*==========================================================================*
+ * import
+ *==========================================================================*/
+
+static
+void
+test_import(
+    void)
+{
+    const int count = 100;
+    const QString dir(QDir::homePath() + "/Documents/FoilAuth");
+    FoilAuthModel* model;
+    QList<FoilAuthToken> list;
+    QStringList ids, files;
+    int i;
+
+    // Start with an empty directory
+    QDir(dir).removeRecursively();
+    model = new FoilAuthModel;
+    model->setSaveDelay(0);
+    model->setVault(false);
+    model->generateKey(TEST_KEY_BITS, TEST_PASSWORD);
+    test_wait_ready(model);
+
+    // The rows are inserted right away, nothing is written yet
+    for (i = 0; i < count; i++) {
+        list.append(test_token(i));
+    }
+    model->addTokens(list);
+    g_assert_cmpint(model->rowCount(), == ,count);
+    g_assert_cmpint(model->importPending(), == ,count);
+    g_assert(model->busy());
+    ids = test_ids(model);
+
+    // Each token is written once, under the id it got when it was added
+    test_wait_idle(model);
+    g_assert_cmpint(model->importPending(), == ,0);
+    g_assert(test_ids(model) == ids);
+    files = QDir(dir).entryList(QDir::Files);
+    g_assert_cmpint(files.count(), == ,count);
+    for (i = 0; i < count; i++) {
+        g_assert(files.contains(ids.at(i)));
+    }
+
+    // And they are all there after unlock
+    model->lock(false);
+    g_assert(model->unlock(TEST_PASSWORD));
+    test_wait(model, SIGNAL(foilStateChanged()),
+        FoilAuthModel::FoilModelReady, false);
+    test_check(model, ids);
+    delete model;
+}
+
+/*==========================================================================*
+ * supersede
+ *==========================================================================*/
+
+static
+void
+test_supersede(
+    void)
+{
+    const int count = 5;
+    const QString dir(QDir::homePath() + "/Documents/FoilAuth");
+    FoilAuthModel* model;
+    int labelRole;
+    QStringList files;
+    QString id, label;
+    int i;
+
+    // Start with an empty directory
+    QDir(dir).removeRecursively();
+    model = new FoilAuthModel;
+    labelRole = model->roleNames().key("label");
+    model->setSaveDelay(0);
+    model->setVault(false);
+    model->generateKey(TEST_KEY_BITS, TEST_PASSWORD);
+    test_wait_ready(model);
+
+    model->addTokens(QList<FoilAuthToken>() << test_token(0));
+    test_wait_idle(model);
+
+    // Only the last edit matters, and only one file is left
+    for (i = 0; i < count; i++) {
+        label = QString("Label %1").arg(i);
+        g_assert(model->setData(model->index(0), label, labelRole));
+    }
+    test_wait_idle(model);
+    id = test_id_at(model, 0);
+    files = QDir(dir).entryList(QDir::Files);
+    g_assert_cmpint(files.count(), == ,1);
+    g_assert(files.first() == id);
+    g_assert(model->data(model->index(0), labelRole).toString() == label);
+
+    // Deleting the token takes care of the pending writes too
+    for (i = 0; i < count; i++) {
+        g_assert(model->setData(model->index(0), QString("Deleted %1").
+            arg(i), labelRole));
+    }
+    model->deleteToken(test_id_at(model, 0));
+    test_wait_idle(model);
+    g_assert(!model->rowCount());
+    g_assert(QDir(dir).entryList(QDir::Files).isEmpty());
+    delete model;
+}
+
+/*==========================================================================*
+ * unlock
+ *==========================================================================*/
+
+static
+void
+test_unlock(
+    void)
+{
+    const int count = 50;
+    const QString dir(QDir::homePath() + "/Documents/FoilAuth");
+    FoilAuthModel* model = new FoilAuthModel;
+    const int pendingRole = model->roleNames().key("pending");
+    QList<FoilAuthToken> list;
+    QStringList ids;
+    int i;
+
+    model->setSaveDelay(0);
+    model->setVault(true);
+    model->generateKey(TEST_KEY_BITS, TEST_PASSWORD);
+    test_wait_ready(model);
+
+    model->addGroup("Group");
+    for (i = 0; i < count; i++) {
+        list.append(test_token(i));
+    }
+    model->addTokens(list);
+    g_assert(model->setData(model->index(count - 1), true,
+        FoilAuthModel::favoriteRole()));
+    test_wait_idle(model);
+    ids = test_ids(model);
+
+    // The rows are all there (some of them as placeholders) by the time
+    // the model becomes ready
+    model->lock(false);
+    g_assert_cmpint(model->rowCount(), == ,0);
+    g_assert(model->unlock(TEST_PASSWORD));
+    test_wait(model, SIGNAL(foilStateChanged()),
+        FoilAuthModel::FoilModelReady, false);
+    g_assert(test_ids(model) == ids);
+    model->setVisibleRows(count/2, count - 1);
+
+    // Placeholders get replaced in place
+    test_wait_idle(model);
+    test_check(model, ids);
+    for (i = 0; i < ids.count(); i++) {
+        g_assert(!model->data(model->index(i), pendingRole).toBool());
+    }
+    for (i = 0; i < count; i++) {
+        g_assert_cmpint(model->indexOf(list.at(i)), == ,i + 1);
+    }
+    g_assert(model->data(model->index(count - 1),
+        FoilAuthModel::favoriteRole()).toBool());
+    g_assert(QFile::exists(dir + "/.vault"));
+
+    // Disabling the vault exports it back into the files
+    model->lock(false);
+    model->setVault(false);
+    g_assert(model->unlock(TEST_PASSWORD));
+    test_wait_ready(model);
+    test_wait_idle(model);
+    g_assert(!QFile::exists(dir + "/.vault"));
+    for (i = 0; i < count; i++) {
+        g_assert(QFile::exists(dir + "/" + ids.at(i + 1)));
+    }
+    test_check(model, ids);
+    for (i = 0; i < count; i++) {
+        g_assert_cmpint(model->indexOf(list.at(i)), == ,i + 1);
+    }
+    g_assert(model->data(model->index(count - 1),
+        FoilAuthModel::favoriteRole()).toBool());
+    delete model;
+}
+
+/*==========================================================================*
+ * snapshot
+ *==========================================================================*/
+
+static
+void
+test_snapshot(
+    void)
+{
+    const int count = 20;
+    const QString dir(QDir::homePath() + "/Documents/FoilAuth");
+    FoilAuthModel* model;
+    int pendingRole;
+    QList<FoilAuthToken> list;
+    QStringList ids;
+    int i;
+
+    // Start with an empty directory
+    QDir(dir).removeRecursively();
+    model = new FoilAuthModel;
+    pendingRole = model->roleNames().key("pending");
+    model->setSaveDelay(0);
+    model->setVault(false);
+    model->setSnapshot(true);
+    model->generateKey(TEST_KEY_BITS, TEST_PASSWORD);
+    test_wait_ready(model);
+
+    model->addGroup("Group");
+    for (i = 0; i < count; i++) {
+        list.append(test_token(i));
+    }
+    model->addTokens(list);
+    g_assert(model->setData(model->index(1), true,
+        FoilAuthModel::favoriteRole()));
+    test_wait_idle(model);
+    ids = test_ids(model);
+    g_assert(QFile::exists(dir + "/.snapshot"));
+
+    // Nothing has changed, the whole thing comes from the snapshot
+    model->lock(false);
+    g_assert(model->unlock(TEST_PASSWORD));
+    test_wait(model, SIGNAL(foilStateChanged()),
+        FoilAuthModel::FoilModelReady, false);
+    test_check(model, ids);
+    for (i = 0; i < ids.count(); i++) {
+        g_assert(!model->data(model->index(i), pendingRole).toBool());
+    }
+    for (i = 0; i < count; i++) {
+        g_assert_cmpint(model->indexOf(list.at(i)), == ,i + 1);
+    }
+    g_assert(model->data(model->index(1),
+        FoilAuthModel::favoriteRole()).toBool());
+    test_wait_idle(model);
+
+    // The file which doesn't match the snapshot gets decrypted
+    const QByteArray path(QString(dir + "/" + ids.at(2)).toUtf8());
+    struct utimbuf times;
+
+    times.actime = times.modtime = 1000000000;
+    g_assert(!utime(path.constData(), &times));
+    model->lock(false);
+    g_assert(model->unlock(TEST_PASSWORD));
+    test_wait_ready(model);
+    test_check(model, ids);
+    for (i = 0; i < ids.count(); i++) {
+        g_assert(!model->data(model->index(i), pendingRole).toBool());
+    }
+    for (i = 0; i < count; i++) {
+        g_assert_cmpint(model->indexOf(list.at(i)), == ,i + 1);
+    }
+
+    // Disabling the snapshot removes it
+    model->setSnapshot(false);
+    model->deleteToken(ids.last());
+    test_wait_idle(model);
+    g_assert(!QFile::exists(dir + "/.snapshot"));
+    delete model;
+}
+
+/*==========================================================================*
+ * unlockAsync
+ *==========================================================================*/
+
+static
+void
+test_unlockAsync(
+    void)
+{
+    FoilAuthModel* model = new FoilAuthModel;
+
+    model->setSaveDelay(0);
+    model->generateKey(TEST_KEY_BITS, TEST_PASSWORD);
+    test_wait_ready(model);
+    delete model;
+
+    // The key is probed in the background
+    model = new FoilAuthModel;
+    g_assert_cmpint(model->foilState(), == ,FoilAuthModel::FoilCheckingKey);
+    test_wait(model, SIGNAL(foilStateChanged()),
+        FoilAuthModel::FoilLocked, true);
+
+    // Wrong password
+    g_assert(model->unlockAsync("wrong"));
+    g_assert_cmpint(model->foilState(), == ,FoilAuthModel::FoilUnlocking);
+    g_assert(model->busy());
+    test_wait(model, SIGNAL(foilStateChanged()),
+        FoilAuthModel::FoilLocked, true);
+    g_assert(!model->keyAvailable());
+
+    // The user changes their mind
+    g_assert(model->unlockAsync(TEST_PASSWORD));
+    model->cancelKeyTask();
+    g_assert_cmpint(model->foilState(), == ,FoilAuthModel::FoilLocked);
+    g_assert(!model->busy());
+
+    // And then tries again
+    g_assert(model->unlockAsync(TEST_PASSWORD));
+    test_wait_ready(model);
+    g_assert(model->keyAvailable());
+
+    // Password gets changed in the background too
+    g_assert(model->changePasswordAsync(TEST_PASSWORD, TEST_PASSWORD "2"));
+    g_assert(model->busy());
+    test_wait_idle(model);
+    model->lock(false);
+    g_assert(!model->changePasswordAsync(TEST_PASSWORD "2", TEST_PASSWORD));
+    g_assert(model->unlockAsync(TEST_PASSWORD));
+    test_wait(model, SIGNAL(foilStateChanged()),
+        FoilAuthModel::FoilLocked, true);
+    g_assert(model->unlockAsync(TEST_PASSWORD "2"));
+    test_wait_ready(model);
+
+    // The synchronous calls report the result right away
+    g_assert(model->checkPassword(TEST_PASSWORD "2"));
+    g_assert(!model->checkPassword(TEST_PASSWORD));
+    g_assert(!model->changePassword(TEST_PASSWORD, TEST_PASSWORD "3"));
+    model->lock(false);
+    g_assert(!model->unlock(TEST_PASSWORD));
+    g_assert_cmpint(model->foilState(), == ,FoilAuthModel::FoilLocked);
+    g_assert(model->unlock(TEST_PASSWORD "2"));
+    test_wait_ready(model);
+    delete model;
+}
+
+/*==========================================================================*
+ * period
+ *==========================================================================*/
+
+static
+void
+test_period(
+    void)
+{
+    const QString dir(QDir::homePath() + "/Documents/FoilAuth");
+    FoilAuthModel* model;
+    int periodRole;
+
+    QDir(dir).removeRecursively();
+    model = new FoilAuthModel;
+    periodRole = model->roleNames().key("period");
+    model->setSaveDelay(0);
+    model->generateKey(TEST_KEY_BITS, TEST_PASSWORD);
+    test_wait_ready(model);
+
+    model->addTokens(QList<FoilAuthToken>() << test_token(0));
+    test_wait_idle(model);
+    g_assert_cmpint(model->rowCount(), == ,1);
+    g_assert(model->timerActive());
+    g_assert_cmpint(model->period(), == ,FoilAuthTypes::DEFAULT_PERIOD);
+    g_assert(!(model->periodEnd() % (FoilAuthTypes::DEFAULT_PERIOD * 1000)));
+
+    // The countdown follows the period of the token
+    g_assert(!model->setData(model->index(0), 0, periodRole));
+    g_assert(model->setData(model->index(0), 90, periodRole));
+    g_assert_cmpint(model->data(model->index(0), periodRole).toInt(), == ,90);
+    g_assert_cmpint(model->period(), == ,90);
+    g_assert(!(model->periodEnd() % 90000));
+    g_assert_cmpint(model->timeLeft(), <= ,90);
+    test_wait_idle(model);
+    delete model;
+}
+
+/*==========================================================================*
+ * Common
+ *==========================================================================*/
+
+#define TEST_(name) "/FoilAuthModel/" name
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    char* home = g_dir_make_tmp("TestFoilAuthModel-XXXXXX", NULL);
+    int ret;
+
+    // The model keeps its files under the home directory
+    g_setenv("HOME", home, TRUE);
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func(TEST_("rowIndex"), test_rowIndex);
+    g_test_add_func(TEST_("secretIndex"), test_secretIndex);
+    g_test_add_func(TEST_("deleteTokens"), test_deleteTokens);
+    g_test_add_func(TEST_("import"), test_import);
+    g_test_add_func(TEST_("supersede"), test_supersede);
+    g_test_add_func(TEST_("unlock"), test_unlock);
+    g_test_add_func(TEST_("snapshot"), test_snapshot);
+    g_test_add_func(TEST_("unlockAsync"), test_unlockAsync);
+    g_test_add_func(TEST_("period"), test_period);
+    ret = g_test_run();
+    QDir(QString::fromLocal8Bit(home)).removeRecursively();
+    g_free(home);
+    return ret;
+}
+
+/*
+ * Local Variables:
+ * mode: C++
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -135,6 +135,21 @@ test_validDigits(
     g_assert_cmpint(FoilAuthToken::validDigits(FoilAuthTypes::MAX_DIGITS + 1), == ,FoilAuthTypes::DEFAULT_DIGITS);
 }
 
+/*==========================================================================*
+ * validPeriod
+ *==========================================================================*/
+
+static
+void
+test_validPeriod(
+    void)
+{
+    g_assert_cmpint(FoilAuthToken::validPeriod(FoilAuthTypes::MIN_PERIOD), == ,FoilAuthTypes::MIN_PERIOD);
+    g_assert_cmpint(FoilAuthToken::validPeriod(FoilAuthTypes::MIN_PERIOD - 1), == ,FoilAuthTypes::DEFAULT_PERIOD);
+    g_assert_cmpint(FoilAuthToken::validPeriod(FoilAuthTypes::MAX_PERIOD), == ,FoilAuthTypes::MAX_PERIOD);
+    g_assert_cmpint(FoilAuthToken::validPeriod(FoilAuthTypes::MAX_PERIOD + 1), == ,FoilAuthTypes::DEFAULT_PERIOD);
+}
+
 /*==========================================================================*
  * invalid
  *==========================================================================*/
@@ -156,7 +171,11 @@ test_invalid(
     g_assert_cmpint(invalid.timeshift(), == ,0);
     g_assert_cmpint(invalid.counter(), == ,0);
     g_assert_cmpint(invalid.digits(), == ,0);
+    g_assert_cmpint(invalid.period(), == ,0);
+    g_assert_cmpuint(invalid.periodStart(123456789), == ,123456789);
     g_assert(invalid.passwordString(123456789).isEmpty());
+    g_assert(invalid.formatPassword(123456).isEmpty());
+    g_assert_cmpuint(invalid.passwordValue(123456789), == ,0);
 
     g_assert(invalid.withType(FoilAuthTypes::DEFAULT_AUTH_TYPE) == invalid);
     g_assert(invalid.withAlgorithm(FoilAuthTypes::DEFAULT_ALGORITHM) == invalid);
@@ -166,6 +185,7 @@ test_invalid(
     g_assert(invalid.withTimeshift(1) == invalid);
     g_assert(invalid.withCounter(1) == invalid);
     g_assert(invalid.withDigits(FoilAuthTypes::DEFAULT_DIGITS) == invalid);
+    g_assert(invalid.withPeriod(FoilAuthTypes::DEFAULT_PERIOD) == invalid);
 }
 
 /*==========================================================================*
@@ -180,6 +200,162 @@ test_password(
     QByteArray data = HarbourBase32::fromBase32("VHIIKTVJC6MEOFTJ");
     FoilAuthToken token(FoilAuthTypes::AuthTypeTOTP, data, "Label", "Issuer");
     g_assert(token.passwordString(1548529350) == QString("038068"));
+
+    // Cached key state doesn't affect the result
+    g_assert(token.passwordString(1548529350) == QString("038068"));
+    token.clearCache();
+    g_assert(token.passwordString(1548529350) == QString("038068"));
+    g_assert(token.passwordString(1548529350) == QString("038068"));
+
+    // Numeric values
+    g_assert_cmpuint(token.passwordValue(1548529350), == ,38068);
+    g_assert_cmpuint(token.passwordValueFromHash(936036598), == ,38068);
+    g_assert(token.formatPassword(38068) == QString("038068"));
+    g_assert(token.formatPassword(0) == QString("000000"));
+    g_assert(token.formatPassword(999999) == QString("999999"));
+
+    FoilAuthToken token9(token.withDigits(9));
+    g_assert_cmpuint(token9.passwordValueFromHash(936036598), == ,936036598);
+    g_assert(token9.formatPassword(36598) == QString("000036598"));
+
+    // Steam codes keep the entire hash
+    FoilAuthToken steam(token.withType(FoilAuthTypes::AuthTypeSteam).
+        withDigits(5));
+    g_assert_cmpuint(steam.passwordValueFromHash(936036598), == ,936036598);
+    g_assert(steam.formatPassword(936036598) == QString("MHHBR"));
+    g_assert(steam.formatPassword(0) == QString("22222"));
+}
+
+/*==========================================================================*
+ * passwordValues
+ *==========================================================================*/
+
+static
+void
+test_passwordValues(
+    void)
+{
+    QByteArray data = HarbourBase32::fromBase32("VHIIKTVJC6MEOFTJ");
+    FoilAuthToken totp(FoilAuthTypes::AuthTypeTOTP, data, "Label", "Issuer");
+    FoilAuthToken steam(totp.withType(FoilAuthTypes::AuthTypeSteam).
+        withDigits(5).withPeriod(60));
+    FoilAuthToken hotp(totp.withType(FoilAuthTypes::AuthTypeHOTP).
+        withCounter(5));
+    const quint64 t = 1548529350;
+    uint values[37];
+    const int n = G_N_ELEMENTS(values);
+    int i;
+
+    g_assert_cmpint(FoilAuthToken().passwordValues(t, values, n), == ,0);
+    g_assert_cmpint(totp.passwordValues(t, values, 0), == ,0);
+
+    // Starts at the beginning of the period
+    g_assert_cmpint(totp.passwordValues(t + 29, values, n), == ,n);
+    g_assert_cmpuint(values[0], == ,38068);
+    for (i = 0; i < n; i++) {
+        g_assert_cmpuint(values[i], == ,totp.passwordValue(t + i * 30));
+    }
+
+    g_assert_cmpint(steam.passwordValues(t, values, n), == ,n);
+    for (i = 0; i < n; i++) {
+        g_assert_cmpuint(values[i], == ,
+            steam.passwordValue(steam.periodStart(t) + i * 60));
+    }
+
+    g_assert_cmpint(hotp.passwordValues(t, values, n), == ,n);
+    for (i = 0; i < n; i++) {
+        g_assert_cmpuint(values[i], == ,hotp.withCounter(5 + i).
+            passwordValue(t));
+    }
+}
+
+/*==========================================================================*
+ * passwordKey
+ *==========================================================================*/
+
+static
+void
+test_passwordKey(
+    void)
+{
+    QByteArray data = HarbourBase32::fromBase32("VHIIKTVJC6MEOFTJ");
+    FoilAuthToken token(FoilAuthTypes::AuthTypeTOTP, data, "Label", "Issuer");
+    FoilAuthToken steam(token.withType(FoilAuthTypes::AuthTypeSteam).
+        withDigits(5));
+    FoilAuthToken token5(token.withDigits(5));
+    QList<quint64> keys;
+
+    // Invalid token and invalid codes
+    g_assert_cmpuint(FoilAuthToken().passwordKey(38068), == ,0);
+    g_assert(!FoilAuthToken().checkPassword(38068, "038068"));
+    g_assert(FoilAuthToken::passwordKeys(QString()).isEmpty());
+    g_assert(FoilAuthToken::passwordKeys("0123456789").isEmpty());
+    g_assert(FoilAuthToken::passwordKeys("12-34").isEmpty());
+
+    // Numeric codes
+    keys = FoilAuthToken::passwordKeys("038068");
+    g_assert_cmpint(keys.count(), == ,1);
+    g_assert(keys.contains(token.passwordKey(38068)));
+    g_assert(!keys.contains(token.withDigits(7).passwordKey(38068)));
+    g_assert(!FoilAuthToken::passwordKeys("38068").contains(token.passwordKey(38068)));
+    g_assert(token.checkPassword(38068, "038068"));
+    g_assert(!token.checkPassword(38068, "038069"));
+    g_assert(!token.checkPassword(38068, "38068"));
+
+    // Steam codes (case insensitive)
+    keys = FoilAuthToken::passwordKeys("mhhbr");
+    g_assert_cmpint(keys.count(), == ,1);
+    g_assert(keys.contains(steam.passwordKey(936036598)));
+    g_assert(steam.checkPassword(936036598, "MHHBR"));
+    g_assert(steam.checkPassword(936036598, "mhhbr"));
+    g_assert(!steam.checkPassword(936036598, "MHHBX"));
+    g_assert(!steam.checkPassword(936036598, "MHHB"));
+
+    // Only the displayed digits matter
+    g_assert_cmpuint(steam.passwordKey(0), == ,steam.passwordKey(26*26*26*26*26));
+
+    // This one can be either
+    keys = FoilAuthToken::passwordKeys("22222");
+    g_assert_cmpint(keys.count(), == ,2);
+    g_assert(keys.contains(steam.passwordKey(0)));
+    g_assert(keys.contains(token5.passwordKey(22222)));
+    g_assert_cmpuint(steam.passwordKey(0), != ,token5.passwordKey(22222));
+}
+
+/*==========================================================================*
+ * period
+ *==========================================================================*/
+
+static
+void
+test_period(
+    void)
+{
+    QByteArray data = HarbourBase32::fromBase32("VHIIKTVJC6MEOFTJ");
+    FoilAuthToken token(FoilAuthTypes::AuthTypeTOTP, data, "Label", "Issuer");
+    g_assert_cmpint(token.period(), == ,FoilAuthTypes::DEFAULT_PERIOD);
+    g_assert_cmpuint(token.periodStart(1548529350), == ,1548529350);
+    g_assert_cmpuint(token.periodStart(1548529379), == ,1548529350);
+
+    // Invalid periods are ignored
+    g_assert(token.withPeriod(0) == token);
+    g_assert(token.withPeriod(FoilAuthTypes::MAX_PERIOD + 1) == token);
+
+    FoilAuthToken token60(token.withPeriod(60));
+    g_assert(token60 != token);
+    g_assert_cmpint(token60.period(), == ,60);
+    g_assert_cmpuint(token60.periodStart(1548529350), == ,1548529320);
+    g_assert_cmpuint(token60.hashInput(1548529350), == ,1548529350/60);
+    g_assert(token60.passwordString(1548529350) == QString("964549"));
+    g_assert(token60.passwordString(1548529320) == QString("964549"));
+    g_assert(token60.withPeriod(30) == token);
+
+    // Period survives the round trip through otpauth URI
+    const QString uri(token60.toUri());
+    g_assert(uri == QString("otpauth://totp/Label?secret=vhiiktvjc6meoftj&issuer=Issuer&digits=6&period=60"));
+    g_assert(FoilAuthToken::fromUri(uri) == token60);
+    g_assert(FoilAuthToken::fromUri(uri + "0000") == token);
+    g_assert(FoilAuthToken::fromUri("otpauth://totp/Label?secret=vhiiktvjc6meoftj&period=15&issuer=Issuer").period() == 15);
 }
 
 /*==========================================================================*
@@ -344,7 +520,7 @@ test_toVariantMap(
     g_assert(token.isValid());
     map = token.toVariantMap();
 
-    g_assert_cmpint(map.count(), == ,9);
+    g_assert_cmpint(map.count(), == ,10);
     g_assert(map.value(FoilAuthToken::KEY_VALID).toBool());
     g_assert_cmpint(map.value(FoilAuthToken::KEY_TYPE).toInt(), == ,FoilAuthTypes::AuthTypeTOTP);
     g_assert(map.value(FoilAuthToken::KEY_LABEL).toString() == QString("Test"));
@@ -354,6 +530,7 @@ test_toVariantMap(
     g_assert_cmpint(map.value(FoilAuthToken::KEY_COUNTER).toInt(), == ,FoilAuthTypes::DEFAULT_COUNTER);
     g_assert_cmpint(map.value(FoilAuthToken::KEY_TIMESHIFT).toInt(), == ,FoilAuthTypes::DEFAULT_TIMESHIFT);
     g_assert_cmpint(map.value(FoilAuthToken::KEY_ALGORITHM).toInt(), == ,FoilAuthTypes::DEFAULT_ALGORITHM);
+    g_assert_cmpint(map.value(FoilAuthToken::KEY_PERIOD).toInt(), == ,FoilAuthTypes::DEFAULT_PERIOD);
 }
 
 /*==========================================================================*
@@ -976,8 +1153,12 @@ int main(int argc, char* argv[])
     g_test_init(&argc, &argv, NULL);
     g_test_add_func(TEST_("basic"), test_basic);
     g_test_add_func(TEST_("validDigits"), test_validDigits);
+    g_test_add_func(TEST_("validPeriod"), test_validPeriod);
     g_test_add_func(TEST_("invalid"), test_invalid);
     g_test_add_func(TEST_("password"), test_password);
+    g_test_add_func(TEST_("passwordValues"), test_passwordValues);
+    g_test_add_func(TEST_("passwordKey"), test_passwordKey);
+    g_test_add_func(TEST_("period"), test_period);
     g_test_add_func(TEST_("fromUri"), test_fromUri);
     g_test_add_func(TEST_("toUri"), test_toUri);
     g_test_add_func(TEST_("toVariantMap"), test_toVariantMap);
@@ -0,0 +1,349 @@
+/*
+ * Copyright (C) 2026 Slava Monich <slava@monich.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *  3. Neither the names of the copyright holders nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation
+ * are those of the authors and should not be interpreted as representing
+ * any official policies, either expressed or implied.
+ */
+
+#include "FoilAuthVault.h"
+
+#include "foil_key.h"
+#include "foil_private_key.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include <glib.h>
+
+#define TEST_KEY_BITS 1024
+
+static FoilPrivateKey* test_private_key = NULL;
+static FoilKey* test_public_key = NULL;
+static QString test_dir;
+
+/*==========================================================================*
+ * Helpers
+ *==========================================================================*/
+
+static
+QString
+test_path(
+    const char* aName)
+{
+    const QString path(test_dir + "/" + aName);
+
+    QFile::remove(path);
+    return path;
+}
+
+static
+FoilAuthVault::Ptr
+test_create(
+    const QString& aPath)
+{
+    FoilAuthVault::Ptr vault(FoilAuthVault::create(aPath,
+        test_private_key, test_public_key));
+
+    g_assert(vault);
+    return vault;
+}
+
+static
+FoilAuthVault::Ptr
+test_open(
+    const QString& aPath)
+{
+    return FoilAuthVault::open(aPath, test_private_key, test_public_key);
+}
+
+static
+qint64
+test_size(
+    const QString& aPath)
+{
+    return QFileInfo(aPath).size();
+}
+
+/*==========================================================================*
+ * basic
+ *==========================================================================*/
+
+static
+void
+test_basic(
+    void)
+{
+    const QString path(test_path("basic"));
+    const QByteArray a("a"), b(1000, 'b');
+    FoilAuthVault::Ptr vault(test_create(path));
+    QHash<QString,QByteArray> all;
+
+    g_assert(vault->path() == path);
+    g_assert(vault->ids().isEmpty());
+    g_assert(!vault->write("a", QByteArray()));
+    g_assert(vault->write("a", a));
+    g_assert(vault->write("b", b));
+    g_assert(vault->read("a") == a);
+    g_assert(vault->read("b") == b);
+    g_assert(vault->read("c").isEmpty());
+
+    // Everything is there after reopening
+    vault = test_open(path);
+    g_assert(vault);
+    g_assert(vault->contains("a"));
+    g_assert(vault->contains("b"));
+    g_assert(!vault->contains("c"));
+    g_assert_cmpint(vault->ids().count(), == ,2);
+    all = vault->readAll();
+    g_assert_cmpint(all.count(), == ,2);
+    g_assert(all.value("a") == a);
+    g_assert(all.value("b") == b);
+
+    // The last write wins
+    g_assert(vault->write("a", b));
+    vault = test_open(path);
+    g_assert(vault->read("a") == b);
+
+    // Batch write
+    all.clear();
+    all.insert("c", a);
+    all.insert("d", b);
+    all.insert("e", QByteArray());
+    g_assert(vault->writeAll(all));
+    vault = test_open(path);
+    g_assert_cmpint(vault->ids().count(), == ,4);
+    g_assert(vault->read("c") == a);
+    g_assert(vault->read("d") == b);
+    g_assert(!vault->contains("e"));
+}
+
+/*==========================================================================*
+ * invalid
+ *==========================================================================*/
+
+static
+void
+test_invalid(
+    void)
+{
+    const QString path(test_path("invalid"));
+    QFile file(path);
+
+    // Missing file
+    g_assert(!test_open(path));
+
+    // Not a vault
+    g_assert(file.open(QIODevice::WriteOnly));
+    g_assert_cmpint(file.write("FOILAV00garbage"), == ,15);
+    file.close();
+    g_assert(!test_open(path));
+}
+
+/*==========================================================================*
+ * mac
+ *==========================================================================*/
+
+static
+void
+test_mac(
+    void)
+{
+    const QString path(test_path("mac"));
+    const QByteArray a("a"), b("b");
+    FoilAuthVault::Ptr vault(test_create(path));
+    QFile file(path);
+    QByteArray contents;
+
+    g_assert(vault->write("a", a));
+    g_assert(vault->write("b", b));
+    vault.reset();
+
+    // Damage the last byte of the MAC of the last record
+    g_assert(file.open(QIODevice::ReadOnly));
+    contents = file.readAll();
+    file.close();
+    contents[contents.size() - 1] = contents.at(contents.size() - 1) ^ 1;
+    g_assert(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    g_assert_cmpint(file.write(contents), == ,contents.size());
+    file.close();
+
+    // The damaged record is gone, the rest is intact
+    vault = test_open(path);
+    g_assert(vault);
+    g_assert(vault->read("a") == a);
+    g_assert(!vault->contains("b"));
+    g_assert(vault->read("b").isEmpty());
+}
+
+/*==========================================================================*
+ * truncated
+ *==========================================================================*/
+
+static
+void
+test_truncated(
+    void)
+{
+    const QString path(test_path("truncated"));
+    const QByteArray a("a"), b("b"), c("c");
+    FoilAuthVault::Ptr vault(test_create(path));
+    qint64 size;
+
+    g_assert(vault->write("a", a));
+    size = test_size(path);
+    g_assert(vault->write("b", b));
+    vault.reset();
+
+    // Incomplete write of the last record
+    g_assert(QFile::resize(path, test_size(path) - 3));
+    vault = test_open(path);
+    g_assert(vault);
+    g_assert(vault->read("a") == a);
+    g_assert(!vault->contains("b"));
+
+    // The next write drops the garbage at the end
+    g_assert(vault->write("c", c));
+    g_assert_cmpint(test_size(path), > ,size);
+    vault = test_open(path);
+    g_assert_cmpint(vault->ids().count(), == ,2);
+    g_assert(vault->read("a") == a);
+    g_assert(vault->read("c") == c);
+}
+
+/*==========================================================================*
+ * remove
+ *==========================================================================*/
+
+static
+void
+test_remove(
+    void)
+{
+    const QString path(test_path("remove"));
+    const QByteArray a("a"), b("b");
+    FoilAuthVault::Ptr vault(test_create(path));
+
+    g_assert(vault->write("a", a));
+    g_assert(vault->write("b", b));
+    g_assert(!vault->remove("c"));
+    g_assert(vault->remove("a"));
+    g_assert(!vault->remove("a"));
+    g_assert(!vault->contains("a"));
+    g_assert(vault->read("a").isEmpty());
+
+    // Removal survives reopening
+    vault = test_open(path);
+    g_assert(!vault->contains("a"));
+    g_assert(vault->read("b") == b);
+    g_assert_cmpint(vault->ids().count(), == ,1);
+
+    // And the record can be written again
+    g_assert(vault->write("a", b));
+    vault = test_open(path);
+    g_assert(vault->read("a") == b);
+}
+
+/*==========================================================================*
+ * compact
+ *==========================================================================*/
+
+static
+void
+test_compact(
+    void)
+{
+    const int count = 100;
+    const QString path(test_path("compact"));
+    const QByteArray a("a");
+    FoilAuthVault::Ptr vault(test_create(path));
+    int i;
+
+    g_assert(vault->write("a", a));
+    for (i = 0; i < count; i++) {
+        QByteArray b(1000, 'b');
+
+        b[0] = (char)i;
+        g_assert(vault->write("b", b));
+    }
+
+    // Superseded records got dropped at some point
+    g_assert_cmpint(test_size(path), < ,count * 1000 / 2);
+
+    // Only the latest copies survived
+    vault = test_open(path);
+    g_assert_cmpint(vault->ids().count(), == ,2);
+    g_assert(vault->read("a") == a);
+    g_assert_cmpint(vault->read("b").size(), == ,1000);
+    g_assert_cmpint(vault->read("b").at(0), == ,count - 1);
+    g_assert(!QFile::exists(path + ".tmp"));
+}
+
+/*==========================================================================*
+ * Common
+ *==========================================================================*/
+
+#define TEST_(name) "/FoilAuthVault/" name
+
+int main(int argc, char* argv[])
+{
+    char* dir = g_dir_make_tmp("TestFoilAuthVault-XXXXXX", NULL);
+    FoilKey* key = foil_key_generate_new(FOIL_KEY_RSA_PRIVATE, TEST_KEY_BITS);
+    int ret;
+
+    test_dir = QString::fromLocal8Bit(dir);
+    test_private_key = FOIL_PRIVATE_KEY(key);
+    test_public_key = foil_public_key_new_from_private(test_private_key);
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func(TEST_("basic"), test_basic);
+    g_test_add_func(TEST_("invalid"), test_invalid);
+    g_test_add_func(TEST_("mac"), test_mac);
+    g_test_add_func(TEST_("truncated"), test_truncated);
+    g_test_add_func(TEST_("remove"), test_remove);
+    g_test_add_func(TEST_("compact"), test_compact);
+    ret = g_test_run();
+    foil_private_key_unref(test_private_key);
+    foil_key_unref(test_public_key);
+    QDir(test_dir).removeRecursively();
+    g_free(dir);
+    return ret;
+}
+
+/*
+ * Local Variables:
+ * mode: C++
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -141,6 +141,16 @@
         <extracomment>Text field placeholder (number of password digits)</extracomment>
         <translation>Décalage horaire OTP, en secondes</translation>
     </message>
+    <message id="foilauth-token-period-text">
+        <source>Period (seconds)</source>
+        <extracomment>Text field label (TOTP period)</extracomment>
+        <translation type="unfinished">Period (seconds)</translation>
+    </message>
+    <message id="foilauth-token-period-placeholder">
+        <source>How often the password changes, in seconds</source>
+        <extracomment>Text field placeholder (TOTP period)</extracomment>
+        <translation type="unfinished">How often the password changes, in seconds</translation>
+    </message>
     <message id="foilauth-token-counter-text">
         <source>Counter value</source>
         <extracomment>Text field label (HOTP counter value)</extracomment>
@@ -277,6 +287,11 @@
         <extracomment>Context menu item</extracomment>
         <translation type="unfinished">Afficher le code QR</translation>
     </message>
+    <message id="foilauth-menu-next_codes">
+        <source>Next codes</source>
+        <extracomment>Context menu item (show the upcoming passwords)</extracomment>
+        <translation type="unfinished">Next codes</translation>
+    </message>
     <message id="foilauth-menu-edit">
         <source>Edit</source>
         <extracomment>Generic menu item</extracomment>
@@ -523,5 +538,25 @@
             <numerusform>%1 min</numerusform>
         </translation>
     </message>
+    <message id="foilauth-settings_page-vault-text">
+        <source>Keep tokens in a single file</source>
+        <extracomment>Text switch label</extracomment>
+        <translation type="unfinished">Keep tokens in a single file</translation>
+    </message>
+    <message id="foilauth-settings_page-vault-description">
+        <source>Makes unlocking and editing faster. Turning it off moves the tokens back into separate files. Takes effect next time Foil Auth is unlocked.</source>
+        <extracomment>Text switch description</extracomment>
+        <translation type="unfinished">Makes unlocking and editing faster. Turning it off moves the tokens back into separate files. Takes effect next time Foil Auth is unlocked.</translation>
+    </message>
+    <message id="foilauth-settings_page-snapshot-text">
+        <source>Remember unchanged tokens</source>
+        <extracomment>Text switch label</extracomment>
+        <translation type="unfinished">Remember unchanged tokens</translation>
+    </message>
+    <message id="foilauth-settings_page-snapshot-description">
+        <source>Keeps an encrypted copy of the tokens which allows to skip decrypting the files which haven&apos;t changed since the last time.</source>
+        <extracomment>Text switch description</extracomment>
+        <translation type="unfinished">Keeps an encrypted copy of the tokens which allows to skip decrypting the files which haven&apos;t changed since the last time.</translation>
+    </message>
 </context>
 </TS>